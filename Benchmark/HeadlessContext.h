@@ -0,0 +1,79 @@
+#pragma once
+
+// Windowless OpenGL 4.5 core context through EGL, for running the GL paths of the benchmarks on machines without a
+// display or GPU (eg. Mesa's llvmpipe in CI). Linux only; link with -lEGL.
+
+#include "opengl.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstdio>
+
+class HeadlessContext
+{
+public:
+	HeadlessContext()
+	{
+		// Mesa's surfaceless platform needs neither a display server nor a GPU device.
+		const auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+			eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		display_ = getPlatformDisplay
+			? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+			: eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major, minor;
+		if (display_ == EGL_NO_DISPLAY || !eglInitialize(display_, &major, &minor) || !eglBindAPI(EGL_OPENGL_API))
+		{
+			fprintf(stderr, "Failed to initialize EGL (0x%x)\n", eglGetError());
+			return;
+		}
+
+		const EGLint attributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 5,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context_ = eglCreateContext(display_, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+		if (context_ == EGL_NO_CONTEXT || !eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_))
+		{
+			fprintf(stderr, "Failed to create a headless OpenGL 4.5 context (0x%x)\n", eglGetError());
+			return;
+		}
+
+		gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress));
+		isValid_ = true;
+	}
+
+	~HeadlessContext()
+	{
+		if (context_ != EGL_NO_CONTEXT)
+		{
+			eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display_, context_);
+		}
+		if (display_ != EGL_NO_DISPLAY)
+		{
+			eglTerminate(display_);
+		}
+	}
+
+	HeadlessContext(const HeadlessContext&) = delete;
+	HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+	bool IsValid() const
+	{
+		return isValid_;
+	}
+
+	const char* Renderer() const
+	{
+		return reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+	}
+
+private:
+	EGLDisplay display_ = EGL_NO_DISPLAY;
+	EGLContext context_ = EGL_NO_CONTEXT;
+	bool isValid_ = false;
+};
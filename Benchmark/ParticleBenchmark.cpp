@@ -0,0 +1,2402 @@
+// Headless particle benchmarks. Nothing here creates a window; the CPU benchmarks don't touch GL at all, and the GPU
+// simulation runs on a surfaceless EGL context (Mesa's llvmpipe is enough).
+//
+// Build (from this directory):
+//     g++ -O2 -std=c++17 -pthread -I../GLParticles ParticleBenchmark.cpp ../GLParticles/ShaderSet.cpp
+//         ../GLParticles/glad.c -lEGL -ldl -o ParticleBenchmark
+//
+// Usage:
+//     ParticleBenchmark [--effects N] [--particles N] [--frames N] [--max-threads N] [--gpu 0|1] [--rng-samples N]
+//                       [--grid-particles N] [--grid-queries N] [--force-particles N] [--quantization-error X]
+//                       [--collision-triangles N] [--collision-particles N] [--fluid-particles N]
+//                       [--pipeline-particles N,N,...] [--pipeline-effects N,N,...] [--pipeline-max-particles N]
+//                       [--upload 0|1] [--json FILE] [--cache-particles N] [--cache-file FILE]
+//                       [--behavior-particles N] [--script-particles N] [--trail-particles N] [--trail-length N]
+//                       [--event-particles N] [--culling-effects N] [--culling-particles N] [--pool-triggers N]
+//                       [--kernel-particles N]
+
+#include "ParticleBudget.h"
+#include "ParticleEffect.h"
+#include "ParticleEffectFile.h"
+#include "ParticleEffectPool.h"
+#include "ParticleCollision.h"
+#include "ParticleRandom.h"
+#include "ParticleSpatialGrid.h"
+#include "ShaderSet.h"
+#include "WorkerPool.h"
+#include "HeadlessContext.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions
+{
+	int numEffects = 16;
+	int numParticles = 100000;
+	int numFrames = 60;
+	int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+	// Also run the compute shader simulation, and compare its statistics with the CPU path.
+	bool gpu = false;
+	// Samples per generator in the random number benchmark, 0 to skip it.
+	int numRandomSamples = 1 << 22;
+	// Largest particle count of the spatial grid benchmark, which runs 100k, 1M, 10M... up to it. 0 skips it.
+	int maxGridParticles = 10000000;
+	int numGridQueries = 100000;
+	// Particles pushed through the force field benchmark, 0 to skip it.
+	int numForceParticles = 1 << 20;
+	// Largest error the compact vertex formats may make, as a fraction of the effect's extent for positions, of the
+	// largest size for sizes, and absolute for colors. Exceeding it fails the benchmark.
+	float maxQuantizationError = 1.0f / 255.0f;
+	// Triangles of the terrain and particles raining on it in the collision benchmark, 0 to skip it.
+	int numCollisionTriangles = 100000;
+	int numCollisionParticles = 100000;
+	// Particles of the dam break in the fluid benchmark, 0 to skip it.
+	int numFluidParticles = 20000;
+	// Pipeline suite: every pair of particles per effect and effect count, up to maxPipelineParticles in total. Zeros
+	// in either list are skipped.
+	std::vector<int> pipelineParticles = { 1000, 10000, 100000, 1000000, 10000000 };
+	std::vector<int> pipelineEffects = { 1, 16 };
+	int maxPipelineParticles = 10000000;
+	// Write the instances of the pipeline suite into mapped GL buffers on a headless context, and draw them offscreen.
+	bool upload = false;
+	// Where the pipeline suite writes its results as JSON, empty for nowhere.
+	std::string jsonPath;
+	// Particles of the effect baked into a cache and played back in the cache benchmark, 0 to skip it.
+	int numCacheParticles = 100000;
+	// Scratch file of the cache benchmark, removed once it is done.
+	std::string cacheFile = "ParticleBenchmark.pcache";
+	// Particles of the always-full effect the spawn and update paths are compared on, 0 to skip it.
+	int numBehaviorParticles = 1000000;
+	// Particles of the effect file whose scripts are compared with the same modules in C++, 0 to skip it.
+	int numScriptParticles = 1000000;
+	// Slowest the script update may be, relative to the C++ one, without failing the benchmark.
+	double maxScriptSlowdown = 2.0;
+	// Particles of the trail benchmark and the samples each keeps, 0 to skip it.
+	int numTrailParticles = 50000;
+	int trailLength = 32;
+	// Rockets of the firework in the event benchmark, 0 to skip it.
+	int numEventParticles = 100000;
+	// Effects around the turning camera of the culling benchmark and particles in each, 0 to skip it.
+	int numCullingEffects = 32;
+	int numCullingParticles = 20000;
+	// Effects gameplay starts over the pool benchmark, 0 to skip it.
+	int numPoolTriggers = 400;
+	// Particles the SIMD integration and vector field kernels are compared with the scalar ones on, 0 to skip it. Not a
+	// multiple of 8, so the kernels run into the padding lanes.
+	int numKernelParticles = 1003;
+};
+
+// Shaders are loaded from the source tree, relative to this directory.
+static const std::string SHADER_DIRECTORY = "../GLParticles/";
+
+// Heap allocations made so far, counted by the global operator new below, so the pool benchmark can check for none.
+static std::atomic<uint64_t> numAllocations(0);
+
+// Every replacement operator new and delete goes through these two, so the compiler sees one allocation function paired
+// with one deallocation function rather than malloc() and free() inlined into new and delete expressions.
+static void* CountedAllocate(const std::size_t size, const std::size_t alignment)
+{
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+	auto* const data = alignment > alignof(std::max_align_t)
+		? std::aligned_alloc(alignment, (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment)
+		: std::malloc(size > 0 ? size : 1);
+	if (!data)
+	{
+		throw std::bad_alloc();
+	}
+	return data;
+}
+
+static void CountedFree(void* data) noexcept
+{
+	std::free(data);
+}
+
+void* operator new(const std::size_t size)
+{
+	return CountedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(const std::size_t size, const std::align_val_t alignment)
+{
+	return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* data) noexcept
+{
+	CountedFree(data);
+}
+
+void operator delete(void* data, std::size_t) noexcept
+{
+	CountedFree(data);
+}
+
+void operator delete(void* data, std::align_val_t) noexcept
+{
+	CountedFree(data);
+}
+
+void operator delete(void* data, std::size_t, std::align_val_t) noexcept
+{
+	CountedFree(data);
+}
+
+// Same viewpoint as the main camera in main.cpp.
+static glm::mat4 BenchmarkView()
+{
+	return glm::lookAt(glm::vec3(2.0f, 1.5f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+static std::vector<ParticleEffect> CreateEffects(const BenchmarkOptions& options,
+                                                 const ParticleEffectSettings::Backend backend = ParticleEffectSettings::CPU)
+{
+	// Same distributions as the sparks in main.cpp, but always full: every slot is refilled as soon as it frees up.
+	ParticleEffectSettings settings;
+	settings.backend = backend;
+	settings.numParticles = options.numParticles;
+	settings.spawnRate = std::numeric_limits<float>::infinity();
+	settings.initialBurst = options.numParticles;
+	settings.decayRange = { 0.0015f, 0.051f };
+	settings.speed = 5.0f;
+
+	std::vector<ParticleEffect> effects;
+	effects.reserve(options.numEffects);
+	for (auto i = 0; i < options.numEffects; ++i)
+	{
+		settings.seed = static_cast<uint32_t>(i);
+		effects.emplace_back(settings);
+	}
+	return effects;
+}
+
+// Updates every effect for numFrames frames with 1..maxThreads threads, the same way Renderer does: effects in
+// parallel, large effects split into chunks, and a barrier at the end of each frame.
+static void RunThreadScaling(const BenchmarkOptions& options)
+{
+	printf("Thread scaling: %d effects x %d particles, %d frames\n", options.numEffects, options.numParticles,
+	       options.numFrames);
+	printf("%8s %14s %18s %10s\n", "threads", "ms/frame", "particles/sec", "speedup");
+
+	auto effects = CreateEffects(options);
+	const auto view = BenchmarkView();
+	const auto particlesPerFrame = static_cast<double>(options.numEffects) * options.numParticles;
+
+	double singleThreadSeconds = 0.0;
+	for (auto numThreads = 1; numThreads <= options.maxThreads; ++numThreads)
+	{
+		WorkerPool workers(numThreads - 1);
+
+		// Warm up caches and page in the staging buffers before timing.
+		workers.ParallelFor(effects.size(), 1, [&effects, &workers, &view](const size_t begin, const size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				effects[i].Update(16.0f, view, &workers);
+			}
+		});
+
+		const auto start = std::chrono::steady_clock::now();
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			workers.ParallelFor(effects.size(), 1, [&effects, &workers, &view](const size_t begin, const size_t end)
+			{
+				for (auto i = begin; i < end; ++i)
+				{
+					effects[i].Update(16.0f, view, &workers);
+				}
+			});
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (numThreads == 1)
+		{
+			singleThreadSeconds = seconds;
+		}
+
+		printf("%8d %14.3f %18.0f %10.2f\n", numThreads, 1000.0 * seconds / options.numFrames,
+		       particlesPerFrame * options.numFrames / seconds, singleThreadSeconds / seconds);
+	}
+}
+
+static ParticleSimulationStats SumStats(const std::vector<ParticleEffect>& effects)
+{
+	ParticleSimulationStats total;
+	for (const auto& effect : effects)
+	{
+		const auto& stats = effect.SimulationStats();
+		total.updates += stats.updates;
+		total.spawned += stats.spawned;
+		total.killed += stats.killed;
+		total.aliveCount += stats.aliveCount;
+	}
+	return total;
+}
+
+static void PrintStats(const char* backend, const ParticleSimulationStats& stats)
+{
+	printf("%8s %10llu %14llu %14llu %12zu\n", backend, static_cast<unsigned long long>(stats.updates),
+	       static_cast<unsigned long long>(stats.spawned), static_cast<unsigned long long>(stats.killed),
+	       stats.aliveCount);
+}
+
+// Runs the compute shader simulation the way Renderer does (minus the draws), timing each frame up to glFinish(), then
+// compares its statistics with the same number of CPU updates.
+static bool RunGpuSimulation(const BenchmarkOptions& options)
+{
+	HeadlessContext context;
+	if (!context.IsValid())
+	{
+		return false;
+	}
+
+	// 450 rather than Renderer's 460, which llvmpipe doesn't expose.
+	ShaderSet shaders;
+	shaders.SetVersion("450");
+	shaders.SetPreambleFile(SHADER_DIRECTORY + "Preamble.glsl");
+	ParticleComputePrograms programs;
+	programs.simulate = shaders.AddProgramFromExts({ SHADER_DIRECTORY + "particle_simulate.comp" });
+	programs.emit = shaders.AddProgramFromExts({ SHADER_DIRECTORY + "particle_emit.comp" });
+	programs.instances = shaders.AddProgramFromExts({ SHADER_DIRECTORY + "particle_instances.comp" });
+	shaders.UpdatePrograms();
+	if (!*programs.simulate || !*programs.emit || !*programs.instances)
+	{
+		fprintf(stderr, "Failed to build the particle compute programs\n");
+		return false;
+	}
+
+	printf("GPU simulation on %s: %d effects x %d particles, %d frames\n", context.Renderer(), options.numEffects,
+	       options.numParticles, options.numFrames);
+
+	const auto view = BenchmarkView();
+	const auto particlesPerFrame = static_cast<double>(options.numEffects) * options.numParticles;
+	auto gpuEffects = CreateEffects(options, ParticleEffectSettings::GPU);
+
+	const auto runFrame = [&gpuEffects, &programs, &view]()
+	{
+		for (auto& effect : gpuEffects)
+		{
+			effect.BeginFrame();
+			effect.Update(16.0f, view);
+			effect.Dispatch(programs);
+		}
+		glFinish();
+	};
+
+	// Creates the buffers and compiles the pipelines before timing.
+	runFrame();
+
+	const auto start = std::chrono::steady_clock::now();
+	for (auto frame = 0; frame < options.numFrames; ++frame)
+	{
+		runFrame();
+	}
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%14s %18s\n", "ms/frame", "particles/sec");
+	printf("%14.3f %18.0f\n", 1000.0 * seconds / options.numFrames, particlesPerFrame * options.numFrames / seconds);
+
+	// Collect the counters still in flight.
+	for (auto segment = 0; segment < StreamingBuffer::NUM_SEGMENTS; ++segment)
+	{
+		for (auto& effect : gpuEffects)
+		{
+			effect.BeginFrame();
+		}
+	}
+
+	auto cpuEffects = CreateEffects(options);
+	for (auto frame = 0; frame < options.numFrames + 1; ++frame)
+	{
+		for (auto& effect : cpuEffects)
+		{
+			effect.Update(16.0f, view);
+		}
+	}
+
+	printf("%8s %10s %14s %14s %12s\n", "backend", "updates", "spawned", "killed", "alive");
+	PrintStats("cpu", SumStats(cpuEffects));
+	PrintStats("gpu", SumStats(gpuEffects));
+	return true;
+}
+
+// Updates one effect at several spawn rates, to show the update cost following the live count rather than the capacity.
+static void RunOccupancy(const BenchmarkOptions& options)
+{
+	printf("Occupancy: 1 effect x %d particles capacity, %d frames, 1 thread\n", options.numParticles,
+	       options.numFrames);
+	printf("%10s %12s %14s %14s\n", "target", "alive", "ms/frame", "ns/particle");
+
+	const auto view = BenchmarkView();
+	const float deltaTime = 16.0f;
+	auto effectOptions = options;
+	effectOptions.numEffects = 1;
+	effectOptions.maxThreads = 1;
+
+	for (const auto occupancy : { 1.0f, 0.1f, 0.01f })
+	{
+		auto effects = CreateEffects(effectOptions);
+		auto& effect = effects.front();
+
+		// Little's law: the live count settles at spawn rate x mean lifetime, and decay is uniform in decayRange.
+		const auto& decayRange = effect.Settings().decayRange;
+		const auto meanLifetime = std::log(decayRange.y / decayRange.x) / (decayRange.y - decayRange.x);
+		effect.Settings().spawnRate = occupancy * options.numParticles / meanLifetime;
+
+		// Let the live count settle before timing.
+		for (auto frame = 0; frame < 60; ++frame)
+		{
+			effect.Update(deltaTime, view);
+		}
+
+		size_t aliveSum = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			effect.Update(deltaTime, view);
+			aliveSum += effect.SimulationStats().aliveCount;
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const auto meanAlive = static_cast<double>(aliveSum) / options.numFrames;
+		printf("%9.0f%% %12.0f %14.3f %14.2f\n", occupancy * 100.0f, meanAlive, 1000.0 * seconds / options.numFrames,
+		       1.0e9 * seconds / aliveSum);
+	}
+}
+
+// Steps seeded particles through each integration kernel the CPU supports, and checks that every stream matches the
+// scalar kernel bit for bit. The count is not a multiple of the SIMD width, so the kernels also run into the padding
+// lanes past the last particle, which must leave the particles themselves alone.
+static bool RunKernelCheck(const BenchmarkOptions& options)
+{
+	const auto count = static_cast<size_t>(options.numKernelParticles);
+	printf("Integration kernels: %zu particles, %d steps\n", count, options.numFrames);
+
+	ParticlePool reference(count);
+	reference.SetCount(count);
+	const ParticleRandom random(7);
+	const glm::vec2 ranges[ParticlePool::NUM_STREAMS] = {
+		{ -1.0f, 1.0f }, { -1.0f, 1.0f }, { -1.0f, 1.0f },
+		{ -0.01f, 0.01f }, { -0.01f, 0.01f }, { -0.01f, 0.01f },
+		{ 0.0f, 1.0f }, { 0.0001f, 0.001f }, { 0.01f, 0.1f },
+		{ -1.0f, 1.0f }, { -1.0f, 1.0f }, { -1.0f, 1.0f }
+	};
+	for (size_t stream = 0; stream < ParticlePool::NUM_STREAMS; ++stream)
+	{
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, static_cast<uint32_t>(stream), 0, count,
+		                        reference.Data(static_cast<ParticlePool::Stream>(stream)), ranges[stream].x,
+		                        ranges[stream].y);
+	}
+
+	struct Kernel
+	{
+		const char* name;
+		ParticleKernels::IntegrateFunc integrate;
+	};
+	std::vector<Kernel> kernels = { { "IntegrateScalar", ParticleKernels::IntegrateScalar } };
+#if PARTICLE_KERNELS_X86
+	const auto instructionSet = ParticleKernels::Detect();
+	if (instructionSet >= ParticleKernels::SSE2)
+	{
+		kernels.push_back({ "IntegrateSSE2", ParticleKernels::IntegrateSSE2 });
+	}
+	if (instructionSet >= ParticleKernels::AVX2)
+	{
+		kernels.push_back({ "IntegrateAVX2", ParticleKernels::IntegrateAVX2 });
+	}
+#endif
+
+	std::vector<ParticlePool> pools;
+	for (size_t kernel = 0; kernel < kernels.size(); ++kernel)
+	{
+		pools.push_back(reference.Clone());
+	}
+	for (auto frame = 0; frame < options.numFrames; ++frame)
+	{
+		// Vary the step like a frame clock would.
+		const auto deltaTime = 16.0f + static_cast<float>(frame % 5);
+		const auto stepScale = deltaTime / 1000.0f;
+		const ParticleIntegration step = { deltaTime, stepScale, glm::vec3(0.0f, -0.0001f, 0.0f) * stepScale };
+		for (size_t kernel = 0; kernel < kernels.size(); ++kernel)
+		{
+			// The scalar kernel stops at the last particle; the SIMD ones run whole lanes, as ParticleEffect does.
+			const auto end = kernel == 0 ? count : pools[kernel].PaddedCount();
+			kernels[kernel].integrate(pools[kernel], 0, end, step);
+		}
+	}
+
+	auto passed = true;
+	for (size_t kernel = 1; kernel < kernels.size(); ++kernel)
+	{
+		size_t mismatches = 0;
+		for (size_t stream = 0; stream < ParticlePool::NUM_STREAMS; ++stream)
+		{
+			const auto* const expected = pools[0].Data(static_cast<ParticlePool::Stream>(stream));
+			const auto* const actual = pools[kernel].Data(static_cast<ParticlePool::Stream>(stream));
+			for (size_t i = 0; i < count; ++i)
+			{
+				mismatches += std::memcmp(&expected[i], &actual[i], sizeof(float)) != 0 ? 1 : 0;
+			}
+		}
+		printf("%-36s %s\n", kernels[kernel].name, mismatches == 0 ? "matches scalar" : "MISMATCH");
+		if (mismatches != 0)
+		{
+			fprintf(stderr, "%s differs from IntegrateScalar in %zu values\n", kernels[kernel].name, mismatches);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+// Checks that the AVX2 vector field kernel adds exactly what the scalar one does to every velocity, with particles
+// inside the field's box, on its faces (the last node belongs to the last cell), clamped from outside it, and NaN
+// positions in the padding lanes.
+static bool RunVectorFieldCheck(const BenchmarkOptions& options)
+{
+	const auto count = static_cast<size_t>(options.numKernelParticles);
+	const glm::vec3 boundsMin(-1.0f, -0.5f, -2.0f);
+	const glm::vec3 boundsMax(1.0f, 1.5f, 0.5f);
+	ParticleVectorField field(glm::ivec3(7, 5, 9), boundsMin, boundsMax);
+	const ParticleRandom random(11);
+	for (size_t component = 0; component < 3; ++component)
+	{
+		const auto numNodes = static_cast<size_t>(7 * 5 * 9);
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, static_cast<uint32_t>(component), 0, numNodes,
+		                        field.Component(component), -1.0f, 1.0f);
+	}
+
+	// Half again the box on every side, so about two thirds of the particles are clamped on some axis.
+	ParticlePool reference(count);
+	reference.SetCount(count);
+	const auto extent = boundsMax - boundsMin;
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		const auto stream = static_cast<ParticlePool::Stream>(ParticlePool::POSITION_X + axis);
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, static_cast<uint32_t>(3 + axis), 0, count, reference.Data(stream),
+		                        boundsMin[axis] - 0.5f * extent[axis], boundsMax[axis] + 0.5f * extent[axis]);
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, static_cast<uint32_t>(6 + axis), 0, count,
+		                        reference.Data(static_cast<ParticlePool::Stream>(ParticlePool::VELOCITY_X + axis)),
+		                        -1.0f, 1.0f);
+		auto* const position = reference.Data(stream);
+		for (size_t i = 0; i < count && i < 8; ++i)
+		{
+			position[i] = i % 2 == 0 ? boundsMin[axis] : boundsMax[axis];
+		}
+		std::fill(position + count, position + reference.PaddedCount(), std::numeric_limits<float>::quiet_NaN());
+	}
+
+	printf("Vector field kernels: %zu particles\n", count);
+	auto passed = true;
+#if PARTICLE_KERNELS_X86
+	if (ParticleKernels::Detect() == ParticleKernels::AVX2)
+	{
+		const auto scalar = reference.Clone();
+		const auto avx2 = reference.Clone();
+		field.AccelerateScalar(scalar, 0, scalar.PaddedCount(), 0.5f);
+		field.AccelerateAVX2(avx2, 0, avx2.PaddedCount(), 0.5f);
+
+		size_t mismatches = 0;
+		for (const auto stream : { ParticlePool::VELOCITY_X, ParticlePool::VELOCITY_Y, ParticlePool::VELOCITY_Z })
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				mismatches += std::memcmp(&scalar.Data(stream)[i], &avx2.Data(stream)[i], sizeof(float)) != 0 ? 1 : 0;
+			}
+		}
+		printf("%-36s %s\n", "ParticleVectorField::AccelerateAVX2", mismatches == 0 ? "matches scalar" : "MISMATCH");
+		if (mismatches != 0)
+		{
+			fprintf(stderr, "AccelerateAVX2 differs from AccelerateScalar in %zu values\n", mismatches);
+			passed = false;
+		}
+	}
+#endif
+	return passed;
+}
+
+// Prints the throughput of one benchmark case, eg. a random number generator. generate returns one of its results,
+// which is kept alive so the work can't be optimized away.
+template<class Generate>
+static void RunThroughputCase(const char* name, const int numSamples, const Generate& generate)
+{
+	static volatile float sink;
+	const auto start = std::chrono::steady_clock::now();
+	sink = generate();
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	(void)sink;
+	printf("%-36s %14.1f\n", name, numSamples / seconds / 1.0e6);
+}
+
+// Compares the spawn distributions drawn with rand() and glm's generators (global state, one value at a time) against
+// ParticleRandom's batch APIs filling structure-of-arrays streams.
+static void RunRandomBenchmark(const BenchmarkOptions& options)
+{
+	const auto count = static_cast<size_t>(options.numRandomSamples);
+	std::vector<float> x(count);
+	std::vector<float> y(count);
+	std::vector<float> z(count);
+	const ParticleRandom random(1);
+
+	printf("Random numbers: %d samples\n", options.numRandomSamples);
+	printf("%-36s %14s\n", "generator", "Msamples/sec");
+
+	RunThroughputCase("rand() uniform", options.numRandomSamples, [&]()
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			x[i] = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+		}
+		return x[count / 2];
+	});
+	RunThroughputCase("ParticleRandom::FillUniformRange", options.numRandomSamples, [&]()
+	{
+		random.FillUniformRange(SPAWN_DECAY_STREAM, 0, 0, count, x.data());
+		return x[count / 2];
+	});
+	RunThroughputCase("glm::sphericalRand", options.numRandomSamples, [&]()
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto sample = glm::sphericalRand(1.0f);
+			x[i] = sample.x;
+			y[i] = sample.y;
+			z[i] = sample.z;
+		}
+		return x[count / 2];
+	});
+	RunThroughputCase("ParticleRandom::FillUnitSphereRange", options.numRandomSamples, [&]()
+	{
+		random.FillUnitSphereRange(SPAWN_VELOCITY_STREAM, 0, 0, count, x.data(), y.data(), z.data());
+		return x[count / 2];
+	});
+	RunThroughputCase("glm::ballRand", options.numRandomSamples, [&]()
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto sample = glm::ballRand(1.0f);
+			x[i] = sample.x;
+			y[i] = sample.y;
+			z[i] = sample.z;
+		}
+		return x[count / 2];
+	});
+	RunThroughputCase("ParticleRandom::FillUnitBallRange", options.numRandomSamples, [&]()
+	{
+		random.FillUnitBallRange(SPAWN_VELOCITY_STREAM, 0, 0, count, x.data(), y.data(), z.data());
+		return x[count / 2];
+	});
+}
+
+// Builds a ParticleSpatialGrid over uniformly scattered particles at growing counts, with 1 and maxThreads threads,
+// then runs radius queries one cell wide around random particles. The density is the same at every count (about 8
+// particles per cell), so query costs stay comparable.
+static void RunSpatialGridBenchmark(const BenchmarkOptions& options)
+{
+	constexpr float cellSize = 0.05f;
+	constexpr float particlesPerCell = 8.0f;
+
+	printf("Spatial grid: %d queries, radius = cell size, %.0f particles per cell\n", options.numGridQueries,
+	       particlesPerCell);
+	printf("%12s %8s %14s %18s %16s %12s\n", "particles", "threads", "build ms", "build Mparticles/s",
+	       "Mqueries/s", "neighbors");
+
+	const ParticleRandom random(1);
+	for (size_t count = 100000; count <= static_cast<size_t>(options.maxGridParticles); count *= 10)
+	{
+		const auto extent = std::cbrt(count / particlesPerCell) * cellSize;
+		std::vector<float> x(count);
+		std::vector<float> y(count);
+		std::vector<float> z(count);
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, 0, 0, count, x.data(), 0.0f, extent);
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, 1, 0, count, y.data(), 0.0f, extent);
+		random.FillUniformRange(SPAWN_VELOCITY_STREAM, 2, 0, count, z.data(), 0.0f, extent);
+
+		for (const auto numThreads : { 1, options.maxThreads })
+		{
+			WorkerPool workers(numThreads - 1);
+			ParticleSpatialGrid grid;
+			// The first build sizes the buffers.
+			grid.Build(x.data(), y.data(), z.data(), count, cellSize, &workers);
+
+			constexpr auto numBuilds = 5;
+			const auto buildStart = std::chrono::steady_clock::now();
+			for (auto build = 0; build < numBuilds; ++build)
+			{
+				grid.Build(x.data(), y.data(), z.data(), count, cellSize, &workers);
+			}
+			const auto buildSeconds =
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count() / numBuilds;
+
+			const auto numQueries = static_cast<size_t>(options.numGridQueries);
+			std::vector<size_t> neighbors(numQueries);
+			const auto queryStart = std::chrono::steady_clock::now();
+			workers.ParallelFor(numQueries, 1024, [&](const size_t begin, const size_t end)
+			{
+				for (auto query = begin; query < end; ++query)
+				{
+					const auto p = random.Generate(SPAWN_DECAY_STREAM, 0, static_cast<uint32_t>(query))[0] % count;
+					neighbors[query] = grid.CountInRadius(glm::vec3(x[p], y[p], z[p]), cellSize);
+				}
+			});
+			const auto querySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - queryStart).count();
+
+			size_t neighborSum = 0;
+			for (const auto neighborCount : neighbors)
+			{
+				neighborSum += neighborCount;
+			}
+			printf("%12zu %8d %14.2f %18.1f %16.2f %12.1f\n", count, numThreads, 1000.0 * buildSeconds,
+			       count / buildSeconds / 1.0e6, numQueries / querySeconds / 1.0e6,
+			       static_cast<double>(neighborSum) / std::max<size_t>(numQueries, 1));
+
+			if (numThreads == options.maxThreads)
+			{
+				break;
+			}
+		}
+	}
+}
+
+// Compares sampling a baked curl noise field (with each kernel) against evaluating the noise at every particle, and
+// times the bake itself, which an evolving field spreads over its key interval.
+static void RunForceFieldBenchmark(const BenchmarkOptions& options)
+{
+	const auto count = static_cast<size_t>(options.numForceParticles);
+	ParticleCurlNoiseSettings settings;
+	settings.strength = 1.0f;
+
+	printf("Curl noise: %zu particles, %d^3 field\n", count, settings.resolution);
+	printf("%-36s %14s\n", "method", "Mparticles/sec");
+
+	ParticlePool pool(count);
+	pool.SetCount(count);
+	const ParticleRandom random(1);
+	random.FillUniformRange(SPAWN_VELOCITY_STREAM, 0, 0, count, pool.PositionX(), -1.0f, 1.0f);
+	random.FillUniformRange(SPAWN_VELOCITY_STREAM, 1, 0, count, pool.PositionY(), -1.0f, 1.0f);
+	random.FillUniformRange(SPAWN_VELOCITY_STREAM, 2, 0, count, pool.PositionZ(), -1.0f, 1.0f);
+
+	ParticleCurlNoise noise(settings);
+	const auto bakeStart = std::chrono::steady_clock::now();
+	noise.Advance(0.0f);
+	const auto bakeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bakeStart).count();
+
+	ParticleVectorField field(glm::ivec3(settings.resolution), settings.boundsMin, settings.boundsMax);
+	for (auto z = 0; z < settings.resolution; ++z)
+	{
+		for (auto y = 0; y < settings.resolution; ++y)
+		{
+			for (auto x = 0; x < settings.resolution; ++x)
+			{
+				field.Set(x, y, z, ParticleCurlNoise::Evaluate(field.NodePosition(x, y, z), 0.0f));
+			}
+		}
+	}
+
+	RunThroughputCase("ParticleVectorField::AccelerateScalar", options.numForceParticles, [&]()
+	{
+		field.AccelerateScalar(pool, 0, pool.PaddedCount(), 1.0e-6f);
+		return pool.VelocityX()[count / 2];
+	});
+#if PARTICLE_KERNELS_X86
+	if (ParticleKernels::Detect() == ParticleKernels::AVX2)
+	{
+		RunThroughputCase("ParticleVectorField::AccelerateAVX2", options.numForceParticles, [&]()
+		{
+			field.AccelerateAVX2(pool, 0, pool.PaddedCount(), 1.0e-6f);
+			return pool.VelocityX()[count / 2];
+		});
+	}
+#endif
+	RunThroughputCase("ParticleCurlNoise::Evaluate", options.numForceParticles, [&]()
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto acceleration = ParticleCurlNoise::Evaluate(
+				glm::vec3(pool.PositionX()[i], pool.PositionY()[i], pool.PositionZ()[i]), 0.0f);
+			pool.VelocityX()[i] += acceleration.x * 1.0e-6f;
+			pool.VelocityY()[i] += acceleration.y * 1.0e-6f;
+			pool.VelocityZ()[i] += acceleration.z * 1.0e-6f;
+		}
+		return pool.VelocityX()[count / 2];
+	});
+	printf("Bake: %.2f ms\n", 1000.0 * bakeSeconds);
+}
+
+// Rains particles on a wavy terrain mesh, and compares whole simulation steps with and without collisions against it.
+// The particles are spawned just above the terrain and the effect warms up first, so most of them are sliding or
+// bouncing on it while timed. Steps with the collider have to fit a 60 Hz frame with all the threads.
+static bool RunCollisionBenchmark(const BenchmarkOptions& options)
+{
+	constexpr auto frameMilliseconds = 1000.0 / 60.0;
+	// Two triangles per grid cell.
+	const auto gridSize = std::max(static_cast<int>(std::sqrt(options.numCollisionTriangles / 2.0)), 1);
+	const auto cellSize = 4.0f / gridSize;
+	const auto height = [](const float x, const float z)
+	{
+		return 0.1f * std::sin(4.0f * x) * std::cos(4.0f * z);
+	};
+	std::vector<glm::vec3> corners;
+	corners.reserve(6 * gridSize * gridSize);
+	for (auto z = 0; z < gridSize; ++z)
+	{
+		for (auto x = 0; x < gridSize; ++x)
+		{
+			const auto x0 = -2.0f + x * cellSize;
+			const auto z0 = -2.0f + z * cellSize;
+			const glm::vec3 v00(x0, height(x0, z0), z0);
+			const glm::vec3 v10(x0 + cellSize, height(x0 + cellSize, z0), z0);
+			const glm::vec3 v01(x0, height(x0, z0 + cellSize), z0 + cellSize);
+			const glm::vec3 v11(x0 + cellSize, height(x0 + cellSize, z0 + cellSize), z0 + cellSize);
+			corners.insert(corners.end(), { v00, v01, v10, v10, v01, v11 });
+		}
+	}
+
+	const auto buildStart = std::chrono::steady_clock::now();
+	const auto collider = std::make_shared<const ParticleCollider>(corners);
+	const auto buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+	printf("Collision: %d particles, %zu triangles, BVH of %zu nodes built in %.1f ms\n", options.numCollisionParticles,
+	       collider->NumTriangles(), collider->NumNodes(), 1000.0 * buildSeconds);
+	printf("%8s %10s %14s %14s %16s %10s\n", "threads", "collider", "ms/step", "hits/step", "Mparticles/s", "60 Hz");
+
+	ParticleEffectSettings settings;
+	settings.numParticles = options.numCollisionParticles;
+	settings.spawnRate = std::numeric_limits<float>::infinity();
+	settings.initialBurst = options.numCollisionParticles;
+	settings.decayRange = { 0.001f, 0.002f };
+	settings.speed = 1.0f;
+	settings.position = glm::vec3(0.0f, 0.15f, 0.0f);
+	settings.gravity = glm::vec3(0.0f, -40.0f, 0.0f);
+
+	constexpr auto warmupSteps = 30;
+	auto colliderMilliseconds = 0.0;
+	for (const auto numThreads : { 1, options.maxThreads })
+	{
+		WorkerPool workers(numThreads - 1);
+		for (const auto withCollider : { false, true })
+		{
+			settings.collider = withCollider ? collider : nullptr;
+			ParticleEffect effect(settings);
+			for (auto step = 0; step < warmupSteps; ++step)
+			{
+				effect.Simulate(16.0f, &workers);
+			}
+
+			const auto collisionsBefore = effect.SimulationStats().collisions;
+			const auto start = std::chrono::steady_clock::now();
+			for (auto step = 0; step < options.numFrames; ++step)
+			{
+				effect.Simulate(16.0f, &workers);
+			}
+			const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			const auto stepMilliseconds = 1000.0 * seconds / options.numFrames;
+			printf("%8d %10s %14.3f %14.0f %16.1f %10s\n", numThreads, withCollider ? "yes" : "no", stepMilliseconds,
+			       static_cast<double>(effect.SimulationStats().collisions - collisionsBefore) / options.numFrames,
+			       effect.Pool().Count() / (stepMilliseconds * 1000.0),
+			       stepMilliseconds <= frameMilliseconds ? "ok" : "over");
+			if (withCollider)
+			{
+				colliderMilliseconds = stepMilliseconds;
+			}
+		}
+
+		if (numThreads == options.maxThreads)
+		{
+			break;
+		}
+	}
+
+	if (colliderMilliseconds > frameMilliseconds)
+	{
+		printf("Collision: %d threads take %.3f ms per step with the collider, over a 60 Hz frame\n", options.maxThreads,
+		       colliderMilliseconds);
+		return false;
+	}
+	return true;
+}
+
+// Dam break: a block of fluid standing in one corner of a tank collapses and surges to the far wall. The frames are
+// 16 ms steps from rest, timed with one thread and with all of them. Density columns are the largest over the run, of
+// the average and of any particle, over the rest density; the front is how far the fluid got, in block widths. Fails
+// if particles end up outside the tank or not finite, or if the fluid compresses more than its stiffness allows.
+static bool RunFluidBenchmark(const BenchmarkOptions& options)
+{
+	ParticleEffectSettings settings;
+	settings.integrator = ParticleEffectSettings::FLUID;
+	settings.numParticles = options.numFluidParticles;
+
+	// A block twice as wide and high as it is deep, in a tank three blocks long.
+	const auto blockSize = settings.fluid.spacing * std::cbrt(2.0f * options.numFluidParticles);
+	const auto block = glm::vec3(blockSize, blockSize, 0.5f * blockSize);
+	settings.fluid.boundsMin = glm::vec3(0.0f);
+	settings.fluid.boundsMax = glm::vec3(3.0f * block.x, 2.0f * block.y, block.z);
+	const auto positions = ParticleFluid::FillBox(glm::vec3(0.0f), block, settings.fluid.spacing);
+	settings.numParticles = static_cast<int>(positions.size());
+	settings.boundingRadius = glm::length(settings.fluid.boundsMax);
+
+	printf("Fluid: dam break of %zu particles, %.2f m block in a %.2f x %.2f x %.2f m tank, %d frames\n",
+	       positions.size(), blockSize, settings.fluid.boundsMax.x, settings.fluid.boundsMax.y,
+	       settings.fluid.boundsMax.z, options.numFrames);
+	printf("%8s %12s %12s %14s %12s %14s %14s %10s\n", "threads", "ms/step", "steps/s", "substeps/s", "substeps",
+	       "density avg", "density max", "front");
+
+	auto passed = true;
+	for (const auto numThreads : { 1, options.maxThreads })
+	{
+		WorkerPool workers(numThreads - 1);
+		ParticleEffect effect(settings);
+		effect.SpawnAt(positions.data(), positions.size());
+
+		auto maxAverageDensityRatio = 0.0f;
+		auto maxDensityRatio = 0.0f;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto step = 0; step < options.numFrames; ++step)
+		{
+			effect.Simulate(16.0f, &workers);
+			maxAverageDensityRatio = std::max(maxAverageDensityRatio, effect.Fluid()->Stats().averageDensityRatio);
+			maxDensityRatio = std::max(maxDensityRatio, effect.Fluid()->Stats().maxDensityRatio);
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// How far the fluid got towards the far wall, in blocks.
+		const auto& pool = effect.Pool();
+		auto front = 0.0f;
+		auto contained = pool.Count() == positions.size();
+		for (size_t i = 0; i < pool.Count(); ++i)
+		{
+			const auto position = glm::vec3(pool.PositionX()[i], pool.PositionY()[i], pool.PositionZ()[i]);
+			contained = contained && glm::all(glm::greaterThanEqual(position, settings.fluid.boundsMin)) &&
+			            glm::all(glm::lessThanEqual(position, settings.fluid.boundsMax));
+			front = std::max(front, position.x / block.x);
+		}
+
+		const auto& stats = effect.Fluid()->Stats();
+		const auto stepMilliseconds = 1000.0 * seconds / options.numFrames;
+		printf("%8d %12.2f %12.1f %14.0f %12.1f %14.3f %14.3f %10.2f\n", numThreads, stepMilliseconds,
+		       options.numFrames / seconds, static_cast<double>(stats.substeps) / seconds,
+		       static_cast<double>(stats.substeps) / stats.steps, maxAverageDensityRatio, maxDensityRatio, front);
+
+		// With the default stiffness, the fluid falls well below the speed of sound, so it should stay within a few
+		// percent of the rest density as a whole. Single particles caught in a splash against a wall go further.
+		if (!contained || !(maxAverageDensityRatio < 1.1f) || !(maxDensityRatio < 2.0f))
+		{
+			printf("Fluid: %s\n", contained ? "compressed too far" : "particles left the tank");
+			passed = false;
+		}
+
+		if (numThreads == options.maxThreads)
+		{
+			break;
+		}
+	}
+	return passed;
+}
+
+// Spawn functions in the shape ParticleEffectSettings::decayFunc/velocityFunc take, drawing the same distributions as
+// the settings from a global counter. They only differ from the batch paths by the call per particle.
+static uint32_t functionCounter = 0;
+
+static float FunctionDecay()
+{
+	static const ParticleRandom random(0);
+	return random.Uniform(SPAWN_DECAY_STREAM, 0, functionCounter++, 0.0015f, 0.051f);
+}
+
+static glm::vec3 FunctionVelocity()
+{
+	static const ParticleRandom random(0);
+	return random.UnitBall(SPAWN_VELOCITY_STREAM, 0, functionCounter++) * 5.0f;
+}
+
+// Runs the same always-full effect through the spawn function pointers, the settings distributions and the fused
+// kernels of a ParticleBehavior, single-threaded. The behavior composed from the settings has to produce the same
+// particles bit for bit; the last one adds drag and a size over life to the fused loop.
+static bool RunBehaviorBenchmark(const BenchmarkOptions& options)
+{
+	printf("Behaviors: 1 effect x %d particles, %d frames, 1 thread\n", options.numBehaviorParticles,
+	       options.numFrames);
+	printf("%-18s %12s %16s %16s\n", "spawn/update", "ms/frame", "emit ns/spawn", "update ns/particle");
+
+	auto behaviorOptions = options;
+	behaviorOptions.numEffects = 1;
+	behaviorOptions.numParticles = options.numBehaviorParticles;
+	const auto settings = CreateEffects(behaviorOptions).front().Settings();
+
+	auto functionSettings = settings;
+	functionSettings.decayFunc = FunctionDecay;
+	functionSettings.velocityFunc = FunctionVelocity;
+
+	const auto gravity = MakeParticleForces(ParticleGravity{ settings.gravity });
+	auto fusedSettings = settings;
+	fusedSettings.behavior = ComposeParticleBehavior(ParticlePointEmitter(),
+	                                                 ParticleBallVelocity{ settings.speed },
+	                                                 ParticleUniformDecay{ settings.decayRange.x, settings.decayRange.y },
+	                                                 gravity, ParticleConstantSize{ settings.particleSize });
+
+	auto extendedSettings = settings;
+	extendedSettings.behavior = ComposeParticleBehavior(ParticlePointEmitter(),
+	                                                    ParticleBallVelocity{ settings.speed },
+	                                                    ParticleUniformDecay{ settings.decayRange.x,
+	                                                                          settings.decayRange.y },
+	                                                    MakeParticleForces(ParticleGravity{ settings.gravity },
+	                                                                       ParticleDrag{ 0.5f }),
+	                                                    ParticleSizeOverLife{ settings.particleSize, 0.0f });
+
+	const std::pair<const char*, const ParticleEffectSettings*> cases[] = {
+		{ "function pointers", &functionSettings },
+		{ "settings", &settings },
+		{ "fused", &fusedSettings },
+		{ "fused, drag, size", &extendedSettings }
+	};
+
+	std::vector<ParticleEffect> effects;
+	for (const auto& namedSettings : cases)
+	{
+		functionCounter = 0;
+		ParticleEffect effect(*namedSettings.second);
+		size_t particleSteps = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			particleSteps += effect.Pool().Count();
+			effect.Simulate(16.0f);
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const auto& times = effect.StageTimes();
+		printf("%-18s %12.3f %16.2f %16.2f\n", namedSettings.first, 1000.0 * seconds / options.numFrames,
+		       1e9 * times.emit / std::max<uint64_t>(effect.SimulationStats().spawned, 1),
+		       1e9 * times.update / std::max<size_t>(particleSteps, 1));
+		effects.push_back(effect);
+	}
+
+	// Padding is never read back, so only the live particles are compared.
+	const auto& expected = effects[1].Pool();
+	const auto& fused = effects[2].Pool();
+	auto matches = fused.Count() == expected.Count();
+	const std::pair<const float*, const float*> streams[] = {
+		{ expected.PositionX(), fused.PositionX() }, { expected.PositionY(), fused.PositionY() },
+		{ expected.PositionZ(), fused.PositionZ() }, { expected.VelocityX(), fused.VelocityX() },
+		{ expected.VelocityY(), fused.VelocityY() }, { expected.VelocityZ(), fused.VelocityZ() },
+		{ expected.Life(), fused.Life() }, { expected.Decay(), fused.Decay() }, { expected.Size(), fused.Size() }
+	};
+	for (const auto& stream : streams)
+	{
+		matches = matches && std::memcmp(stream.first, stream.second, expected.Count() * sizeof(float)) == 0;
+	}
+	if (!matches)
+	{
+		printf("Behaviors: the fused kernels differ from the settings\n");
+	}
+	return matches;
+}
+
+// Scripts of the effect file in the script benchmark: a size drawn at spawn, drag, and a size shrinking with life.
+static const char* const SCRIPT_EFFECT = R"(
+spawn
+    size = 0.01 + 0.02 * rand()
+end
+
+update
+    drag = 0.5 * stepScale
+    vx = vx - vx * drag
+    vy = vy - vy * drag
+    vz = vz - vz * drag
+    size = size * 0.98 + 0.0004 * life
+end
+)";
+
+// SCRIPT_EFFECT written by hand, with the same operations in the same order.
+struct HandWrittenModules
+{
+	ParticleModules<ParticlePointEmitter, ParticleBallVelocity, ParticleUniformDecay> defaults;
+
+	void Spawn(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count,
+	           const glm::vec3& origin, const ParticlePool& pool) const
+	{
+		defaults.Spawn(random, frame, indices, count, origin, pool);
+		for (size_t i = 0; i < count; ++i)
+		{
+			pool.Size()[indices[i]] = 0.01f + 0.02f * random.Uniform(SPAWN_SCRIPT_STREAM, frame, indices[i]);
+		}
+	}
+
+	void Update(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step) const
+	{
+		const auto drag = 0.5f * step.stepScale;
+		auto* const velocityX = pool.VelocityX();
+		auto* const velocityY = pool.VelocityY();
+		auto* const velocityZ = pool.VelocityZ();
+		auto* const size = pool.Size();
+		const auto* const life = pool.Life();
+		for (auto i = begin; i < end; ++i)
+		{
+			velocityX[i] = velocityX[i] - velocityX[i] * drag;
+			velocityY[i] = velocityY[i] - velocityY[i] * drag;
+			velocityZ[i] = velocityZ[i] - velocityZ[i] * drag;
+			size[i] = size[i] * 0.98f + 0.0004f * life[i];
+		}
+		ParticleKernels::Integrate(pool, begin, end, step);
+	}
+};
+
+// Runs the always-full effect with SCRIPT_EFFECT loaded over it, and with the same modules in C++, single-threaded.
+// Both have to produce the same particles bit for bit, and the script update may be at most maxScriptSlowdown times
+// slower.
+static bool RunScriptBenchmark(const BenchmarkOptions& options)
+{
+	printf("Scripts: 1 effect x %d particles, %d frames, 1 thread\n", options.numScriptParticles, options.numFrames);
+	printf("%-18s %12s %16s %16s\n", "spawn/update", "ms/frame", "emit ns/spawn", "update ns/particle");
+
+	auto scriptOptions = options;
+	scriptOptions.numEffects = 1;
+	scriptOptions.numParticles = options.numScriptParticles;
+	const auto settings = CreateEffects(scriptOptions).front().Settings();
+
+	auto scriptSettings = settings;
+	if (!ParticleEffectFile::Parse(SCRIPT_EFFECT, "SCRIPT_EFFECT", scriptSettings))
+	{
+		return false;
+	}
+
+	auto handWrittenSettings = settings;
+	handWrittenSettings.behavior = ParticleBehavior(HandWrittenModules{
+		{ {}, { settings.speed }, { settings.decayRange.x, settings.decayRange.y }, {},
+		  { settings.particleSize } } });
+
+	const std::pair<const char*, const ParticleEffectSettings*> cases[] = {
+		{ "settings", &settings },
+		{ "hand-written", &handWrittenSettings },
+		{ "script", &scriptSettings }
+	};
+
+	std::vector<ParticleEffect> effects;
+	std::vector<double> updateTimes;
+	for (const auto& namedSettings : cases)
+	{
+		ParticleEffect effect(*namedSettings.second);
+		size_t particleSteps = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			particleSteps += effect.Pool().Count();
+			effect.Simulate(16.0f);
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const auto& times = effect.StageTimes();
+		updateTimes.push_back(1e9 * times.update / std::max<size_t>(particleSteps, 1));
+		printf("%-18s %12.3f %16.2f %16.2f\n", namedSettings.first, 1000.0 * seconds / options.numFrames,
+		       1e9 * times.emit / std::max<uint64_t>(effect.SimulationStats().spawned, 1), updateTimes.back());
+		effects.push_back(effect);
+	}
+
+	const auto& expected = effects[1].Pool();
+	const auto& script = effects[2].Pool();
+	auto matches = script.Count() == expected.Count();
+	const std::pair<const float*, const float*> streams[] = {
+		{ expected.PositionX(), script.PositionX() }, { expected.PositionY(), script.PositionY() },
+		{ expected.PositionZ(), script.PositionZ() }, { expected.VelocityX(), script.VelocityX() },
+		{ expected.VelocityY(), script.VelocityY() }, { expected.VelocityZ(), script.VelocityZ() },
+		{ expected.Life(), script.Life() }, { expected.Decay(), script.Decay() }, { expected.Size(), script.Size() }
+	};
+	for (const auto& stream : streams)
+	{
+		matches = matches && std::memcmp(stream.first, stream.second, expected.Count() * sizeof(float)) == 0;
+	}
+	if (!matches)
+	{
+		printf("Scripts: the script differs from the hand-written modules\n");
+		return false;
+	}
+
+	const auto slowdown = updateTimes[2] / updateTimes[1];
+	printf("Script update: %.2fx the hand-written one\n", slowdown);
+	if (slowdown > options.maxScriptSlowdown)
+	{
+		printf("Scripts: the script update is more than %.1fx slower than the hand-written one\n",
+		       options.maxScriptSlowdown);
+		return false;
+	}
+	return true;
+}
+
+// Draws trails of trailLength segments behind the always-full effect, against the way they used to be faked: with
+// trailLength more particles per trail, all simulated and sorted. The ribbons have to stay in the staging they were
+// first built in (nothing allocated per frame), one ribbon per particle, with every vertex finite.
+static bool RunTrailBenchmark(const BenchmarkOptions& options)
+{
+	printf("Trails: %d trails x %d segments, %d frames, 1 thread\n", options.numTrailParticles, options.trailLength,
+	       options.numFrames);
+	printf("%-18s %12s %12s %12s %16s\n", "trails", "particles", "sim ms", "draw ms", "vertices/frame");
+
+	const auto view = BenchmarkView();
+	auto trailOptions = options;
+	trailOptions.numEffects = 1;
+	trailOptions.numParticles = options.numTrailParticles;
+	auto trailSettings = CreateEffects(trailOptions).front().Settings();
+	trailSettings.trail.length = options.trailLength;
+
+	trailOptions.numParticles = options.numTrailParticles * (options.trailLength + 1);
+	const auto fakeSettings = CreateEffects(trailOptions).front().Settings();
+
+	const std::pair<const char*, const ParticleEffectSettings*> cases[] = {
+		{ "extra particles", &fakeSettings },
+		{ "ribbons", &trailSettings }
+	};
+
+	auto isValid = true;
+	for (const auto& namedSettings : cases)
+	{
+		ParticleEffect effect(*namedSettings.second);
+		effect.Update(16.0f, view);
+		const auto* const staging = effect.StagedTrailVertices().data();
+
+		double simulateSeconds = 0.0;
+		double drawSeconds = 0.0;
+		size_t vertices = 0;
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			effect.Simulate(16.0f);
+			const auto simulated = std::chrono::steady_clock::now();
+			effect.PrepareDraw(view, 0.5f);
+			const auto end = std::chrono::steady_clock::now();
+			simulateSeconds += std::chrono::duration<double>(simulated - start).count();
+			drawSeconds += std::chrono::duration<double>(end - simulated).count();
+			vertices += effect.HasTrails() ? effect.StagedTrailVertices().size() : 4 * effect.Pool().Count();
+		}
+		printf("%-18s %12zu %12.3f %12.3f %16zu\n", namedSettings.first, effect.Pool().Capacity(),
+		       1000.0 * simulateSeconds / options.numFrames, 1000.0 * drawSeconds / options.numFrames,
+		       vertices / options.numFrames);
+
+		if (!effect.HasTrails())
+		{
+			continue;
+		}
+		const auto& trailVertices = effect.StagedTrailVertices();
+		isValid = isValid && trailVertices.data() == staging &&
+		          trailVertices.size() == effect.Pool().Count() * (2 * (options.trailLength + 1) + 2);
+		for (const auto& vertex : trailVertices)
+		{
+			isValid = isValid && std::isfinite(vertex.position.x) && std::isfinite(vertex.position.y) &&
+			          std::isfinite(vertex.position.z);
+		}
+	}
+
+	if (!isValid)
+	{
+		printf("Trails: the ribbons were reallocated, miscounted or not finite\n");
+	}
+	return isValid;
+}
+
+// Fireworks: rockets bouncing off the ground raise events from worker threads, which three sub-emitters consume in one
+// pass after each step: sparks where rockets die, splashes where they hit the ground, and smoke halfway through their
+// life. Every death and collision has to come out as exactly one event, and every event as its sub-emitter's count of
+// particles, starting out where the event happened.
+static bool RunEventBenchmark(const BenchmarkOptions& options)
+{
+	// At least a few workers, so chunks append to the event buffer concurrently.
+	const auto numThreads = std::max(options.maxThreads, 4);
+	WorkerPool workers(numThreads - 1);
+	printf("Events: %d rockets, %d frames, %d threads\n", options.numEventParticles, options.numFrames, numThreads);
+	printf("%-10s %12s %12s %12s %14s\n", "event", "events/step", "spawned", "dropped", "spawn ms/step");
+
+	const std::vector<glm::vec3> ground = {
+		{ -10.0f, 0.0f, -10.0f }, { -10.0f, 0.0f, 10.0f }, { 10.0f, 0.0f, -10.0f },
+		{ 10.0f, 0.0f, -10.0f }, { -10.0f, 0.0f, 10.0f }, { 10.0f, 0.0f, 10.0f }
+	};
+
+	auto eventOptions = options;
+	eventOptions.numEffects = 1;
+	eventOptions.numParticles = options.numEventParticles;
+	auto rocketSettings = CreateEffects(eventOptions).front().Settings();
+	rocketSettings.position = glm::vec3(0.0f, 0.5f, 0.0f);
+	rocketSettings.gravity = glm::vec3(0.0f, -40.0f, 0.0f);
+	rocketSettings.collider = std::make_shared<const ParticleCollider>(ground);
+	rocketSettings.events.capacity = 4 * options.numEventParticles;
+
+	const std::pair<const char*, ParticleSubEmitter> subEmitters[] = {
+		{ "death", { PARTICLE_EVENT_DEATH, 0, 4, 0.5f } },
+		{ "collision", { PARTICLE_EVENT_COLLISION, 1, 1, 0.0f } },
+		{ "lifetime", { PARTICLE_EVENT_LIFETIME, 2, 1, 1.0f } }
+	};
+	std::vector<ParticleEffect> children;
+	for (const auto& subEmitter : subEmitters)
+	{
+		rocketSettings.events.subEmitters.push_back(subEmitter.second);
+		eventOptions.numParticles = 16 * options.numEventParticles;
+		// Short-lived, so they never run out of capacity.
+		auto childSettings = CreateEffects(eventOptions).front().Settings();
+		childSettings.spawnRate = 0.0f;
+		childSettings.initialBurst = 0;
+		childSettings.decayRange = { 0.05f, 0.1f };
+		children.emplace_back(childSettings);
+	}
+
+	ParticleEffect rockets(rocketSettings);
+	std::array<size_t, NUM_PARTICLE_EVENT_TYPES> eventCounts = {};
+	std::array<size_t, NUM_PARTICLE_EVENT_TYPES> spawnCounts = {};
+	double spawnSeconds = 0.0;
+	auto isValid = true;
+	for (auto frame = 0; frame < options.numFrames; ++frame)
+	{
+		const auto before = rockets.SimulationStats();
+		rockets.Simulate(16.0f, &workers);
+		const auto& after = rockets.SimulationStats();
+
+		const auto& events = *rockets.Events();
+		std::array<size_t, NUM_PARTICLE_EVENT_TYPES> counts = {};
+		for (size_t e = 0; e < events.Count(); ++e)
+		{
+			++counts[events.Data()[e].type];
+		}
+		isValid = isValid && counts[PARTICLE_EVENT_DEATH] == after.killed - before.killed &&
+		          counts[PARTICLE_EVENT_COLLISION] == after.collisions - before.collisions;
+
+		const auto spawnStart = std::chrono::steady_clock::now();
+		for (size_t c = 0; c < children.size(); ++c)
+		{
+			const auto& subEmitter = subEmitters[c].second;
+			auto& child = children[c];
+			const auto first = child.Pool().Count();
+			const auto spawned = child.SpawnFromEvents(events, subEmitter, &workers);
+			isValid = isValid && spawned == counts[subEmitter.event] * subEmitter.count;
+
+			// The first particle spawned starts out at the first event of its type.
+			const auto* const event = std::find_if(events.Data(), events.Data() + events.Count(),
+			                                       [&](const ParticleEvent& e) { return e.type == subEmitter.event; });
+			if (spawned > 0)
+			{
+				const auto& pool = child.Pool();
+				isValid = isValid && pool.PositionX()[first] == event->position.x &&
+				          pool.PositionY()[first] == event->position.y && pool.PositionZ()[first] == event->position.z;
+			}
+			eventCounts[subEmitter.event] += counts[subEmitter.event];
+			spawnCounts[subEmitter.event] += spawned;
+		}
+		spawnSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - spawnStart).count();
+		rockets.ClearEvents();
+
+		for (auto& child : children)
+		{
+			child.Simulate(16.0f, &workers);
+		}
+	}
+
+	for (const auto& subEmitter : subEmitters)
+	{
+		const auto type = subEmitter.second.event;
+		printf("%-10s %12.1f %12zu\n", subEmitter.first, static_cast<double>(eventCounts[type]) / options.numFrames,
+		       spawnCounts[type]);
+	}
+	printf("%-10s %12s %12s %12llu %14.3f\n", "all", "", "", static_cast<unsigned long long>(rockets.Events()->Dropped()),
+	       1000.0 * spawnSeconds / options.numFrames);
+
+	isValid = isValid && rockets.Events()->Dropped() == 0 && eventCounts[PARTICLE_EVENT_LIFETIME] > 0 &&
+	          eventCounts[PARTICLE_EVENT_COLLISION] > 0;
+	if (!isValid)
+	{
+		printf("Events: events or sub-emitter spawns went missing\n");
+	}
+	return isValid;
+}
+
+// Whether any particle of effect, as it stands, is inside the clip volume of viewProjection.
+static bool HasParticleInView(const ParticleEffect& effect, const glm::mat4& viewProjection)
+{
+	const auto& pool = effect.Pool();
+	for (size_t i = 0; i < pool.Count(); ++i)
+	{
+		const auto clip = viewProjection * glm::vec4(pool.PositionX()[i], pool.PositionY()[i], pool.PositionZ()[i], 1.0f);
+		if (std::abs(clip.x) <= clip.w && std::abs(clip.y) <= clip.w && std::abs(clip.z) <= clip.w)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether bounds hold the current and previous position of every particle of effect.
+static bool BoundsHoldParticles(const ParticleEffect& effect, const ParticleBounds& bounds)
+{
+	const auto& pool = effect.Pool();
+	const auto isInside = [&](const float x, const float y, const float z)
+	{
+		return x >= bounds.min.x && y >= bounds.min.y && z >= bounds.min.z && x <= bounds.max.x && y <= bounds.max.y &&
+		       z <= bounds.max.z;
+	};
+	for (size_t i = 0; i < pool.Count(); ++i)
+	{
+		if (!isInside(pool.PositionX()[i], pool.PositionY()[i], pool.PositionZ()[i]) ||
+		    !isInside(pool.PreviousX()[i], pool.PreviousY()[i], pool.PreviousZ()[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// A ring of effects around a camera that turns once over the frames, planned and updated the way Renderer does it:
+// without culling, with the effects outside the frustum updating coarsely, and with them frozen. Every frame, the
+// bounds have to hold every particle, and no effect with a particle in view may be culled.
+static bool RunCullingBenchmark(const BenchmarkOptions& options)
+{
+	WorkerPool workers(options.maxThreads - 1);
+	printf("Culling: %d effects x %d particles, %d frames, %d threads\n", options.numCullingEffects,
+	       options.numCullingParticles, options.numFrames, options.maxThreads);
+	printf("%-14s %12s %10s %10s %10s %16s\n", "culling", "ms/frame", "visible", "culled", "offscreen",
+	       "particles/frame");
+
+	const auto eye = glm::vec3(0.0f, 1.0f, 0.0f);
+	const auto projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	const auto viewportHeight = 720;
+
+	auto cullingOptions = options;
+	cullingOptions.numEffects = 1;
+	cullingOptions.numParticles = options.numCullingParticles;
+	auto settings = CreateEffects(cullingOptions).front().Settings();
+
+	ParticleBudgetSettings budgetSettings;
+	budgetSettings.maxParticles = static_cast<size_t>(options.numCullingEffects) * options.numCullingParticles;
+	budgetSettings.cpuBudgetMilliseconds = std::numeric_limits<double>::infinity();
+	const std::pair<const char*, int> cases[] = { { "off", -1 }, { "offscreen", 8 }, { "frozen", 0 } };
+
+	auto isValid = true;
+	for (const auto& namedCase : cases)
+	{
+		std::vector<ParticleEffect> effects;
+		std::vector<uint32_t> effectIds;
+		for (auto i = 0; i < options.numCullingEffects; ++i)
+		{
+			const auto angle = glm::two_pi<float>() * static_cast<float>(i) / options.numCullingEffects;
+			settings.position = glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * 8.0f;
+			settings.seed = static_cast<uint32_t>(i);
+			effects.emplace_back(settings);
+			effectIds.push_back(static_cast<uint32_t>(i));
+		}
+
+		budgetSettings.frustumCulling = namedCase.second >= 0;
+		budgetSettings.offscreenUpdateInterval = std::max(namedCase.second, 0);
+		ParticleBudgetManager budget(budgetSettings);
+		const auto effect = [&effects](const uint32_t effectId) -> ParticleEffect& { return effects[effectId]; };
+
+		double seconds = 0.0;
+		size_t visible = 0;
+		size_t culled = 0;
+		size_t offscreen = 0;
+		size_t particles = 0;
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			const auto yaw = glm::two_pi<float>() * static_cast<float>(frame) / options.numFrames;
+			const auto view = glm::lookAt(eye, eye + glm::vec3(std::cos(yaw), -0.1f, std::sin(yaw)),
+			                              glm::vec3(0.0f, 1.0f, 0.0f));
+
+			// The bounds the budget culls with describe the particles as they are before the frame's updates.
+			std::vector<bool> inView;
+			for (const auto& planned : effects)
+			{
+				inView.push_back(HasParticleInView(planned, projection * view));
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			const auto& decisions = budget.Plan(effectIds, effect, eye, view, projection, viewportHeight, 1, 1.0f);
+			workers.ParallelFor(decisions.size(), 1, [&](const size_t begin, const size_t end)
+			{
+				for (auto i = begin; i < end; ++i)
+				{
+					const auto& decision = decisions[i];
+					for (auto step = 0; step < decision.steps; ++step)
+					{
+						effects[decision.effectId].Simulate(16.0f * decision.stepMultiple, &workers);
+					}
+					if (decision.visible)
+					{
+						effects[decision.effectId].PrepareDraw(view, decision.alpha, &workers);
+					}
+				}
+			});
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			const auto& usage = budget.Usage();
+			visible += usage.visible;
+			culled += usage.culled;
+			offscreen += usage.offscreen;
+			for (const auto& decision : decisions)
+			{
+				const auto& updated = effects[decision.effectId];
+				particles += decision.steps > 0 ? updated.Pool().Count() : 0;
+				isValid = isValid && BoundsHoldParticles(updated, updated.Bounds()) &&
+				          (decision.visible || !inView[decision.effectId]);
+			}
+		}
+
+		printf("%-14s %12.3f %10.1f %10.1f %10.1f %16zu\n", namedCase.first, 1000.0 * seconds / options.numFrames,
+		       static_cast<double>(visible) / options.numFrames, static_cast<double>(culled) / options.numFrames,
+		       static_cast<double>(offscreen) / options.numFrames, particles / options.numFrames);
+	}
+
+	if (!isValid)
+	{
+		printf("Culling: an effect in view was culled, or its bounds missed some of its particles\n");
+	}
+	return isValid;
+}
+
+// Gameplay starting short impacts and long-running smoke all the time: created on the spot, against acquired from a
+// ParticleEffectPool and released once done. Every frame is planned by a ParticleBudgetManager and updated the way
+// Renderer does it, each effect single-threaded (WorkerPool jobs allocate) and drawn into CPU-side staging. The pooled
+// run must allocate nothing at all once the pool and the budget are set up, the smoke must start out
+// prewarmed: as full as the original, and moved where it was started, and two smokes started together must go on to
+// spawn particles of their own. Sparks placed by a behavior must spawn where they were started too.
+static bool RunPoolBenchmark(const BenchmarkOptions& options)
+{
+	printf("Effect pool: %d triggers, one every frame, 1 thread\n", options.numPoolTriggers);
+	printf("%-10s %12s %14s %14s %16s %14s\n", "effects", "ms/frame", "us/trigger", "allocations", "allocs/trigger",
+	       "smoke alive");
+
+	// Every spot effects are started at is in view.
+	const auto eye = glm::vec3(3.0f, 5.0f, 12.0f);
+	const auto view = glm::lookAt(eye, glm::vec3(3.0f, 0.0f, 2.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const auto projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	const auto viewportHeight = 720;
+	ParticleBudgetSettings budgetSettings;
+	budgetSettings.cpuBudgetMilliseconds = std::numeric_limits<double>::infinity();
+
+	ParticleEffectSettings impact;
+	impact.numParticles = 2000;
+	impact.initialBurst = 2000;
+	impact.decayRange = { 0.004f, 0.008f };
+	impact.speed = 3.0f;
+	impact.vertexFormat = PARTICLE_VERTEX_FIXED16;
+	ParticleEffectSettings smoke;
+	smoke.numParticles = 5000;
+	smoke.spawnRate = 5.0f;
+	smoke.decayRange = { 0.001f, 0.002f };
+	smoke.speed = 0.5f;
+	smoke.gravity = glm::vec3(0.0f, 0.4f, 0.0f);
+	smoke.prewarmTime = 2000.0f;
+	smoke.trail.length = 4;
+	// Smoke keeps going, so it is released after a while rather than once it is finished.
+	const auto smokeFrames = 30;
+	// Standing still, so they stay where they spawn.
+	ParticleEffectSettings sparks;
+	sparks.numParticles = 64;
+	sparks.decayRange = { 0.001f, 0.002f };
+	sparks.behavior = ComposeParticleBehavior(ParticlePointEmitter(), ParticleBallVelocity(),
+	                                          ParticleUniformDecay{ sparks.decayRange.x, sparks.decayRange.y });
+	const ParticleEffectSettings* const types[] = { &impact, &smoke };
+
+	struct ActiveEffect
+	{
+		uint32_t type;
+		// New for every trigger, like the ids of effects added to a Scene, so the budget keeps meeting new effects.
+		uint32_t effectId;
+		int frames;
+		ParticleEffect effect;
+	};
+
+	auto isValid = true;
+	for (const auto usePool : { false, true })
+	{
+		ParticleEffectPool pool;
+		for (const auto* const settings : types)
+		{
+			pool.AddType(*settings, 32, false);
+		}
+		const auto sparksType = pool.AddType(sparks, 1, false);
+		const auto& original = pool.Original(1);
+		if (usePool)
+		{
+			// Two smokes started at the same spot share the original's particles, but must spawn their own from there.
+			ParticleEffect first;
+			ParticleEffect second;
+			pool.Acquire(1, glm::vec3(0.0f), first);
+			pool.Acquire(1, glm::vec3(0.0f), second);
+			for (auto* const effect : { &first, &second })
+			{
+				effect->Burst(16);
+				effect->Update(16.0f, view);
+			}
+			const auto count = first.Pool().Count();
+			isValid = isValid && count == second.Pool().Count() &&
+			          std::memcmp(first.Pool().VelocityX(), second.Pool().VelocityX(), count * sizeof(float)) != 0;
+			pool.Release(1, std::move(first));
+			pool.Release(1, std::move(second));
+
+			const auto sparksPosition = glm::vec3(3.0f, 1.0f, 2.0f);
+			ParticleEffect moved;
+			pool.Acquire(sparksType, sparksPosition, moved);
+			moved.Burst(16);
+			moved.Update(16.0f, view);
+			const auto last = moved.Pool().Count() - 1;
+			isValid = isValid && moved.Pool().Count() > 0 && moved.Pool().PositionX()[last] == sparksPosition.x &&
+			          moved.Pool().PositionY()[last] == sparksPosition.y &&
+			          moved.Pool().PositionZ()[last] == sparksPosition.z;
+			pool.Release(sparksType, std::move(moved));
+		}
+
+		std::vector<ActiveEffect> active;
+		active.reserve(64);
+		ParticleBudgetManager budget(budgetSettings);
+		budget.Reserve(active.capacity());
+		std::vector<uint32_t> effectIds;
+		effectIds.reserve(active.capacity());
+		const auto effect = [&active](const uint32_t effectId) -> ParticleEffect&
+		{
+			return std::find_if(active.begin(), active.end(), [effectId](const ActiveEffect& running)
+			{
+				return running.effectId == effectId;
+			})->effect;
+		};
+		ParticleEffect acquired;
+		size_t smokeAlive = 0;
+		double seconds = 0.0;
+		double triggerSeconds = 0.0;
+		const auto allocationsBefore = numAllocations.load();
+		for (auto trigger = 0; trigger < options.numPoolTriggers; ++trigger)
+		{
+			const auto start = std::chrono::steady_clock::now();
+
+			// Mostly impacts, and smoke every tenth trigger.
+			const auto type = trigger % 10 == 9 ? 1u : 0u;
+			const auto position = glm::vec3(static_cast<float>(trigger % 7), 0.0f, static_cast<float>(trigger % 5));
+			const auto effectId = static_cast<uint32_t>(trigger);
+			if (usePool)
+			{
+				if (pool.Acquire(type, position, acquired))
+				{
+					active.push_back({ type, effectId, 0, std::move(acquired) });
+				}
+			}
+			else
+			{
+				auto settings = *types[type];
+				settings.position = position;
+				active.push_back({ type, effectId, 0, ParticleEffect(settings) });
+			}
+			triggerSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			if (type == 1)
+			{
+				// Prewarmed, and moved where it was started.
+				const auto& started = active.back().effect;
+				smokeAlive = started.Pool().Count();
+				isValid = isValid && smokeAlive > 0 && smokeAlive == original.Pool().Count() &&
+				          (!usePool || (started.Pool().PositionX()[0] == original.Pool().PositionX()[0] + position.x &&
+				                        started.Pool().PositionZ()[0] == original.Pool().PositionZ()[0] + position.z));
+			}
+
+			effectIds.clear();
+			for (const auto& running : active)
+			{
+				effectIds.push_back(running.effectId);
+			}
+			for (const auto& decision : budget.Plan(effectIds, effect, eye, view, projection, viewportHeight, 1, 1.0f))
+			{
+				auto& planned = effect(decision.effectId);
+				for (auto step = 0; step < decision.steps; ++step)
+				{
+					planned.Simulate(16.0f * decision.stepMultiple, nullptr);
+				}
+				if (decision.visible)
+				{
+					planned.PrepareDraw(view, decision.alpha, nullptr);
+				}
+			}
+
+			for (size_t i = 0; i < active.size();)
+			{
+				auto& running = active[i];
+				++running.frames;
+				if (running.effect.IsFinished() || (running.type == 1 && running.frames >= smokeFrames))
+				{
+					if (usePool)
+					{
+						pool.Release(running.type, std::move(running.effect));
+					}
+					running = std::move(active.back());
+					active.pop_back();
+				}
+				else
+				{
+					++i;
+				}
+			}
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		const auto allocations = numAllocations.load() - allocationsBefore;
+		active.clear();
+
+		printf("%-10s %12.3f %14.2f %14llu %16.1f %14zu\n", usePool ? "pooled" : "created",
+		       1000.0 * seconds / options.numPoolTriggers, 1e6 * triggerSeconds / options.numPoolTriggers,
+		       static_cast<unsigned long long>(allocations),
+		       static_cast<double>(allocations) / options.numPoolTriggers, smokeAlive);
+		isValid = isValid && (!usePool || (allocations == 0 && pool.Misses(0) == 0 && pool.Misses(1) == 0));
+	}
+
+	if (!isValid)
+	{
+		printf("Effect pool: the pooled effects allocated, ran out, repeated each other, or didn't start out prewarmed "
+		       "or spawning where they were started\n");
+	}
+	return isValid;
+}
+
+// Bakes numFrames frames of one effect into a cache in each vertex format, then plays it back with a CACHE effect.
+// A few frames are sought out of order and must come back byte for byte as they were recorded.
+static bool RunCacheBenchmark(const BenchmarkOptions& options)
+{
+	printf("Cache: 1 effect x %d particles, %d frames, 1 thread\n", options.numCacheParticles, options.numFrames);
+	printf("%-10s %12s %16s %16s %10s\n", "format", "file MB", "simulate ms/frame", "replay ms/frame", "speedup");
+
+	const auto view = BenchmarkView();
+	const auto frameDuration = 16.0f;
+	auto passed = true;
+	for (const auto format : { PARTICLE_VERTEX_FLOAT, PARTICLE_VERTEX_FIXED16 })
+	{
+		auto cacheOptions = options;
+		cacheOptions.numEffects = 1;
+		cacheOptions.numParticles = options.numCacheParticles;
+		auto settings = CreateEffects(cacheOptions).front().Settings();
+		settings.vertexFormat = format;
+		ParticleEffect effect(settings);
+
+		// Keeps a copy of the first, middle and last frames to check the playback against.
+		const std::vector<int> checkedFrames = { options.numFrames - 1, 0, options.numFrames / 2 };
+		std::vector<std::vector<uint8_t>> recorded(options.numFrames);
+		ParticleCacheWriter writer;
+		auto isWritten = writer.Open(options.cacheFile, format, frameDuration);
+		auto simulateSeconds = 0.0;
+		for (auto frame = 0; frame < options.numFrames && isWritten; ++frame)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			effect.Update(frameDuration, view);
+			simulateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			isWritten = effect.RecordFrame(writer);
+
+			if (std::find(checkedFrames.begin(), checkedFrames.end(), frame) != checkedFrames.end())
+			{
+				const auto* const instances = format == PARTICLE_VERTEX_FLOAT
+					? static_cast<const void*>(effect.StagedInstances().data())
+					: static_cast<const void*>(effect.StagedCompactInstances().data());
+				const auto* const bytes = static_cast<const uint8_t*>(instances);
+				recorded[frame].assign(bytes, bytes + effect.NumInstances() * effect.InstanceSize());
+			}
+		}
+		isWritten = writer.Close() && isWritten;
+
+		auto cache = std::make_shared<ParticleCache>();
+		if (!isWritten || !ParticleCache::Load(options.cacheFile, *cache))
+		{
+			printf("Cache: failed to bake [%s]\n", options.cacheFile.c_str());
+			std::remove(options.cacheFile.c_str());
+			return false;
+		}
+
+		ParticleEffectSettings replaySettings;
+		replaySettings.backend = ParticleEffectSettings::CACHE;
+		replaySettings.cache = cache;
+		ParticleEffect replay(replaySettings);
+
+		auto matches = replay.VertexFormat() == format && cache->NumFrames() == static_cast<size_t>(options.numFrames);
+		for (const auto frame : checkedFrames)
+		{
+			replay.SetCacheTime((frame + 1) * frameDuration);
+			replay.PrepareDraw(view);
+			const auto* const instances = format == PARTICLE_VERTEX_FLOAT
+				? static_cast<const void*>(replay.StagedInstances().data())
+				: static_cast<const void*>(replay.StagedCompactInstances().data());
+			const auto size = replay.NumInstances() * replay.InstanceSize();
+			const auto& decode = replay.InstanceDecode();
+			matches = matches && size == recorded[frame].size() &&
+			          std::memcmp(instances, recorded[frame].data(), size) == 0 &&
+			          decode.scale == cache->Frame(frame).decode.scale && decode.bias == cache->Frame(frame).decode.bias;
+		}
+
+		// Plays the whole recording from the start, as a scene would.
+		replay.SetCacheTime(0.0);
+		const auto start = std::chrono::steady_clock::now();
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			replay.Simulate(frameDuration);
+			replay.PrepareDraw(view);
+		}
+		const auto replaySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		printf("%-10s %12.1f %16.3f %16.3f %10.1f\n", format == PARTICLE_VERTEX_FLOAT ? "float" : "fixed16",
+		       cache->FileSize() / (1024.0 * 1024.0), 1000.0 * simulateSeconds / options.numFrames,
+		       1000.0 * replaySeconds / options.numFrames, simulateSeconds / replaySeconds);
+		if (!matches)
+		{
+			printf("Cache: playback differs from the recording\n");
+			passed = false;
+		}
+	}
+
+	std::remove(options.cacheFile.c_str());
+	return passed;
+}
+
+// Draws the same effect in every vertex format, and checks the compact instances against the full float ones. The last
+// frame extrapolates (alpha 1.5, as ParticleBudgetManager does for distant effects) to make sure the fixed point bounds
+// follow it.
+static bool RunQuantizationCheck(const BenchmarkOptions& options)
+{
+	printf("Vertex formats: %d particles, %d frames, max error %g\n", options.numParticles, options.numFrames,
+	       options.maxQuantizationError);
+	printf("%-10s %14s %14s %14s %14s %16s\n", "format", "bytes/particle", "position err", "size err", "color err",
+	       "pack Mparticles/s");
+
+	auto benchmarkOptions = options;
+	benchmarkOptions.numEffects = 1;
+	const auto view = BenchmarkView();
+	const auto runFrames = [&options, &view](ParticleEffect& effect)
+	{
+		for (auto frame = 0; frame < options.numFrames; ++frame)
+		{
+			effect.Update(16.0f, view);
+		}
+		effect.Simulate(16.0f);
+
+		constexpr auto numPacks = 10;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto pack = 0; pack < numPacks; ++pack)
+		{
+			effect.PrepareDraw(view, 1.5f);
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return effect.NumInstances() * numPacks / seconds / 1.0e6;
+	};
+
+	auto reference = CreateEffects(benchmarkOptions)[0];
+	const auto referenceRate = runFrames(reference);
+	const auto& expected = reference.StagedInstances();
+	auto boundsMin = glm::vec4(std::numeric_limits<float>::max());
+	auto boundsMax = glm::vec4(std::numeric_limits<float>::lowest());
+	for (const auto& instance : expected)
+	{
+		boundsMin = glm::min(boundsMin, instance.positionSize);
+		boundsMax = glm::max(boundsMax, instance.positionSize);
+	}
+	const auto extent = boundsMax - boundsMin;
+	const auto positionExtent = std::max(std::max(extent.x, extent.y), extent.z);
+	printf("%-10s %14zu %14s %14s %14s %16.1f\n", "float", reference.InstanceSize(), "-", "-", "-", referenceRate);
+
+	auto passed = true;
+	const std::pair<const char*, ParticleVertexFormat> formats[] = {
+		{ "half", PARTICLE_VERTEX_HALF },
+		{ "fixed16", PARTICLE_VERTEX_FIXED16 }
+	};
+	for (const auto& format : formats)
+	{
+		auto settings = reference.Settings();
+		settings.vertexFormat = format.second;
+		ParticleEffect effect(settings);
+		const auto rate = runFrames(effect);
+
+		const auto& instances = effect.StagedCompactInstances();
+		const ParticleQuantizer quantizer(format.second, effect.InstanceDecode());
+		auto positionError = 0.0f;
+		auto sizeError = 0.0f;
+		auto colorError = 0.0f;
+		for (size_t i = 0; i < instances.size() && i < expected.size(); ++i)
+		{
+			const auto decoded = quantizer.Decode(instances[i]);
+			const auto positionSizeError = glm::abs(decoded.positionSize - expected[i].positionSize);
+			const auto channelError = glm::abs(decoded.color - expected[i].color);
+			positionError = std::max({ positionError, positionSizeError.x, positionSizeError.y, positionSizeError.z });
+			sizeError = std::max(sizeError, positionSizeError.w);
+			colorError = std::max({ colorError, channelError.r, channelError.g, channelError.b, channelError.a });
+		}
+		positionError /= std::max(positionExtent, std::numeric_limits<float>::min());
+		sizeError /= std::max(boundsMax.w, std::numeric_limits<float>::min());
+		printf("%-10s %14zu %14.2e %14.2e %14.2e %16.1f\n", format.first, effect.InstanceSize(), positionError,
+		       sizeError, colorError, rate);
+
+		if (instances.size() != expected.size() || positionError > options.maxQuantizationError ||
+		    sizeError > options.maxQuantizationError || colorError > options.maxQuantizationError)
+		{
+			fprintf(stderr, "The %s vertex format exceeds the error bound\n", format.first);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+// Renderer's particle pass, minus the window: the particle program drawing blended billboards into an offscreen color
+// target, so every uploaded instance is actually read by the GPU.
+class OffscreenParticlePass
+{
+public:
+	static constexpr int TARGET_SIZE = 256;
+
+	bool Init()
+	{
+		if (!context_.IsValid())
+		{
+			return false;
+		}
+
+		shaders_.SetVersion("450");
+		shaders_.SetPreambleFile(SHADER_DIRECTORY + "Preamble.glsl");
+		program_ = shaders_.AddProgramFromExts({ SHADER_DIRECTORY + "particle.vert", SHADER_DIRECTORY + "particle.frag" });
+		shaders_.UpdatePrograms();
+		if (!*program_)
+		{
+			fprintf(stderr, "Failed to build the particle program\n");
+			return false;
+		}
+
+		glGenTextures(1, &colorTexture_);
+		glBindTexture(GL_TEXTURE_2D, colorTexture_);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, TARGET_SIZE, TARGET_SIZE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenFramebuffers(1, &framebuffer_);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture_, 0);
+		glViewport(0, 0, TARGET_SIZE, TARGET_SIZE);
+		return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+
+	~OffscreenParticlePass()
+	{
+		if (framebuffer_)
+		{
+			glDeleteFramebuffers(1, &framebuffer_);
+			glDeleteTextures(1, &colorTexture_);
+		}
+	}
+
+	const char* Renderer() const
+	{
+		return context_.Renderer();
+	}
+
+	void Draw(std::vector<ParticleEffect>& effects, const glm::mat4& view)
+	{
+		const auto projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+		const auto viewProjection = projection * view;
+		glClear(GL_COLOR_BUFFER_BIT);
+		glUseProgram(*program_);
+		glUniformMatrix4fv(PARTICLE_VP_UNIFORM_LOCATION, 1, GL_FALSE, glm::value_ptr(viewProjection));
+		glUniform3f(PARTICLE_CAMERA_RIGHT_UNIFORM_LOCATION, view[0][0], view[1][0], view[2][0]);
+		glUniform3f(PARTICLE_CAMERA_UP_UNIFORM_LOCATION, view[0][1], view[1][1], view[2][1]);
+		glUniform1i(PARTICLE_HAS_TEXTURE_UNIFORM_LOCATION, 0);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		for (auto& effect : effects)
+		{
+			effect.Draw();
+		}
+		glDisable(GL_BLEND);
+	}
+
+private:
+	HeadlessContext context_;
+	ShaderSet shaders_;
+	GLuint* program_ = nullptr;
+	GLuint colorTexture_ = 0;
+	GLuint framebuffer_ = 0;
+};
+
+// Resets the peak resident set size the kernel tracks for the process (Linux 4.0 and up; older kernels ignore it).
+static void ResetPeakMemory()
+{
+	if (auto* const file = fopen("/proc/self/clear_refs", "w"))
+	{
+		fputs("5", file);
+		fclose(file);
+	}
+}
+
+// Peak resident set size since the last ResetPeakMemory(), in bytes. 0 when the kernel doesn't report it.
+static size_t PeakMemory()
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, 6, "VmHWM:") == 0)
+		{
+			return static_cast<size_t>(std::strtoull(line.c_str() + 6, nullptr, 10)) * 1024;
+		}
+	}
+	return 0;
+}
+
+static const char* InstructionSetName(const ParticleKernels::InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+	case ParticleKernels::AVX2:
+		return "avx2";
+	case ParticleKernels::SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+struct PipelineResult
+{
+	int numEffects = 0;
+	int particlesPerEffect = 0;
+	int numFrames = 0;
+	double seconds = 0.0;
+	// Particles alive at the end of each frame, summed over effects and frames: what the per-particle costs divide by.
+	double particleFrames = 0.0;
+	// Summed over the effects.
+	ParticleStageTimes stages;
+	// Acquiring the mapped segments, and drawing them up to glFinish().
+	double uploadSeconds = 0.0;
+	size_t peakMemory = 0;
+
+	double NanosecondsPerParticle(const double stageSeconds) const
+	{
+		return 1.0e9 * stageSeconds / std::max(particleFrames, 1.0);
+	}
+};
+
+// Runs full effects through the whole CPU pipeline the way Renderer does: effects in parallel, each emitting, updating,
+// sorting and packing its particles, then the upload and draws when pass is given. Cases are timed over enough frames
+// to push about frames x 1M particles through, at least 3 and at most 100 x frames.
+static PipelineResult RunPipelineCase(const BenchmarkOptions& options, const int numEffects, const int numParticles,
+                                      WorkerPool& workers, OffscreenParticlePass* pass)
+{
+	ResetPeakMemory();
+	PipelineResult result;
+	result.numEffects = numEffects;
+	result.particlesPerEffect = numParticles;
+	const auto total = static_cast<double>(numEffects) * numParticles;
+	result.numFrames = static_cast<int>(std::min(std::max(options.numFrames * 1.0e6 / total, 3.0),
+	                                             100.0 * options.numFrames));
+
+	auto benchmarkOptions = options;
+	benchmarkOptions.numEffects = numEffects;
+	benchmarkOptions.numParticles = numParticles;
+	auto effects = CreateEffects(benchmarkOptions);
+	const auto view = BenchmarkView();
+
+	ParticleStageTimes startStages;
+	const auto runFrame = [&](const bool timed)
+	{
+		auto uploadSeconds = 0.0;
+		if (pass)
+		{
+			const auto beginStart = std::chrono::steady_clock::now();
+			for (auto& effect : effects)
+			{
+				effect.BeginFrame();
+			}
+			uploadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - beginStart).count();
+		}
+
+		workers.ParallelFor(effects.size(), 1, [&effects, &workers, &view](const size_t begin, const size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				effects[i].Simulate(16.0f, &workers);
+				effects[i].PrepareDraw(view, 1.0f, &workers);
+			}
+		});
+
+		if (pass)
+		{
+			const auto drawStart = std::chrono::steady_clock::now();
+			pass->Draw(effects, view);
+			glFinish();
+			uploadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - drawStart).count();
+		}
+
+		if (timed)
+		{
+			result.uploadSeconds += uploadSeconds;
+			for (const auto& effect : effects)
+			{
+				result.particleFrames += static_cast<double>(effect.SimulationStats().aliveCount);
+			}
+		}
+	};
+
+	// Page in the staging and mapped buffers, and settle the live counts, before timing.
+	for (auto frame = 0; frame < 2; ++frame)
+	{
+		runFrame(false);
+	}
+	for (const auto& effect : effects)
+	{
+		startStages.update -= effect.StageTimes().update;
+		startStages.emit -= effect.StageTimes().emit;
+		startStages.sort -= effect.StageTimes().sort;
+		startStages.pack -= effect.StageTimes().pack;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	for (auto frame = 0; frame < result.numFrames; ++frame)
+	{
+		runFrame(true);
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	result.stages = startStages;
+	for (const auto& effect : effects)
+	{
+		result.stages.update += effect.StageTimes().update;
+		result.stages.emit += effect.StageTimes().emit;
+		result.stages.sort += effect.StageTimes().sort;
+		result.stages.pack += effect.StageTimes().pack;
+	}
+	result.peakMemory = PeakMemory();
+	return result;
+}
+
+static bool WritePipelineJson(const BenchmarkOptions& options, const std::vector<PipelineResult>& results,
+                              const char* renderer)
+{
+	auto* const file = fopen(options.jsonPath.c_str(), "w");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open %s\n", options.jsonPath.c_str());
+		return false;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"threads\": %d,\n", options.maxThreads);
+	fprintf(file, "  \"instructionSet\": \"%s\",\n", InstructionSetName(ParticleKernels::Detect()));
+	fprintf(file, "  \"upload\": %s,\n", options.upload ? "true" : "false");
+	fprintf(file, "  \"renderer\": \"%s\",\n", renderer);
+	fprintf(file, "  \"pipeline\": [");
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const auto& result = results[i];
+		const auto totalSeconds = result.stages.emit + result.stages.update + result.stages.sort + result.stages.pack +
+		                          result.uploadSeconds;
+		fprintf(file, "%s\n    {\n", i == 0 ? "" : ",");
+		fprintf(file, "      \"effects\": %d,\n", result.numEffects);
+		fprintf(file, "      \"particlesPerEffect\": %d,\n", result.particlesPerEffect);
+		fprintf(file, "      \"frames\": %d,\n", result.numFrames);
+		fprintf(file, "      \"msPerFrame\": %.4f,\n", 1000.0 * result.seconds / result.numFrames);
+		fprintf(file, "      \"particlesPerSecond\": %.0f,\n", result.particleFrames / result.seconds);
+		fprintf(file, "      \"nsPerParticle\": {\n");
+		fprintf(file, "        \"emit\": %.3f,\n", result.NanosecondsPerParticle(result.stages.emit));
+		fprintf(file, "        \"update\": %.3f,\n", result.NanosecondsPerParticle(result.stages.update));
+		fprintf(file, "        \"sort\": %.3f,\n", result.NanosecondsPerParticle(result.stages.sort));
+		fprintf(file, "        \"pack\": %.3f,\n", result.NanosecondsPerParticle(result.stages.pack));
+		fprintf(file, "        \"upload\": %.3f,\n", result.NanosecondsPerParticle(result.uploadSeconds));
+		fprintf(file, "        \"total\": %.3f\n", result.NanosecondsPerParticle(totalSeconds));
+		fprintf(file, "      },\n");
+		fprintf(file, "      \"peakMemoryBytes\": %zu\n", result.peakMemory);
+		fprintf(file, "    }");
+	}
+	fprintf(file, "\n  ]\n}\n");
+	fclose(file);
+	return true;
+}
+
+// The whole CPU pipeline (emit, update, sort, pack, and optionally upload) over a range of particle and effect counts,
+// with maxThreads threads. Stage costs are in ns per live particle; they are summed over effects, so with several
+// threads working on several effects they add up to more than the frame time. Peak memory is the process's resident
+// high-water mark during the case.
+static bool RunPipelineSuite(const BenchmarkOptions& options)
+{
+	std::unique_ptr<OffscreenParticlePass> pass;
+	if (options.upload)
+	{
+		pass = std::make_unique<OffscreenParticlePass>();
+		if (!pass->Init())
+		{
+			return false;
+		}
+	}
+	const auto* const renderer = pass ? pass->Renderer() : "none";
+
+	printf("Pipeline: %d threads, %s kernels, upload through %s\n", options.maxThreads,
+	       InstructionSetName(ParticleKernels::Detect()), renderer);
+	printf("%8s %10s %7s %11s %13s %8s %8s %8s %8s %8s %9s\n", "effects", "particles", "frames", "ms/frame",
+	       "Mparticles/s", "emit", "update", "sort", "pack", "upload", "peak MB");
+
+	WorkerPool workers(options.maxThreads - 1);
+	std::vector<PipelineResult> results;
+	for (const auto numEffects : options.pipelineEffects)
+	{
+		for (const auto numParticles : options.pipelineParticles)
+		{
+			if (numEffects <= 0 || numParticles <= 0 ||
+			    static_cast<double>(numEffects) * numParticles > options.maxPipelineParticles)
+			{
+				continue;
+			}
+
+			results.push_back(RunPipelineCase(options, numEffects, numParticles, workers, pass.get()));
+			const auto& result = results.back();
+			printf("%8d %10d %7d %11.3f %13.2f %8.2f %8.2f %8.2f %8.2f %8.2f %9.1f\n", numEffects, numParticles,
+			       result.numFrames, 1000.0 * result.seconds / result.numFrames,
+			       result.particleFrames / result.seconds / 1.0e6, result.NanosecondsPerParticle(result.stages.emit),
+			       result.NanosecondsPerParticle(result.stages.update), result.NanosecondsPerParticle(result.stages.sort),
+			       result.NanosecondsPerParticle(result.stages.pack), result.NanosecondsPerParticle(result.uploadSeconds),
+			       result.peakMemory / (1024.0 * 1024.0));
+		}
+	}
+
+	return options.jsonPath.empty() || WritePipelineJson(options, results, renderer);
+}
+
+// Parses a comma-separated list of integers, eg. "1000,10000".
+static bool ParseList(const char* text, std::vector<int>& values)
+{
+	values.clear();
+	for (auto* position = text; *position;)
+	{
+		char* end;
+		values.push_back(static_cast<int>(strtol(position, &end, 10)));
+		if (end == position || (*end != ',' && *end != '\0'))
+		{
+			return false;
+		}
+		position = *end == ',' ? end + 1 : end;
+	}
+	return !values.empty();
+}
+
+static bool ParseOptions(const int argc, char** argv, BenchmarkOptions& options)
+{
+	for (auto i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		}
+
+		const auto value = atoi(argv[++i]);
+		if (arg == "--effects")
+		{
+			options.numEffects = value;
+		}
+		else if (arg == "--particles")
+		{
+			options.numParticles = value;
+		}
+		else if (arg == "--frames")
+		{
+			options.numFrames = value;
+		}
+		else if (arg == "--max-threads")
+		{
+			options.maxThreads = value;
+		}
+		else if (arg == "--gpu")
+		{
+			options.gpu = value != 0;
+		}
+		else if (arg == "--rng-samples")
+		{
+			options.numRandomSamples = value;
+		}
+		else if (arg == "--grid-particles")
+		{
+			options.maxGridParticles = value;
+		}
+		else if (arg == "--grid-queries")
+		{
+			options.numGridQueries = value;
+		}
+		else if (arg == "--force-particles")
+		{
+			options.numForceParticles = value;
+		}
+		else if (arg == "--collision-triangles")
+		{
+			options.numCollisionTriangles = value;
+		}
+		else if (arg == "--collision-particles")
+		{
+			options.numCollisionParticles = value;
+		}
+		else if (arg == "--fluid-particles")
+		{
+			options.numFluidParticles = value;
+		}
+		else if (arg == "--quantization-error")
+		{
+			options.maxQuantizationError = static_cast<float>(atof(argv[i]));
+		}
+		else if (arg == "--pipeline-particles" || arg == "--pipeline-effects")
+		{
+			if (!ParseList(argv[i], arg == "--pipeline-particles" ? options.pipelineParticles : options.pipelineEffects))
+			{
+				fprintf(stderr, "Invalid list for %s: %s\n", arg.c_str(), argv[i]);
+				return false;
+			}
+		}
+		else if (arg == "--pipeline-max-particles")
+		{
+			options.maxPipelineParticles = value;
+		}
+		else if (arg == "--upload")
+		{
+			options.upload = value != 0;
+		}
+		else if (arg == "--json")
+		{
+			options.jsonPath = argv[i];
+		}
+		else if (arg == "--cache-particles")
+		{
+			options.numCacheParticles = value;
+		}
+		else if (arg == "--cache-file")
+		{
+			options.cacheFile = argv[i];
+		}
+		else if (arg == "--behavior-particles")
+		{
+			options.numBehaviorParticles = value;
+		}
+		else if (arg == "--script-particles")
+		{
+			options.numScriptParticles = value;
+		}
+		else if (arg == "--trail-particles")
+		{
+			options.numTrailParticles = value;
+		}
+		else if (arg == "--trail-length")
+		{
+			options.trailLength = value;
+		}
+		else if (arg == "--event-particles")
+		{
+			options.numEventParticles = value;
+		}
+		else if (arg == "--culling-effects")
+		{
+			options.numCullingEffects = value;
+		}
+		else if (arg == "--culling-particles")
+		{
+			options.numCullingParticles = value;
+		}
+		else if (arg == "--pool-triggers")
+		{
+			options.numPoolTriggers = value;
+		}
+		else if (arg == "--kernel-particles")
+		{
+			options.numKernelParticles = value;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	options.maxThreads = options.maxThreads > 0 ? options.maxThreads : 1;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		return 1;
+	}
+
+	srand(1);
+	RunThreadScaling(options);
+	RunOccupancy(options);
+
+	if (options.numKernelParticles > 0 && (!RunKernelCheck(options) || !RunVectorFieldCheck(options)))
+	{
+		return 1;
+	}
+
+	if (options.numRandomSamples > 0)
+	{
+		RunRandomBenchmark(options);
+	}
+
+	if (options.maxGridParticles > 0)
+	{
+		RunSpatialGridBenchmark(options);
+	}
+
+	if (options.numForceParticles > 0)
+	{
+		RunForceFieldBenchmark(options);
+	}
+
+	if (options.numCollisionTriangles > 0 && options.numCollisionParticles > 0 && !RunCollisionBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numFluidParticles > 0 && !RunFluidBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numBehaviorParticles > 0 && !RunBehaviorBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numScriptParticles > 0 && !RunScriptBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numTrailParticles > 0 && options.trailLength > 0 && !RunTrailBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numEventParticles > 0 && !RunEventBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numCullingEffects > 0 && options.numCullingParticles > 0 && !RunCullingBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.numPoolTriggers > 0 && !RunPoolBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (!RunPipelineSuite(options))
+	{
+		return 1;
+	}
+
+	if (!RunQuantizationCheck(options))
+	{
+		return 1;
+	}
+
+	if (options.numCacheParticles > 0 && !RunCacheBenchmark(options))
+	{
+		return 1;
+	}
+
+	if (options.gpu && !RunGpuSimulation(options))
+	{
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "ParticleEffectSettings.h"
+#include "ParticleInstance.h"
+#include "ParticleKernels.h"
+#include "ParticlePool.h"
+#include "ParticleRandom.h"
+#include "StreamingBuffer.h"
+#include "Preamble.glsl"
+
+// Compute programs of the GPU simulation. Held by pointer, since ShaderSet swaps the handles when it reloads a shader.
+struct ParticleComputePrograms
+{
+	// particle_simulate.comp
+	GLuint* simulate = nullptr;
+	// particle_emit.comp
+	GLuint* emit = nullptr;
+	// particle_instances.comp
+	GLuint* instances = nullptr;
+};
+
+// std430 layout of a particle in the simulation's storage buffer.
+struct GpuParticle
+{
+	// xyz: position, w: life
+	glm::vec4 positionLife;
+	// xyz: velocity, w: decay
+	glm::vec4 velocityDecay;
+	// xyz: position before the last step
+	glm::vec4 previousPosition;
+};
+
+// One fixed simulation step queued for Dispatch().
+struct GpuParticleStep
+{
+	ParticleIntegration integration;
+	size_t spawnBudget;
+};
+
+// std430 layout of the counters the compute passes write. The same buffer is the indirect argument buffer of the emit
+// dispatch and of the draw.
+struct GpuParticleCounters
+{
+	// DrawArraysIndirectCommand. instanceCount is the number of particles alive after the update.
+	GLuint vertexCount;
+	GLuint instanceCount;
+	GLuint firstVertex;
+	GLuint baseInstance;
+	// DispatchIndirectCommand of the emit pass.
+	GLuint emitGroupsX;
+	GLuint emitGroupsY;
+	GLuint emitGroupsZ;
+	// Free slots found by the last simulation pass: particles that died this step, and slots that were already empty.
+	GLuint deadCount;
+	// Summed over the steps of the frame. The emit pass adds min(deadCount, spawn budget) to spawnedCount.
+	GLuint killedCount;
+	GLuint spawnedCount;
+};
+
+// GPU backend of ParticleEffect. The particles live in shader storage buffers and never come back to the CPU:
+// for every fixed step, particle_simulate.comp integrates the live ones and puts free slots (particles that died, and
+// ones already empty) on a dead list, then particle_emit.comp (dispatched indirectly) spawns up to the step's spawn
+// budget into free slots. Once per frame, particle_instances.comp appends the live particles to an instance buffer,
+// interpolated between their last two steps. The instance count lands in an indirect draw command, so drawing needs no
+// readback either. Empty slots still cost an early-out per pass, so unlike the CPU path the passes run over the
+// capacity.
+// Unlike the CPU path the instances are not depth sorted, which is invisible with the additive blending particles use.
+// The spawn distributions (or decayFunc and velocityFunc, which are CPU function pointers) are sampled into a table
+// once, and the emit pass picks from it with a hash of the particle index and frame.
+// The counters are copied into a read-mapped StreamingBuffer and read a few frames late, for the statistics.
+// Copies share the same GL objects.
+class GpuParticleSimulation
+{
+public:
+	GpuParticleSimulation(const ParticleEffectSettings& settings, const ParticlePool& pool)
+		: state_(std::make_shared<State>())
+	{
+		auto& state = *state_;
+		state.count = static_cast<GLuint>(pool.Capacity());
+
+		// Uploaded (and released) on first use, when there is a GL context. Slots past the live particles have zero life,
+		// so they start out empty.
+		state.initialParticles.resize(state.count);
+		for (size_t i = 0; i < pool.Capacity(); ++i)
+		{
+			state.initialParticles[i] = {
+				glm::vec4(pool.PositionX()[i], pool.PositionY()[i], pool.PositionZ()[i], pool.Life()[i]),
+				glm::vec4(pool.VelocityX()[i], pool.VelocityY()[i], pool.VelocityZ()[i], pool.Decay()[i]),
+				glm::vec4(pool.PreviousX()[i], pool.PreviousY()[i], pool.PreviousZ()[i], 0.0f)
+			};
+		}
+
+		// Table entries are drawn like CPU spawns, on streams of their own.
+		const ParticleRandom random(settings.seed);
+		state.spawnTable.resize(PARTICLE_SPAWN_TABLE_SIZE);
+		for (uint32_t i = 0; i < PARTICLE_SPAWN_TABLE_SIZE; ++i)
+		{
+			const auto velocity = settings.velocityFunc
+				? settings.velocityFunc()
+				: random.UnitBall(GPU_SPAWN_VELOCITY_STREAM, 0, i) * settings.speed;
+			const auto decay = settings.decayFunc
+				? settings.decayFunc()
+				: random.Uniform(GPU_SPAWN_DECAY_STREAM, 0, i, settings.decayRange.x, settings.decayRange.y);
+			state.spawnTable[i] = glm::vec4(velocity, decay);
+		}
+	}
+
+	// Creates the GL objects on first use and moves on to the next readback segment. Returns true and fills completed
+	// with the counters of an earlier Dispatch() once they are available. Call on the GL thread, before Dispatch().
+	bool BeginFrame(GpuParticleCounters& completed)
+	{
+		auto& state = *state_;
+		if (!state.particles)
+		{
+			CreateBuffers();
+		}
+
+		const auto* const counters = static_cast<const GpuParticleCounters*>(state.readback.BeginSegment());
+		auto& hasCounters = state.hasCounters[state.readback.SegmentIndex()];
+		if (!hasCounters)
+		{
+			return false;
+		}
+
+		completed = *counters;
+		hasCounters = false;
+		return true;
+	}
+
+	// Runs the simulation and emit passes once per step (possibly none), then writes the instances alpha of the way
+	// between the last two steps, and queues the copy of the counters. Call on the GL thread, after BeginFrame().
+	// Skipped while a program fails to compile.
+	void Dispatch(const ParticleComputePrograms& programs, const ParticleEffectSettings& settings,
+	              const std::vector<GpuParticleStep>& steps, const float alpha)
+	{
+		auto& state = *state_;
+		if (!*programs.simulate || !*programs.emit || !*programs.instances || state.count == 0)
+		{
+			return;
+		}
+
+		const GpuParticleCounters reset = { 4, 0, 0, 0, 0, 1, 1, 0, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.counters);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(reset), &reset);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_SIM_PARTICLES_BUFFER_BINDING, state.particles);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_SIM_INSTANCES_BUFFER_BINDING, state.instances);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_SIM_DEAD_LIST_BUFFER_BINDING, state.deadList);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_SIM_SPAWN_TABLE_BUFFER_BINDING, state.spawnTableBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_SIM_COUNTERS_BUFFER_BINDING, state.counters);
+
+		const auto groups = (state.count + PARTICLE_SIMULATE_GROUP_SIZE - 1) / PARTICLE_SIMULATE_GROUP_SIZE;
+		for (size_t i = 0; i < steps.size(); ++i)
+		{
+			const auto& step = steps[i];
+			const auto budget = static_cast<GLuint>(std::min<size_t>(step.spawnBudget, state.count));
+
+			if (i > 0)
+			{
+				// Each step starts a fresh dead list and emit dispatch; the killed and spawned counts keep adding up.
+				const std::array<GLuint, 4> stepReset = { 0, 1, 1, 0 };
+				glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(GpuParticleCounters, emitGroupsX), sizeof(stepReset),
+				                stepReset.data());
+			}
+
+			glUseProgram(*programs.simulate);
+			glUniform1ui(PARTICLE_SIM_COUNT_UNIFORM_LOCATION, state.count);
+			glUniform1f(PARTICLE_SIM_DELTA_TIME_UNIFORM_LOCATION, step.integration.deltaTime);
+			glUniform1f(PARTICLE_SIM_STEP_SCALE_UNIFORM_LOCATION, step.integration.stepScale);
+			glUniform3fv(PARTICLE_SIM_GRAVITY_STEP_UNIFORM_LOCATION, 1, glm::value_ptr(step.integration.gravityStep));
+			glUniform1ui(PARTICLE_SIM_SPAWN_BUDGET_UNIFORM_LOCATION, budget);
+			glDispatchCompute(groups, 1, 1);
+
+			// The emit pass reads the dead list and its own dispatch size from what the simulation pass wrote.
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+			glUseProgram(*programs.emit);
+			glUniform1ui(PARTICLE_SIM_FRAME_UNIFORM_LOCATION, state.frame);
+			glUniform3fv(PARTICLE_SIM_EMITTER_POSITION_UNIFORM_LOCATION, 1, glm::value_ptr(settings.position));
+			glUniform1ui(PARTICLE_SIM_SPAWN_BUDGET_UNIFORM_LOCATION, budget);
+			glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, state.counters);
+			glDispatchComputeIndirect(offsetof(GpuParticleCounters, emitGroupsX));
+			glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+			// The next pass reads the particles the emit pass spawned.
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			++state.frame;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glUseProgram(*programs.instances);
+		SetInstanceUniforms(settings);
+		glUniform1ui(PARTICLE_SIM_COUNT_UNIFORM_LOCATION, state.count);
+		glUniform1f(PARTICLE_SIM_ALPHA_UNIFORM_LOCATION, alpha);
+		glDispatchCompute(groups, 1, 1);
+
+		glUseProgram(0);
+
+		// The instances are read as vertex attributes, the counters as the draw command and by the readback copy.
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, state.counters);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, state.readback.Buffer());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, state.readback.SegmentOffset(),
+		                    sizeof(GpuParticleCounters));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		state.readback.EndSegment();
+		state.hasCounters[state.readback.SegmentIndex()] = true;
+
+		state.hasInstances = true;
+	}
+
+	// Draws the instances written by the last Dispatch() with vao, whose attributes read from PARTICLE_INSTANCE_BINDING.
+	void Draw(const GLuint vao) const
+	{
+		const auto& state = *state_;
+		if (!state.hasInstances)
+		{
+			return;
+		}
+
+		glBindVertexArray(vao);
+		glBindVertexBuffer(PARTICLE_INSTANCE_BINDING, state.instances, 0, sizeof(ParticleInstance));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, state.counters);
+		glDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	// Time the last BeginFrame() waited for the GPU to release the readback segment.
+	double FenceWaitMilliseconds() const
+	{
+		return state_->readback.LastWaitMilliseconds();
+	}
+
+private:
+	struct State
+	{
+		~State()
+		{
+			if (particles)
+			{
+				const std::array<GLuint, 5> buffers = { particles, instances, deadList, spawnTableBuffer, counters };
+				glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+			}
+		}
+
+		GLuint count = 0;
+		// Steps simulated so far, which also seeds the spawn table lookups.
+		GLuint frame = 0;
+		bool hasInstances = false;
+
+		std::vector<GpuParticle> initialParticles;
+		std::vector<glm::vec4> spawnTable;
+
+		GLuint particles = 0;
+		GLuint instances = 0;
+		GLuint deadList = 0;
+		GLuint spawnTableBuffer = 0;
+		GLuint counters = 0;
+
+		StreamingBuffer readback;
+		std::array<bool, StreamingBuffer::NUM_SEGMENTS> hasCounters = {};
+	};
+
+	void CreateBuffers()
+	{
+		auto& state = *state_;
+
+		state.particles = CreateBuffer(state.count * sizeof(GpuParticle), state.initialParticles.data(), 0);
+		state.instances = CreateBuffer(state.count * sizeof(ParticleInstance), nullptr, 0);
+		state.deadList = CreateBuffer(state.count * sizeof(GLuint), nullptr, 0);
+		state.spawnTableBuffer = CreateBuffer(state.spawnTable.size() * sizeof(glm::vec4), state.spawnTable.data(), 0);
+		state.counters = CreateBuffer(sizeof(GpuParticleCounters), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		state.readback.Reserve(sizeof(GpuParticleCounters), GL_MAP_READ_BIT);
+
+		state.initialParticles = {};
+		state.spawnTable = {};
+	}
+
+	static GLuint CreateBuffer(const size_t size, const void* data, const GLbitfield flags)
+	{
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		// Zero-sized storage is an error, so empty effects still get one byte.
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, size > 0 ? size : 1, data, flags);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return buffer;
+	}
+
+	// Uniforms particle_instances.comp uses to write instances.
+	static void SetInstanceUniforms(const ParticleEffectSettings& settings)
+	{
+		glUniform1f(PARTICLE_SIM_SIZE_UNIFORM_LOCATION, settings.particleSize);
+		glUniform3fv(PARTICLE_SIM_INITIAL_COLOR_UNIFORM_LOCATION, 1, glm::value_ptr(settings.initialColor));
+		glUniform3fv(PARTICLE_SIM_END_COLOR_UNIFORM_LOCATION, 1, glm::value_ptr(settings.endColor));
+		glUniform1f(PARTICLE_SIM_COLOR_FALLOFF_UNIFORM_LOCATION, settings.colorFalloff);
+	}
+
+	std::shared_ptr<State> state_;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. The OS pages it in on first access, so mapping costs the same whatever the
+// size of the file, and the parts nobody reads never leave the disk. Copies share the same mapping (like the GL
+// handles held by Mesh).
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	static bool Open(const std::string& filename, MappedFile& file)
+	{
+		auto mapping = std::make_shared<Mapping>();
+#ifdef _WIN32
+		mapping->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		                            FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER size;
+		if (mapping->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(mapping->file, &size))
+		{
+			std::cerr << "Failed to open file [" << filename << "]." << std::endl;
+			return false;
+		}
+		mapping->size = static_cast<size_t>(size.QuadPart);
+		if (mapping->size > 0)
+		{
+			mapping->mapping = CreateFileMappingA(mapping->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			mapping->data = mapping->mapping ? MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		}
+#else
+		const auto descriptor = open(filename.c_str(), O_RDONLY);
+		struct stat status;
+		if (descriptor < 0 || fstat(descriptor, &status) != 0)
+		{
+			if (descriptor >= 0)
+			{
+				close(descriptor);
+			}
+			std::cerr << "Failed to open file [" << filename << "]." << std::endl;
+			return false;
+		}
+		mapping->size = static_cast<size_t>(status.st_size);
+		if (mapping->size > 0)
+		{
+			const auto data = mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			mapping->data = data == MAP_FAILED ? nullptr : data;
+		}
+		// The mapping keeps the file alive on its own.
+		close(descriptor);
+#endif
+		if (mapping->size > 0 && !mapping->data)
+		{
+			std::cerr << "Failed to map file [" << filename << "]." << std::endl;
+			return false;
+		}
+
+		file.mapping_ = std::move(mapping);
+		return true;
+	}
+
+	const uint8_t* Data() const
+	{
+		return mapping_ ? static_cast<const uint8_t*>(mapping_->data) : nullptr;
+	}
+
+	size_t Size() const
+	{
+		return mapping_ ? mapping_->size : 0;
+	}
+
+private:
+	struct Mapping
+	{
+		~Mapping()
+		{
+#ifdef _WIN32
+			if (data)
+			{
+				UnmapViewOfFile(data);
+			}
+			if (mapping)
+			{
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+			}
+#else
+			if (data)
+			{
+				munmap(data, size);
+			}
+#endif
+		}
+
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#endif
+		void* data = nullptr;
+		size_t size = 0;
+	};
+
+	std::shared_ptr<Mapping> mapping_;
+};
@@ -17,7 +17,8 @@ public:
 		  attributeVBO_(new GLuint(), [](auto id) { glDeleteBuffers(1, id); }),
 		  indexVBO_(new GLuint(), [](auto id) { glDeleteBuffers(1, id); }),
 		  numIndices_(0),
-		  numVertices_(0)
+		  numVertices_(0),
+		  triangleCorners_(std::make_shared<std::vector<glm::vec3>>())
 	{
 		glGenVertexArrays(1, vao_.get());
 		glGenBuffers(1, attributeVBO_.get());
@@ -86,6 +87,13 @@ public:
 		materialIDs_ = materialIDs;
 	}
 
+	// Object-space corners of the mesh's triangles, three per triangle, kept on the CPU for particle collision. Shared
+	// between copies of the mesh.
+	std::vector<glm::vec3>& TriangleCorners() const
+	{
+		return *triangleCorners_;
+	}
+
 private:
 	std::shared_ptr<GLuint> vao_;
 	std::shared_ptr<GLuint> attributeVBO_;
@@ -96,4 +104,5 @@ private:
 
 	std::vector<DrawElementsIndirectCommand> drawCommands_;
 	std::vector<uint32_t> materialIDs_;
+	std::shared_ptr<std::vector<glm::vec3>> triangleCorners_;
 };
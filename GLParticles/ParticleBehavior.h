@@ -0,0 +1,455 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+#include "ParticleKernels.h"
+#include "ParticlePool.h"
+#include "ParticleRandom.h"
+
+// Modules of a ParticleModules behavior. Each is a small value type whose members are inlined into the kernels of the
+// behavior it is composed into, so a behavior runs as one fused loop with no call per particle.
+// Emitters and velocities fill a batch of up to ParticleRandom::BATCH_SIZE spawned particles (drawn like the
+// ParticleEffectSettings distributions, so the same seed gives the same particles); forces and sizes run per particle.
+// Emitters place the particles relative to the effect's position, so effects moved elsewhere (eg. restarted by a
+// ParticleEffectPool) spawn around their own.
+
+// Spawns every particle at position.
+struct ParticlePointEmitter
+{
+	glm::vec3 position = glm::vec3(0.0f);
+
+	void Emit(const ParticleRandom&, uint32_t, const uint32_t*, const size_t count, float* x, float* y, float* z) const
+	{
+		std::fill(x, x + count, position.x);
+		std::fill(y, y + count, position.y);
+		std::fill(z, z + count, position.z);
+	}
+};
+
+// Spawns particles uniformly in a ball.
+struct ParticleSphereEmitter
+{
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 1.0f;
+
+	void Emit(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count, float* x,
+	          float* y, float* z) const
+	{
+		random.FillUnitBall(SPAWN_POSITION_STREAM, frame, indices, count, x, y, z);
+		for (size_t i = 0; i < count; ++i)
+		{
+			x[i] = center.x + x[i] * radius;
+			y[i] = center.y + y[i] * radius;
+			z[i] = center.z + z[i] * radius;
+		}
+	}
+};
+
+// Uniform in a ball of radius speed, like ParticleEffectSettings::speed.
+struct ParticleBallVelocity
+{
+	float speed = 0.0f;
+
+	void Emit(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count, float* x,
+	          float* y, float* z) const
+	{
+		random.FillUnitBall(SPAWN_VELOCITY_STREAM, frame, indices, count, x, y, z);
+		for (size_t i = 0; i < count; ++i)
+		{
+			x[i] *= speed;
+			y[i] *= speed;
+			z[i] *= speed;
+		}
+	}
+};
+
+// Uniform in [min, max), like ParticleEffectSettings::decayRange.
+struct ParticleUniformDecay
+{
+	float min = 0.0f;
+	float max = 0.0f;
+
+	void Emit(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count,
+	          float* decay) const
+	{
+		random.FillUniform(SPAWN_DECAY_STREAM, frame, indices, count, decay, min, max);
+	}
+};
+
+// Forces and sizes are written once against a lane type, Float: ParticleFloat1 for one particle, or ParticleFloat4 for
+// four adjacent ones. The fused update runs them four particles at a time with SSE2, which every x86-64 CPU has, and on
+// its own for the rest.
+
+// One particle's value of a stream, with the same interface as ParticleFloat4.
+struct ParticleFloat1
+{
+	static constexpr size_t LANES = 1;
+
+	float value;
+
+	ParticleFloat1(const float value) : value(value) {}
+
+	static ParticleFloat1 Load(const float* source)
+	{
+		return *source;
+	}
+
+	void Store(float* target) const
+	{
+		*target = value;
+	}
+
+	friend ParticleFloat1 operator+(const ParticleFloat1 a, const ParticleFloat1 b) { return a.value + b.value; }
+	friend ParticleFloat1 operator-(const ParticleFloat1 a, const ParticleFloat1 b) { return a.value - b.value; }
+	friend ParticleFloat1 operator*(const ParticleFloat1 a, const ParticleFloat1 b) { return a.value * b.value; }
+	friend ParticleFloat1 operator/(const ParticleFloat1 a, const ParticleFloat1 b) { return a.value / b.value; }
+	friend ParticleFloat1 Min(const ParticleFloat1 a, const ParticleFloat1 b) { return a.value < b.value ? a : b; }
+	friend ParticleFloat1 Max(const ParticleFloat1 a, const ParticleFloat1 b) { return a.value > b.value ? a : b; }
+};
+
+#if PARTICLE_KERNELS_X86
+// Four adjacent particles' values of a stream. Multiply and add stay separate (no FMA), so the lanes match
+// ParticleFloat1 bit for bit.
+struct ParticleFloat4
+{
+	static constexpr size_t LANES = 4;
+
+	__m128 value;
+
+	ParticleFloat4(const float value) : value(_mm_set1_ps(value)) {}
+	ParticleFloat4(const __m128 value) : value(value) {}
+
+	static ParticleFloat4 Load(const float* source)
+	{
+		return _mm_loadu_ps(source);
+	}
+
+	void Store(float* target) const
+	{
+		_mm_storeu_ps(target, value);
+	}
+
+	friend ParticleFloat4 operator+(const ParticleFloat4 a, const ParticleFloat4 b)
+	{
+		return _mm_add_ps(a.value, b.value);
+	}
+
+	friend ParticleFloat4 operator-(const ParticleFloat4 a, const ParticleFloat4 b)
+	{
+		return _mm_sub_ps(a.value, b.value);
+	}
+
+	friend ParticleFloat4 operator*(const ParticleFloat4 a, const ParticleFloat4 b)
+	{
+		return _mm_mul_ps(a.value, b.value);
+	}
+
+	friend ParticleFloat4 operator/(const ParticleFloat4 a, const ParticleFloat4 b)
+	{
+		return _mm_div_ps(a.value, b.value);
+	}
+
+	// Like ParticleFloat1, the second operand wins when either is NaN.
+	friend ParticleFloat4 Min(const ParticleFloat4 a, const ParticleFloat4 b)
+	{
+		return _mm_min_ps(a.value, b.value);
+	}
+
+	friend ParticleFloat4 Max(const ParticleFloat4 a, const ParticleFloat4 b)
+	{
+		return _mm_max_ps(a.value, b.value);
+	}
+};
+#endif
+
+// Three streams (eg. a position or velocity) in lanes of Float.
+template<class Float>
+struct ParticleVector
+{
+	Float x;
+	Float y;
+	Float z;
+
+	ParticleVector(const Float& x, const Float& y, const Float& z) : x(x), y(y), z(z) {}
+	explicit ParticleVector(const glm::vec3& v) : x(v.x), y(v.y), z(v.z) {}
+
+	friend ParticleVector operator+(const ParticleVector& a, const ParticleVector& b)
+	{
+		return { a.x + b.x, a.y + b.y, a.z + b.z };
+	}
+
+	friend ParticleVector operator-(const ParticleVector& a, const ParticleVector& b)
+	{
+		return { a.x - b.x, a.y - b.y, a.z - b.z };
+	}
+
+	friend ParticleVector operator*(const ParticleVector& a, const Float& b)
+	{
+		return { a.x * b, a.y * b, a.z * b };
+	}
+};
+
+// Forces return the velocity after one step of stepScale, from the position and velocity before it.
+
+struct ParticleGravity
+{
+	glm::vec3 gravity = glm::vec3(0.0f, -0.8f, 0.0f);
+
+	template<class Float>
+	ParticleVector<Float> Accelerate(const ParticleVector<Float>&, const ParticleVector<Float>& velocity,
+	                                 const Float& stepScale) const
+	{
+		return velocity + ParticleVector<Float>(gravity) * stepScale;
+	}
+};
+
+// Linear drag: slows particles down by coefficient of their velocity per unit of stepScale.
+struct ParticleDrag
+{
+	float coefficient = 0.0f;
+
+	template<class Float>
+	ParticleVector<Float> Accelerate(const ParticleVector<Float>&, const ParticleVector<Float>& velocity,
+	                                 const Float& stepScale) const
+	{
+		return velocity - velocity * (Float(coefficient) * stepScale);
+	}
+};
+
+// Applies Forces in order. No forces at all leaves the velocity alone.
+template<class... Forces>
+struct ParticleForces
+{
+	std::tuple<Forces...> forces;
+
+	template<class Float>
+	ParticleVector<Float> Accelerate(const ParticleVector<Float>& position, const ParticleVector<Float>& velocity,
+	                                 const Float& stepScale) const
+	{
+		return Accelerate(position, velocity, stepScale, std::index_sequence_for<Forces...>());
+	}
+
+private:
+	template<class Float, size_t... I>
+	ParticleVector<Float> Accelerate(const ParticleVector<Float>& position, ParticleVector<Float> velocity,
+	                                 const Float& stepScale, std::index_sequence<I...>) const
+	{
+		((velocity = std::get<I>(forces).Accelerate(position, velocity, stepScale)), ...);
+		return velocity;
+	}
+};
+
+template<class... Forces>
+ParticleForces<Forces...> MakeParticleForces(const Forces&... forces)
+{
+	return { std::make_tuple(forces...) };
+}
+
+// Sizes give a particle's size from its life, which runs from 1 down to 0. VARIES tells whether it needs rewriting
+// after every step.
+
+struct ParticleConstantSize
+{
+	static constexpr bool VARIES = false;
+
+	float size = 0.02f;
+
+	template<class Float>
+	Float Size(const Float&) const
+	{
+		return size;
+	}
+};
+
+// From start at birth to end at death.
+struct ParticleSizeOverLife
+{
+	static constexpr bool VARIES = true;
+
+	float start = 0.02f;
+	float end = 0.0f;
+
+	template<class Float>
+	Float Size(const Float& life) const
+	{
+		return Float(end) + Float(start - end) * life;
+	}
+};
+
+// Compile-time composition of one module of each kind into a fused spawn kernel and a fused update kernel. The update
+// takes the place of ParticleKernels::Integrate(): the forces replace gravity, and run between moving the particles and
+// aging them, in the same loop.
+// With ParticlePointEmitter, ParticleBallVelocity, ParticleUniformDecay, ParticleForces<ParticleGravity> and
+// ParticleConstantSize, the particles come out bit for bit the same as with the equivalent ParticleEffectSettings.
+template<class Emitter, class Velocity, class Decay, class Forces = ParticleForces<>,
+         class Sizes = ParticleConstantSize>
+struct ParticleModules
+{
+	Emitter emitter;
+	Velocity velocity;
+	Decay decay;
+	Forces forces;
+	Sizes sizes;
+
+	// Spawns the particles indices[0, count), count <= ParticleRandom::BATCH_SIZE, drawing their values for frame.
+	// origin is the effect's position, which the emitter's are relative to.
+	void Spawn(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count,
+	           const glm::vec3& origin, const ParticlePool& pool) const
+	{
+		std::array<float, ParticleRandom::BATCH_SIZE> x;
+		std::array<float, ParticleRandom::BATCH_SIZE> y;
+		std::array<float, ParticleRandom::BATCH_SIZE> z;
+		std::array<float, ParticleRandom::BATCH_SIZE> vx;
+		std::array<float, ParticleRandom::BATCH_SIZE> vy;
+		std::array<float, ParticleRandom::BATCH_SIZE> vz;
+		std::array<float, ParticleRandom::BATCH_SIZE> decays;
+		emitter.Emit(random, frame, indices, count, x.data(), y.data(), z.data());
+		velocity.Emit(random, frame, indices, count, vx.data(), vy.data(), vz.data());
+		decay.Emit(random, frame, indices, count, decays.data());
+		const auto size = sizes.Size(ParticleFloat1(1.0f)).value;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto index = indices[i];
+			pool.PositionX()[index] = pool.PreviousX()[index] = origin.x + x[i];
+			pool.PositionY()[index] = pool.PreviousY()[index] = origin.y + y[i];
+			pool.PositionZ()[index] = pool.PreviousZ()[index] = origin.z + z[i];
+			pool.VelocityX()[index] = vx[i];
+			pool.VelocityY()[index] = vy[i];
+			pool.VelocityZ()[index] = vz[i];
+			pool.Life()[index] = 1.0f;
+			pool.Decay()[index] = decays[i];
+			pool.Size()[index] = size;
+		}
+	}
+
+	// Same contract as ParticleKernels::Integrate(), without the alignment requirements.
+	void Update(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step) const
+	{
+		auto i = begin;
+#if PARTICLE_KERNELS_X86
+		static const auto hasSSE2 = ParticleKernels::Detect() != ParticleKernels::SCALAR;
+		if (hasSSE2)
+		{
+			for (; i + ParticleFloat4::LANES <= end; i += ParticleFloat4::LANES)
+			{
+				UpdateLanes<ParticleFloat4>(pool, i, step);
+			}
+		}
+#endif
+		for (; i < end; ++i)
+		{
+			UpdateLanes<ParticleFloat1>(pool, i, step);
+		}
+	}
+
+private:
+	// Updates the Float::LANES particles from i.
+	template<class Float>
+	void UpdateLanes(const ParticlePool& pool, const size_t i, const ParticleIntegration& step) const
+	{
+		const Float stepScale(step.stepScale);
+		const auto position = ParticleVector<Float>(Float::Load(pool.PositionX() + i), Float::Load(pool.PositionY() + i),
+		                                            Float::Load(pool.PositionZ() + i));
+		const auto velocity = ParticleVector<Float>(Float::Load(pool.VelocityX() + i), Float::Load(pool.VelocityY() + i),
+		                                            Float::Load(pool.VelocityZ() + i));
+		position.x.Store(pool.PreviousX() + i);
+		position.y.Store(pool.PreviousY() + i);
+		position.z.Store(pool.PreviousZ() + i);
+
+		const auto moved = position + velocity * stepScale;
+		moved.x.Store(pool.PositionX() + i);
+		moved.y.Store(pool.PositionY() + i);
+		moved.z.Store(pool.PositionZ() + i);
+
+		const auto accelerated = forces.Accelerate(position, velocity, stepScale);
+		accelerated.x.Store(pool.VelocityX() + i);
+		accelerated.y.Store(pool.VelocityY() + i);
+		accelerated.z.Store(pool.VelocityZ() + i);
+
+		const auto life = Float::Load(pool.Life() + i) - Float::Load(pool.Decay() + i) * Float(step.deltaTime);
+		life.Store(pool.Life() + i);
+		if constexpr (Sizes::VARIES)
+		{
+			sizes.Size(life).Store(pool.Size() + i);
+		}
+	}
+};
+
+// Type-erased ParticleModules, as held by ParticleEffectSettings::behavior. The concrete modules stay behind one
+// function pointer per kernel, called once per spawn batch or update chunk rather than per particle, so effects of
+// different behaviors still fit in the same Scene. Copies share the same modules.
+class ParticleBehavior
+{
+public:
+	ParticleBehavior() = default;
+
+	template<class Modules>
+	explicit ParticleBehavior(const Modules& modules)
+		: modules_(std::make_shared<const Modules>(modules)),
+		  spawn_(&SpawnModules<Modules>),
+		  update_(&UpdateModules<Modules>)
+	{
+	}
+
+	explicit operator bool() const
+	{
+		return modules_ != nullptr;
+	}
+
+	// See ParticleModules::Spawn().
+	void Spawn(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count,
+	           const glm::vec3& origin, const ParticlePool& pool) const
+	{
+		spawn_(modules_.get(), random, frame, indices, count, origin, pool);
+	}
+
+	// See ParticleModules::Update().
+	void Update(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step) const
+	{
+		update_(modules_.get(), pool, begin, end, step);
+	}
+
+private:
+	using SpawnFunc = void (*)(const void* modules, const ParticleRandom& random, uint32_t frame,
+	                           const uint32_t* indices, size_t count, const glm::vec3& origin, const ParticlePool& pool);
+	using UpdateFunc = void (*)(const void* modules, const ParticlePool& pool, size_t begin, size_t end,
+	                            const ParticleIntegration& step);
+
+	template<class Modules>
+	static void SpawnModules(const void* modules, const ParticleRandom& random, const uint32_t frame,
+	                         const uint32_t* indices, const size_t count, const glm::vec3& origin,
+	                         const ParticlePool& pool)
+	{
+		static_cast<const Modules*>(modules)->Spawn(random, frame, indices, count, origin, pool);
+	}
+
+	template<class Modules>
+	static void UpdateModules(const void* modules, const ParticlePool& pool, const size_t begin, const size_t end,
+	                          const ParticleIntegration& step)
+	{
+		static_cast<const Modules*>(modules)->Update(pool, begin, end, step);
+	}
+
+	std::shared_ptr<const void> modules_;
+	SpawnFunc spawn_ = nullptr;
+	UpdateFunc update_ = nullptr;
+};
+
+// Composes the given modules into a ParticleBehavior, deducing their types.
+template<class Emitter, class Velocity, class Decay, class Forces = ParticleForces<>,
+         class Sizes = ParticleConstantSize>
+ParticleBehavior ComposeParticleBehavior(const Emitter& emitter, const Velocity& velocity, const Decay& decay,
+                                         const Forces& forces = Forces(), const Sizes& sizes = Sizes())
+{
+	return ParticleBehavior(ParticleModules<Emitter, Velocity, Decay, Forces, Sizes> { emitter, velocity, decay, forces,
+	                                                                                  sizes });
+}
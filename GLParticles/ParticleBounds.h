@@ -0,0 +1,123 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include "ParticlePool.h"
+
+// Axis-aligned box. Starts out empty, and grows to hold what is added to it.
+struct ParticleBounds
+{
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+	bool IsEmpty() const
+	{
+		return min.x > max.x;
+	}
+
+	void Add(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void Add(const ParticleBounds& bounds)
+	{
+		min = glm::min(min, bounds.min);
+		max = glm::max(max, bounds.max);
+	}
+
+	// Moves the box by offset. Empty boxes stay empty.
+	void Translate(const glm::vec3& offset)
+	{
+		if (!IsEmpty())
+		{
+			min += offset;
+			max += offset;
+		}
+	}
+
+	// Box around what particles [begin, end) of pool cover on screen for one more step: their previous and current
+	// positions, and as far again past the current one (where extrapolated draws and the next step take them), grown
+	// by sizeScale times their size. The six bounds are reduced in separate accumulators over the pool's streams, so
+	// the loop vectorizes like the integration kernels.
+	static ParticleBounds OfParticles(const ParticlePool& pool, const size_t begin, const size_t end,
+	                                  const float sizeScale)
+	{
+		const float* const positions[3] = { pool.PositionX(), pool.PositionY(), pool.PositionZ() };
+		const float* const previous[3] = { pool.PreviousX(), pool.PreviousY(), pool.PreviousZ() };
+		const auto* const size = pool.Size();
+
+		ParticleBounds bounds;
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			const auto* const position = positions[axis];
+			const auto* const previousPosition = previous[axis];
+			auto low = std::numeric_limits<float>::max();
+			auto high = std::numeric_limits<float>::lowest();
+			for (auto i = begin; i < end; ++i)
+			{
+				// pos +- |pos - previous| holds the previous position and the one extrapolated a step further.
+				const auto reach = std::fabs(position[i] - previousPosition[i]) + size[i] * sizeScale;
+				const auto particleLow = position[i] - reach;
+				const auto particleHigh = position[i] + reach;
+				low = particleLow < low ? particleLow : low;
+				high = particleHigh > high ? particleHigh : high;
+			}
+			bounds.min[axis] = low;
+			bounds.max[axis] = high;
+		}
+		return bounds;
+	}
+};
+
+// The six planes of a view frustum, pointing inwards, for culling boxes against it.
+class ParticleFrustum
+{
+public:
+	// Planes of the clip volume of viewProjection, as the rows of the matrix combine into them.
+	explicit ParticleFrustum(const glm::mat4& viewProjection)
+	{
+		const auto row = [&](const int r)
+		{
+			return glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+		};
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			planes_[2 * axis] = row(3) + row(axis);
+			planes_[2 * axis + 1] = row(3) - row(axis);
+		}
+	}
+
+	// Whether bounds may be in view. Conservative: boxes near the corners of the frustum can pass without being in it,
+	// but nothing in it is ever rejected. Empty boxes are never in view.
+	bool Intersects(const ParticleBounds& bounds) const
+	{
+		if (bounds.IsEmpty())
+		{
+			return false;
+		}
+
+		for (const auto& plane : planes_)
+		{
+			// The corner furthest along the plane's normal.
+			const auto corner = glm::vec3(plane.x >= 0.0f ? bounds.max.x : bounds.min.x,
+			                              plane.y >= 0.0f ? bounds.max.y : bounds.min.y,
+			                              plane.z >= 0.0f ? bounds.max.z : bounds.min.z);
+			if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	std::array<glm::vec4, 6> planes_;
+};
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "ParticleBounds.h"
+#include "ParticleEffect.h"
+
+struct ParticleBudgetSettings
+{
+	// Most particles alive across all effects. Shared out between the visible effects by their projected size.
+	size_t maxParticles = 1000000;
+	// Target CPU time of the particle update per frame. Going over throttles emission everywhere until it fits again.
+	double cpuBudgetMilliseconds = 4.0;
+	// Effects closer than this update every step at their full spawn rate. Past it, the update interval grows and the
+	// spawn rate shrinks with the distance.
+	float lodDistance = 10.0f;
+	int maxUpdateInterval = 4;
+	float minEmissionScale = 0.25f;
+	// Effects whose bounding sphere covers fewer pixels across than this are neither simulated nor drawn.
+	float minProjectedPixels = 2.0f;
+	// Effects whose bounds (see ParticleEffect::Bounds()) are outside the view frustum are not drawn. They keep
+	// updating more cheaply: every offscreenUpdateInterval steps at most, as one coarse step, and without growing past
+	// what they have alive. 0 freezes them instead, like the effects too small to see.
+	bool frustumCulling = true;
+	int offscreenUpdateInterval = 8;
+};
+
+// What the manager decided for one effect this frame.
+struct ParticleBudgetDecision
+{
+	uint32_t effectId = 0;
+	float distance = 0.0f;
+	// Screen-space diameter of the effect's bounding sphere.
+	float projectedPixels = 0.0f;
+	// Drawn this frame. Effects that are neither visible nor offscreen are frozen.
+	bool visible = true;
+	// Outside the view frustum: only simulated, when steps are due.
+	bool offscreen = false;
+	// Simulation steps per update.
+	int updateInterval = 1;
+	// Simulate() calls due this frame (0 when skipped), each covering stepMultiple fixed steps at once.
+	int steps = 0;
+	int stepMultiple = 1;
+	// PrepareDraw() blend factor. Past 1 it extrapolates the last update.
+	float alpha = 1.0f;
+	float emissionScale = 1.0f;
+	size_t particleLimit = 0;
+};
+
+// Totals of the last Plan(), and the CPU time of the last ReportCpuTime().
+struct ParticleBudgetUsage
+{
+	size_t aliveParticles = 0;
+	size_t maxParticles = 0;
+	double cpuMilliseconds = 0.0;
+	double cpuBudgetMilliseconds = 0.0;
+	// Emission scale applied everywhere to stay within the CPU budget.
+	float cpuEmissionScale = 1.0f;
+	size_t updated = 0;
+	// Effects past lodDistance waiting out their updateInterval this frame.
+	size_t skipped = 0;
+	// Effects drawn, and not drawn, for being too small or (offscreen) outside the view frustum.
+	size_t visible = 0;
+	size_t culled = 0;
+	size_t offscreen = 0;
+};
+
+// Scales particle work with what the viewer can see. Every frame, Plan() looks at each effect from the main camera:
+// - Effects whose bounding sphere projects to fewer than minProjectedPixels are culled. They freeze: no update, no
+//   draw, and no time owed once they come back.
+// - Effects whose bounds are outside the view frustum are culled too, but keep updating at offscreenUpdateInterval,
+//   so they are still alive when the camera turns back to them. The bounds are those of the last update: particles
+//   outrunning them by more than a step's motion show up a frame late.
+// - Past lodDistance, an effect updates only every updateInterval steps, running the steps it skipped as one coarse
+//   step, and is drawn extrapolated from its last two updates in between. Its spawn rate drops with the distance too.
+// - Each visible effect gets a particle limit: its share of maxParticles, by projected size, and never more than it
+//   can hold. Capacity one effect can't use goes to the others.
+// - When the measured update time goes over the CPU budget, emission is throttled for all effects, and eases back
+//   once there is room again.
+class ParticleBudgetManager
+{
+public:
+	ParticleBudgetManager() = default;
+
+	explicit ParticleBudgetManager(const ParticleBudgetSettings& settings)
+		: settings_(settings)
+	{
+	}
+
+	// Makes room for numEffects effects, so that planning up to that many allocates nothing, even as effects come and
+	// go. Past it, the storage grows once and is kept.
+	void Reserve(const size_t numEffects)
+	{
+		states_.reserve(numEffects);
+		decisions_.reserve(numEffects);
+	}
+
+	// Decides this frame's work for the effects, which effect(id) returns, and applies the emission scale and particle
+	// limit to them. frameSteps and clockAlpha come from the SimulationClock; viewportHeight is in pixels.
+	template<class GetEffect>
+	const std::vector<ParticleBudgetDecision>& Plan(const std::vector<uint32_t>& effectIds, const GetEffect& effect,
+	                                                const glm::vec3& eye, const glm::mat4& view,
+	                                                const glm::mat4& projection, const int viewportHeight,
+	                                                const int frameSteps, const float clockAlpha)
+	{
+		decisions_.clear();
+		usage_.aliveParticles = 0;
+		usage_.updated = 0;
+		usage_.skipped = 0;
+		usage_.visible = 0;
+		usage_.culled = 0;
+		usage_.offscreen = 0;
+		const ParticleFrustum frustum(projection * view);
+
+		// Pixels per unit of size at unit distance, from the vertical field of view.
+		const auto pixelsPerUnit = projection[1][1] * 0.5f * static_cast<float>(viewportHeight);
+
+		for (const auto effectId : effectIds)
+		{
+			const auto& settings = effect(effectId).Settings();
+			auto& state = State(effectId);
+			state.seen = true;
+
+			ParticleBudgetDecision decision;
+			decision.effectId = effectId;
+			decision.distance = glm::distance(eye, settings.position);
+			decision.projectedPixels = settings.boundingRadius * 2.0f * pixelsPerUnit /
+			                           std::max(decision.distance, std::numeric_limits<float>::epsilon());
+			const auto isLargeEnough = decision.projectedPixels >= settings_.minProjectedPixels;
+			const auto isInFrustum = !settings_.frustumCulling || frustum.Intersects(effect(effectId).Bounds());
+			decision.visible = isLargeEnough && isInFrustum;
+			decision.offscreen = isLargeEnough && !isInFrustum && settings_.offscreenUpdateInterval > 0;
+
+			const auto lodFactor = std::max(decision.distance / settings_.lodDistance, 1.0f);
+			decision.updateInterval = std::min(static_cast<int>(lodFactor), std::max(settings_.maxUpdateInterval, 1));
+			decision.emissionScale = std::max(1.0f / lodFactor, settings_.minEmissionScale) * cpuEmissionScale_;
+			if (decision.offscreen)
+			{
+				decision.updateInterval = std::max(decision.updateInterval, settings_.offscreenUpdateInterval);
+			}
+
+			++(decision.visible ? usage_.visible : usage_.culled);
+			usage_.offscreen += decision.offscreen ? 1 : 0;
+			if (!decision.visible && !decision.offscreen)
+			{
+				state.pendingSteps = 0;
+			}
+			else
+			{
+				state.pendingSteps += frameSteps;
+				if (state.pendingSteps >= decision.updateInterval)
+				{
+					// Full-rate effects run every step; the others catch up with one coarse step.
+					const auto isFullRate = decision.updateInterval == 1;
+					decision.steps = isFullRate ? state.pendingSteps : 1;
+					decision.stepMultiple = isFullRate ? 1 : state.pendingSteps;
+					state.lastSteps = decision.stepMultiple;
+					state.pendingSteps = 0;
+					++usage_.updated;
+				}
+				else if (decision.updateInterval > 1)
+				{
+					// Full-rate effects only wait for the fixed clock here, which isn't level of detail at work.
+					++usage_.skipped;
+				}
+
+				// Drawn one step behind real time, like the full-rate effects: between the last two updates right
+				// after an update, and extrapolated past the last one while skipping.
+				decision.alpha = state.lastSteps > 1
+					? 1.0f + (static_cast<float>(state.pendingSteps) + clockAlpha - 1.0f) / state.lastSteps
+					: clockAlpha;
+			}
+
+			usage_.aliveParticles += effect(effectId).SimulationStats().aliveCount;
+			decisions_.push_back(decision);
+		}
+
+		ShareParticles(effectIds, effect);
+		for (const auto& decision : decisions_)
+		{
+			auto& target = effect(decision.effectId);
+			target.SetEmissionScale(decision.emissionScale);
+			target.SetParticleLimit(decision.particleLimit);
+		}
+
+		// Forget effects that were removed from the scene.
+		states_.erase(std::remove_if(states_.begin(), states_.end(), [](const EffectState& state)
+		{
+			return !state.seen;
+		}), states_.end());
+		for (auto& state : states_)
+		{
+			state.seen = false;
+		}
+
+		usage_.maxParticles = settings_.maxParticles;
+		usage_.cpuBudgetMilliseconds = settings_.cpuBudgetMilliseconds;
+		return decisions_;
+	}
+
+	// Feeds back the CPU time the planned updates took, which steers the emission throttle of the next frames.
+	void ReportCpuTime(const double milliseconds)
+	{
+		usage_.cpuMilliseconds = milliseconds;
+		cpuEmissionScale_ = milliseconds > settings_.cpuBudgetMilliseconds
+			? std::max(cpuEmissionScale_ * 0.9f, MIN_CPU_EMISSION_SCALE)
+			: std::min(cpuEmissionScale_ * 1.02f, 1.0f);
+		usage_.cpuEmissionScale = cpuEmissionScale_;
+	}
+
+	const std::vector<ParticleBudgetDecision>& Decisions() const
+	{
+		return decisions_;
+	}
+
+	const ParticleBudgetUsage& Usage() const
+	{
+		return usage_;
+	}
+
+	const ParticleBudgetSettings& Settings() const
+	{
+		return settings_;
+	}
+
+	ParticleBudgetSettings& Settings()
+	{
+		return settings_;
+	}
+
+private:
+	static constexpr float MIN_CPU_EMISSION_SCALE = 0.05f;
+
+	struct EffectState
+	{
+		uint32_t effectId = 0;
+		// Steps owed since the last update, and the steps the last Simulate() covered.
+		int pendingSteps = 0;
+		int lastSteps = 1;
+		// Particle limit of the last frame the effect was drawn in, which it keeps offscreen.
+		size_t particleLimit = 0;
+		bool seen = false;
+	};
+
+	// State of effectId, added if the effect is new. The states are kept sorted by id, in storage that is reused as
+	// effects come and go.
+	EffectState& State(const uint32_t effectId)
+	{
+		const auto it = std::lower_bound(states_.begin(), states_.end(), effectId,
+		                                 [](const EffectState& state, const uint32_t id) { return state.effectId < id; });
+		if (it != states_.end() && it->effectId == effectId)
+		{
+			return *it;
+		}
+		EffectState state;
+		state.effectId = effectId;
+		return *states_.insert(it, state);
+	}
+
+	// Water-fills maxParticles over the visible effects, in proportion to their projected size and up to their
+	// capacity. Culled effects keep what they have alive, since frozen ones don't spawn anyway, and offscreen ones
+	// the limit they last had on screen, so they keep replacing the particles that die.
+	template<class GetEffect>
+	void ShareParticles(const std::vector<uint32_t>& effectIds, const GetEffect& effect)
+	{
+		auto remaining = static_cast<double>(settings_.maxParticles);
+		double totalWeight = 0.0;
+		for (size_t i = 0; i < decisions_.size(); ++i)
+		{
+			auto& decision = decisions_[i];
+			if (decision.visible)
+			{
+				totalWeight += decision.projectedPixels;
+				decision.particleLimit = std::numeric_limits<size_t>::max();
+			}
+			else
+			{
+				decision.particleLimit = effect(effectIds[i]).SimulationStats().aliveCount;
+				if (decision.offscreen)
+				{
+					decision.particleLimit = std::max(decision.particleLimit, State(effectIds[i]).particleLimit);
+				}
+				remaining -= static_cast<double>(decision.particleLimit);
+			}
+		}
+
+		// Each round settles the effects whose share exceeds their capacity, and hands the rest on.
+		auto settled = false;
+		while (!settled && totalWeight > 0.0)
+		{
+			settled = true;
+			const auto perWeight = std::max(remaining, 0.0) / totalWeight;
+			for (size_t i = 0; i < decisions_.size(); ++i)
+			{
+				auto& decision = decisions_[i];
+				const auto capacity = effect(effectIds[i]).Pool().Capacity();
+				if (decision.visible && decision.particleLimit == std::numeric_limits<size_t>::max() &&
+				    perWeight * decision.projectedPixels >= static_cast<double>(capacity))
+				{
+					decision.particleLimit = capacity;
+					remaining -= static_cast<double>(capacity);
+					totalWeight -= decision.projectedPixels;
+					settled = false;
+				}
+			}
+		}
+
+		const auto perWeight = totalWeight > 0.0 ? std::max(remaining, 0.0) / totalWeight : 0.0;
+		for (auto& decision : decisions_)
+		{
+			if (decision.particleLimit == std::numeric_limits<size_t>::max())
+			{
+				decision.particleLimit = static_cast<size_t>(perWeight * decision.projectedPixels);
+			}
+			if (decision.visible)
+			{
+				State(decision.effectId).particleLimit = decision.particleLimit;
+			}
+		}
+	}
+
+	ParticleBudgetSettings settings_;
+	float cpuEmissionScale_ = 1.0f;
+	std::vector<EffectState> states_;
+	std::vector<ParticleBudgetDecision> decisions_;
+	ParticleBudgetUsage usage_;
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "ParticleInstance.h"
+
+// Particle cache file, little-endian:
+// - a ParticleCacheHeader,
+// - one chunk per frame, holding its instances exactly as they are uploaded (in the header's vertex format), starting
+//   on a CHUNK_ALIGNMENT boundary,
+// - the frame table, one ParticleCacheFrame per frame, at frameTableOffset.
+// Frames stand on their own (no deltas), so any frame can be read without the ones before it.
+struct ParticleCacheHeader
+{
+	// "PCCH"
+	static constexpr uint32_t MAGIC = 0x48434350;
+	static constexpr uint32_t VERSION = 1;
+
+	uint32_t magic = MAGIC;
+	uint32_t version = VERSION;
+	uint32_t vertexFormat = PARTICLE_VERTEX_FLOAT;
+	uint32_t instanceSize = 0;
+	uint32_t numFrames = 0;
+	// Most instances in any frame.
+	uint32_t maxInstances = 0;
+	// Update time between frames, in the units of ParticleEffect::Simulate().
+	float frameDuration = 0.0f;
+	uint32_t reserved = 0;
+	uint64_t frameTableOffset = 0;
+};
+
+struct ParticleCacheFrame
+{
+	// Of the frame's chunk, from the start of the file.
+	uint64_t offset = 0;
+	uint32_t count = 0;
+	uint32_t reserved = 0;
+	ParticleInstanceDecode decode;
+};
+
+static_assert(sizeof(ParticleCacheHeader) == 40, "ParticleCacheHeader is written as is");
+static_assert(sizeof(ParticleCacheFrame) == 48, "ParticleCacheFrame is written as is");
+
+// Recorded particle frames, played back straight from a memory-mapped cache file (see ParticleEffectSettings::CACHE).
+// Only the frame table is read when loading; the instances are paged in as frames are played, and copied from the
+// mapping into the upload path as they are. Copies share the same mapping.
+class ParticleCache
+{
+public:
+	// Chunks start on a cache line, so copying them out runs on aligned memory.
+	static constexpr size_t CHUNK_ALIGNMENT = 64;
+
+	ParticleCache() = default;
+
+	static bool Load(const std::string& filename, ParticleCache& cache)
+	{
+		MappedFile file;
+		if (!MappedFile::Open(filename, file))
+		{
+			return false;
+		}
+
+		ParticleCacheHeader header;
+		if (file.Size() < sizeof(header))
+		{
+			std::cerr << "Particle cache [" << filename << "] is too small." << std::endl;
+			return false;
+		}
+		std::memcpy(&header, file.Data(), sizeof(header));
+
+		const auto format = static_cast<ParticleVertexFormat>(header.vertexFormat);
+		const auto tableSize = static_cast<uint64_t>(header.numFrames) * sizeof(ParticleCacheFrame);
+		if (header.magic != ParticleCacheHeader::MAGIC || header.version != ParticleCacheHeader::VERSION ||
+		    header.vertexFormat > PARTICLE_VERTEX_FIXED16 || header.instanceSize != InstanceSize(format) ||
+		    !(header.frameDuration > 0.0f) || header.frameTableOffset > file.Size() ||
+		    tableSize > file.Size() - header.frameTableOffset)
+		{
+			std::cerr << "Invalid particle cache header in [" << filename << "]." << std::endl;
+			return false;
+		}
+
+		std::vector<ParticleCacheFrame> frames(header.numFrames);
+		std::memcpy(frames.data(), file.Data() + header.frameTableOffset, tableSize);
+		for (size_t frame = 0; frame < frames.size(); ++frame)
+		{
+			const auto& entry = frames[frame];
+			if (entry.count > header.maxInstances || entry.offset % CHUNK_ALIGNMENT != 0 ||
+			    entry.offset > file.Size() ||
+			    static_cast<uint64_t>(entry.count) * header.instanceSize > file.Size() - entry.offset)
+			{
+				std::cerr << "Frame " << frame << " of particle cache [" << filename << "] is out of bounds." << std::endl;
+				return false;
+			}
+		}
+
+		cache.file_ = std::move(file);
+		cache.header_ = header;
+		cache.frames_ = std::move(frames);
+		return true;
+	}
+
+	static size_t InstanceSize(const ParticleVertexFormat format)
+	{
+		return format == PARTICLE_VERTEX_FLOAT ? sizeof(ParticleInstance) : sizeof(ParticleCompactInstance);
+	}
+
+	// Frame to show at time into playback (in update time, like frameDuration), frame i being recorded at
+	// (i + 1) * frameDuration, ie. after the step that produced it. Rounds to the nearest frame, so steps that only add
+	// up to frameDuration within float precision land on the right one. Past the last frame, playback wraps around when
+	// looping, and holds the last frame otherwise.
+	size_t FrameAt(const double time, const bool loop) const
+	{
+		if (frames_.empty())
+		{
+			return 0;
+		}
+
+		const auto frame = static_cast<uint64_t>(std::max(std::round(time / header_.frameDuration) - 1.0, 0.0));
+		return static_cast<size_t>(loop ? frame % frames_.size() : std::min<uint64_t>(frame, frames_.size() - 1));
+	}
+
+	const ParticleCacheFrame& Frame(const size_t frame) const
+	{
+		return frames_[frame];
+	}
+
+	// The frame's instances, in VertexFormat(), inside the mapping.
+	const void* Instances(const size_t frame) const
+	{
+		return file_.Data() + frames_[frame].offset;
+	}
+
+	size_t NumFrames() const
+	{
+		return frames_.size();
+	}
+
+	float FrameDuration() const
+	{
+		return header_.frameDuration;
+	}
+
+	ParticleVertexFormat VertexFormat() const
+	{
+		return static_cast<ParticleVertexFormat>(header_.vertexFormat);
+	}
+
+	size_t InstanceSize() const
+	{
+		return header_.instanceSize;
+	}
+
+	size_t MaxInstances() const
+	{
+		return header_.maxInstances;
+	}
+
+	size_t FileSize() const
+	{
+		return file_.Size();
+	}
+
+private:
+	MappedFile file_;
+	ParticleCacheHeader header_;
+	std::vector<ParticleCacheFrame> frames_;
+};
+
+// Writes a particle cache one frame at a time, eg. from ParticleEffect::RecordFrame() after every step of a live or
+// offline simulation. Frames go to disk as they are appended; the table and header are written by Close().
+class ParticleCacheWriter
+{
+public:
+	ParticleCacheWriter() = default;
+
+	ParticleCacheWriter(const ParticleCacheWriter&) = delete;
+	ParticleCacheWriter& operator=(const ParticleCacheWriter&) = delete;
+
+	~ParticleCacheWriter()
+	{
+		Close();
+	}
+
+	// Starts a cache of frames frameDuration apart, in format.
+	bool Open(const std::string& filename, const ParticleVertexFormat format, const float frameDuration)
+	{
+		Close();
+		file_.open(filename, std::ios::binary | std::ios::trunc);
+		if (!file_)
+		{
+			std::cerr << "Failed to create particle cache [" << filename << "]." << std::endl;
+			return false;
+		}
+
+		filename_ = filename;
+		header_ = ParticleCacheHeader();
+		header_.vertexFormat = format;
+		header_.instanceSize = static_cast<uint32_t>(ParticleCache::InstanceSize(format));
+		header_.frameDuration = frameDuration;
+		frames_.clear();
+
+		// Rewritten by Close(), once the frames are known.
+		file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+		return Check();
+	}
+
+	// Appends a frame of count instances in the format given to Open().
+	bool AppendFrame(const void* instances, const size_t count, const ParticleInstanceDecode& decode)
+	{
+		if (!file_.is_open())
+		{
+			return false;
+		}
+
+		ParticleCacheFrame frame;
+		frame.offset = Align();
+		frame.count = static_cast<uint32_t>(count);
+		frame.decode = decode;
+		file_.write(static_cast<const char*>(instances), static_cast<std::streamsize>(count * header_.instanceSize));
+		frames_.push_back(frame);
+		header_.maxInstances = std::max(header_.maxInstances, frame.count);
+		return Check();
+	}
+
+	// Writes the frame table and the header, and closes the file. Returns whether everything made it to disk.
+	bool Close()
+	{
+		if (!file_.is_open())
+		{
+			return false;
+		}
+
+		header_.numFrames = static_cast<uint32_t>(frames_.size());
+		header_.frameTableOffset = Align();
+		file_.write(reinterpret_cast<const char*>(frames_.data()),
+		            static_cast<std::streamsize>(frames_.size() * sizeof(ParticleCacheFrame)));
+		file_.seekp(0);
+		file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+		const auto isWritten = Check();
+		file_.close();
+		return isWritten;
+	}
+
+	size_t NumFrames() const
+	{
+		return frames_.size();
+	}
+
+private:
+	// Pads the file up to the next chunk boundary, and returns the offset it ends at.
+	uint64_t Align()
+	{
+		const auto offset = static_cast<uint64_t>(file_.tellp());
+		const auto padding = (ParticleCache::CHUNK_ALIGNMENT - offset % ParticleCache::CHUNK_ALIGNMENT) %
+		                     ParticleCache::CHUNK_ALIGNMENT;
+		static const char zeros[ParticleCache::CHUNK_ALIGNMENT] = {};
+		file_.write(zeros, static_cast<std::streamsize>(padding));
+		return offset + padding;
+	}
+
+	bool Check()
+	{
+		if (!file_)
+		{
+			std::cerr << "Failed to write particle cache [" << filename_ << "]." << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	std::ofstream file_;
+	std::string filename_;
+	ParticleCacheHeader header_;
+	std::vector<ParticleCacheFrame> frames_;
+};
@@ -0,0 +1,814 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "ParticleEvent.h"
+#include "ParticleKernels.h"
+#include "ParticlePool.h"
+
+// How particles react when they hit a ParticleCollider.
+struct ParticleCollisionSettings
+{
+	enum Response
+	{
+		// Reflect off the surface, losing speed to restitution and friction.
+		BOUNCE,
+		// Die on contact.
+		KILL
+	};
+
+	Response response = BOUNCE;
+	// Radius of the sphere swept along each particle's step. Also how far bouncing particles are kept from surfaces.
+	float radius = 0.005f;
+	// Fraction of the speed along the surface normal that is kept, reversed.
+	float restitution = 0.5f;
+	// Fraction of the speed along the surface that is lost on every bounce.
+	float friction = 0.2f;
+};
+
+// Static triangle geometry particles collide with (eg. from Scene::BuildParticleCollider()), in world space.
+// A bounding volume hierarchy over the triangles is built once, with the surface area heuristic over binned
+// centroids, then collapsed into a 4-wide tree whose child boxes are tested together with SSE. Each simulation step
+// sweeps every particle's sphere from its previous to its new position, and resolves the earliest hit. Short sweeps
+// skip the top of the tree: a coarse grid over the bounds holds, per cell, the few deepest nodes all the triangles near
+// the cell lie under (or none), which they start from instead of the root.
+// The sweep is exact over the faces of the triangles, but edges and corners are not rounded off: a sphere grazing an
+// edge is caught when its center crosses the triangle instead. That only shows with spheres that are large next to the
+// triangles, and no particle tunnels through a closed mesh either way.
+class ParticleCollider
+{
+public:
+	ParticleCollider() = default;
+
+	// corners holds three per triangle.
+	explicit ParticleCollider(const std::vector<glm::vec3>& corners)
+	{
+		Build(corners);
+	}
+
+	void Build(const std::vector<glm::vec3>& corners)
+	{
+		const auto numTriangles = corners.size() / 3;
+		triangles_.clear();
+		triangles_.reserve(numTriangles);
+		std::vector<BuildTriangle> buildTriangles;
+		buildTriangles.reserve(numTriangles);
+		for (size_t i = 0; i < numTriangles; ++i)
+		{
+			const auto& v0 = corners[3 * i];
+			const auto& v1 = corners[3 * i + 1];
+			const auto& v2 = corners[3 * i + 2];
+			const auto normal = glm::cross(v1 - v0, v2 - v0);
+			// Degenerate triangles have no face to hit.
+			if (glm::dot(normal, normal) <= 0.0f)
+			{
+				continue;
+			}
+
+			BuildTriangle triangle;
+			triangle.boundsMin = glm::min(glm::min(v0, v1), v2);
+			triangle.boundsMax = glm::max(glm::max(v0, v1), v2);
+			triangle.centroid = (v0 + v1 + v2) / 3.0f;
+			triangle.index = static_cast<uint32_t>(triangles_.size());
+			buildTriangles.push_back(triangle);
+			triangles_.push_back(MakeTriangle(v0, v1, v2));
+		}
+
+		wideNodes_.clear();
+		boundsMin_ = glm::vec3(std::numeric_limits<float>::max());
+		boundsMax_ = glm::vec3(std::numeric_limits<float>::lowest());
+		if (buildTriangles.empty())
+		{
+			return;
+		}
+
+		std::vector<Node> nodes;
+		nodes.reserve(2 * buildTriangles.size());
+		nodes.emplace_back();
+		BuildNodes(buildTriangles, nodes);
+		boundsMin_ = nodes[0].boundsMin;
+		boundsMax_ = nodes[0].boundsMax;
+
+		// A root that is a leaf still goes into a wide node, in its first lane.
+		if (nodes[0].count != 0)
+		{
+			wideNodes_.emplace_back();
+			SetLane(wideNodes_[0], 0, nodes[0], nodes[0].first);
+		}
+		else
+		{
+			Collapse(nodes, 0);
+		}
+
+		// Leaves index triangles_ directly, in tree order.
+		std::vector<Triangle> ordered;
+		ordered.reserve(buildTriangles.size());
+		for (const auto& triangle : buildTriangles)
+		{
+			ordered.push_back(triangles_[triangle.index]);
+		}
+		triangles_.swap(ordered);
+
+		BuildEntryCells();
+	}
+
+	// Sweeps the particles [begin, end) from their previous to their current position, and applies the response to
+	// the ones that hit something. stepScale is the step's deltaTime / dampening, which turns velocities into
+	// distances. Returns how many particles hit, and raises a PARTICLE_EVENT_COLLISION into events for each, if given.
+	// Particles are gathered in batches first, so those far from every triangle cost a bounds check and nothing more.
+	size_t Collide(const ParticlePool& pool, const size_t begin, const size_t end, const float stepScale,
+	               const ParticleCollisionSettings& settings, ParticleEventBuffer* events = nullptr) const
+	{
+		const auto* const previousX = pool.PreviousX();
+		const auto* const previousY = pool.PreviousY();
+		const auto* const previousZ = pool.PreviousZ();
+		auto* const px = pool.PositionX();
+		auto* const py = pool.PositionY();
+		auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+		auto* const life = pool.Life();
+		if (wideNodes_.empty())
+		{
+			return 0;
+		}
+
+		const auto rootMin = boundsMin_ - settings.radius;
+		const auto rootMax = boundsMax_ + settings.radius;
+
+		size_t hits = 0;
+		ParticleEventWriter eventWriter(events);
+		std::array<uint32_t, BATCH_SIZE> candidates;
+		for (auto batch = begin; batch < end; batch += BATCH_SIZE)
+		{
+			const auto batchEnd = std::min(batch + BATCH_SIZE, end);
+			size_t numCandidates = 0;
+			for (auto i = batch; i < batchEnd; ++i)
+			{
+				const auto overlaps =
+					std::min(previousX[i], px[i]) <= rootMax.x && std::max(previousX[i], px[i]) >= rootMin.x &&
+					std::min(previousY[i], py[i]) <= rootMax.y && std::max(previousY[i], py[i]) >= rootMin.y &&
+					std::min(previousZ[i], pz[i]) <= rootMax.z && std::max(previousZ[i], pz[i]) >= rootMin.z;
+				candidates[numCandidates] = static_cast<uint32_t>(i);
+				numCandidates += overlaps ? 1 : 0;
+			}
+
+			for (size_t c = 0; c < numCandidates; ++c)
+			{
+				const auto i = candidates[c];
+				auto from = glm::vec3(previousX[i], previousY[i], previousZ[i]);
+				auto to = glm::vec3(px[i], py[i], pz[i]);
+				auto velocity = glm::vec3(vx[i], vy[i], vz[i]);
+
+				Hit hit;
+				if (!Sweep(from, to, settings.radius, hit))
+				{
+					continue;
+				}
+				++hits;
+				eventWriter.Add(PARTICLE_EVENT_COLLISION, hit.position, velocity);
+
+				if (settings.response == ParticleCollisionSettings::KILL)
+				{
+					life[i] = 0.0f;
+					to = hit.position;
+				}
+				else
+				{
+					// The rest of the step continues along the reflected velocity, which may hit again (eg. in a
+					// corner). Past MAX_BOUNCES, the particle stops at its last contact. Each sweep's hit time is a
+					// fraction of that sweep only, so what is left of the whole step is carried along.
+					auto remaining = 1.0f;
+					for (auto bounce = 1;; ++bounce)
+					{
+						velocity = Reflect(velocity, hit.normal, settings);
+						remaining *= 1.0f - hit.time;
+						from = hit.position;
+						to = from + velocity * stepScale * remaining;
+						if (!Sweep(from, to, settings.radius, hit))
+						{
+							break;
+						}
+						to = hit.position;
+						if (bounce == MAX_BOUNCES)
+						{
+							break;
+						}
+					}
+				}
+
+				px[i] = to.x;
+				py[i] = to.y;
+				pz[i] = to.z;
+				vx[i] = velocity.x;
+				vy[i] = velocity.y;
+				vz[i] = velocity.z;
+			}
+		}
+		return hits;
+	}
+
+	struct Hit
+	{
+		// Fraction of the way from from to to at contact.
+		float time;
+		// Center of the sphere at contact, radius away from the surface.
+		glm::vec3 position;
+		// Unit normal of the surface, facing the side the sphere came from.
+		glm::vec3 normal;
+	};
+
+	// Earliest contact of a sphere of radius moving from from to to. Spheres already within radius of a face count as
+	// hitting it at time 0 while they move further in, and not when they move out.
+	bool Sweep(const glm::vec3& from, const glm::vec3& to, const float radius, Hit& hit) const
+	{
+		const auto sweepMin = glm::min(from, to) - radius;
+		const auto sweepMax = glm::max(from, to) + radius;
+		const auto motion = to - from;
+
+		auto found = false;
+		hit.time = std::numeric_limits<float>::max();
+		if (wideNodes_.empty())
+		{
+			return false;
+		}
+
+		std::array<uint32_t, MAX_STACK_SIZE> stack;
+		size_t stackSize = 0;
+		const auto* const entryCell = FindEntryCell(sweepMin, sweepMax);
+		if (entryCell)
+		{
+			for (; stackSize < entryCell->count; ++stackSize)
+			{
+				stack[stackSize] = entryCell->nodes[stackSize];
+			}
+		}
+		else
+		{
+			stack[stackSize++] = 0;
+		}
+		while (stackSize > 0)
+		{
+			const auto& node = wideNodes_[stack[--stackSize]];
+			for (auto mask = OverlapMask(node, sweepMin, sweepMax); mask != 0; mask &= mask - 1)
+			{
+				const auto lane = CountTrailingZeros(mask);
+				if (node.count[lane] == 0)
+				{
+					stack[stackSize++] = node.first[lane];
+					continue;
+				}
+
+				for (auto t = node.first[lane]; t < node.first[lane] + node.count[lane]; ++t)
+				{
+					found |= SweepTriangle(triangles_[t], from, motion, radius, hit);
+				}
+			}
+		}
+		return found;
+	}
+
+	size_t NumTriangles() const
+	{
+		return triangles_.size();
+	}
+
+	// Nodes of the 4-wide tree.
+	size_t NumNodes() const
+	{
+		return wideNodes_.size();
+	}
+
+	// Empty (min above max) when there are no triangles.
+	glm::vec3 BoundsMin() const
+	{
+		return boundsMin_;
+	}
+
+	glm::vec3 BoundsMax() const
+	{
+		return boundsMax_;
+	}
+
+private:
+	// Particles gathered per batch in Collide().
+	static constexpr size_t BATCH_SIZE = 256;
+	static constexpr int MAX_BOUNCES = 2;
+	static constexpr size_t MAX_LEAF_TRIANGLES = 4;
+	static constexpr int NUM_BINS = 16;
+	static constexpr int WIDTH = 4;
+	// Triangles per cell of the entry grid, roughly, the most cells it has along an axis, and the most nodes a cell
+	// starts the sweeps from.
+	static constexpr size_t ENTRY_CELL_TRIANGLES = 2;
+	static constexpr int MAX_ENTRY_RESOLUTION = 256;
+	static constexpr uint32_t MAX_ENTRY_NODES = 4;
+	// Past MAX_SAH_DEPTH, the build halves the triangle ranges, so no binary tree gets deeper than 64 levels, and no
+	// wide tree either. Each wide level leaves at most WIDTH - 1 nodes on the traversal stack, on top of the entry
+	// nodes.
+	static constexpr uint32_t MAX_SAH_DEPTH = 32;
+	static constexpr size_t MAX_STACK_SIZE = 64 * (WIDTH - 1) + MAX_ENTRY_NODES;
+
+	// Node of the binary tree the build makes. Interior nodes have count 0 and their children at first and first + 1.
+	// Leaves hold triangles_[first, first + count).
+	struct Node
+	{
+		glm::vec3 boundsMin;
+		uint32_t first;
+		glm::vec3 boundsMax;
+		uint32_t count;
+	};
+
+	// Up to WIDTH children, with their bounds laid out lane by lane for OverlapMask(). Lanes with a count hold
+	// triangles_[first, first + count); lanes without point at another wide node. Unused lanes have empty bounds,
+	// which nothing overlaps.
+	struct alignas(16) WideNode
+	{
+		float minX[WIDTH];
+		float minY[WIDTH];
+		float minZ[WIDTH];
+		float maxX[WIDTH];
+		float maxY[WIDTH];
+		float maxZ[WIDTH];
+		uint32_t first[WIDTH];
+		uint32_t count[WIDTH];
+
+		WideNode()
+		{
+			for (auto lane = 0; lane < WIDTH; ++lane)
+			{
+				minX[lane] = minY[lane] = minZ[lane] = std::numeric_limits<float>::max();
+				maxX[lane] = maxY[lane] = maxZ[lane] = std::numeric_limits<float>::lowest();
+				first[lane] = 0;
+				count[lane] = 0;
+			}
+		}
+	};
+
+	// Nodes the sweeps within a cell of the entry grid start from. None when no triangle comes near the cell.
+	struct EntryCell
+	{
+		uint32_t nodes[MAX_ENTRY_NODES];
+		uint32_t count;
+	};
+
+	struct Triangle
+	{
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+		glm::vec3 normal;
+		// Barycentric solve of a point in the plane: dot products of the edges, over their determinant.
+		float edge11;
+		float edge12;
+		float edge22;
+		float inverseDeterminant;
+	};
+
+	struct BuildTriangle
+	{
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		glm::vec3 centroid;
+		uint32_t index;
+	};
+
+	struct Bin
+	{
+		glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+		size_t count = 0;
+
+		void Grow(const glm::vec3& pointMin, const glm::vec3& pointMax)
+		{
+			boundsMin = glm::min(boundsMin, pointMin);
+			boundsMax = glm::max(boundsMax, pointMax);
+		}
+
+		float HalfArea() const
+		{
+			const auto extent = boundsMax - boundsMin;
+			return count ? extent.x * extent.y + extent.y * extent.z + extent.z * extent.x : 0.0f;
+		}
+	};
+
+	static Triangle MakeTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+	{
+		Triangle triangle;
+		triangle.v0 = v0;
+		triangle.edge1 = v1 - v0;
+		triangle.edge2 = v2 - v0;
+		triangle.normal = glm::normalize(glm::cross(triangle.edge1, triangle.edge2));
+		triangle.edge11 = glm::dot(triangle.edge1, triangle.edge1);
+		triangle.edge12 = glm::dot(triangle.edge1, triangle.edge2);
+		triangle.edge22 = glm::dot(triangle.edge2, triangle.edge2);
+		triangle.inverseDeterminant = 1.0f / (triangle.edge11 * triangle.edge22 - triangle.edge12 * triangle.edge12);
+		return triangle;
+	}
+
+	// Bit i is set when lane i's box overlaps [boundsMin, boundsMax].
+	static unsigned OverlapMask(const WideNode& node, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+#if PARTICLE_KERNELS_X86
+		const auto overlapsX = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.minX), _mm_set1_ps(boundsMax.x)),
+		                                  _mm_cmpge_ps(_mm_load_ps(node.maxX), _mm_set1_ps(boundsMin.x)));
+		const auto overlapsY = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.minY), _mm_set1_ps(boundsMax.y)),
+		                                  _mm_cmpge_ps(_mm_load_ps(node.maxY), _mm_set1_ps(boundsMin.y)));
+		const auto overlapsZ = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.minZ), _mm_set1_ps(boundsMax.z)),
+		                                  _mm_cmpge_ps(_mm_load_ps(node.maxZ), _mm_set1_ps(boundsMin.z)));
+		return static_cast<unsigned>(_mm_movemask_ps(_mm_and_ps(_mm_and_ps(overlapsX, overlapsY), overlapsZ)));
+#else
+		unsigned mask = 0;
+		for (auto lane = 0; lane < WIDTH; ++lane)
+		{
+			const auto overlaps = node.minX[lane] <= boundsMax.x && node.maxX[lane] >= boundsMin.x &&
+			                      node.minY[lane] <= boundsMax.y && node.maxY[lane] >= boundsMin.y &&
+			                      node.minZ[lane] <= boundsMax.z && node.maxZ[lane] >= boundsMin.z;
+			mask |= overlaps ? 1u << lane : 0u;
+		}
+		return mask;
+#endif
+	}
+
+	// Index of the lowest set bit of a non-zero mask.
+	static int CountTrailingZeros(const unsigned mask)
+	{
+#if GLM_COMPILER & GLM_COMPILER_VC
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// Fills the entry grid: cubic cells as far as the bounds allow, shrunk until there are about ENTRY_CELL_TRIANGLES
+	// triangles per cell. Each cell, grown by half a cell on every side, starts from the root and opens up the nodes
+	// whose overlapping lanes are all interior ones, while they fit in MAX_ENTRY_NODES: the triangles that may touch a
+	// sweep within the grown cell all lie under the nodes left.
+	void BuildEntryCells()
+	{
+		const auto extent = boundsMax_ - boundsMin_;
+		const auto numCells = [](const glm::ivec3& resolution)
+		{
+			return static_cast<size_t>(resolution.x) * resolution.y * resolution.z;
+		};
+		const auto targetCells = std::max<size_t>(triangles_.size() / ENTRY_CELL_TRIANGLES, 1);
+		auto cellSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, std::numeric_limits<float>::min()));
+		entryResolution_ = glm::ivec3(1);
+		while (numCells(entryResolution_) < targetCells &&
+		       std::max(std::max(entryResolution_.x, entryResolution_.y), entryResolution_.z) < MAX_ENTRY_RESOLUTION)
+		{
+			cellSize *= 0.8f;
+			entryResolution_ = glm::clamp(glm::ivec3(glm::ceil(extent / cellSize)), 1, MAX_ENTRY_RESOLUTION);
+		}
+		entryCellSize_ = cellSize;
+
+		entryCells_.resize(numCells(entryResolution_));
+		for (auto z = 0; z < entryResolution_.z; ++z)
+		{
+			for (auto y = 0; y < entryResolution_.y; ++y)
+			{
+				for (auto x = 0; x < entryResolution_.x; ++x)
+				{
+					glm::vec3 grownMin;
+					glm::vec3 grownMax;
+					GrownEntryCell(glm::ivec3(x, y, z), grownMin, grownMax);
+					auto& cell = entryCells_[(static_cast<size_t>(z) * entryResolution_.y + y) * entryResolution_.x + x];
+					cell.nodes[0] = 0;
+					cell.count = 1;
+					for (uint32_t entry = 0; entry < cell.count;)
+					{
+						const auto& node = wideNodes_[cell.nodes[entry]];
+						const auto mask = OverlapMask(node, grownMin, grownMax);
+						// A lane's box may overlap the cell where none of the boxes within it do.
+						if (mask == 0)
+						{
+							cell.nodes[entry] = cell.nodes[--cell.count];
+							continue;
+						}
+
+						uint32_t numLanes = 0;
+						auto interior = true;
+						for (auto lanes = mask; lanes != 0; lanes &= lanes - 1)
+						{
+							++numLanes;
+							interior = interior && node.count[CountTrailingZeros(lanes)] == 0;
+						}
+						if (!interior || cell.count - 1 + numLanes > MAX_ENTRY_NODES)
+						{
+							++entry;
+							continue;
+						}
+
+						// The first lane takes the node's place, and is looked at next.
+						cell.nodes[entry] = node.first[CountTrailingZeros(mask)];
+						for (auto lanes = mask & (mask - 1); lanes != 0; lanes &= lanes - 1)
+						{
+							cell.nodes[cell.count++] = node.first[CountTrailingZeros(lanes)];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Entry cell a sweep within [sweepMin, sweepMax] starts from: the one around its center, if the sweep stays within
+	// the grown cell. Otherwise (NaNs included) nullptr, and the sweep starts from the root.
+	const EntryCell* FindEntryCell(const glm::vec3& sweepMin, const glm::vec3& sweepMax) const
+	{
+		const auto coordinate = (0.5f * (sweepMin + sweepMax) - boundsMin_) / entryCellSize_;
+		glm::ivec3 cell;
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			const auto last = static_cast<float>(entryResolution_[axis] - 1);
+			cell[axis] = coordinate[axis] > 0.0f ? static_cast<int>(std::min(coordinate[axis], last)) : 0;
+		}
+
+		glm::vec3 grownMin;
+		glm::vec3 grownMax;
+		GrownEntryCell(cell, grownMin, grownMax);
+		if (!(glm::all(glm::greaterThanEqual(sweepMin, grownMin)) && glm::all(glm::lessThanEqual(sweepMax, grownMax))))
+		{
+			return nullptr;
+		}
+		return &entryCells_[(static_cast<size_t>(cell.z) * entryResolution_.y + cell.y) * entryResolution_.x + cell.x];
+	}
+
+	// Bounds of an entry cell grown by half a cell on every side, computed the same way for the build and the sweeps.
+	void GrownEntryCell(const glm::ivec3& cell, glm::vec3& grownMin, glm::vec3& grownMax) const
+	{
+		grownMin = boundsMin_ + (glm::vec3(cell) - 0.5f) * entryCellSize_;
+		grownMax = boundsMin_ + (glm::vec3(cell) + 1.5f) * entryCellSize_;
+	}
+
+	static void SetLane(WideNode& wideNode, const int lane, const Node& node, const uint32_t first)
+	{
+		wideNode.minX[lane] = node.boundsMin.x;
+		wideNode.minY[lane] = node.boundsMin.y;
+		wideNode.minZ[lane] = node.boundsMin.z;
+		wideNode.maxX[lane] = node.boundsMax.x;
+		wideNode.maxY[lane] = node.boundsMax.y;
+		wideNode.maxZ[lane] = node.boundsMax.z;
+		wideNode.first[lane] = first;
+		wideNode.count[lane] = node.count;
+	}
+
+	static float HalfArea(const Node& node)
+	{
+		const auto extent = node.boundsMax - node.boundsMin;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	// Turns the interior binary node at index into a wide node, and its subtree likewise. Its children are opened up,
+	// largest first, until there are WIDTH of them or only leaves are left. Returns the wide node's index.
+	uint32_t Collapse(const std::vector<Node>& nodes, const uint32_t index)
+	{
+		std::array<uint32_t, WIDTH> children;
+		auto numChildren = 2;
+		children[0] = nodes[index].first;
+		children[1] = nodes[index].first + 1;
+		while (numChildren < WIDTH)
+		{
+			auto largest = -1;
+			for (auto c = 0; c < numChildren; ++c)
+			{
+				if (nodes[children[c]].count == 0 &&
+				    (largest < 0 || HalfArea(nodes[children[c]]) > HalfArea(nodes[children[largest]])))
+				{
+					largest = c;
+				}
+			}
+			if (largest < 0)
+			{
+				break;
+			}
+
+			const auto opened = nodes[children[largest]].first;
+			children[largest] = opened;
+			children[numChildren++] = opened + 1;
+		}
+
+		const auto wideIndex = static_cast<uint32_t>(wideNodes_.size());
+		wideNodes_.emplace_back();
+		for (auto c = 0; c < numChildren; ++c)
+		{
+			const auto& child = nodes[children[c]];
+			const auto first = child.count != 0 ? child.first : Collapse(nodes, children[c]);
+			SetLane(wideNodes_[wideIndex], c, child, first);
+		}
+		return wideIndex;
+	}
+
+	// Sphere against the face of one triangle, from either side. Keeps the hit if it is earlier than hit.time.
+	static bool SweepTriangle(const Triangle& triangle, const glm::vec3& from, const glm::vec3& motion,
+	                          const float radius, Hit& hit)
+	{
+		auto normal = triangle.normal;
+		auto startDistance = glm::dot(normal, from - triangle.v0);
+		auto endDistance = startDistance + glm::dot(normal, motion);
+		if (startDistance < 0.0f)
+		{
+			normal = -normal;
+			startDistance = -startDistance;
+			endDistance = -endDistance;
+		}
+
+		// Moving away, or ending the step short of the surface.
+		if (endDistance >= startDistance || endDistance >= radius)
+		{
+			return false;
+		}
+
+		// First where the sphere touches the plane, which must lie within the triangle. When it touches the plane just
+		// outside an edge, its center may still cross the triangle itself later on.
+		const auto touchTime = startDistance > radius ? (startDistance - radius) / (startDistance - endDistance) : 0.0f;
+		if (TouchTriangle(triangle, from, motion, normal, touchTime, radius, hit))
+		{
+			return true;
+		}
+		return endDistance < 0.0f &&
+		       TouchTriangle(triangle, from, motion, normal, startDistance / (startDistance - endDistance), radius, hit);
+	}
+
+	// Records a hit at time, if it is earlier than hit.time and the sphere center then projects into the triangle.
+	static bool TouchTriangle(const Triangle& triangle, const glm::vec3& from, const glm::vec3& motion,
+	                          const glm::vec3& normal, const float time, const float radius, Hit& hit)
+	{
+		if (time >= hit.time)
+		{
+			return false;
+		}
+
+		const auto center = from + motion * time;
+		const auto touch = center - normal * glm::dot(normal, center - triangle.v0) - triangle.v0;
+		const auto touch1 = glm::dot(touch, triangle.edge1);
+		const auto touch2 = glm::dot(touch, triangle.edge2);
+		const auto u = (triangle.edge22 * touch1 - triangle.edge12 * touch2) * triangle.inverseDeterminant;
+		const auto v = (triangle.edge11 * touch2 - triangle.edge12 * touch1) * triangle.inverseDeterminant;
+		if (u < 0.0f || v < 0.0f || u + v > 1.0f)
+		{
+			return false;
+		}
+
+		hit.time = time;
+		hit.normal = normal;
+		hit.position = triangle.v0 + touch + normal * radius;
+		return true;
+	}
+
+	static glm::vec3 Reflect(const glm::vec3& velocity, const glm::vec3& normal,
+	                         const ParticleCollisionSettings& settings)
+	{
+		const auto normalSpeed = glm::dot(velocity, normal);
+		const auto tangential = velocity - normal * normalSpeed;
+		// Only motion into the surface bounces.
+		const auto bounced = normalSpeed < 0.0f ? -normalSpeed * settings.restitution : normalSpeed;
+		return normal * bounced + tangential * (1.0f - settings.friction);
+	}
+
+	// Splits triangles top-down into the binary tree nodes, reordering them so every node covers a contiguous range.
+	void BuildNodes(std::vector<BuildTriangle>& triangles, std::vector<Node>& nodes) const
+	{
+		struct Task
+		{
+			uint32_t node;
+			uint32_t first;
+			uint32_t count;
+			uint32_t depth;
+		};
+
+		std::vector<Task> tasks;
+		tasks.push_back({ 0, 0, static_cast<uint32_t>(triangles.size()), 0 });
+		while (!tasks.empty())
+		{
+			const auto task = tasks.back();
+			tasks.pop_back();
+
+			Bin bounds;
+			Bin centroidBounds;
+			for (auto i = task.first; i < task.first + task.count; ++i)
+			{
+				bounds.Grow(triangles[i].boundsMin, triangles[i].boundsMax);
+				centroidBounds.Grow(triangles[i].centroid, triangles[i].centroid);
+			}
+			auto& node = nodes[task.node];
+			node.boundsMin = bounds.boundsMin;
+			node.boundsMax = bounds.boundsMax;
+			node.first = task.first;
+			node.count = task.count;
+			if (task.count <= MAX_LEAF_TRIANGLES)
+			{
+				continue;
+			}
+
+			const auto split = task.depth < MAX_SAH_DEPTH
+				? FindSplit(triangles, task.first, task.count, centroidBounds)
+				: Split();
+			auto* const first = triangles.data() + task.first;
+			auto* const last = first + task.count;
+			auto* middle = last;
+			if (split.axis >= 0)
+			{
+				middle = std::partition(first, last, [&](const BuildTriangle& triangle)
+				{
+					return triangle.centroid[split.axis] < split.position;
+				});
+			}
+			// Identical centroids, a heuristic that puts everything on one side, or a tree getting too deep fall back to
+			// halving the range along its longest axis.
+			if (middle == first || middle == last)
+			{
+				const auto extent = centroidBounds.boundsMax - centroidBounds.boundsMin;
+				const auto axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+				middle = first + task.count / 2;
+				std::nth_element(first, middle, last, [axis](const BuildTriangle& a, const BuildTriangle& b)
+				{
+					return a.centroid[axis] < b.centroid[axis];
+				});
+			}
+
+			const auto leftCount = static_cast<uint32_t>(middle - first);
+			const auto left = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			nodes.emplace_back();
+			// node may have moved with the emplaces.
+			nodes[task.node].first = left;
+			nodes[task.node].count = 0;
+			tasks.push_back({ left, task.first, leftCount, task.depth + 1 });
+			tasks.push_back({ left + 1, task.first + leftCount, task.count - leftCount, task.depth + 1 });
+		}
+	}
+
+	struct Split
+	{
+		// -1 when the centroids all coincide.
+		int axis = -1;
+		float position = 0.0f;
+	};
+
+	Split FindSplit(const std::vector<BuildTriangle>& triangles, const uint32_t first, const uint32_t count,
+	                const Bin& centroidBounds) const
+	{
+		Split best;
+		auto bestCost = std::numeric_limits<float>::max();
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			const auto axisMin = centroidBounds.boundsMin[axis];
+			const auto axisExtent = centroidBounds.boundsMax[axis] - axisMin;
+			if (axisExtent <= 0.0f)
+			{
+				continue;
+			}
+
+			std::array<Bin, NUM_BINS> bins;
+			const auto binScale = NUM_BINS / axisExtent;
+			for (auto i = first; i < first + count; ++i)
+			{
+				const auto bin = std::min(static_cast<int>((triangles[i].centroid[axis] - axisMin) * binScale), NUM_BINS - 1);
+				bins[bin].Grow(triangles[i].boundsMin, triangles[i].boundsMax);
+				++bins[bin].count;
+			}
+
+			// Sweep from both ends: the cost of splitting after bin b is the area times count of each side.
+			std::array<float, NUM_BINS - 1> leftCosts;
+			Bin left;
+			for (auto b = 0; b < NUM_BINS - 1; ++b)
+			{
+				left.Grow(bins[b].boundsMin, bins[b].boundsMax);
+				left.count += bins[b].count;
+				leftCosts[b] = left.HalfArea() * left.count;
+			}
+			Bin right;
+			for (auto b = NUM_BINS - 1; b > 0; --b)
+			{
+				right.Grow(bins[b].boundsMin, bins[b].boundsMax);
+				right.count += bins[b].count;
+				const auto cost = leftCosts[b - 1] + right.HalfArea() * right.count;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					best.axis = axis;
+					best.position = axisMin + b / binScale;
+				}
+			}
+		}
+		return best;
+	}
+
+	std::vector<WideNode> wideNodes_;
+	std::vector<Triangle> triangles_;
+	glm::vec3 boundsMin_;
+	glm::vec3 boundsMax_;
+	// Entry grid over the bounds (see BuildEntryCells()), x fastest.
+	std::vector<EntryCell> entryCells_;
+	glm::ivec3 entryResolution_ = glm::ivec3(0);
+	float entryCellSize_ = 0.0f;
+};
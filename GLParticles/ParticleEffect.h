@@ -0,0 +1,1259 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+
+#include "ParticleBounds.h"
+#include "ParticleEffectSettings.h"
+#include "ParticleEvent.h"
+#include "ParticleInstance.h"
+#include "ParticlePool.h"
+#include "ParticleKernels.h"
+#include "ParticleQuantization.h"
+#include "ParticleRandom.h"
+#include "ParticleSort.h"
+#include "ParticleSpatialGrid.h"
+#include "ParticleTrail.h"
+#include "GpuParticleSimulation.h"
+#include "WorkerPool.h"
+#include "StreamingBuffer.h"
+#include "Preamble.glsl"
+
+// Cumulative simulation counters, filled in by both backends. The GPU backend reads its counters back a few frames
+// late, so its spawned/killed/aliveCount trail updates slightly.
+struct ParticleSimulationStats
+{
+	uint64_t updates = 0;
+	uint64_t spawned = 0;
+	uint64_t killed = 0;
+	// Particles that hit the collider (CPU backend only).
+	uint64_t collisions = 0;
+	// Particles drawn by the last completed update.
+	size_t aliveCount = 0;
+};
+
+// Cumulative wall-clock seconds of each stage of the CPU backend, as seen by the thread calling into the effect. A
+// stage split across workers counts once, however many threads ran it.
+struct ParticleStageTimes
+{
+	// Integration, forces, collisions (or the fluid step), removing the dead and rebuilding the neighbor grid.
+	double update = 0.0;
+	// Spawning, from the spawn rate and bursts.
+	double emit = 0.0;
+	double sort = 0.0;
+	// Packing the instances in the vertex format, including its decode bounds. For CACHE effects, copying the frame.
+	double pack = 0.0;
+};
+
+class ParticleEffect
+{
+public:
+	ParticleEffect() = default;
+
+	explicit ParticleEffect(const ParticleEffectSettings& settings)
+		: settings_(settings),
+		  pool_(settings.backend == ParticleEffectSettings::CACHE ? 0 : settings.numParticles),
+		  vao_(new GLuint(0), [](auto id) { if (*id) glDeleteVertexArrays(1, id); delete id; }),
+		  trailVao_(new GLuint(0), [](auto id) { if (*id) glDeleteVertexArrays(1, id); delete id; }),
+		  vertexFormat_(EffectVertexFormat(settings)),
+		  staging_(std::make_shared<std::vector<ParticleInstance>>()),
+		  compactStaging_(std::make_shared<std::vector<ParticleCompactInstance>>()),
+		  trailStaging_(std::make_shared<std::vector<ParticleTrailVertex>>()),
+		  sorter_(std::make_shared<ParticleDepthSorter>()),
+		  grid_(std::make_shared<ParticleSpatialGrid>()),
+		  random_(settings.seed)
+	{
+		sorter_->SetSettings(settings.sort);
+		if (settings.curlNoise.strength != 0.0f)
+		{
+			curlNoise_ = std::make_shared<ParticleCurlNoise>(settings.curlNoise);
+		}
+		if (settings.integrator == ParticleEffectSettings::FLUID)
+		{
+			fluid_ = std::make_shared<ParticleFluid>(settings.fluid);
+		}
+		if (settings.trail.length > 0 && settings.backend == ParticleEffectSettings::CPU)
+		{
+			trails_ = std::make_shared<ParticleTrails>(pool_.Capacity(), settings.trail);
+			trailBounds_.resize(static_cast<size_t>(settings.trail.length) * std::max(settings.trail.interval, 1));
+		}
+		if (settings.backend == ParticleEffectSettings::CPU)
+		{
+			for (const auto& subEmitter : settings.events.subEmitters)
+			{
+				eventTypes_ |= 1u << subEmitter.event;
+			}
+		}
+		if (eventTypes_)
+		{
+			events_ = std::make_shared<ParticleEventBuffer>(static_cast<size_t>(std::max(settings.events.capacity, 0)));
+		}
+		stats_.spawned = Spawn(static_cast<size_t>(std::max(settings.initialBurst, 0)), 0, nullptr);
+		stats_.aliveCount = pool_.Count();
+		if (settings.prewarmTime > 0.0f && settings.backend == ParticleEffectSettings::CPU)
+		{
+			Prewarm();
+		}
+
+		// The GPU simulation starts from the same freshly spawned particles.
+		if (settings.backend == ParticleEffectSettings::GPU)
+		{
+			gpu_ = std::make_shared<GpuParticleSimulation>(settings_, pool_);
+			gpuSteps_ = std::make_shared<std::vector<GpuParticleStep>>();
+		}
+	}
+
+	// Particles per chunk when an update is split across workers. A multiple of ParticlePool::LANE_PADDING, so every
+	// chunk starts on a whole SIMD lane.
+	static constexpr size_t UPDATE_GRAIN_SIZE = 16 * 1024;
+
+	// Advances the simulation by one step of deltaTime: integrates the live particles, swap-removes the ones that died
+	// and spawns new ones from the spawn rate and pending bursts. The work follows the live count, not the capacity.
+	// Called once per fixed step, so results don't depend on the frame rate (see SimulationClock). Does not touch GL, so
+	// it may run off the render thread. If workers is given, large effects are split into chunks across it.
+	// GPU effects only queue the step here; the compute passes need the GL thread and run in Dispatch(). CACHE effects
+	// only move their playback time.
+	void Simulate(const float deltaTime, WorkerPool* workers = nullptr)
+	{
+		++stats_.updates;
+		if (settings_.backend == ParticleEffectSettings::CACHE)
+		{
+			SetCacheTime(cacheTime_ + deltaTime);
+			cacheDelta_ = deltaTime;
+			return;
+		}
+
+		const auto spawnBudget = TakeSpawnBudget(deltaTime);
+		if (gpu_)
+		{
+			gpuSteps_->push_back({ IntegrationStep(deltaTime), spawnBudget });
+			return;
+		}
+
+		const auto updateStart = std::chrono::steady_clock::now();
+		// The trails still draw where the particles were over the steps they cover.
+		if (!trailBounds_.empty())
+		{
+			trailBounds_[stats_.updates % trailBounds_.size()] = stepBounds_;
+		}
+		stepBounds_ = ParticleBounds();
+		std::mutex boundsMutex;
+		if (fluid_)
+		{
+			stats_.collisions += SimulateFluid(deltaTime, workers, boundsMutex);
+		}
+		else
+		{
+			if (curlNoise_)
+			{
+				curlNoise_->Advance(deltaTime, workers);
+			}
+			std::atomic<size_t> collisions(0);
+			ForEachChunk(workers, pool_.Count(), [&](const size_t begin, const size_t end)
+			{
+				collisions += Integrate(deltaTime, begin, end);
+				// Reduced while the chunk is still in cache, rather than in a pass over the whole pool of its own.
+				AddBounds(begin, end, boundsMutex);
+			});
+			stats_.collisions += collisions;
+		}
+		if (trails_ && trails_->Advance())
+		{
+			ForEachChunk(workers, pool_.Count(), [this](const size_t begin, const size_t end)
+			{
+				trails_->Record(pool_, begin, end);
+			});
+		}
+		stats_.killed += RemoveDead();
+		const auto emitStart = std::chrono::steady_clock::now();
+		stats_.spawned += Spawn(spawnBudget, static_cast<uint32_t>(stats_.updates), workers);
+		stats_.aliveCount = pool_.Count();
+		const auto emitEnd = std::chrono::steady_clock::now();
+
+		if (settings_.neighborCellSize > 0.0f)
+		{
+			grid_->Build(pool_, settings_.neighborCellSize, workers);
+		}
+
+		const auto emitSeconds = std::chrono::duration<double>(emitEnd - emitStart).count();
+		stageTimes_.emit += emitSeconds;
+		stageTimes_.update += std::chrono::duration<double>(std::chrono::steady_clock::now() - updateStart).count() -
+		                      emitSeconds;
+	}
+
+	// Sorts the live particles back-to-front as seen through view and packs one instance per particle, alpha of the way
+	// from its position before the last step to its current one, in the effect's VertexFormat(). Effects with trails
+	// also build the ribbon of every particle, in the same order. Call once per frame, after the frame's Simulate()
+	// steps. Does not touch GL either.
+	// The instances go straight into the streaming buffer segment acquired by BeginFrame(), or into CPU-side staging
+	// when there is none (eg. when running headless).
+	// CACHE effects copy the recorded frame nearest to alpha of the way through the last step instead, as it was
+	// recorded (view is ignored).
+	void PrepareDraw(const glm::mat4& view, const float alpha = 1.0f, WorkerPool* workers = nullptr)
+	{
+		alpha_ = alpha;
+		if (gpu_)
+		{
+			return;
+		}
+		if (settings_.backend == ParticleEffectSettings::CACHE)
+		{
+			CopyCacheFrame(workers);
+			return;
+		}
+
+		const auto sortStart = std::chrono::steady_clock::now();
+		Sort(view, workers);
+		const auto packStart = std::chrono::steady_clock::now();
+		UpdateDecode(workers);
+		ForEachChunk(workers, pool_.Count(), [this](const size_t begin, const size_t end)
+		{
+			BuildInstances(begin, end);
+		});
+		if (trails_)
+		{
+			BuildTrails(view, workers);
+		}
+		const auto packEnd = std::chrono::steady_clock::now();
+		stageTimes_.sort += std::chrono::duration<double>(packStart - sortStart).count();
+		stageTimes_.pack += std::chrono::duration<double>(packEnd - packStart).count();
+	}
+
+	// One Simulate() step of deltaTime, drawn as it lands.
+	void Update(const float deltaTime, const glm::mat4& view, WorkerPool* workers = nullptr)
+	{
+		Simulate(deltaTime, workers);
+		PrepareDraw(view, 1.0f, workers);
+	}
+
+	// Acquires the next segment of the effect's streaming buffer, so the following PrepareDraw() writes into mapped GPU
+	// memory. Call on the GL thread before PrepareDraw(). The GL objects are created on first use.
+	// GPU effects collect the counters of an earlier Dispatch() into the statistics instead.
+	void BeginFrame()
+	{
+		if (!*vao_)
+		{
+			CreateVertexArray();
+		}
+
+		if (gpu_)
+		{
+			GpuParticleCounters counters;
+			if (gpu_->BeginFrame(counters))
+			{
+				stats_.spawned += counters.spawnedCount;
+				stats_.killed += counters.killedCount;
+				stats_.aliveCount = counters.instanceCount;
+			}
+			return;
+		}
+
+		stream_.Reserve(MaxInstances() * InstanceSize());
+		mapped_ = stream_.BeginSegment();
+		if (trails_)
+		{
+			if (!*trailVao_)
+			{
+				CreateTrailVertexArray();
+			}
+			trailStream_.Reserve(MaxTrailVertices() * sizeof(ParticleTrailVertex));
+			trailMapped_ = static_cast<ParticleTrailVertex*>(trailStream_.BeginSegment());
+		}
+	}
+
+	// Allocates up front everything the effect otherwise allocates as it fills up: the sort and neighbor grid buffers
+	// and the CPU-side staging at its capacity and, with createGlObjects, its vertex arrays and streaming buffers, which
+	// must then be called on the GL thread. From then on, running the effect allocates neither memory nor GL objects,
+	// but for what WorkerPool jobs take. CPU backend only.
+	void Preallocate(const bool createGlObjects, WorkerPool* workers = nullptr)
+	{
+		sorter_->Reserve(pool_.Capacity());
+		if (settings_.neighborCellSize > 0.0f)
+		{
+			grid_->Reserve(pool_.Capacity(), workers);
+		}
+		staging_->reserve(vertexFormat_ == PARTICLE_VERTEX_FLOAT ? pool_.Capacity() : 0);
+		compactStaging_->reserve(vertexFormat_ == PARTICLE_VERTEX_FLOAT ? 0 : pool_.Capacity());
+		trailStaging_->reserve(MaxTrailVertices());
+		if (!createGlObjects)
+		{
+			return;
+		}
+
+		if (!*vao_)
+		{
+			CreateVertexArray();
+		}
+		stream_.Reserve(MaxInstances() * InstanceSize());
+		if (trails_)
+		{
+			if (!*trailVao_)
+			{
+				CreateTrailVertexArray();
+			}
+			trailStream_.Reserve(MaxTrailVertices() * sizeof(ParticleTrailVertex));
+		}
+	}
+
+	// Restarts the effect as a copy of source moved to position, eg. to recycle it (see ParticleEffectPool). source
+	// must have the same settings but for the position, eg. a freshly created (and prewarmed) effect. Its particles,
+	// trails, bounds, spawn state and statistics are copied over the effect's own storage, so nothing is allocated,
+	// and nothing is left of what the effect did before. The particles it spawns from here on are drawn with seed
+	// rather than source's seed, so restarts given different seeds don't all replay the same spawns. CPU backend only.
+	void Restart(const ParticleEffect& source, const glm::vec3& position, const uint64_t seed)
+	{
+		const auto offset = position - source.settings_.position;
+		settings_.position = position;
+
+		const auto count = std::min(source.pool_.Count(), pool_.Capacity());
+		pool_.SetCount(count);
+		for (size_t stream = 0; stream < ParticlePool::NUM_STREAMS; ++stream)
+		{
+			const auto type = static_cast<ParticlePool::Stream>(stream);
+			std::copy_n(source.pool_.Data(type), pool_.PaddedCount(), pool_.Data(type));
+		}
+		for (const auto axis : { 0, 1, 2 })
+		{
+			auto* const positions = pool_.Data(static_cast<ParticlePool::Stream>(ParticlePool::POSITION_X + axis));
+			auto* const previous = pool_.Data(static_cast<ParticlePool::Stream>(ParticlePool::PREVIOUS_X + axis));
+			for (size_t i = 0; i < count; ++i)
+			{
+				positions[i] += offset[axis];
+				previous[i] += offset[axis];
+			}
+		}
+		if (trails_ && source.trails_)
+		{
+			trails_->CopyFrom(*source.trails_, count, offset);
+		}
+
+		stepBounds_ = source.stepBounds_;
+		stepBounds_.Translate(offset);
+		for (size_t i = 0; i < trailBounds_.size() && i < source.trailBounds_.size(); ++i)
+		{
+			trailBounds_[i] = source.trailBounds_[i];
+			trailBounds_[i].Translate(offset);
+		}
+
+		random_ = ParticleRandom(seed);
+		spawnAccumulator_ = source.spawnAccumulator_;
+		pendingBurst_ = source.pendingBurst_;
+		stats_ = source.stats_;
+		stageTimes_ = ParticleStageTimes();
+		numInstances_ = 0;
+		numTrailVertices_ = 0;
+		alpha_ = 1.0f;
+		sorter_->Invalidate();
+		ClearEvents();
+		if (settings_.neighborCellSize > 0.0f)
+		{
+			grid_->Build(pool_, settings_.neighborCellSize);
+		}
+	}
+
+	// Whether the effect is done: nothing alive and nothing more to spawn, short of a Burst(), eg. once an impact has
+	// faded out and can go back to its ParticleEffectPool.
+	bool IsFinished() const
+	{
+		return stats_.aliveCount == 0 && pendingBurst_ == 0 && settings_.spawnRate * emissionScale_ <= 0.0f;
+	}
+
+	// Queues count particles to spawn on the next step, on top of the spawn rate. Whatever doesn't fit in the capacity
+	// is dropped.
+	void Burst(const size_t count)
+	{
+		pendingBurst_ += count;
+	}
+
+	// Spawns a particle at each of positions[0, count) right away, with the rest of its values drawn as usual, eg. to lay
+	// out a block of fluid (see ParticleFluid::FillBox()). Returns how many fit; the particle limit doesn't apply. CPU
+	// backend only.
+	size_t SpawnAt(const glm::vec3* positions, const size_t count)
+	{
+		const auto first = pool_.Count();
+		const auto spawned = Spawn(count, static_cast<uint32_t>(stats_.updates), nullptr);
+		for (size_t i = 0; i < spawned; ++i)
+		{
+			pool_.PositionX()[first + i] = pool_.PreviousX()[first + i] = positions[i].x;
+			pool_.PositionY()[first + i] = pool_.PreviousY()[first + i] = positions[i].y;
+			pool_.PositionZ()[first + i] = pool_.PreviousZ()[first + i] = positions[i].z;
+		}
+		stepBounds_.Add(ParticleBounds::OfParticles(pool_, first, first + spawned, BoundsSizeScale()));
+		stats_.spawned += spawned;
+		stats_.aliveCount = pool_.Count();
+		return spawned;
+	}
+
+	// Spawns subEmitter.count particles at each event of its type, with the rest of their values drawn as usual and
+	// subEmitter.inheritVelocity of the event's velocity on top, eg. from the Events() of the effect subEmitter belongs
+	// to, once its update is done. Returns how many fit under the capacity and the particle limit. CPU backend only.
+	size_t SpawnFromEvents(const ParticleEventBuffer& events, const ParticleSubEmitter& subEmitter,
+	                       WorkerPool* workers = nullptr)
+	{
+		if (gpu_ || settings_.backend == ParticleEffectSettings::CACHE || subEmitter.count <= 0)
+		{
+			return 0;
+		}
+
+		const auto* const first = events.Data();
+		const auto* const last = first + events.Count();
+		const auto perEvent = static_cast<size_t>(subEmitter.count);
+		const auto matching = static_cast<size_t>(std::count_if(first, last, [&](const ParticleEvent& event)
+		{
+			return event.type == subEmitter.event;
+		}));
+		const auto alive = pool_.Count();
+		const auto budget = std::min(matching * perEvent, particleLimit_ > alive ? particleLimit_ - alive : 0);
+		const auto spawned = Spawn(budget, static_cast<uint32_t>(stats_.updates), workers);
+
+		auto p = alive;
+		for (const auto* event = first; event != last && p < alive + spawned; ++event)
+		{
+			if (event->type != subEmitter.event)
+			{
+				continue;
+			}
+			const auto velocity = event->velocity * subEmitter.inheritVelocity;
+			for (size_t k = 0; k < perEvent && p < alive + spawned; ++k, ++p)
+			{
+				pool_.PositionX()[p] = pool_.PreviousX()[p] = event->position.x;
+				pool_.PositionY()[p] = pool_.PreviousY()[p] = event->position.y;
+				pool_.PositionZ()[p] = pool_.PreviousZ()[p] = event->position.z;
+				pool_.VelocityX()[p] += velocity.x;
+				pool_.VelocityY()[p] += velocity.y;
+				pool_.VelocityZ()[p] += velocity.z;
+			}
+		}
+		stepBounds_.Add(ParticleBounds::OfParticles(pool_, alive, alive + spawned, BoundsSizeScale()));
+		stats_.spawned += spawned;
+		stats_.aliveCount = pool_.Count();
+		return spawned;
+	}
+
+	// Events raised by the steps since the last ClearEvents(), for the effect's sub-emitters. Null when it has none.
+	const ParticleEventBuffer* Events() const
+	{
+		return events_.get();
+	}
+
+	void ClearEvents()
+	{
+		if (events_)
+		{
+			events_->Clear();
+		}
+	}
+
+	// Moves the playback of a CACHE effect to time (in update time, from the start of the recording), eg. to scrub
+	// through it. Any frame is read on its own, so seeking costs the same wherever it lands.
+	void SetCacheTime(const double time)
+	{
+		cacheTime_ = time;
+		cacheDelta_ = 0.0f;
+		if (settings_.cache && settings_.cache->NumFrames() > 0)
+		{
+			stats_.aliveCount = settings_.cache->Frame(settings_.cache->FrameAt(time, settings_.loopCache)).count;
+		}
+	}
+
+	// Appends the instances of the last PrepareDraw() to writer as a frame, eg. to bake a cache offline from a headless
+	// effect. Call before Draw(). Reading back from a mapped segment is slow, so record from staging where possible.
+	// Returns false for GPU effects, whose instances never reach the CPU.
+	bool RecordFrame(ParticleCacheWriter& writer) const
+	{
+		return !gpu_ && target_ && writer.AppendFrame(target_, numInstances_, decode_);
+	}
+
+	// Multiplies the spawn rate, eg. to thin out a distant effect. Bursts are not scaled.
+	void SetEmissionScale(const float emissionScale)
+	{
+		emissionScale_ = emissionScale;
+	}
+
+	// Most particles the effect may have alive, below its capacity. Spawns (bursts included) stop at the limit; lowering
+	// it doesn't kill anything. The GPU backend compares against its read-back alive count, so it may overshoot briefly.
+	void SetParticleLimit(const size_t particleLimit)
+	{
+		particleLimit_ = particleLimit;
+	}
+
+	// Runs the compute passes of a GPU effect for the steps queued by Simulate() since the last call, and writes its
+	// instances with the alpha given to PrepareDraw(). Call on the GL thread, after PrepareDraw() and before Draw(). Does
+	// nothing for CPU effects.
+	void Dispatch(const ParticleComputePrograms& programs)
+	{
+		if (gpu_)
+		{
+			gpu_->Dispatch(programs, settings_, *gpuSteps_, alpha_);
+			gpuSteps_->clear();
+		}
+	}
+
+	// Draws the instances written by the last PrepareDraw() (or Dispatch()) as camera-facing quads, and fences the
+	// streaming buffer segment they live in. Call on the GL thread with the particle program bound, after BeginFrame()
+	// and PrepareDraw(). Sets the program's decode uniforms for the effect's instances.
+	void Draw()
+	{
+		glUniform4fv(PARTICLE_DECODE_SCALE_UNIFORM_LOCATION, 1, glm::value_ptr(decode_.scale));
+		glUniform4fv(PARTICLE_DECODE_BIAS_UNIFORM_LOCATION, 1, glm::value_ptr(decode_.bias));
+		if (gpu_)
+		{
+			gpu_->Draw(*vao_);
+			return;
+		}
+
+		if (!mapped_)
+		{
+			return;
+		}
+
+		glBindVertexArray(*vao_);
+		glBindVertexBuffer(PARTICLE_INSTANCE_BINDING, stream_.Buffer(), stream_.SegmentOffset(),
+		                   static_cast<GLsizei>(InstanceSize()));
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, NumInstances());
+		glBindVertexArray(0);
+
+		stream_.EndSegment();
+		mapped_ = nullptr;
+	}
+
+	// Draws the trail ribbons written by the last PrepareDraw(), all in one triangle strip, and fences their streaming
+	// buffer segment. Call on the GL thread with the particle trail program bound, after BeginFrame() and PrepareDraw().
+	// Does nothing for effects without trails.
+	void DrawTrails()
+	{
+		if (!trailMapped_)
+		{
+			return;
+		}
+
+		glBindVertexArray(*trailVao_);
+		glBindVertexBuffer(PARTICLE_TRAIL_VERTEX_BINDING, trailStream_.Buffer(), trailStream_.SegmentOffset(),
+		                   sizeof(ParticleTrailVertex));
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, NumTrailVertices());
+		glBindVertexArray(0);
+
+		trailStream_.EndSegment();
+		trailMapped_ = nullptr;
+	}
+
+	GLsizei NumInstances() const
+	{
+		return static_cast<GLsizei>(numInstances_);
+	}
+
+	GLsizei NumTrailVertices() const
+	{
+		return static_cast<GLsizei>(numTrailVertices_);
+	}
+
+	bool HasTrails() const
+	{
+		return trails_ != nullptr;
+	}
+
+	// Most trail vertices one PrepareDraw() may write.
+	size_t MaxTrailVertices() const
+	{
+		return trails_ ? pool_.Capacity() * trails_->VerticesPerTrail() : 0;
+	}
+
+	ParticleVertexFormat VertexFormat() const
+	{
+		return vertexFormat_;
+	}
+
+	// Most instances one PrepareDraw() may write.
+	size_t MaxInstances() const
+	{
+		if (settings_.backend == ParticleEffectSettings::CACHE)
+		{
+			return settings_.cache ? settings_.cache->MaxInstances() : 0;
+		}
+		return pool_.Capacity();
+	}
+
+	// Bytes uploaded per drawn particle.
+	size_t InstanceSize() const
+	{
+		return vertexFormat_ == PARTICLE_VERTEX_FLOAT ? sizeof(ParticleInstance) : sizeof(ParticleCompactInstance);
+	}
+
+	// How particle.vert turns the last PrepareDraw()'s instances back into world space (see ParticleQuantizer).
+	const ParticleInstanceDecode& InstanceDecode() const
+	{
+		return decode_;
+	}
+
+	// Instances of the last PrepareDraw() that ran without a mapped segment (eg. headless), in the effect's format:
+	// StagedInstances() for PARTICLE_VERTEX_FLOAT, StagedCompactInstances() for the others.
+	const std::vector<ParticleInstance>& StagedInstances() const
+	{
+		return *staging_;
+	}
+
+	const std::vector<ParticleCompactInstance>& StagedCompactInstances() const
+	{
+		return *compactStaging_;
+	}
+
+	// Trail vertices of the last PrepareDraw() that ran without a mapped segment.
+	const std::vector<ParticleTrailVertex>& StagedTrailVertices() const
+	{
+		return *trailStaging_;
+	}
+
+	// Time the last BeginFrame() waited for the GPU to release the streaming buffer segment.
+	double FenceWaitMilliseconds() const
+	{
+		return gpu_ ? gpu_->FenceWaitMilliseconds() : stream_.LastWaitMilliseconds();
+	}
+
+	const ParticleEffectSettings& Settings() const
+	{
+		return settings_;
+	}
+
+	ParticleEffectSettings& Settings()
+	{
+		return settings_;
+	}
+
+	// With the GPU backend, this only holds the initial particles.
+	const ParticlePool& Pool() const
+	{
+		return pool_;
+	}
+
+	bool IsGpuSimulated() const
+	{
+		return gpu_ != nullptr;
+	}
+
+	const ParticleSimulationStats& SimulationStats() const
+	{
+		return stats_;
+	}
+
+	// CPU backend only.
+	const ParticleStageTimes& StageTimes() const
+	{
+		return stageTimes_;
+	}
+
+	const ParticleSortStats& SortStats() const
+	{
+		return sorter_->Stats();
+	}
+
+	// Solver of a FLUID effect, null otherwise.
+	const ParticleFluid* Fluid() const
+	{
+		return fluid_.get();
+	}
+
+	// Neighbor grid over Pool() as of the last Simulate(), when Settings().neighborCellSize is set. Empty otherwise.
+	const ParticleSpatialGrid& NeighborGrid() const
+	{
+		return *grid_;
+	}
+
+	// Box everything the effect draws stays within until its next Simulate(), trails included, as the updates reduce
+	// it, for culling. It holds the emitter even when empty. GPU and CACHE effects have no particles on the CPU to
+	// bound, and fall back on the bounding sphere of the settings.
+	ParticleBounds Bounds() const
+	{
+		ParticleBounds bounds;
+		bounds.Add(settings_.position);
+		if (gpu_ || settings_.backend == ParticleEffectSettings::CACHE)
+		{
+			bounds.Add(settings_.position - glm::vec3(settings_.boundingRadius));
+			bounds.Add(settings_.position + glm::vec3(settings_.boundingRadius));
+			return bounds;
+		}
+
+		bounds.Add(stepBounds_);
+		for (const auto& stepBounds : trailBounds_)
+		{
+			bounds.Add(stepBounds);
+		}
+		return bounds;
+	}
+
+private:
+	static ParticleVertexFormat EffectVertexFormat(const ParticleEffectSettings& settings)
+	{
+		switch (settings.backend)
+		{
+		case ParticleEffectSettings::GPU:
+			return PARTICLE_VERTEX_FLOAT;
+		case ParticleEffectSettings::CACHE:
+			return settings.cache ? settings.cache->VertexFormat() : PARTICLE_VERTEX_FLOAT;
+		default:
+			return settings.vertexFormat;
+		}
+	}
+
+	// Effects that fit in one chunk run inline, without wrapping func into a job, which would allocate.
+	template<class Func>
+	static void ForEachChunk(WorkerPool* workers, const size_t count, const Func& func)
+	{
+		if (workers && count > UPDATE_GRAIN_SIZE)
+		{
+			workers->ParallelFor(count, UPDATE_GRAIN_SIZE, func);
+		}
+		else
+		{
+			func(0, count);
+		}
+	}
+
+	// Simulates prewarmTime ahead in coarse steps. The events they raise are dropped, so sub-emitters don't fire all
+	// at once when the effect shows up.
+	void Prewarm()
+	{
+		const auto step = settings_.prewarmStep > 0.0f ? settings_.prewarmStep : settings_.prewarmTime;
+		for (auto remaining = settings_.prewarmTime; remaining > 0.0f; remaining -= step)
+		{
+			Simulate(std::min(step, remaining));
+			ClearEvents();
+		}
+		stageTimes_ = ParticleStageTimes();
+	}
+
+	ParticleIntegration IntegrationStep(const float deltaTime) const
+	{
+		const auto stepScale = deltaTime / settings_.dampening;
+		return { deltaTime, stepScale, settings_.gravity * stepScale };
+	}
+
+	// Returns how many particles hit the collider.
+	size_t Integrate(const float deltaTime, const size_t begin, const size_t end)
+	{
+		// The last chunk runs over the padding, so the SIMD kernels never need a scalar tail.
+		const auto paddedEnd = end == pool_.Count() ? pool_.PaddedCount() : end;
+		const auto step = IntegrationStep(deltaTime);
+
+		// Forces scale like gravity, and land in the velocity before it moves the particles.
+		if (curlNoise_)
+		{
+			curlNoise_->Accelerate(pool_, begin, paddedEnd, step.stepScale);
+		}
+		if (settings_.vectorField)
+		{
+			settings_.vectorField->Accelerate(pool_, begin, paddedEnd, settings_.vectorFieldStrength * step.stepScale);
+		}
+		for (const auto& attractor : settings_.attractors)
+		{
+			attractor.Accelerate(pool_, begin, paddedEnd, step.stepScale);
+		}
+
+		if (settings_.behavior)
+		{
+			settings_.behavior.Update(pool_, begin, paddedEnd, step);
+		}
+		else
+		{
+			ParticleKernels::Integrate(pool_, begin, paddedEnd, step);
+		}
+
+		// Collisions correct the step that was just taken, from the previous positions it saved.
+		const auto collisions = settings_.collider
+			? settings_.collider->Collide(pool_, begin, end, step.stepScale, settings_.collision,
+			                              EventBuffer(PARTICLE_EVENT_COLLISION))
+			: 0;
+		RaiseLifetimeEvents(begin, end, deltaTime);
+		return collisions;
+	}
+
+	// Buffer the events of type go to, null when nothing listens to them.
+	ParticleEventBuffer* EventBuffer(const ParticleEventType type) const
+	{
+		return eventTypes_ & (1u << type) ? events_.get() : nullptr;
+	}
+
+	// Raises PARTICLE_EVENT_LIFETIME for the particles [begin, end) whose life went below the threshold in the step of
+	// deltaTime that just aged them. A pass of its own, so the integration kernels stay branch-free.
+	void RaiseLifetimeEvents(const size_t begin, const size_t end, const float deltaTime)
+	{
+		auto* const events = EventBuffer(PARTICLE_EVENT_LIFETIME);
+		if (!events)
+		{
+			return;
+		}
+
+		ParticleEventWriter eventWriter(events);
+		const auto threshold = settings_.events.lifeThreshold;
+		const auto* const life = pool_.Life();
+		const auto* const decay = pool_.Decay();
+		for (auto i = begin; i < end; ++i)
+		{
+			if (life[i] < threshold && life[i] + decay[i] * deltaTime >= threshold)
+			{
+				eventWriter.Add(PARTICLE_EVENT_LIFETIME, ParticlePosition(i), ParticleVelocity(i));
+			}
+		}
+	}
+
+	glm::vec3 ParticlePosition(const size_t p) const
+	{
+		return glm::vec3(pool_.PositionX()[p], pool_.PositionY()[p], pool_.PositionZ()[p]);
+	}
+
+	glm::vec3 ParticleVelocity(const size_t p) const
+	{
+		return glm::vec3(pool_.VelocityX()[p], pool_.VelocityY()[p], pool_.VelocityZ()[p]);
+	}
+
+	// Grows the bounds of this step by the particles [begin, end), for one of the chunks sharing mutex.
+	void AddBounds(const size_t begin, const size_t end, std::mutex& mutex)
+	{
+		const auto bounds = ParticleBounds::OfParticles(pool_, begin, end, BoundsSizeScale());
+		std::lock_guard<std::mutex> lock(mutex);
+		stepBounds_.Add(bounds);
+	}
+
+	// Reach of a particle past its center, in sizes: half the quad's diagonal, or half the width of its trail.
+	float BoundsSizeScale() const
+	{
+		return trails_ ? std::max(0.71f, 0.5f * settings_.trail.width) : 0.71f;
+	}
+
+	// The fluid moves all particles at once, so aging and collisions run in chunks around it rather than in
+	// Integrate(). Returns how many particles hit the collider.
+	size_t SimulateFluid(const float deltaTime, WorkerPool* workers, std::mutex& boundsMutex)
+	{
+		ForEachChunk(workers, pool_.Count(), [this, deltaTime](const size_t begin, const size_t end)
+		{
+			std::copy(pool_.PositionX() + begin, pool_.PositionX() + end, pool_.PreviousX() + begin);
+			std::copy(pool_.PositionY() + begin, pool_.PositionY() + end, pool_.PreviousY() + begin);
+			std::copy(pool_.PositionZ() + begin, pool_.PositionZ() + end, pool_.PreviousZ() + begin);
+			for (auto i = begin; i < end; ++i)
+			{
+				pool_.Life()[i] -= pool_.Decay()[i] * deltaTime;
+			}
+			RaiseLifetimeEvents(begin, end, deltaTime);
+		});
+
+		fluid_->Step(pool_, deltaTime, workers);
+
+		std::atomic<size_t> collisions(0);
+		ForEachChunk(workers, pool_.Count(), [&](const size_t begin, const size_t end)
+		{
+			if (settings_.collider)
+			{
+				collisions += settings_.collider->Collide(pool_, begin, end, deltaTime * ParticleFluid::TIME_SCALE,
+				                                          settings_.collision, EventBuffer(PARTICLE_EVENT_COLLISION));
+			}
+			AddBounds(begin, end, boundsMutex);
+		});
+		return collisions;
+	}
+
+	// Swap-removes the particles that died, so the live ones stay packed at the start of the pool. Kept out of the
+	// integration kernel so it stays branch-free; only the life stream is scanned, and only dead particles are moved.
+	// Returns how many died.
+	size_t RemoveDead()
+	{
+		const auto* const life = pool_.Life();
+		const auto count = pool_.Count();
+		auto alive = count;
+		ParticleEventWriter eventWriter(EventBuffer(PARTICLE_EVENT_DEATH));
+
+		for (size_t i = 0; i < alive;)
+		{
+			if (life[i] <= 0.0f)
+			{
+				eventWriter.Add(PARTICLE_EVENT_DEATH, ParticlePosition(i), ParticleVelocity(i));
+				// The particle moved in from the end is checked on the next iteration.
+				pool_.CopyParticle(--alive, i);
+				if (trails_)
+				{
+					trails_->CopyParticle(alive, i);
+				}
+			}
+			else
+			{
+				++i;
+			}
+		}
+
+		pool_.SetCount(alive);
+		return count - alive;
+	}
+
+	// Takes the particles due this update: the spawn rate's share of deltaTime plus any pending bursts.
+	size_t TakeSpawnBudget(const float deltaTime)
+	{
+		// An infinite rate times a zero scale (or step) is a NaN, which would stick in the accumulator, so a scale of 0
+		// or less and a NaN product both spawn nothing. Capping at the capacity keeps an infinite rate finite, and a
+		// full effect from building up a backlog.
+		const auto rate = emissionScale_ > 0.0f ? settings_.spawnRate * emissionScale_ * deltaTime : 0.0f;
+		spawnAccumulator_ = std::min(spawnAccumulator_ + (std::isnan(rate) ? 0.0f : rate),
+		                             static_cast<float>(pool_.Capacity()));
+		const auto rateSpawns = std::floor(spawnAccumulator_);
+		spawnAccumulator_ -= rateSpawns;
+
+		const auto budget = static_cast<size_t>(rateSpawns) + pendingBurst_;
+		pendingBurst_ = 0;
+
+		const auto alive = gpu_ ? stats_.aliveCount : pool_.Count();
+		return std::min(budget, particleLimit_ > alive ? particleLimit_ - alive : 0);
+	}
+
+	// Appends up to count new particles after the live ones, drawing their values for frame. Returns how many fit.
+	size_t Spawn(const size_t count, const uint32_t frame, WorkerPool* workers)
+	{
+		const auto first = pool_.Count();
+		const auto spawned = std::min(count, pool_.Capacity() - first);
+		pool_.SetCount(first + spawned);
+
+		// The custom spawn functions (eg. rand() based ones) aren't expected to be thread-safe, so they spawn serially.
+		const auto spawnWorkers = settings_.decayFunc || settings_.velocityFunc ? nullptr : workers;
+		std::mutex boundsMutex;
+		ForEachChunk(spawnWorkers, spawned, [&](const size_t begin, const size_t end)
+		{
+			std::array<uint32_t, ParticleRandom::BATCH_SIZE> indices;
+			for (auto batch = begin; batch < end; batch += indices.size())
+			{
+				const auto batchCount = std::min(indices.size(), end - batch);
+				for (size_t i = 0; i < batchCount; ++i)
+				{
+					indices[i] = static_cast<uint32_t>(first + batch + i);
+				}
+				SpawnBatch(indices.data(), batchCount, frame);
+			}
+			AddBounds(first + begin, first + end, boundsMutex);
+		});
+		if (trails_)
+		{
+			trails_->Reset(first, first + spawned);
+		}
+		return spawned;
+	}
+
+	// Spawns the particles indices[0, count), count <= ParticleRandom::BATCH_SIZE, drawing their values for frame.
+	void SpawnBatch(const uint32_t* indices, const size_t count, const uint32_t frame)
+	{
+		if (settings_.behavior)
+		{
+			settings_.behavior.Spawn(random_, frame, indices, count, settings_.position, pool_);
+			return;
+		}
+
+		std::array<float, ParticleRandom::BATCH_SIZE> decay;
+		std::array<float, ParticleRandom::BATCH_SIZE> vx;
+		std::array<float, ParticleRandom::BATCH_SIZE> vy;
+		std::array<float, ParticleRandom::BATCH_SIZE> vz;
+
+		if (!settings_.decayFunc)
+		{
+			random_.FillUniform(SPAWN_DECAY_STREAM, frame, indices, count, decay.data(), settings_.decayRange.x,
+			                    settings_.decayRange.y);
+		}
+		if (!settings_.velocityFunc)
+		{
+			random_.FillUnitBall(SPAWN_VELOCITY_STREAM, frame, indices, count, vx.data(), vy.data(), vz.data());
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto index = indices[i];
+			const auto velocity = settings_.velocityFunc
+				? settings_.velocityFunc()
+				: glm::vec3(vx[i], vy[i], vz[i]) * settings_.speed;
+
+			pool_.PositionX()[index] = settings_.position.x;
+			pool_.PositionY()[index] = settings_.position.y;
+			pool_.PositionZ()[index] = settings_.position.z;
+			pool_.PreviousX()[index] = settings_.position.x;
+			pool_.PreviousY()[index] = settings_.position.y;
+			pool_.PreviousZ()[index] = settings_.position.z;
+			pool_.VelocityX()[index] = velocity.x;
+			pool_.VelocityY()[index] = velocity.y;
+			pool_.VelocityZ()[index] = velocity.z;
+			pool_.Life()[index] = 1.0f;
+			pool_.Decay()[index] = settings_.decayFunc ? settings_.decayFunc() : decay[i];
+			pool_.Size()[index] = settings_.particleSize;
+		}
+	}
+
+	void Sort(const glm::mat4& view, WorkerPool* workers)
+	{
+		sorter_->Sort(pool_, view, workers);
+		numInstances_ = sorter_->Order().size();
+		AcquireTarget();
+	}
+
+	// Points target_ at where this frame's numInstances_ instances go.
+	void AcquireTarget()
+	{
+		if (mapped_)
+		{
+			target_ = mapped_;
+		}
+		else if (vertexFormat_ == PARTICLE_VERTEX_FLOAT)
+		{
+			staging_->resize(numInstances_);
+			target_ = staging_->data();
+		}
+		else
+		{
+			compactStaging_->resize(numInstances_);
+			target_ = compactStaging_->data();
+		}
+	}
+
+	// Copies the cache frame due at alpha of the way through the last step straight from the mapping into the target.
+	void CopyCacheFrame(WorkerPool* workers)
+	{
+		const auto packStart = std::chrono::steady_clock::now();
+		const auto* const cache = settings_.cache.get();
+		if (!cache || cache->NumFrames() == 0)
+		{
+			numInstances_ = 0;
+			return;
+		}
+
+		const auto frame = cache->FrameAt(cacheTime_ - (1.0f - alpha_) * cacheDelta_, settings_.loopCache);
+		numInstances_ = cache->Frame(frame).count;
+		decode_ = cache->Frame(frame).decode;
+		AcquireTarget();
+
+		const auto* const source = static_cast<const uint8_t*>(cache->Instances(frame));
+		auto* const target = static_cast<uint8_t*>(target_);
+		const auto instanceSize = InstanceSize();
+		ForEachChunk(workers, numInstances_, [=](const size_t begin, const size_t end)
+		{
+			std::memcpy(target + begin * instanceSize, source + begin * instanceSize, (end - begin) * instanceSize);
+		});
+		stageTimes_.pack += std::chrono::duration<double>(std::chrono::steady_clock::now() - packStart).count();
+	}
+
+	// Picks the decode of this frame's compact instances. Fixed point spreads its range over the bounds of the positions
+	// and sizes about to be written, so nothing gets clamped, even when alpha extrapolates.
+	void UpdateDecode(WorkerPool* workers)
+	{
+		if (vertexFormat_ == PARTICLE_VERTEX_HALF)
+		{
+			decode_ = ParticleQuantizer::HalfDecode(settings_.position);
+		}
+		if (vertexFormat_ != PARTICLE_VERTEX_FIXED16 || pool_.Count() == 0)
+		{
+			return;
+		}
+
+		auto boundsMin = glm::vec4(std::numeric_limits<float>::max());
+		auto boundsMax = glm::vec4(std::numeric_limits<float>::lowest());
+		std::mutex boundsMutex;
+		ForEachChunk(workers, pool_.Count(), [&](const size_t begin, const size_t end)
+		{
+			auto chunkMin = glm::vec4(std::numeric_limits<float>::max());
+			auto chunkMax = glm::vec4(std::numeric_limits<float>::lowest());
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto positionSize = InstancePositionSize(i);
+				chunkMin = glm::min(chunkMin, positionSize);
+				chunkMax = glm::max(chunkMax, positionSize);
+			}
+
+			std::lock_guard<std::mutex> lock(boundsMutex);
+			boundsMin = glm::min(boundsMin, chunkMin);
+			boundsMax = glm::max(boundsMax, chunkMax);
+		});
+		decode_ = ParticleQuantizer::FixedDecode(boundsMin, boundsMax);
+	}
+
+	// Position (alpha of the way from the previous one) and size particle p is drawn with.
+	glm::vec4 InstancePositionSize(const size_t p) const
+	{
+		const auto previous = glm::vec3(pool_.PreviousX()[p], pool_.PreviousY()[p], pool_.PreviousZ()[p]);
+		const auto position = glm::vec3(pool_.PositionX()[p], pool_.PositionY()[p], pool_.PositionZ()[p]);
+		return glm::vec4(glm::mix(previous, position, alpha_), pool_.Size()[p]);
+	}
+
+	// Color particle p is drawn with, fading from initialColor to endColor as it dies.
+	glm::vec4 InstanceColor(const size_t p) const
+	{
+		const auto life = pool_.Life()[p];
+		const auto blend = glm::clamp(life * settings_.colorFalloff, 0.0f, 1.0f);
+		return glm::vec4(glm::mix(settings_.endColor, settings_.initialColor, blend), life);
+	}
+
+	void BuildInstances(const size_t begin, const size_t end)
+	{
+		const auto& order = sorter_->Order();
+		auto* const instances = static_cast<ParticleInstance*>(target_);
+		auto* const compactInstances = static_cast<ParticleCompactInstance*>(target_);
+		const ParticleQuantizer quantizer(vertexFormat_, decode_);
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			const auto p = order[i];
+			const auto positionSize = InstancePositionSize(p);
+			const auto color = InstanceColor(p);
+			if (vertexFormat_ == PARTICLE_VERTEX_FLOAT)
+			{
+				instances[i] = { positionSize, color };
+			}
+			else
+			{
+				quantizer.Encode(positionSize, color, compactInstances[i]);
+			}
+		}
+	}
+
+	// Builds the ribbons of the sorted particles, each VerticesPerTrail() apart, so chunks know where they write without
+	// counting the ones before them.
+	void BuildTrails(const glm::mat4& view, WorkerPool* workers)
+	{
+		const auto verticesPerTrail = trails_->VerticesPerTrail();
+		numTrailVertices_ = numInstances_ * verticesPerTrail;
+		if (trailMapped_)
+		{
+			trailTarget_ = trailMapped_;
+		}
+		else
+		{
+			trailStaging_->resize(numTrailVertices_);
+			trailTarget_ = trailStaging_->data();
+		}
+
+		const auto eye = glm::vec3(glm::inverse(view)[3]);
+		ForEachChunk(workers, numInstances_, [this, eye, verticesPerTrail](const size_t begin, const size_t end)
+		{
+			const auto& order = sorter_->Order();
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto p = order[i];
+				trails_->BuildRibbon(p, InstancePositionSize(p), InstanceColor(p), eye,
+				                     trailTarget_ + i * verticesPerTrail);
+			}
+		});
+	}
+
+	// Both attributes read from one interleaved, per-instance binding. Its buffer offset changes with the streaming
+	// buffer segment, so it is bound in Draw(). Compact instances are widened by the vertex fetch: half floats as they
+	// are, fixed point positions and colors normalized to [0, 1].
+	void CreateVertexArray()
+	{
+		glGenVertexArrays(1, vao_.get());
+		glBindVertexArray(*vao_);
+
+		switch (vertexFormat_)
+		{
+		case PARTICLE_VERTEX_FLOAT:
+			glVertexAttribFormat(PARTICLE_POSITION_SIZE_ATTRIB_LOCATION, 4, GL_FLOAT, GL_FALSE,
+			                     offsetof(ParticleInstance, positionSize));
+			glVertexAttribFormat(PARTICLE_COLOR_ATTRIB_LOCATION, 4, GL_FLOAT, GL_FALSE, offsetof(ParticleInstance, color));
+			break;
+		case PARTICLE_VERTEX_HALF:
+			glVertexAttribFormat(PARTICLE_POSITION_SIZE_ATTRIB_LOCATION, 4, GL_HALF_FLOAT, GL_FALSE,
+			                     offsetof(ParticleCompactInstance, positionSize));
+			break;
+		case PARTICLE_VERTEX_FIXED16:
+			glVertexAttribFormat(PARTICLE_POSITION_SIZE_ATTRIB_LOCATION, 4, GL_UNSIGNED_SHORT, GL_TRUE,
+			                     offsetof(ParticleCompactInstance, positionSize));
+			break;
+		}
+		if (vertexFormat_ != PARTICLE_VERTEX_FLOAT)
+		{
+			glVertexAttribFormat(PARTICLE_COLOR_ATTRIB_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+			                     offsetof(ParticleCompactInstance, color));
+		}
+
+		glVertexAttribBinding(PARTICLE_POSITION_SIZE_ATTRIB_LOCATION, PARTICLE_INSTANCE_BINDING);
+		glEnableVertexAttribArray(PARTICLE_POSITION_SIZE_ATTRIB_LOCATION);
+		glVertexAttribBinding(PARTICLE_COLOR_ATTRIB_LOCATION, PARTICLE_INSTANCE_BINDING);
+		glEnableVertexAttribArray(PARTICLE_COLOR_ATTRIB_LOCATION);
+
+		glVertexBindingDivisor(PARTICLE_INSTANCE_BINDING, 1);
+
+		glBindVertexArray(0);
+	}
+
+	// Per-vertex, with the buffer offset bound in DrawTrails() like the instances.
+	void CreateTrailVertexArray()
+	{
+		glGenVertexArrays(1, trailVao_.get());
+		glBindVertexArray(*trailVao_);
+
+		glVertexAttribFormat(PARTICLE_TRAIL_POSITION_ATTRIB_LOCATION, 3, GL_FLOAT, GL_FALSE,
+		                     offsetof(ParticleTrailVertex, position));
+		glVertexAttribFormat(PARTICLE_TRAIL_COLOR_ATTRIB_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+		                     offsetof(ParticleTrailVertex, color));
+		glVertexAttribBinding(PARTICLE_TRAIL_POSITION_ATTRIB_LOCATION, PARTICLE_TRAIL_VERTEX_BINDING);
+		glEnableVertexAttribArray(PARTICLE_TRAIL_POSITION_ATTRIB_LOCATION);
+		glVertexAttribBinding(PARTICLE_TRAIL_COLOR_ATTRIB_LOCATION, PARTICLE_TRAIL_VERTEX_BINDING);
+		glEnableVertexAttribArray(PARTICLE_TRAIL_COLOR_ATTRIB_LOCATION);
+
+		glBindVertexArray(0);
+	}
+
+	ParticleEffectSettings settings_;
+	ParticlePool pool_;
+
+	std::shared_ptr<GLuint> vao_;
+	StreamingBuffer stream_;
+	// Mapped segment acquired by BeginFrame(), and where the current PrepareDraw() writes its instances.
+	void* mapped_ = nullptr;
+	void* target_ = nullptr;
+	size_t numInstances_ = 0;
+	// The same for the trail ribbons, when the effect has trails.
+	std::shared_ptr<GLuint> trailVao_;
+	StreamingBuffer trailStream_;
+	ParticleTrailVertex* trailMapped_ = nullptr;
+	ParticleTrailVertex* trailTarget_ = nullptr;
+	size_t numTrailVertices_ = 0;
+	ParticleVertexFormat vertexFormat_ = PARTICLE_VERTEX_FLOAT;
+	ParticleInstanceDecode decode_;
+
+	// CPU-side staging, kept across frames so steady-state updates don't allocate. Held by pointer so copies of the
+	// effect (eg. through Scene::ParticleEffects()) stay cheap.
+	std::shared_ptr<std::vector<ParticleInstance>> staging_;
+	std::shared_ptr<std::vector<ParticleCompactInstance>> compactStaging_;
+	std::shared_ptr<std::vector<ParticleTrailVertex>> trailStaging_;
+	std::shared_ptr<ParticleDepthSorter> sorter_;
+	std::shared_ptr<ParticleSpatialGrid> grid_;
+	// Set when the settings enable curl noise.
+	std::shared_ptr<ParticleCurlNoise> curlNoise_;
+	// Set for FLUID effects.
+	std::shared_ptr<ParticleFluid> fluid_;
+	// Set when the settings enable trails.
+	std::shared_ptr<ParticleTrails> trails_;
+	// Bounds of the particles as of the last step, and of the steps before it that the trails still reach back to.
+	ParticleBounds stepBounds_;
+	std::vector<ParticleBounds> trailBounds_;
+	// Set when sub-emitters listen to the effect's events, along with a bit per type of event they listen to.
+	std::shared_ptr<ParticleEventBuffer> events_;
+	uint32_t eventTypes_ = 0;
+	ParticleRandom random_;
+	float spawnAccumulator_ = 0.0f;
+	size_t pendingBurst_ = 0;
+	float emissionScale_ = 1.0f;
+	size_t particleLimit_ = std::numeric_limits<size_t>::max();
+	// Interpolation factor of the last PrepareDraw().
+	float alpha_ = 1.0f;
+	// Playback time of a CACHE effect, and the length of the step that last moved it.
+	double cacheTime_ = 0.0;
+	float cacheDelta_ = 0.0f;
+
+	// Set for GPU effects, along with the steps the next Dispatch() runs. The vector keeps its capacity across frames.
+	std::shared_ptr<GpuParticleSimulation> gpu_;
+	std::shared_ptr<std::vector<GpuParticleStep>> gpuSteps_;
+
+	ParticleSimulationStats stats_;
+	ParticleStageTimes stageTimes_;
+};
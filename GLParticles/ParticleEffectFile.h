@@ -0,0 +1,190 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "ParticleEffectSettings.h"
+#include "ParticleScript.h"
+
+// Text definition of a particle effect, eg.
+//     # Sparks raining on the cube.
+//     numParticles 100
+//     spawnRate 2
+//     position 0 1 0
+//     decayRange 0.0015 0.051
+//     vertexFormat fixed16
+//     update
+//         size = 0.02 * life
+//     end
+// Every line sets one ParticleEffectSettings field, by name, to the values after it (vertexFormat takes float, half or
+// fixed16, backend cpu or gpu, spawnRate inf; the trail fields are trail.length and so on). Fields the file doesn't
+// set keep the values of the settings it is loaded over. Everything after a # is a comment.
+// Optional spawn and update blocks, up to a line holding end, are ParticleScript programs, run by the effect's behavior
+// (see ParticleScriptModules). CPU backend only.
+class ParticleEffectFile
+{
+public:
+	static bool Load(const std::string& filename, ParticleEffectSettings& settings)
+	{
+		std::ifstream file(filename);
+		if (!file)
+		{
+			std::cerr << "Failed to open particle effect file [" << filename << "]." << std::endl;
+			return false;
+		}
+
+		const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		return Parse(text, filename, settings);
+	}
+
+	// Loads the text of an effect file over settings; name only shows in the errors. On failure, settings are left
+	// alone.
+	static bool Parse(const std::string& text, const std::string& name, ParticleEffectSettings& settings)
+	{
+		auto parsed = settings;
+		std::string programs[2];
+		int programLines[2] = { 0, 0 };
+		auto* program = static_cast<std::string*>(nullptr);
+
+		std::istringstream lines(text);
+		std::string line;
+		for (auto lineNumber = 1; std::getline(lines, line); ++lineNumber)
+		{
+			std::istringstream values(line.substr(0, line.find('#')));
+			std::string key;
+			if (!(values >> key))
+			{
+				if (program)
+				{
+					*program += '\n';
+				}
+				continue;
+			}
+
+			if (program)
+			{
+				*program += key == "end" ? "" : line;
+				*program += '\n';
+				program = key == "end" ? nullptr : program;
+				continue;
+			}
+			if (key == "spawn" || key == "update")
+			{
+				const auto stage = key == "spawn" ? ParticleScript::SPAWN : ParticleScript::UPDATE;
+				program = &programs[stage];
+				programLines[stage] = lineNumber + 1;
+				continue;
+			}
+
+			if (!ParseSetting(key, values, parsed) || !(values >> std::ws).eof())
+			{
+				std::cerr << "Invalid setting [" << key << "] on line " << lineNumber << " of particle effect ["
+				          << name << "]." << std::endl;
+				return false;
+			}
+		}
+		if (program)
+		{
+			std::cerr << "Particle effect [" << name << "] ends inside a program." << std::endl;
+			return false;
+		}
+
+		ParticleScriptModules modules;
+		for (const auto stage : { ParticleScript::SPAWN, ParticleScript::UPDATE })
+		{
+			std::string error;
+			auto& script = stage == ParticleScript::SPAWN ? modules.spawn : modules.update;
+			if (!ParticleScript::Compile(programs[stage], stage, script, error, programLines[stage]))
+			{
+				std::cerr << "Particle effect [" << name << "], " << error << "." << std::endl;
+				return false;
+			}
+		}
+
+		if (!modules.spawn.IsEmpty() || !modules.update.IsEmpty())
+		{
+			// Emitters are relative to the effect's position, so the point one sits at its origin.
+			modules.defaults = { {}, { parsed.speed },
+			                     { parsed.decayRange.x, parsed.decayRange.y }, {}, { parsed.particleSize } };
+			parsed.behavior = ParticleBehavior(modules);
+		}
+		settings = parsed;
+		return true;
+	}
+
+private:
+	static bool ParseSetting(const std::string& key, std::istringstream& values, ParticleEffectSettings& settings)
+	{
+		if (key == "numParticles")
+		{
+			return static_cast<bool>(values >> settings.numParticles);
+		}
+		if (key == "initialBurst")
+		{
+			return static_cast<bool>(values >> settings.initialBurst);
+		}
+		if (key == "seed")
+		{
+			return static_cast<bool>(values >> settings.seed);
+		}
+		if (key == "spawnRate")
+		{
+			// strtof takes inf as well; anything it doesn't consume whole (eg. 10x) is rejected, and so is a NaN.
+			std::string rate;
+			values >> rate;
+			char* end = nullptr;
+			settings.spawnRate = std::strtof(rate.c_str(), &end);
+			return !rate.empty() && *end == '\0' && !std::isnan(settings.spawnRate);
+		}
+		if (key == "position" || key == "initialColor" || key == "endColor" || key == "gravity")
+		{
+			auto& vector = key == "position" ? settings.position : key == "initialColor" ? settings.initialColor
+				: key == "endColor" ? settings.endColor : settings.gravity;
+			return static_cast<bool>(values >> vector.x >> vector.y >> vector.z);
+		}
+		if (key == "trail.length" || key == "trail.interval")
+		{
+			return static_cast<bool>(values >> (key == "trail.length" ? settings.trail.length : settings.trail.interval));
+		}
+		if (key == "trail.width")
+		{
+			return static_cast<bool>(values >> settings.trail.width);
+		}
+		if (key == "decayRange")
+		{
+			return static_cast<bool>(values >> settings.decayRange.x >> settings.decayRange.y);
+		}
+		if (key == "colorFalloff" || key == "particleSize" || key == "dampening" || key == "boundingRadius" ||
+		    key == "speed" || key == "neighborCellSize" || key == "prewarmTime" || key == "prewarmStep")
+		{
+			auto& value = key == "colorFalloff" ? settings.colorFalloff : key == "particleSize" ? settings.particleSize
+				: key == "dampening" ? settings.dampening : key == "boundingRadius" ? settings.boundingRadius
+				: key == "speed" ? settings.speed : key == "prewarmTime" ? settings.prewarmTime
+				: key == "prewarmStep" ? settings.prewarmStep : settings.neighborCellSize;
+			return static_cast<bool>(values >> value);
+		}
+		if (key == "vertexFormat")
+		{
+			std::string format;
+			values >> format;
+			settings.vertexFormat = format == "half" ? PARTICLE_VERTEX_HALF
+				: format == "fixed16" ? PARTICLE_VERTEX_FIXED16 : PARTICLE_VERTEX_FLOAT;
+			return format == "float" || format == "half" || format == "fixed16";
+		}
+		if (key == "backend")
+		{
+			std::string backend;
+			values >> backend;
+			settings.backend = backend == "gpu" ? ParticleEffectSettings::GPU : ParticleEffectSettings::CPU;
+			return backend == "cpu" || backend == "gpu";
+		}
+		return false;
+	}
+};
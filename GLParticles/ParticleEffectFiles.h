@@ -0,0 +1,74 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "ParticleEffectFile.h"
+#include "Scene.h"
+
+// Effects of a Scene defined by effect files, reloaded when their file changes, the same way
+// ShaderSet::UpdatePrograms() recompiles shaders.
+class ParticleEffectFiles
+{
+public:
+	// Adds an effect to scene, loaded from filename over base (which holds what files can't express, eg. the texture
+	// and collider), and returns its ID. If the file doesn't load, the effect starts out from base, and picks the file
+	// up once it is fixed.
+	uint32_t Add(Scene& scene, const std::string& filename, const ParticleEffectSettings& base)
+	{
+		auto settings = base;
+		ParticleEffectFile::Load(filename, settings);
+		const auto effectId = scene.AddParticleEffect(settings);
+		files_.push_back({ filename, base, effectId, Timestamp(filename) });
+		return effectId;
+	}
+
+	// Polls the timestamps of the files, and restarts the effects whose file changed from its new definition. An effect
+	// whose file no longer loads keeps running as it was. Call on the GL thread, outside of the particle update.
+	void Update(Scene& scene)
+	{
+		for (auto& file : files_)
+		{
+			const auto timestamp = Timestamp(file.filename);
+			if (timestamp <= file.timestamp)
+			{
+				continue;
+			}
+
+			file.timestamp = timestamp;
+			auto settings = file.base;
+			if (ParticleEffectFile::Load(file.filename, settings))
+			{
+				scene.ParticleEffect(file.effectId) = ParticleEffect(settings);
+			}
+		}
+	}
+
+private:
+	struct File
+	{
+		std::string filename;
+		ParticleEffectSettings base;
+		uint32_t effectId;
+		// Last modification time, 0 when the file is missing.
+		uint64_t timestamp;
+	};
+
+	static uint64_t Timestamp(const std::string& filename)
+	{
+#ifdef _WIN32
+		struct __stat64 status;
+		return _stat64(filename.c_str(), &status) == 0 ? static_cast<uint64_t>(status.st_mtime) : 0;
+#else
+		struct stat status;
+		return stat(filename.c_str(), &status) == 0 ? static_cast<uint64_t>(status.st_mtime) : 0;
+#endif
+	}
+
+	std::vector<File> files_;
+};
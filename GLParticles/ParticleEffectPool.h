@@ -0,0 +1,104 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "ParticleEffect.h"
+
+// Recycles particle effects by type, so that gameplay can start one (eg. an impact) without allocating memory or GL
+// objects, and have it look from its first frame like it has been running for a while.
+// Every instance of a type is created and preallocated up front (see ParticleEffect::Preallocate()), along with an
+// original of the type, simulated once through its prewarm time. Acquire() restarts a free instance as a copy of the
+// original at the position it is wanted, and Release() takes it back once it is done (see
+// ParticleEffect::IsFinished()). Instances move in and out; nothing is copied. Each Acquire() keys the particles the
+// instance spawns by its own seed, so instances playing at once don't spawn in lockstep. CPU backend only.
+class ParticleEffectPool
+{
+public:
+	// Adds a type of effect, with count instances created from settings. With createGlObjects, their GL objects are
+	// created as well, which must then happen on the GL thread. Returns the ID of the type.
+	uint32_t AddType(const ParticleEffectSettings& settings, const size_t count, const bool createGlObjects,
+	                 WorkerPool* workers = nullptr)
+	{
+		Type type;
+		type.original = ParticleEffect(settings);
+
+		// The instances are restarted from the original anyway, so they skip prewarming themselves.
+		auto instanceSettings = settings;
+		instanceSettings.prewarmTime = 0.0f;
+		type.free.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			type.free.emplace_back(instanceSettings);
+			type.free.back().Preallocate(createGlObjects, workers);
+		}
+		type.numInstances = count;
+
+		types_.push_back(std::move(type));
+		return static_cast<uint32_t>(types_.size() - 1);
+	}
+
+	// Moves a free instance of typeId into effect, restarted at position. Returns false, leaving effect alone, while
+	// every instance of the type is in use. Allocates nothing.
+	bool Acquire(const uint32_t typeId, const glm::vec3& position, ParticleEffect& effect)
+	{
+		auto& type = types_[typeId];
+		if (type.free.empty())
+		{
+			++type.misses;
+			return false;
+		}
+
+		effect = std::move(type.free.back());
+		type.free.pop_back();
+		// The settings' seed in the low word, as ParticleRandom keys the original, and the acquire count in the high
+		// one: every instance gets a seed of its own.
+		const auto seed = static_cast<uint64_t>(type.original.Settings().seed) | (++type.acquires << 32);
+		effect.Restart(type.original, position, seed);
+		return true;
+	}
+
+	// Takes back an instance Acquire() handed out for typeId.
+	void Release(const uint32_t typeId, ParticleEffect&& effect)
+	{
+		types_[typeId].free.push_back(std::move(effect));
+	}
+
+	// The prewarmed original instances of typeId restart from.
+	const ParticleEffect& Original(const uint32_t typeId) const
+	{
+		return types_[typeId].original;
+	}
+
+	size_t NumFree(const uint32_t typeId) const
+	{
+		return types_[typeId].free.size();
+	}
+
+	size_t NumInstances(const uint32_t typeId) const
+	{
+		return types_[typeId].numInstances;
+	}
+
+	// Acquire() calls that found no free instance of typeId.
+	uint64_t Misses(const uint32_t typeId) const
+	{
+		return types_[typeId].misses;
+	}
+
+private:
+	struct Type
+	{
+		ParticleEffect original;
+		std::vector<ParticleEffect> free;
+		size_t numInstances = 0;
+		uint64_t acquires = 0;
+		uint64_t misses = 0;
+	};
+
+	std::vector<Type> types_;
+};
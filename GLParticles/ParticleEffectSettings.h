@@ -0,0 +1,112 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ParticleBehavior.h"
+#include "ParticleCache.h"
+#include "ParticleCollision.h"
+#include "ParticleEvent.h"
+#include "ParticleFluid.h"
+#include "ParticleForceField.h"
+#include "ParticleInstance.h"
+#include "ParticleSort.h"
+#include "ParticleTrail.h"
+
+// Per-effect emitter constants. These used to be copied into every particle; they are only read once per update now.
+struct ParticleEffectSettings
+{
+	enum Backend
+	{
+		// Integrated, sorted and packed on the CPU (see ParticleEffect::Update()).
+		CPU,
+		// Integrated, killed and respawned by compute shaders (see GpuParticleSimulation).
+		GPU,
+		// Not simulated at all: plays back the frames recorded in cache.
+		CACHE
+	};
+
+	enum Integrator
+	{
+		// Every particle flies on its own, under gravity and the force fields (see ParticleKernels::Integrate()).
+		BALLISTIC,
+		// The particles push on each other as a liquid (see ParticleFluid). CPU backend only.
+		FLUID
+	};
+
+	// World-space origin that new particles are spawned at.
+	glm::vec3 position = glm::vec3(0.0f);
+	// Color of a particle at full life, and the color it fades towards as it dies.
+	glm::vec3 initialColor = glm::vec3(1.0f, 1.0f, 0.0f);
+	glm::vec3 endColor = glm::vec3(1.0f, 0.0f, 0.0f);
+	// Scales life before it is used as the initialColor/endColor blend factor.
+	float colorFalloff = 0.5f;
+	float particleSize = 0.02f;
+	// Capacity: the most particles alive at once. Only live particles are simulated, sorted and drawn.
+	int numParticles = 0;
+	// Particles spawned per unit of update time (see dampening) while there is capacity for them. Fractions carry over
+	// to the next update. Infinity refills every slot as soon as it frees up.
+	float spawnRate = 0.0f;
+	// Particles spawned when the effect is created. ParticleEffect::Burst() spawns more later on.
+	int initialBurst = 0;
+	// Update time the effect is simulated ahead when it is created, in coarse steps of at most prewarmStep, so it
+	// starts out looking like it has been running for a while (eg. smoke that already rose). CPU backend only.
+	float prewarmTime = 0.0f;
+	float prewarmStep = 100.0f;
+	// Divides both the velocity and the gravity step. The constants are tuned for millisecond time steps.
+	float dampening = 2000.0f;
+	glm::vec3 gravity = glm::vec3(0.0f, -0.8f, 0.0f);
+	// Rough radius of the volume the particles fill around position, for level of detail (see ParticleBudgetManager).
+	float boundingRadius = 1.0f;
+	// Scene texture ID used to draw the particles, -1 for none.
+	int texture = -1;
+	// Spawn distributions used when decayFunc/velocityFunc are not set: decay is uniform in [decayRange.x, decayRange.y)
+	// and velocity uniform in a ball of radius speed. They are drawn from a ParticleRandom keyed by seed, particle index
+	// and update, so spawning is reproducible and runs in parallel with the rest of the update.
+	uint32_t seed = 0;
+	glm::vec2 decayRange = glm::vec2(0.0f);
+	float speed = 0.0f;
+	// Custom spawn functions, called for every spawned particle. They override the distributions above, and make the
+	// effect spawn on the updating thread only, so they needn't be thread-safe.
+	float (*decayFunc)() = nullptr;
+	glm::vec3 (*velocityFunc)() = nullptr;
+	// Modules composed at compile time (see ComposeParticleBehavior()), which effects may share. When set, they spawn the
+	// particles and integrate them in place of all of the above, gravity and particleSize, with no call per particle.
+	// The emitter places the particles relative to position, and should keep them around it, as level of detail and
+	// PARTICLE_VERTEX_HALF expect. The force fields and collisions below still apply. CPU backend only.
+	ParticleBehavior behavior;
+	// Forces added to the velocity every step, on top of gravity. CPU backend only.
+	ParticleCurlNoiseSettings curlNoise;
+	// Baked field (eg. from ParticleVectorField::LoadFga()), which effects may share. Scaled by vectorFieldStrength.
+	std::shared_ptr<const ParticleVectorField> vectorField;
+	float vectorFieldStrength = 1.0f;
+	std::vector<ParticleAttractor> attractors;
+	// Static geometry the particles collide with (eg. from Scene::BuildParticleCollider()), which effects may share.
+	// CPU backend only.
+	std::shared_ptr<const ParticleCollider> collider;
+	ParticleCollisionSettings collision;
+	ParticleSortSettings sort;
+	// Ribbons drawn behind the particles, from their past positions, on top of their quads. CPU backend only.
+	ParticleTrailSettings trail;
+	// Events raised by the particles, and the sub-emitters spawning from them. CPU backend only.
+	ParticleEventSettings events;
+	// Cell size of a ParticleSpatialGrid rebuilt after every simulation step, for neighbor queries. 0 builds none.
+	// CPU backend only.
+	float neighborCellSize = 0.0f;
+	// Layout the instances are uploaded in. The compact ones take 12 bytes per particle instead of 32, within the errors
+	// listed in ParticleQuantizer. Read once, when the effect is created. GPU effects always use PARTICLE_VERTEX_FLOAT.
+	ParticleVertexFormat vertexFormat = PARTICLE_VERTEX_FLOAT;
+	Backend backend = CPU;
+	// FLUID effects ignore gravity and the forces above, and run on the fluid's own constants instead. Their velocities
+	// are in meters per second.
+	Integrator integrator = BALLISTIC;
+	ParticleFluidSettings fluid;
+	// Recording a CACHE effect plays back (eg. from ParticleCache::Load()), which effects may share. Its frames are drawn
+	// as they were recorded, in the cache's vertex format; everything above but backend is ignored.
+	std::shared_ptr<const ParticleCache> cache;
+	// Whether a CACHE effect starts over after its last frame, or holds it.
+	bool loopCache = true;
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum ParticleEventType : uint32_t
+{
+	// The particle died, of old age or on contact with a KILL collider.
+	PARTICLE_EVENT_DEATH,
+	// The particle hit the effect's collider.
+	PARTICLE_EVENT_COLLISION,
+	// The particle's life went below ParticleEventSettings::lifeThreshold.
+	PARTICLE_EVENT_LIFETIME,
+	NUM_PARTICLE_EVENT_TYPES
+};
+
+struct ParticleEvent
+{
+	// Where the particle was when it happened: its last position, or its center at contact for collisions.
+	glm::vec3 position;
+	ParticleEventType type;
+	// Velocity of the particle, before the collision response for collisions.
+	glm::vec3 velocity;
+};
+
+// Spawns particles into another effect from the events of the effect it belongs to (see
+// ParticleEffect::SpawnFromEvents()), eg. sparks where rockets die, or splashes where drops hit the ground.
+struct ParticleSubEmitter
+{
+	ParticleEventType event = PARTICLE_EVENT_DEATH;
+	// Scene ID of the effect the particles are spawned into. It may have sub-emitters of its own, for chains.
+	uint32_t effectId = 0;
+	// Particles spawned per event.
+	int count = 1;
+	// Share of the event's velocity the particles start with, on top of their own.
+	float inheritVelocity = 0.0f;
+};
+
+struct ParticleEventSettings
+{
+	// Only the types of events these listen to are raised. CPU backend only.
+	std::vector<ParticleSubEmitter> subEmitters;
+	// Life at which PARTICLE_EVENT_LIFETIME is raised, as particles go below it.
+	float lifeThreshold = 0.5f;
+	// Most events kept between two ParticleEffect::ClearEvents(). The rest are dropped, and counted.
+	int capacity = 4096;
+};
+
+// Events raised by the particles of one effect since it was last cleared, for sub-emitters to consume in one batch
+// after the update. Any thread may append without locking: writers reserve a range with a single atomic add, and fill
+// it in on their own. The storage is allocated once, so appending never allocates; events past the capacity are
+// dropped.
+// Appends must not race with Clear() or with reading the events.
+class ParticleEventBuffer
+{
+public:
+	explicit ParticleEventBuffer(const size_t capacity = 0)
+		: events_(capacity),
+		  count_(0),
+		  dropped_(0)
+	{
+	}
+
+	void Append(const ParticleEvent* events, const size_t count)
+	{
+		const auto first = count_.fetch_add(count, std::memory_order_relaxed);
+		const auto fit = first < events_.size() ? std::min(count, events_.size() - first) : 0;
+		std::copy(events, events + fit, events_.data() + first);
+		if (fit < count)
+		{
+			dropped_.fetch_add(count - fit, std::memory_order_relaxed);
+		}
+	}
+
+	void Clear()
+	{
+		count_.store(0, std::memory_order_relaxed);
+	}
+
+	const ParticleEvent* Data() const
+	{
+		return events_.data();
+	}
+
+	size_t Count() const
+	{
+		return std::min(count_.load(std::memory_order_relaxed), events_.size());
+	}
+
+	size_t Capacity() const
+	{
+		return events_.size();
+	}
+
+	// Events that didn't fit, since the buffer was created.
+	uint64_t Dropped() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::vector<ParticleEvent> events_;
+	std::atomic<size_t> count_;
+	std::atomic<uint64_t> dropped_;
+};
+
+// Collects the events one thread raises and appends them to a ParticleEventBuffer in batches, so a chunk of particles
+// costs a handful of atomic adds however many events it raises. Without a buffer, events are ignored.
+class ParticleEventWriter
+{
+public:
+	static constexpr size_t BATCH_SIZE = 64;
+
+	explicit ParticleEventWriter(ParticleEventBuffer* buffer)
+		: buffer_(buffer),
+		  count_(0)
+	{
+	}
+
+	ParticleEventWriter(const ParticleEventWriter&) = delete;
+	ParticleEventWriter& operator=(const ParticleEventWriter&) = delete;
+
+	~ParticleEventWriter()
+	{
+		Flush();
+	}
+
+	void Add(const ParticleEventType type, const glm::vec3& position, const glm::vec3& velocity)
+	{
+		if (!buffer_)
+		{
+			return;
+		}
+
+		batch_[count_++] = { position, type, velocity };
+		if (count_ == BATCH_SIZE)
+		{
+			Flush();
+		}
+	}
+
+	void Flush()
+	{
+		if (count_ > 0)
+		{
+			buffer_->Append(batch_.data(), count_);
+			count_ = 0;
+		}
+	}
+
+private:
+	ParticleEventBuffer* buffer_;
+	std::array<ParticleEvent, BATCH_SIZE> batch_;
+	size_t count_;
+};
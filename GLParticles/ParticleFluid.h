@@ -0,0 +1,676 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "ParticleKernels.h"
+#include "ParticlePool.h"
+#include "ParticleSpatialGrid.h"
+#include "WorkerPool.h"
+
+// Fluid constants, in SI units: the solver runs in meters and seconds, whatever the units of the effect's own gravity
+// and velocities.
+struct ParticleFluidSettings
+{
+	// Distance between neighboring particles of fluid at rest. Sets the particle mass (see ParticleFluid).
+	float spacing = 0.025f;
+	// Support radius of the smoothing kernels, and the cell size of the neighbor grid. Twice the spacing gives every
+	// particle about 30 neighbors.
+	float smoothingRadius = 0.05f;
+	float restDensity = 1000.0f;
+	// Pressure per unit of density over the rest density. Pressure is never negative, so the fluid doesn't clump.
+	// Its square root is the speed of sound, which bounds the substep: a stiffer fluid compresses less, but needs more
+	// substeps.
+	float stiffness = 200.0f;
+	// Dynamic viscosity. Far above water's, since it also has to damp the noise of the pressure forces, which would
+	// otherwise feed energy into splashes.
+	float viscosity = 2.0f;
+	glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+	// Box holding the fluid. Particles crossing a wall are put back on it, and the part of their velocity into the wall
+	// is reflected and scaled by wallRestitution.
+	glm::vec3 boundsMin = glm::vec3(-1.0f, 0.0f, -1.0f);
+	glm::vec3 boundsMax = glm::vec3(1.0f, 2.0f, 1.0f);
+	float wallRestitution = 0.2f;
+	// Substeps last at most courantNumber * smoothingRadius / speed of sound. Steps needing more than maxSubsteps run
+	// that many of the longest substep, so the fluid falls behind rather than blow up.
+	float courantNumber = 0.4f;
+	int maxSubsteps = 16;
+};
+
+struct ParticleFluidStats
+{
+	uint64_t steps = 0;
+	uint64_t substeps = 0;
+	// Substeps of the last Step(), and the density at its end over the rest density.
+	int lastSubsteps = 0;
+	float averageDensityRatio = 0.0f;
+	float maxDensityRatio = 0.0f;
+};
+
+// Smoothed particle hydrodynamics after Müller et al., "Particle-Based Fluid Simulation for Interactive Applications":
+// density from the Poly6 kernel, pressure from a stiff equation of state (weakly compressible), and forces from the
+// gradient of the Spiky kernel (pressure) and the Laplacian of the viscosity kernel, integrated with symplectic Euler.
+// Every particle has the mass that brings a cubic lattice of spacing to the rest density, so a block laid out with
+// FillBox() starts at rest.
+// Each substep hashes a working copy of the particles into a ParticleSpatialGrid with cells of smoothingRadius, and the
+// copy then stays in cell order. The density and force passes hand out buckets in parallel; the candidates of the 27
+// cells around each cell are gathered into contiguous streams once, and summed for every particle of the cell with a
+// SIMD kernel.
+class ParticleFluid
+{
+public:
+	// Seconds per unit of update time. The effects' constants are tuned for millisecond steps.
+	static constexpr float TIME_SCALE = 0.001f;
+	// Particles per chunk when copying in and out of the pool.
+	static constexpr size_t GRAIN_SIZE = 16 * 1024;
+
+	ParticleFluid() = default;
+
+	explicit ParticleFluid(const ParticleFluidSettings& settings)
+		: settings_(settings),
+		  mass_(LatticeMass(settings))
+	{
+	}
+
+	// Advances the first pool.Count() particles by deltaTime (in update time, see TIME_SCALE). Reads and writes only
+	// their positions and velocities.
+	void Step(const ParticlePool& pool, const float deltaTime, WorkerPool* workers = nullptr)
+	{
+		const auto seconds = deltaTime * TIME_SCALE;
+		const auto maxSubstep = settings_.courantNumber * settings_.smoothingRadius / std::sqrt(settings_.stiffness);
+		const auto substeps = std::min(std::max(static_cast<int>(std::ceil(seconds / maxSubstep)), 1),
+		                               std::max(settings_.maxSubsteps, 1));
+		const auto substep = std::min(seconds / static_cast<float>(substeps), maxSubstep);
+
+		Load(pool, workers);
+		for (auto i = 0; i < substeps && !x_.empty(); ++i)
+		{
+			Substep(substep, i == substeps - 1, workers);
+		}
+		Store(pool, workers);
+
+		++stats_.steps;
+		stats_.substeps += static_cast<uint64_t>(substeps);
+		stats_.lastSubsteps = substeps;
+	}
+
+	// Positions on a lattice of spacing filling the box [boxMin, boxMax], eg. for ParticleEffect::SpawnAt().
+	static std::vector<glm::vec3> FillBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const float spacing)
+	{
+		const auto cells = glm::max(glm::ivec3((boxMax - boxMin) / spacing), glm::ivec3(0));
+		std::vector<glm::vec3> positions;
+		positions.reserve(static_cast<size_t>(cells.x) * cells.y * cells.z);
+		for (auto z = 0; z < cells.z; ++z)
+		{
+			for (auto y = 0; y < cells.y; ++y)
+			{
+				for (auto x = 0; x < cells.x; ++x)
+				{
+					positions.push_back(boxMin + (glm::vec3(x, y, z) + 0.5f) * spacing);
+				}
+			}
+		}
+		return positions;
+	}
+
+	// Mass of a particle in the middle of a cubic lattice of settings.spacing at exactly settings.restDensity.
+	static float LatticeMass(const ParticleFluidSettings& settings)
+	{
+		const auto h = settings.smoothingRadius;
+		const auto reach = static_cast<int>(std::ceil(h / settings.spacing));
+		double sum = 0.0;
+		for (auto z = -reach; z <= reach; ++z)
+		{
+			for (auto y = -reach; y <= reach; ++y)
+			{
+				for (auto x = -reach; x <= reach; ++x)
+				{
+					const auto distanceSquared = static_cast<double>(x * x + y * y + z * z) * settings.spacing *
+					                             settings.spacing;
+					const auto w = std::max(static_cast<double>(h) * h - distanceSquared, 0.0);
+					sum += w * w * w;
+				}
+			}
+		}
+		return static_cast<float>(settings.restDensity / (Poly6Scale(h) * sum));
+	}
+
+	float ParticleMass() const
+	{
+		return mass_;
+	}
+
+	const ParticleFluidSettings& Settings() const
+	{
+		return settings_;
+	}
+
+	const ParticleFluidStats& Stats() const
+	{
+		return stats_;
+	}
+
+private:
+	static constexpr float PI = 3.14159265358979f;
+	static constexpr int MAX_NEIGHBOR_BUCKETS = 27;
+	// Neighborhoods are padded to a multiple of this many candidates, so the SIMD kernels run whole lanes only.
+	static constexpr size_t LANE_PADDING = 8;
+
+	enum NeighborStream
+	{
+		NEIGHBOR_X,
+		NEIGHBOR_Y,
+		NEIGHBOR_Z,
+		NEIGHBOR_VELOCITY_X,
+		NEIGHBOR_VELOCITY_Y,
+		NEIGHBOR_VELOCITY_Z,
+		NEIGHBOR_PRESSURE,
+		NEIGHBOR_INVERSE_DENSITY,
+		NUM_NEIGHBOR_STREAMS
+	};
+
+	// Candidate neighbors of the particles of one cell: everything in the buckets of the 27 cells around it, gathered
+	// into contiguous streams. The padding sits far away from everything, so it always falls outside the kernels'
+	// support. Every worker fills its own, and only refills it when it moves on to another cell.
+	struct Neighborhood
+	{
+		glm::ivec3 cell;
+		size_t numStreams = 0;
+		size_t count = 0;
+		size_t paddedCount = 0;
+		std::array<std::vector<float>, NUM_NEIGHBOR_STREAMS> streams;
+
+		const float* Stream(const NeighborStream stream) const
+		{
+			return streams[stream].data();
+		}
+	};
+
+	// Particle whose forces are being summed, and the sums so far.
+	struct ForceSum
+	{
+		glm::vec3 position;
+		glm::vec3 velocity;
+		float pressure;
+		glm::vec3 pressureForce;
+		glm::vec3 viscosityForce;
+	};
+
+	using DensityFunc = float (*)(const Neighborhood&, const glm::vec3&, float);
+	using ForceFunc = void (*)(const Neighborhood&, float, ForceSum&);
+
+	// Poly6 kernel: W(r) = Poly6Scale(h) * (h^2 - r^2)^3.
+	static double Poly6Scale(const float h)
+	{
+		return 315.0 / (64.0 * PI * std::pow(static_cast<double>(h), 9.0));
+	}
+
+	// Spiky gradient and viscosity Laplacian share this factor: -45 / (pi h^6) (h - r)^2 along r, and 45 / (pi h^6) (h - r).
+	static float SpikyScale(const float h)
+	{
+		return static_cast<float>(45.0 / (PI * std::pow(static_cast<double>(h), 6.0)));
+	}
+
+	// Sum of (h^2 - r^2)^3 over the neighbors closer to position than h.
+	static float SumDensityScalar(const Neighborhood& neighbors, const glm::vec3& position, const float h2)
+	{
+		const auto* const x = neighbors.Stream(NEIGHBOR_X);
+		const auto* const y = neighbors.Stream(NEIGHBOR_Y);
+		const auto* const z = neighbors.Stream(NEIGHBOR_Z);
+		auto sum = 0.0f;
+		for (size_t j = 0; j < neighbors.count; ++j)
+		{
+			const auto dx = position.x - x[j];
+			const auto dy = position.y - y[j];
+			const auto dz = position.z - z[j];
+			const auto w = std::max(h2 - (dx * dx + dy * dy + dz * dz), 0.0f);
+			sum += w * w * w;
+		}
+		return sum;
+	}
+
+	// Adds the unscaled pressure and viscosity terms of the neighbors to sum. The particle itself, and any other at the
+	// same position, adds nothing.
+	static void SumForcesScalar(const Neighborhood& neighbors, const float h, ForceSum& sum)
+	{
+		const auto* const x = neighbors.Stream(NEIGHBOR_X);
+		const auto* const y = neighbors.Stream(NEIGHBOR_Y);
+		const auto* const z = neighbors.Stream(NEIGHBOR_Z);
+		const auto* const vx = neighbors.Stream(NEIGHBOR_VELOCITY_X);
+		const auto* const vy = neighbors.Stream(NEIGHBOR_VELOCITY_Y);
+		const auto* const vz = neighbors.Stream(NEIGHBOR_VELOCITY_Z);
+		const auto* const pressure = neighbors.Stream(NEIGHBOR_PRESSURE);
+		const auto* const inverseDensity = neighbors.Stream(NEIGHBOR_INVERSE_DENSITY);
+		const auto h2 = h * h;
+		for (size_t j = 0; j < neighbors.count; ++j)
+		{
+			const auto d = sum.position - glm::vec3(x[j], y[j], z[j]);
+			const auto distanceSquared = glm::dot(d, d);
+			if (distanceSquared >= h2 || distanceSquared <= 0.0f)
+			{
+				continue;
+			}
+
+			const auto distance = std::sqrt(distanceSquared);
+			const auto q = h - distance;
+			const auto pressureWeight = (sum.pressure + pressure[j]) * inverseDensity[j] * q * q / distance;
+			const auto viscosityWeight = inverseDensity[j] * q;
+			sum.pressureForce += d * pressureWeight;
+			sum.viscosityForce += (glm::vec3(vx[j], vy[j], vz[j]) - sum.velocity) * viscosityWeight;
+		}
+	}
+
+#if PARTICLE_KERNELS_X86
+	PARTICLE_TARGET_AVX2
+	static float HorizontalSum(const __m256 v)
+	{
+		const auto half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		const auto pairs = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+	}
+
+	PARTICLE_TARGET_AVX2
+	static float SumDensityAVX2(const Neighborhood& neighbors, const glm::vec3& position, const float h2)
+	{
+		const auto* const x = neighbors.Stream(NEIGHBOR_X);
+		const auto* const y = neighbors.Stream(NEIGHBOR_Y);
+		const auto* const z = neighbors.Stream(NEIGHBOR_Z);
+		const auto px = _mm256_set1_ps(position.x);
+		const auto py = _mm256_set1_ps(position.y);
+		const auto pz = _mm256_set1_ps(position.z);
+		const auto radiusSquared = _mm256_set1_ps(h2);
+		auto sum = _mm256_setzero_ps();
+
+		for (size_t j = 0; j < neighbors.paddedCount; j += 8)
+		{
+			const auto dx = _mm256_sub_ps(px, _mm256_loadu_ps(x + j));
+			const auto dy = _mm256_sub_ps(py, _mm256_loadu_ps(y + j));
+			const auto dz = _mm256_sub_ps(pz, _mm256_loadu_ps(z + j));
+			const auto distanceSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+			                                           _mm256_mul_ps(dz, dz));
+			const auto w = _mm256_max_ps(_mm256_sub_ps(radiusSquared, distanceSquared), _mm256_setzero_ps());
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_mul_ps(w, w), w));
+		}
+		return HorizontalSum(sum);
+	}
+
+	PARTICLE_TARGET_AVX2
+	static void SumForcesAVX2(const Neighborhood& neighbors, const float h, ForceSum& sum)
+	{
+		const auto* const x = neighbors.Stream(NEIGHBOR_X);
+		const auto* const y = neighbors.Stream(NEIGHBOR_Y);
+		const auto* const z = neighbors.Stream(NEIGHBOR_Z);
+		const auto* const vx = neighbors.Stream(NEIGHBOR_VELOCITY_X);
+		const auto* const vy = neighbors.Stream(NEIGHBOR_VELOCITY_Y);
+		const auto* const vz = neighbors.Stream(NEIGHBOR_VELOCITY_Z);
+		const auto* const pressure = neighbors.Stream(NEIGHBOR_PRESSURE);
+		const auto* const inverseDensity = neighbors.Stream(NEIGHBOR_INVERSE_DENSITY);
+
+		const auto px = _mm256_set1_ps(sum.position.x);
+		const auto py = _mm256_set1_ps(sum.position.y);
+		const auto pz = _mm256_set1_ps(sum.position.z);
+		const auto velocityX = _mm256_set1_ps(sum.velocity.x);
+		const auto velocityY = _mm256_set1_ps(sum.velocity.y);
+		const auto velocityZ = _mm256_set1_ps(sum.velocity.z);
+		const auto particlePressure = _mm256_set1_ps(sum.pressure);
+		const auto radius = _mm256_set1_ps(h);
+		const auto radiusSquared = _mm256_set1_ps(h * h);
+		const auto zero = _mm256_setzero_ps();
+		auto pressureX = zero;
+		auto pressureY = zero;
+		auto pressureZ = zero;
+		auto viscosityX = zero;
+		auto viscosityY = zero;
+		auto viscosityZ = zero;
+
+		for (size_t j = 0; j < neighbors.paddedCount; j += 8)
+		{
+			const auto dx = _mm256_sub_ps(px, _mm256_loadu_ps(x + j));
+			const auto dy = _mm256_sub_ps(py, _mm256_loadu_ps(y + j));
+			const auto dz = _mm256_sub_ps(pz, _mm256_loadu_ps(z + j));
+			const auto distanceSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+			                                           _mm256_mul_ps(dz, dz));
+
+			// Weights outside the support, or at distance 0, may be infinite or NaN; the mask clears them.
+			const auto mask = _mm256_and_ps(_mm256_cmp_ps(distanceSquared, radiusSquared, _CMP_LT_OQ),
+			                                _mm256_cmp_ps(distanceSquared, zero, _CMP_GT_OQ));
+			const auto distance = _mm256_sqrt_ps(distanceSquared);
+			const auto q = _mm256_sub_ps(radius, distance);
+			const auto density = _mm256_loadu_ps(inverseDensity + j);
+			const auto pressureSum = _mm256_add_ps(particlePressure, _mm256_loadu_ps(pressure + j));
+			const auto pressureWeight = _mm256_and_ps(mask, _mm256_div_ps(
+				_mm256_mul_ps(_mm256_mul_ps(pressureSum, density), _mm256_mul_ps(q, q)), distance));
+			const auto viscosityWeight = _mm256_and_ps(mask, _mm256_mul_ps(density, q));
+
+			pressureX = _mm256_add_ps(pressureX, _mm256_mul_ps(dx, pressureWeight));
+			pressureY = _mm256_add_ps(pressureY, _mm256_mul_ps(dy, pressureWeight));
+			pressureZ = _mm256_add_ps(pressureZ, _mm256_mul_ps(dz, pressureWeight));
+			viscosityX = _mm256_add_ps(viscosityX,
+			                           _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(vx + j), velocityX), viscosityWeight));
+			viscosityY = _mm256_add_ps(viscosityY,
+			                           _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(vy + j), velocityY), viscosityWeight));
+			viscosityZ = _mm256_add_ps(viscosityZ,
+			                           _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(vz + j), velocityZ), viscosityWeight));
+		}
+
+		sum.pressureForce += glm::vec3(HorizontalSum(pressureX), HorizontalSum(pressureY), HorizontalSum(pressureZ));
+		sum.viscosityForce += glm::vec3(HorizontalSum(viscosityX), HorizontalSum(viscosityY), HorizontalSum(viscosityZ));
+	}
+#endif
+
+	// Only AVX2 has kernels of its own; SSE2 runs the scalar ones.
+	static DensityFunc SelectSumDensity(const ParticleKernels::InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+#if PARTICLE_KERNELS_X86
+		case ParticleKernels::AVX2:
+			return &ParticleFluid::SumDensityAVX2;
+#endif
+		default:
+			return &ParticleFluid::SumDensityScalar;
+		}
+	}
+
+	static ForceFunc SelectSumForces(const ParticleKernels::InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+#if PARTICLE_KERNELS_X86
+		case ParticleKernels::AVX2:
+			return &ParticleFluid::SumForcesAVX2;
+#endif
+		default:
+			return &ParticleFluid::SumForcesScalar;
+		}
+	}
+
+	static void ForEachRange(WorkerPool* workers, const size_t count, const std::function<void(size_t, size_t)>& func)
+	{
+		if (workers)
+		{
+			workers->ParallelFor(count, GRAIN_SIZE, func);
+		}
+		else
+		{
+			func(0, count);
+		}
+	}
+
+	// Copies the particles into the working state, in pool order.
+	void Load(const ParticlePool& pool, WorkerPool* workers)
+	{
+		const auto count = pool.Count();
+		for (auto* stream : { &x_, &y_, &z_, &vx_, &vy_, &vz_, &sortedVx_, &sortedVy_, &sortedVz_, &pressure_,
+		                      &inverseDensity_ })
+		{
+			stream->resize(count);
+		}
+		order_.resize(count);
+		sortedOrder_.resize(count);
+
+		ForEachRange(workers, count, [this, &pool](const size_t begin, const size_t end)
+		{
+			std::copy(pool.PositionX() + begin, pool.PositionX() + end, x_.begin() + begin);
+			std::copy(pool.PositionY() + begin, pool.PositionY() + end, y_.begin() + begin);
+			std::copy(pool.PositionZ() + begin, pool.PositionZ() + end, z_.begin() + begin);
+			std::copy(pool.VelocityX() + begin, pool.VelocityX() + end, vx_.begin() + begin);
+			std::copy(pool.VelocityY() + begin, pool.VelocityY() + end, vy_.begin() + begin);
+			std::copy(pool.VelocityZ() + begin, pool.VelocityZ() + end, vz_.begin() + begin);
+			for (auto i = begin; i < end; ++i)
+			{
+				order_[i] = static_cast<uint32_t>(i);
+			}
+		});
+	}
+
+	// Scatters the working state back to the pool slots it came from.
+	void Store(const ParticlePool& pool, WorkerPool* workers) const
+	{
+		ForEachRange(workers, order_.size(), [this, &pool](const size_t begin, const size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto index = order_[i];
+				pool.PositionX()[index] = x_[i];
+				pool.PositionY()[index] = y_[i];
+				pool.PositionZ()[index] = z_[i];
+				pool.VelocityX()[index] = vx_[i];
+				pool.VelocityY()[index] = vy_[i];
+				pool.VelocityZ()[index] = vz_[i];
+			}
+		});
+	}
+
+	// Calls func(first, last, neighborhood) for the sorted particles [first, last) of every non-empty bucket. Buckets
+	// are handed out in ranges, in parallel if workers is given, and every range gets a neighborhood of its own.
+	template<class Func>
+	void ForEachBucket(WorkerPool* workers, const Func& func) const
+	{
+		const auto runBuckets = [this, &func](const size_t firstBucket, const size_t lastBucket)
+		{
+			Neighborhood neighborhood;
+			for (auto bucket = firstBucket; bucket < lastBucket; ++bucket)
+			{
+				const auto first = grid_.BucketStart(static_cast<uint32_t>(bucket));
+				const auto last = grid_.BucketStart(static_cast<uint32_t>(bucket + 1));
+				if (first < last)
+				{
+					func(first, last, neighborhood);
+				}
+			}
+		};
+
+		if (workers)
+		{
+			workers->ParallelFor(grid_.TableSize(), ParticleSpatialGrid::MIN_TABLE_SIZE, runBuckets);
+		}
+		else
+		{
+			runBuckets(0, grid_.TableSize());
+		}
+	}
+
+	void Substep(const float deltaTime, const bool updateStats, WorkerPool* workers)
+	{
+		static const auto sumDensity = SelectSumDensity(ParticleKernels::Detect());
+		static const auto sumForces = SelectSumForces(ParticleKernels::Detect());
+
+		const auto count = x_.size();
+		const auto h = settings_.smoothingRadius;
+		grid_.Build(x_.data(), y_.data(), z_.data(), count, h, workers);
+
+		// Positions come sorted with the grid; velocities and pool slots follow.
+		const auto& indices = grid_.Indices();
+		ForEachRange(workers, count, [this, &indices](const size_t begin, const size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto index = indices[i];
+				sortedVx_[i] = vx_[index];
+				sortedVy_[i] = vy_[index];
+				sortedVz_[i] = vz_[index];
+				sortedOrder_[i] = order_[index];
+			}
+		});
+		order_.swap(sortedOrder_);
+
+		const auto* const x = grid_.SortedX();
+		const auto* const y = grid_.SortedY();
+		const auto* const z = grid_.SortedZ();
+		const auto h2 = h * h;
+		const auto densityScale = mass_ * static_cast<float>(Poly6Scale(h));
+		const std::array<const float*, 3> positionStreams = { x, y, z };
+		ForEachBucket(workers, [&](const uint32_t first, const uint32_t last, Neighborhood& neighbors)
+		{
+			neighbors.numStreams = 0;
+			for (auto i = first; i < last; ++i)
+			{
+				const auto position = glm::vec3(x[i], y[i], z[i]);
+				Gather(position, positionStreams.data(), positionStreams.size(), neighbors);
+
+				// Never 0: every particle is its own neighbor.
+				const auto density = densityScale * sumDensity(neighbors, position, h2);
+				pressure_[i] = std::max(settings_.stiffness * (density - settings_.restDensity), 0.0f);
+				inverseDensity_[i] = 1.0f / density;
+			}
+		});
+
+		if (updateStats)
+		{
+			UpdateStats();
+		}
+
+		// New positions and velocities go straight into the working state, which nothing reads until the next substep.
+		const std::array<const float*, NUM_NEIGHBOR_STREAMS> streams = {
+			x, y, z, sortedVx_.data(), sortedVy_.data(), sortedVz_.data(), pressure_.data(), inverseDensity_.data()
+		};
+		const auto forceScale = mass_ * SpikyScale(h);
+		ForEachBucket(workers, [&](const uint32_t first, const uint32_t last, Neighborhood& neighbors)
+		{
+			neighbors.numStreams = 0;
+			for (auto i = first; i < last; ++i)
+			{
+				ForceSum sum;
+				sum.position = glm::vec3(x[i], y[i], z[i]);
+				sum.velocity = glm::vec3(sortedVx_[i], sortedVy_[i], sortedVz_[i]);
+				sum.pressure = pressure_[i];
+				sum.pressureForce = glm::vec3(0.0f);
+				sum.viscosityForce = glm::vec3(0.0f);
+				Gather(sum.position, streams.data(), streams.size(), neighbors);
+				sumForces(neighbors, h, sum);
+
+				const auto acceleration = settings_.gravity + (forceScale * inverseDensity_[i]) *
+				                          (0.5f * sum.pressureForce + settings_.viscosity * sum.viscosityForce);
+				auto velocity = sum.velocity + acceleration * deltaTime;
+				auto position = sum.position + velocity * deltaTime;
+				for (auto axis = 0; axis < 3; ++axis)
+				{
+					if (position[axis] < settings_.boundsMin[axis])
+					{
+						position[axis] = settings_.boundsMin[axis];
+						velocity[axis] = std::max(velocity[axis], -velocity[axis] * settings_.wallRestitution);
+					}
+					else if (position[axis] > settings_.boundsMax[axis])
+					{
+						position[axis] = settings_.boundsMax[axis];
+						velocity[axis] = std::min(velocity[axis], -velocity[axis] * settings_.wallRestitution);
+					}
+				}
+
+				x_[i] = position.x;
+				y_[i] = position.y;
+				z_[i] = position.z;
+				vx_[i] = velocity.x;
+				vy_[i] = velocity.y;
+				vz_[i] = velocity.z;
+			}
+		});
+	}
+
+	// Fills neighbors with the first numStreams of sources around the cell of position, unless it already holds them.
+	// Each bucket is gathered once, however many of the 27 cells hash to it.
+	void Gather(const glm::vec3& position, const float* const* sources, const size_t numStreams,
+	            Neighborhood& neighbors) const
+	{
+		const auto cell = glm::ivec3(grid_.CellOf(position.x), grid_.CellOf(position.y), grid_.CellOf(position.z));
+		if (neighbors.numStreams == numStreams && cell == neighbors.cell)
+		{
+			return;
+		}
+
+		std::array<uint32_t, MAX_NEIGHBOR_BUCKETS> buckets;
+		size_t numBuckets = 0;
+		size_t count = 0;
+		for (auto z = cell.z - 1; z <= cell.z + 1; ++z)
+		{
+			for (auto y = cell.y - 1; y <= cell.y + 1; ++y)
+			{
+				for (auto x = cell.x - 1; x <= cell.x + 1; ++x)
+				{
+					const auto bucket = grid_.Bucket(x, y, z);
+					const auto bucketsEnd = buckets.begin() + numBuckets;
+					if (std::find(buckets.begin(), bucketsEnd, bucket) == bucketsEnd)
+					{
+						buckets[numBuckets++] = bucket;
+						count += grid_.BucketStart(bucket + 1) - grid_.BucketStart(bucket);
+					}
+				}
+			}
+		}
+
+		const auto paddedCount = (count + LANE_PADDING - 1) / LANE_PADDING * LANE_PADDING;
+		for (size_t stream = 0; stream < numStreams; ++stream)
+		{
+			auto& destination = neighbors.streams[stream];
+			if (destination.size() < paddedCount)
+			{
+				destination.resize(paddedCount);
+			}
+
+			auto offset = destination.begin();
+			for (size_t bucket = 0; bucket < numBuckets; ++bucket)
+			{
+				const auto* const source = sources[stream];
+				offset = std::copy(source + grid_.BucketStart(buckets[bucket]), source + grid_.BucketStart(buckets[bucket] + 1),
+				                   offset);
+			}
+
+			// Positions pad far away, and the other streams with zeros the masked lanes ignore.
+			const auto padding = stream <= NEIGHBOR_Z ? std::numeric_limits<float>::max() : 0.0f;
+			std::fill(offset, destination.begin() + paddedCount, padding);
+		}
+
+		neighbors.cell = cell;
+		neighbors.numStreams = numStreams;
+		neighbors.count = count;
+		neighbors.paddedCount = paddedCount;
+	}
+
+	void UpdateStats()
+	{
+		auto sum = 0.0;
+		auto maxDensity = 0.0f;
+		for (const auto inverseDensity : inverseDensity_)
+		{
+			const auto density = 1.0f / inverseDensity;
+			sum += density;
+			maxDensity = std::max(maxDensity, density);
+		}
+
+		const auto count = std::max<size_t>(inverseDensity_.size(), 1);
+		stats_.averageDensityRatio = static_cast<float>(sum / count) / settings_.restDensity;
+		stats_.maxDensityRatio = maxDensity / settings_.restDensity;
+	}
+
+	ParticleFluidSettings settings_;
+	float mass_ = 0.0f;
+	ParticleSpatialGrid grid_;
+
+	// Working state, in cell order of the last substep (pool order right after Load()), and the pool slot of each
+	// particle.
+	std::vector<float> x_;
+	std::vector<float> y_;
+	std::vector<float> z_;
+	std::vector<float> vx_;
+	std::vector<float> vy_;
+	std::vector<float> vz_;
+	std::vector<uint32_t> order_;
+
+	// Per-substep state, in the grid's cell order.
+	std::vector<float> sortedVx_;
+	std::vector<float> sortedVy_;
+	std::vector<float> sortedVz_;
+	std::vector<uint32_t> sortedOrder_;
+	std::vector<float> pressure_;
+	std::vector<float> inverseDensity_;
+
+	ParticleFluidStats stats_;
+};
@@ -0,0 +1,566 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <glm/gtc/noise.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ParticleKernels.h"
+#include "ParticlePool.h"
+#include "WorkerPool.h"
+
+// Vector field sampled on a regular grid over an axis-aligned box, with nodes on the box corners. Sampling is trilinear
+// and clamps to the box, so particles outside it see the field of the nearest face.
+// The three components are stored as separate streams, x varying fastest, then y, then z.
+class ParticleVectorField
+{
+public:
+	ParticleVectorField()
+		: resolution_(0),
+		  boundsMin_(0.0f),
+		  boundsMax_(0.0f),
+		  scale_(0.0f)
+	{
+	}
+
+	// resolution is the number of nodes along each axis, at least 2.
+	ParticleVectorField(const glm::ivec3& resolution, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+		: resolution_(glm::max(resolution, glm::ivec3(2))),
+		  boundsMin_(boundsMin),
+		  boundsMax_(boundsMax),
+		  scale_(glm::vec3(resolution_ - 1) / (boundsMax - boundsMin))
+	{
+		const auto numNodes = static_cast<size_t>(resolution_.x) * resolution_.y * resolution_.z;
+		for (auto& component : components_)
+		{
+			component.assign(numNodes, 0.0f);
+		}
+	}
+
+	// Loads an FGA ("fluid grid ASCII") file, the vector field format Unreal Engine and most DCC exporters use: comma
+	// separated resolution, box minimum and box maximum, then one x,y,z vector per node. Returns false, leaving field
+	// unchanged, if the file can't be read.
+	static bool LoadFga(const std::string& filename, ParticleVectorField& field)
+	{
+		std::ifstream file(filename);
+		if (!file)
+		{
+			std::cerr << "Failed to open vector field file [" << filename << "]." << std::endl;
+			return false;
+		}
+
+		std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		std::replace(text.begin(), text.end(), ',', ' ');
+		std::istringstream values(text);
+
+		glm::ivec3 resolution;
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		if (!(values >> resolution.x >> resolution.y >> resolution.z) ||
+		    !(values >> boundsMin.x >> boundsMin.y >> boundsMin.z) ||
+		    !(values >> boundsMax.x >> boundsMax.y >> boundsMax.z) ||
+		    glm::any(glm::lessThan(resolution, glm::ivec3(2))) || glm::any(glm::lessThanEqual(boundsMax, boundsMin)))
+		{
+			std::cerr << "Invalid vector field header in [" << filename << "]." << std::endl;
+			return false;
+		}
+
+		ParticleVectorField loaded(resolution, boundsMin, boundsMax);
+		for (size_t node = 0; node < loaded.NumNodes(); ++node)
+		{
+			if (!(values >> loaded.components_[0][node] >> loaded.components_[1][node] >> loaded.components_[2][node]))
+			{
+				std::cerr << "Vector field [" << filename << "] ends after " << node << " of " << loaded.NumNodes()
+				          << " vectors." << std::endl;
+				return false;
+			}
+		}
+
+		field = std::move(loaded);
+		return true;
+	}
+
+	const glm::ivec3& Resolution() const
+	{
+		return resolution_;
+	}
+
+	const glm::vec3& BoundsMin() const
+	{
+		return boundsMin_;
+	}
+
+	const glm::vec3& BoundsMax() const
+	{
+		return boundsMax_;
+	}
+
+	size_t NumNodes() const
+	{
+		return components_[0].size();
+	}
+
+	size_t NodeIndex(const int x, const int y, const int z) const
+	{
+		return (static_cast<size_t>(z) * resolution_.y + y) * resolution_.x + x;
+	}
+
+	// World-space position of node (x, y, z).
+	glm::vec3 NodePosition(const int x, const int y, const int z) const
+	{
+		return boundsMin_ + glm::vec3(x, y, z) / scale_;
+	}
+
+	void Set(const int x, const int y, const int z, const glm::vec3& value)
+	{
+		const auto node = NodeIndex(x, y, z);
+		components_[0][node] = value.x;
+		components_[1][node] = value.y;
+		components_[2][node] = value.z;
+	}
+
+	glm::vec3 Get(const int x, const int y, const int z) const
+	{
+		const auto node = NodeIndex(x, y, z);
+		return glm::vec3(components_[0][node], components_[1][node], components_[2][node]);
+	}
+
+	// Trilinear sample at position. Matches the batch kernels bit for bit.
+	glm::vec3 Sample(const glm::vec3& position) const
+	{
+		glm::vec3 result;
+		SampleScalar(position.x, position.y, position.z, result.x, result.y, result.z);
+		return result;
+	}
+
+	// Adds scale times the field at every particle's position to its velocity, for particles [begin, end). Same lane
+	// rules as ParticleKernels::Integrate(): begin must be a multiple of ParticlePool::LANE_PADDING, and end may run up
+	// to the pool's PaddedCount().
+	void Accelerate(const ParticlePool& pool, const size_t begin, const size_t end, const float scale) const
+	{
+		static const auto accelerate = SelectAccelerate(ParticleKernels::Detect());
+		(this->*accelerate)(pool, begin, end, scale);
+	}
+
+	void AccelerateScalar(const ParticlePool& pool, const size_t begin, const size_t end, const float scale) const
+	{
+		const auto* const px = pool.PositionX();
+		const auto* const py = pool.PositionY();
+		const auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+
+		for (auto i = begin; i < end; ++i)
+		{
+			float x, y, z;
+			SampleScalar(px[i], py[i], pz[i], x, y, z);
+			vx[i] += x * scale;
+			vy[i] += y * scale;
+			vz[i] += z * scale;
+		}
+	}
+
+#if PARTICLE_KERNELS_X86
+	// Eight particles at a time, gathering the eight corners of their cells from each component stream.
+	PARTICLE_TARGET_AVX2
+	void AccelerateAVX2(const ParticlePool& pool, const size_t begin, const size_t end, const float scale) const
+	{
+		const auto* const px = pool.PositionX();
+		const auto* const py = pool.PositionY();
+		const auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+
+		const auto minX = _mm256_set1_ps(boundsMin_.x);
+		const auto minY = _mm256_set1_ps(boundsMin_.y);
+		const auto minZ = _mm256_set1_ps(boundsMin_.z);
+		const auto scaleX = _mm256_set1_ps(scale_.x);
+		const auto scaleY = _mm256_set1_ps(scale_.y);
+		const auto scaleZ = _mm256_set1_ps(scale_.z);
+		const auto maxX = _mm256_set1_ps(static_cast<float>(resolution_.x - 1));
+		const auto maxY = _mm256_set1_ps(static_cast<float>(resolution_.y - 1));
+		const auto maxZ = _mm256_set1_ps(static_cast<float>(resolution_.z - 1));
+		const auto lastCellX = _mm256_set1_epi32(resolution_.x - 2);
+		const auto lastCellY = _mm256_set1_epi32(resolution_.y - 2);
+		const auto lastCellZ = _mm256_set1_epi32(resolution_.z - 2);
+		const auto strideY = _mm256_set1_epi32(resolution_.x);
+		const auto strideZ = _mm256_set1_epi32(resolution_.x * resolution_.y);
+		const auto accelerationScale = _mm256_set1_ps(scale);
+
+		// Offsets of the eight cell corners from the first one.
+		const auto strideX = _mm256_set1_epi32(1);
+		const __m256i corners[8] = {
+			_mm256_setzero_si256(), strideX, strideY, _mm256_add_epi32(strideX, strideY),
+			strideZ, _mm256_add_epi32(strideZ, strideX), _mm256_add_epi32(strideZ, strideY),
+			_mm256_add_epi32(_mm256_add_epi32(strideZ, strideY), strideX)
+		};
+
+		for (auto i = begin; i < end; i += 8)
+		{
+			const auto gx = GridCoordinate(_mm256_load_ps(px + i), minX, scaleX, maxX);
+			const auto gy = GridCoordinate(_mm256_load_ps(py + i), minY, scaleY, maxY);
+			const auto gz = GridCoordinate(_mm256_load_ps(pz + i), minZ, scaleZ, maxZ);
+
+			// Truncation is floor for the non-negative coordinates. The last node belongs to the last cell.
+			const auto cellX = _mm256_min_epi32(_mm256_cvttps_epi32(gx), lastCellX);
+			const auto cellY = _mm256_min_epi32(_mm256_cvttps_epi32(gy), lastCellY);
+			const auto cellZ = _mm256_min_epi32(_mm256_cvttps_epi32(gz), lastCellZ);
+			const auto fx = _mm256_sub_ps(gx, _mm256_cvtepi32_ps(cellX));
+			const auto fy = _mm256_sub_ps(gy, _mm256_cvtepi32_ps(cellY));
+			const auto fz = _mm256_sub_ps(gz, _mm256_cvtepi32_ps(cellZ));
+			const auto node = _mm256_add_epi32(_mm256_add_epi32(cellX, _mm256_mullo_epi32(cellY, strideY)),
+			                                   _mm256_mullo_epi32(cellZ, strideZ));
+
+			__m256 sample[3];
+			for (size_t component = 0; component < 3; ++component)
+			{
+				const auto* const values = components_[component].data();
+				__m256 v[8];
+				for (size_t corner = 0; corner < 8; ++corner)
+				{
+					v[corner] = _mm256_i32gather_ps(values, _mm256_add_epi32(node, corners[corner]), 4);
+				}
+
+				const auto x00 = Lerp(v[0], v[1], fx);
+				const auto x10 = Lerp(v[2], v[3], fx);
+				const auto x01 = Lerp(v[4], v[5], fx);
+				const auto x11 = Lerp(v[6], v[7], fx);
+				sample[component] = Lerp(Lerp(x00, x10, fy), Lerp(x01, x11, fy), fz);
+			}
+
+			_mm256_store_ps(vx + i, _mm256_add_ps(_mm256_load_ps(vx + i), _mm256_mul_ps(sample[0], accelerationScale)));
+			_mm256_store_ps(vy + i, _mm256_add_ps(_mm256_load_ps(vy + i), _mm256_mul_ps(sample[1], accelerationScale)));
+			_mm256_store_ps(vz + i, _mm256_add_ps(_mm256_load_ps(vz + i), _mm256_mul_ps(sample[2], accelerationScale)));
+		}
+	}
+#endif
+
+	float* Component(const size_t component)
+	{
+		return components_[component].data();
+	}
+
+	const float* Component(const size_t component) const
+	{
+		return components_[component].data();
+	}
+
+private:
+	using AccelerateFunc = void (ParticleVectorField::*)(const ParticlePool&, size_t, size_t, float) const;
+
+	// Multiply and add are kept separate (no FMA) in both kernels, so they agree bit for bit.
+	static float Lerp(const float a, const float b, const float t)
+	{
+		return a + (b - a) * t;
+	}
+
+#if PARTICLE_KERNELS_X86
+	PARTICLE_TARGET_AVX2
+	static __m256 Lerp(const __m256 a, const __m256 b, const __m256 t)
+	{
+		return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+	}
+
+	// Clamped like the scalar version: max returns its second operand when the first is a NaN.
+	PARTICLE_TARGET_AVX2
+	static __m256 GridCoordinate(const __m256 position, const __m256 boundsMin, const __m256 scale,
+	                             const __m256 maxCoordinate)
+	{
+		const auto coordinate = _mm256_mul_ps(_mm256_sub_ps(position, boundsMin), scale);
+		return _mm256_min_ps(_mm256_max_ps(coordinate, _mm256_setzero_ps()), maxCoordinate);
+	}
+#endif
+
+	// Grid coordinate along one axis, clamped to [0, maxCoordinate]. NaNs (eg. in padding lanes) become 0.
+	static float GridCoordinate(const float position, const float boundsMin, const float scale, const float maxCoordinate)
+	{
+		const auto coordinate = (position - boundsMin) * scale;
+		const auto clamped = coordinate > 0.0f ? coordinate : 0.0f;
+		return clamped < maxCoordinate ? clamped : maxCoordinate;
+	}
+
+	void SampleScalar(const float px, const float py, const float pz, float& x, float& y, float& z) const
+	{
+		const auto gx = GridCoordinate(px, boundsMin_.x, scale_.x, static_cast<float>(resolution_.x - 1));
+		const auto gy = GridCoordinate(py, boundsMin_.y, scale_.y, static_cast<float>(resolution_.y - 1));
+		const auto gz = GridCoordinate(pz, boundsMin_.z, scale_.z, static_cast<float>(resolution_.z - 1));
+		const auto cellX = std::min(static_cast<int>(gx), resolution_.x - 2);
+		const auto cellY = std::min(static_cast<int>(gy), resolution_.y - 2);
+		const auto cellZ = std::min(static_cast<int>(gz), resolution_.z - 2);
+		const auto fx = gx - static_cast<float>(cellX);
+		const auto fy = gy - static_cast<float>(cellY);
+		const auto fz = gz - static_cast<float>(cellZ);
+
+		const auto node = NodeIndex(cellX, cellY, cellZ);
+		const auto strideY = static_cast<size_t>(resolution_.x);
+		const auto strideZ = strideY * resolution_.y;
+
+		std::array<float, 3> sample;
+		for (size_t component = 0; component < 3; ++component)
+		{
+			const auto* const v = components_[component].data() + node;
+			const auto x00 = Lerp(v[0], v[1], fx);
+			const auto x10 = Lerp(v[strideY], v[strideY + 1], fx);
+			const auto x01 = Lerp(v[strideZ], v[strideZ + 1], fx);
+			const auto x11 = Lerp(v[strideZ + strideY], v[strideZ + strideY + 1], fx);
+			sample[component] = Lerp(Lerp(x00, x10, fy), Lerp(x01, x11, fy), fz);
+		}
+
+		x = sample[0];
+		y = sample[1];
+		z = sample[2];
+	}
+
+	// SSE2 has no gather, and emulating one costs more than it saves, so it shares the scalar kernel.
+	static AccelerateFunc SelectAccelerate(const ParticleKernels::InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+#if PARTICLE_KERNELS_X86
+		case ParticleKernels::AVX2:
+			return &ParticleVectorField::AccelerateAVX2;
+#endif
+		default:
+			return &ParticleVectorField::AccelerateScalar;
+		}
+	}
+
+	glm::ivec3 resolution_;
+	glm::vec3 boundsMin_;
+	glm::vec3 boundsMax_;
+	// Grid cells per unit of world space, along each axis.
+	glm::vec3 scale_;
+	std::array<std::vector<float>, 3> components_;
+};
+
+struct ParticleCurlNoiseSettings
+{
+	// Acceleration at unit noise amplitude, in the same units as ParticleEffectSettings::gravity. 0 disables the noise.
+	float strength = 0.0f;
+	// Noise features per world unit.
+	float frequency = 1.0f;
+	// Noise-space distance the field evolves by per unit of update time, 0 for a static field.
+	float evolution = 0.0f;
+	// Update time between two baked keys of an evolving field.
+	float keyInterval = 500.0f;
+	// Box the field is baked over, and its nodes per axis.
+	glm::vec3 boundsMin = glm::vec3(-1.0f);
+	glm::vec3 boundsMax = glm::vec3(1.0f);
+	int resolution = 32;
+};
+
+// Divergence-free turbulence (Bridson et al., "Curl-Noise for Procedural Fluid Flow"): the curl of a vector potential
+// made of three decorrelated simplex noises, so particles swirl without bunching up in sinks or thinning out at
+// sources.
+// Noise is far too expensive to evaluate per particle per step, so it is baked into ParticleVectorFields, lazily on
+// the first Advance(), and sampled trilinearly. An evolving field blends between two baked keys while the key after
+// them bakes incrementally: every Advance() bakes the share of its slices that is due, so the bake cost is spread
+// evenly over the key interval instead of landing on one frame.
+class ParticleCurlNoise
+{
+public:
+	ParticleCurlNoise() = default;
+
+	explicit ParticleCurlNoise(const ParticleCurlNoiseSettings& settings)
+		: settings_(settings)
+	{
+	}
+
+	bool IsEnabled() const
+	{
+		return settings_.strength != 0.0f;
+	}
+
+	bool IsEvolving() const
+	{
+		return settings_.evolution != 0.0f && settings_.keyInterval > 0.0f;
+	}
+
+	// Moves the field deltaTime forward, baking what is due. Call once per step, before Accelerate(). Bake slices are
+	// spread across workers when given.
+	void Advance(const float deltaTime, WorkerPool* workers = nullptr)
+	{
+		const auto resolution = glm::ivec3(std::max(settings_.resolution, 2));
+		if (!isBaked_)
+		{
+			isBaked_ = true;
+			const auto numKeys = IsEvolving() ? keys_.size() : 1;
+			for (size_t key = 0; key < numKeys; ++key)
+			{
+				keys_[key] = ParticleVectorField(resolution, settings_.boundsMin, settings_.boundsMax);
+				// The last key is only baked as time goes on.
+				if (key < 2)
+				{
+					Bake(keys_[key], KeyNoiseTime(key), 0, resolution.z, workers);
+				}
+			}
+		}
+
+		if (!IsEvolving())
+		{
+			return;
+		}
+
+		elapsed_ += deltaTime;
+		while (elapsed_ >= settings_.keyInterval)
+		{
+			// The next key takes over: finish it, then start on the one after.
+			Bake(keys_[2], KeyNoiseTime(2), bakedSlices_, resolution.z, workers);
+			std::rotate(keys_.begin(), keys_.begin() + 1, keys_.end());
+			elapsed_ -= settings_.keyInterval;
+			keyTime_ += settings_.keyInterval;
+			bakedSlices_ = 0;
+		}
+
+		const auto dueSlices = static_cast<int>(std::ceil(Phase() * resolution.z));
+		if (dueSlices > bakedSlices_)
+		{
+			Bake(keys_[2], KeyNoiseTime(2), bakedSlices_, dueSlices, workers);
+			bakedSlices_ = dueSlices;
+		}
+	}
+
+	// Adds the field at every particle's position, times settings.strength * scale, to its velocity, for particles
+	// [begin, end). Same lane rules as ParticleVectorField::Accelerate().
+	void Accelerate(const ParticlePool& pool, const size_t begin, const size_t end, const float scale) const
+	{
+		const auto strength = settings_.strength * scale;
+		if (!IsEvolving())
+		{
+			keys_[0].Accelerate(pool, begin, end, strength);
+			return;
+		}
+
+		// Blending the accelerations is blending the fields, since sampling is linear in the field.
+		const auto phase = Phase();
+		keys_[0].Accelerate(pool, begin, end, strength * (1.0f - phase));
+		keys_[1].Accelerate(pool, begin, end, strength * phase);
+	}
+
+	// Unbaked curl noise at position and noise time, what the baked field approximates.
+	static glm::vec3 Evaluate(const glm::vec3& position, const float time)
+	{
+		// Central differences of the potential, one noise cell in a thousand apart.
+		constexpr float epsilon = 1.0e-3f;
+		const auto dx = glm::vec3(epsilon, 0.0f, 0.0f);
+		const auto dy = glm::vec3(0.0f, epsilon, 0.0f);
+		const auto dz = glm::vec3(0.0f, 0.0f, epsilon);
+
+		const auto ddx = Potential(position + dx, time) - Potential(position - dx, time);
+		const auto ddy = Potential(position + dy, time) - Potential(position - dy, time);
+		const auto ddz = Potential(position + dz, time) - Potential(position - dz, time);
+
+		return glm::vec3(ddy.z - ddz.y, ddz.x - ddx.z, ddx.y - ddy.x) / (2.0f * epsilon);
+	}
+
+	const ParticleCurlNoiseSettings& Settings() const
+	{
+		return settings_;
+	}
+
+private:
+	// Three noises far apart in noise space, as decorrelated components of the potential.
+	static glm::vec3 Potential(const glm::vec3& position, const float time)
+	{
+		return glm::vec3(glm::simplex(glm::vec4(position, time)),
+		                 glm::simplex(glm::vec4(position + glm::vec3(31.416f, -47.853f, 12.793f), time)),
+		                 glm::simplex(glm::vec4(position + glm::vec3(-61.127f, 8.571f, 93.249f), time)));
+	}
+
+	// Fraction of the key interval elapsed since keys_[0].
+	float Phase() const
+	{
+		return elapsed_ / settings_.keyInterval;
+	}
+
+	float KeyNoiseTime(const size_t key) const
+	{
+		return (keyTime_ + key * settings_.keyInterval) * settings_.evolution;
+	}
+
+	// Bakes z slices [firstSlice, lastSlice) of field at noise time.
+	void Bake(ParticleVectorField& field, const float time, const int firstSlice, const int lastSlice,
+	          WorkerPool* workers) const
+	{
+		const auto bakeSlices = [this, &field, time, firstSlice](const size_t begin, const size_t end)
+		{
+			const auto& resolution = field.Resolution();
+			for (auto z = firstSlice + static_cast<int>(begin); z < firstSlice + static_cast<int>(end); ++z)
+			{
+				for (auto y = 0; y < resolution.y; ++y)
+				{
+					for (auto x = 0; x < resolution.x; ++x)
+					{
+						field.Set(x, y, z, Evaluate(field.NodePosition(x, y, z) * settings_.frequency, time));
+					}
+				}
+			}
+		};
+
+		const auto numSlices = static_cast<size_t>(std::max(lastSlice - firstSlice, 0));
+		if (workers)
+		{
+			workers->ParallelFor(numSlices, 1, bakeSlices);
+		}
+		else
+		{
+			bakeSlices(0, numSlices);
+		}
+	}
+
+	ParticleCurlNoiseSettings settings_;
+	bool isBaked_ = false;
+	// keys_[0] and keys_[1] are baked at keyTime_ and keyTime_ + keyInterval, and blended; keys_[2] is being baked.
+	std::array<ParticleVectorField, 3> keys_;
+	float keyTime_ = 0.0f;
+	float elapsed_ = 0.0f;
+	int bakedSlices_ = 0;
+};
+
+// Point attractor with Plummer softening: the pull falls off with the squared distance, but stays finite (and fades to
+// zero) near the center instead of flinging particles away. Negative strength repels.
+struct ParticleAttractor
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	// Acceleration at distance 1, in the same units as ParticleEffectSettings::gravity.
+	float strength = 0.0f;
+	// Softening radius: the pull peaks at about this distance from the center.
+	float radius = 0.1f;
+
+	// Adds the pull times scale to the velocity of particles [begin, end). Plain loops the compiler vectorizes.
+	void Accelerate(const ParticlePool& pool, const size_t begin, const size_t end, const float scale) const
+	{
+		const auto* const px = pool.PositionX();
+		const auto* const py = pool.PositionY();
+		const auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+
+		const auto pull = strength * scale;
+		const auto radiusSquared = radius * radius;
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto dx = position.x - px[i];
+			const auto dy = position.y - py[i];
+			const auto dz = position.z - pz[i];
+			const auto distanceSquared = dx * dx + dy * dy + dz * dz + radiusSquared;
+			const auto factor = pull / (distanceSquared * std::sqrt(distanceSquared));
+			vx[i] += dx * factor;
+			vy[i] += dy * factor;
+			vz[i] += dz * factor;
+		}
+	}
+};
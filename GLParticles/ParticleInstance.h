@@ -0,0 +1,46 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstdint>
+
+// Per-instance record of one particle. particle.vert expands it into a camera-facing quad.
+// Written by the CPU path into a streaming buffer, and by the compute simulation into a storage buffer (where it is
+// declared with the same std430 layout).
+struct ParticleInstance
+{
+	// xyz: world-space center, w: size
+	glm::vec4 positionSize;
+	glm::vec4 color;
+};
+
+// Layouts a CPU effect can upload its instances in (see ParticleEffectSettings::vertexFormat).
+enum ParticleVertexFormat
+{
+	// ParticleInstance, 32 bytes.
+	PARTICLE_VERTEX_FLOAT,
+	// ParticleCompactInstance with half float position and size, the position relative to the emitter. 12 bytes.
+	PARTICLE_VERTEX_HALF,
+	// ParticleCompactInstance with 16-bit fixed point position and size, over the bounds of the frame's instances.
+	// 12 bytes.
+	PARTICLE_VERTEX_FIXED16
+};
+
+// Quantized ParticleInstance. See ParticleQuantization for the encoding.
+struct ParticleCompactInstance
+{
+	// xyz: position, w: size. Half floats, or normalized 16-bit integers, depending on the format.
+	uint16_t positionSize[4];
+	// Normalized RGBA8, red in the lowest byte.
+	uint32_t color;
+};
+
+static_assert(sizeof(ParticleCompactInstance) == 12, "ParticleCompactInstance must stay tightly packed");
+
+// particle.vert reads the position/size attribute as positionSize * scale + bias, which turns compact instances back
+// into world space. The identity for ParticleInstance.
+struct ParticleInstanceDecode
+{
+	glm::vec4 scale = glm::vec4(1.0f);
+	glm::vec4 bias = glm::vec4(0.0f);
+};
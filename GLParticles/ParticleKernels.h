@@ -0,0 +1,237 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstddef>
+#include <algorithm>
+
+#include "ParticlePool.h"
+
+// glm only compiles its glm/simd helpers when GLM_FORCE_INTRINSICS is set, which would change the layout of every glm
+// type in the project. The kernels use glm's platform detection and raw intrinsics instead, and pick the widest
+// instruction set the running CPU supports.
+#if (GLM_ARCH & GLM_ARCH_X86_BIT) && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || defined(_M_IX86_FP))
+#	define PARTICLE_KERNELS_X86 1
+#	include <immintrin.h>
+#	if GLM_COMPILER & GLM_COMPILER_VC
+#		include <intrin.h>
+// MSVC allows AVX2 intrinsics in any function, regardless of /arch.
+#		define PARTICLE_TARGET_AVX2
+#	else
+#		include <cpuid.h>
+#		define PARTICLE_TARGET_AVX2 __attribute__((target("avx2")))
+#	endif
+#else
+#	define PARTICLE_KERNELS_X86 0
+#endif
+
+// Per-update constants shared by every integration kernel.
+struct ParticleIntegration
+{
+	float deltaTime;
+	// deltaTime / dampening
+	float stepScale;
+	// gravity * stepScale
+	glm::vec3 gravityStep;
+};
+
+class ParticleKernels
+{
+public:
+	enum InstructionSet
+	{
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	using IntegrateFunc = void (*)(const ParticlePool& pool, size_t begin, size_t end, const ParticleIntegration& step);
+
+	// Integrates position, velocity and life of particles [begin, end) with the fastest kernel for this CPU, saving the
+	// old positions as the previous positions.
+	// begin must be a multiple of ParticlePool::LANE_PADDING, and end may run up to the pool's PaddedCount(): the
+	// SIMD kernels always process whole lanes, and the padding particles they touch are never read back.
+	static void Integrate(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step)
+	{
+		static const auto integrate = SelectIntegrate(Detect());
+		integrate(pool, begin, end, step);
+	}
+
+	// Reference implementation, and the fallback on CPUs without SIMD support.
+	static void IntegrateScalar(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step)
+	{
+		auto* const px = pool.PositionX();
+		auto* const py = pool.PositionY();
+		auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+		auto* const life = pool.Life();
+		const auto* const decay = pool.Decay();
+		auto* const previousX = pool.PreviousX();
+		auto* const previousY = pool.PreviousY();
+		auto* const previousZ = pool.PreviousZ();
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			previousX[i] = px[i];
+			previousY[i] = py[i];
+			previousZ[i] = pz[i];
+			px[i] += vx[i] * step.stepScale;
+			py[i] += vy[i] * step.stepScale;
+			pz[i] += vz[i] * step.stepScale;
+			vx[i] += step.gravityStep.x;
+			vy[i] += step.gravityStep.y;
+			vz[i] += step.gravityStep.z;
+			life[i] -= decay[i] * step.deltaTime;
+		}
+	}
+
+#if PARTICLE_KERNELS_X86
+	static void IntegrateSSE2(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step)
+	{
+		auto* const px = pool.PositionX();
+		auto* const py = pool.PositionY();
+		auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+		auto* const life = pool.Life();
+		const auto* const decay = pool.Decay();
+		auto* const previousX = pool.PreviousX();
+		auto* const previousY = pool.PreviousY();
+		auto* const previousZ = pool.PreviousZ();
+
+		const auto stepScale = _mm_set1_ps(step.stepScale);
+		const auto deltaTime = _mm_set1_ps(step.deltaTime);
+		const auto gx = _mm_set1_ps(step.gravityStep.x);
+		const auto gy = _mm_set1_ps(step.gravityStep.y);
+		const auto gz = _mm_set1_ps(step.gravityStep.z);
+
+		// Multiply and add are kept separate (no FMA) so the results match the scalar kernel bit for bit.
+		for (size_t i = begin; i < end; i += 4)
+		{
+			const auto x = _mm_load_ps(vx + i);
+			const auto y = _mm_load_ps(vy + i);
+			const auto z = _mm_load_ps(vz + i);
+			const auto positionX = _mm_load_ps(px + i);
+			const auto positionY = _mm_load_ps(py + i);
+			const auto positionZ = _mm_load_ps(pz + i);
+			_mm_store_ps(previousX + i, positionX);
+			_mm_store_ps(previousY + i, positionY);
+			_mm_store_ps(previousZ + i, positionZ);
+			_mm_store_ps(px + i, _mm_add_ps(positionX, _mm_mul_ps(x, stepScale)));
+			_mm_store_ps(py + i, _mm_add_ps(positionY, _mm_mul_ps(y, stepScale)));
+			_mm_store_ps(pz + i, _mm_add_ps(positionZ, _mm_mul_ps(z, stepScale)));
+			_mm_store_ps(vx + i, _mm_add_ps(x, gx));
+			_mm_store_ps(vy + i, _mm_add_ps(y, gy));
+			_mm_store_ps(vz + i, _mm_add_ps(z, gz));
+			_mm_store_ps(life + i, _mm_sub_ps(_mm_load_ps(life + i), _mm_mul_ps(_mm_load_ps(decay + i), deltaTime)));
+		}
+	}
+
+	PARTICLE_TARGET_AVX2
+	static void IntegrateAVX2(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step)
+	{
+		auto* const px = pool.PositionX();
+		auto* const py = pool.PositionY();
+		auto* const pz = pool.PositionZ();
+		auto* const vx = pool.VelocityX();
+		auto* const vy = pool.VelocityY();
+		auto* const vz = pool.VelocityZ();
+		auto* const life = pool.Life();
+		const auto* const decay = pool.Decay();
+		auto* const previousX = pool.PreviousX();
+		auto* const previousY = pool.PreviousY();
+		auto* const previousZ = pool.PreviousZ();
+
+		const auto stepScale = _mm256_set1_ps(step.stepScale);
+		const auto deltaTime = _mm256_set1_ps(step.deltaTime);
+		const auto gx = _mm256_set1_ps(step.gravityStep.x);
+		const auto gy = _mm256_set1_ps(step.gravityStep.y);
+		const auto gz = _mm256_set1_ps(step.gravityStep.z);
+
+		for (size_t i = begin; i < end; i += 8)
+		{
+			const auto x = _mm256_load_ps(vx + i);
+			const auto y = _mm256_load_ps(vy + i);
+			const auto z = _mm256_load_ps(vz + i);
+			const auto positionX = _mm256_load_ps(px + i);
+			const auto positionY = _mm256_load_ps(py + i);
+			const auto positionZ = _mm256_load_ps(pz + i);
+			_mm256_store_ps(previousX + i, positionX);
+			_mm256_store_ps(previousY + i, positionY);
+			_mm256_store_ps(previousZ + i, positionZ);
+			_mm256_store_ps(px + i, _mm256_add_ps(positionX, _mm256_mul_ps(x, stepScale)));
+			_mm256_store_ps(py + i, _mm256_add_ps(positionY, _mm256_mul_ps(y, stepScale)));
+			_mm256_store_ps(pz + i, _mm256_add_ps(positionZ, _mm256_mul_ps(z, stepScale)));
+			_mm256_store_ps(vx + i, _mm256_add_ps(x, gx));
+			_mm256_store_ps(vy + i, _mm256_add_ps(y, gy));
+			_mm256_store_ps(vz + i, _mm256_add_ps(z, gz));
+			_mm256_store_ps(life + i, _mm256_sub_ps(_mm256_load_ps(life + i), _mm256_mul_ps(_mm256_load_ps(decay + i), deltaTime)));
+		}
+	}
+#endif
+
+	// Queries CPUID (and the OS, for the AVX register state) for the widest supported instruction set.
+	static InstructionSet Detect()
+	{
+#if PARTICLE_KERNELS_X86
+		unsigned int leaf1[4] = {};
+		unsigned int leaf7[4] = {};
+#	if GLM_COMPILER & GLM_COMPILER_VC
+		int regs[4];
+		__cpuid(regs, 1);
+		std::copy(regs, regs + 4, leaf1);
+		__cpuidex(regs, 7, 0);
+		std::copy(regs, regs + 4, leaf7);
+#	else
+		__get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+		__get_cpuid_count(7, 0, &leaf7[0], &leaf7[1], &leaf7[2], &leaf7[3]);
+#	endif
+		const bool hasSSE2 = (leaf1[3] & (1u << 26)) != 0;
+		const bool hasOSXSave = (leaf1[2] & (1u << 27)) != 0;
+		const bool hasAVX = (leaf1[2] & (1u << 28)) != 0;
+		const bool hasAVX2 = (leaf7[1] & (1u << 5)) != 0;
+
+		if (hasOSXSave && hasAVX && hasAVX2 && (ReadXCR0() & 0x6) == 0x6)
+		{
+			return AVX2;
+		}
+		if (hasSSE2)
+		{
+			return SSE2;
+		}
+#endif
+		return SCALAR;
+	}
+
+	static IntegrateFunc SelectIntegrate(const InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+#if PARTICLE_KERNELS_X86
+		case AVX2:
+			return IntegrateAVX2;
+		case SSE2:
+			return IntegrateSSE2;
+#endif
+		default:
+			return IntegrateScalar;
+		}
+	}
+
+private:
+#if PARTICLE_KERNELS_X86
+	static unsigned long long ReadXCR0()
+	{
+#	if GLM_COMPILER & GLM_COMPILER_VC
+		return _xgetbv(0);
+#	else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<unsigned long long>(edx) << 32) | eax;
+#	endif
+	}
+#endif
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <array>
+#include <algorithm>
+
+// Structure-of-arrays particle storage.
+// Every attribute lives in its own cache-line aligned float stream, so an update pass only pulls the streams it
+// actually reads through the cache, and vectorized kernels can load whole lanes without gathering.
+// Copies share the same storage (like the GL handles held by Mesh); use Clone() for a deep copy.
+class ParticlePool
+{
+public:
+	enum Stream
+	{
+		POSITION_X,
+		POSITION_Y,
+		POSITION_Z,
+		VELOCITY_X,
+		VELOCITY_Y,
+		VELOCITY_Z,
+		LIFE,
+		DECAY,
+		SIZE,
+		// Position before the last integration step, for interpolating between simulation steps.
+		PREVIOUS_X,
+		PREVIOUS_Y,
+		PREVIOUS_Z,
+		NUM_STREAMS
+	};
+
+	// Byte alignment of every stream.
+	static constexpr size_t STREAM_ALIGNMENT = 64;
+
+	// Streams are padded to a multiple of this many floats, so SIMD kernels may always run whole lanes over
+	// [0, PaddedSize()) without a scalar tail touching memory outside the allocation.
+	static constexpr size_t LANE_PADDING = 16;
+
+	ParticlePool()
+		: capacity_(0),
+		  paddedCapacity_(0),
+		  size_(0)
+	{
+		streams_.fill(nullptr);
+	}
+
+	explicit ParticlePool(const size_t capacity)
+		: capacity_(capacity),
+		  paddedCapacity_(PadToLanes(capacity)),
+		  size_(0)
+	{
+		const auto bytes = paddedCapacity_ * NUM_STREAMS * sizeof(float);
+		storage_.reset(static_cast<float*>(::operator new[](bytes, std::align_val_t(STREAM_ALIGNMENT))),
+		               [](float* data) { ::operator delete[](data, std::align_val_t(STREAM_ALIGNMENT)); });
+
+		for (size_t stream = 0; stream < NUM_STREAMS; ++stream)
+		{
+			streams_[stream] = storage_.get() + stream * paddedCapacity_;
+			std::fill_n(streams_[stream], paddedCapacity_, 0.0f);
+		}
+	}
+
+	ParticlePool Clone() const
+	{
+		ParticlePool clone(capacity_);
+		for (size_t stream = 0; stream < NUM_STREAMS; ++stream)
+		{
+			std::copy_n(streams_[stream], paddedCapacity_, clone.streams_[stream]);
+		}
+		clone.size_ = size_;
+		return clone;
+	}
+
+	float* Data(const Stream stream) const
+	{
+		return streams_[stream];
+	}
+
+	float* PositionX() const { return streams_[POSITION_X]; }
+	float* PositionY() const { return streams_[POSITION_Y]; }
+	float* PositionZ() const { return streams_[POSITION_Z]; }
+	float* VelocityX() const { return streams_[VELOCITY_X]; }
+	float* VelocityY() const { return streams_[VELOCITY_Y]; }
+	float* VelocityZ() const { return streams_[VELOCITY_Z]; }
+	float* Life() const { return streams_[LIFE]; }
+	float* Decay() const { return streams_[DECAY]; }
+	float* Size() const { return streams_[SIZE]; }
+	float* PreviousX() const { return streams_[PREVIOUS_X]; }
+	float* PreviousY() const { return streams_[PREVIOUS_Y]; }
+	float* PreviousZ() const { return streams_[PREVIOUS_Z]; }
+
+	// Number of particles in use, always packed to the start of the streams.
+	size_t Count() const
+	{
+		return size_;
+	}
+
+	void SetCount(const size_t count)
+	{
+		size_ = count < capacity_ ? count : capacity_;
+	}
+
+	size_t Capacity() const
+	{
+		return capacity_;
+	}
+
+	// Count() rounded up to a whole number of lanes. Never exceeds the padded storage.
+	size_t PaddedCount() const
+	{
+		return PadToLanes(size_);
+	}
+
+	// Copies every stream of particle src over particle dst.
+	void CopyParticle(const size_t src, const size_t dst) const
+	{
+		for (auto* stream : streams_)
+		{
+			stream[dst] = stream[src];
+		}
+	}
+
+	static size_t PadToLanes(const size_t count)
+	{
+		return (count + LANE_PADDING - 1) / LANE_PADDING * LANE_PADDING;
+	}
+
+private:
+	size_t capacity_;
+	size_t paddedCapacity_;
+	size_t size_;
+
+	std::shared_ptr<float> storage_;
+	std::array<float*, NUM_STREAMS> streams_;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "ParticleInstance.h"
+
+// Packs ParticleInstances into ParticleCompactInstances for one ParticleInstanceDecode, and unpacks them the way
+// particle.vert does. Worst-case errors, per component:
+// - PARTICLE_VERTEX_HALF keeps 11 significant bits, so the error is within 2^-12 of the value: positions lose
+//   precision with their distance to the emitter, sizes with their magnitude.
+// - PARTICLE_VERTEX_FIXED16 spreads 65536 levels over the bounds given to FixedDecode(), so the error is within
+//   1/131070 of their extent wherever the effect is. Values outside the bounds are clamped to them.
+// - Colors round to 8 bits per channel, within 1/510.
+class ParticleQuantizer
+{
+public:
+	ParticleQuantizer(const ParticleVertexFormat format, const ParticleInstanceDecode& decode)
+		: format_(format),
+		  decode_(decode),
+		  inverseScale_(InverseScale(decode.scale))
+	{
+	}
+
+	// Half floats relative to origin, usually the emitter position.
+	static ParticleInstanceDecode HalfDecode(const glm::vec3& origin)
+	{
+		ParticleInstanceDecode decode;
+		decode.bias = glm::vec4(origin, 0.0f);
+		return decode;
+	}
+
+	// Fixed point over [boundsMin, boundsMax], with the size in w.
+	static ParticleInstanceDecode FixedDecode(const glm::vec4& boundsMin, const glm::vec4& boundsMax)
+	{
+		ParticleInstanceDecode decode;
+		decode.scale = boundsMax - boundsMin;
+		decode.bias = boundsMin;
+		return decode;
+	}
+
+	void Encode(const glm::vec4& positionSize, const glm::vec4& color, ParticleCompactInstance& instance) const
+	{
+		const auto relative = positionSize - decode_.bias;
+		if (format_ == PARTICLE_VERTEX_HALF)
+		{
+			for (auto i = 0; i < 4; ++i)
+			{
+				instance.positionSize[i] = ToHalf(relative[i]);
+			}
+		}
+		else
+		{
+			const auto normalized = relative * inverseScale_;
+			for (auto i = 0; i < 4; ++i)
+			{
+				instance.positionSize[i] = static_cast<uint16_t>(Saturate(normalized[i]) * 65535.0f + 0.5f);
+			}
+		}
+
+		instance.color = 0;
+		for (auto i = 0; i < 4; ++i)
+		{
+			instance.color |= static_cast<uint32_t>(Saturate(color[i]) * 255.0f + 0.5f) << (8 * i);
+		}
+	}
+
+	ParticleInstance Decode(const ParticleCompactInstance& instance) const
+	{
+		uint64_t bits;
+		std::memcpy(&bits, instance.positionSize, sizeof(bits));
+		const auto normalized = format_ == PARTICLE_VERTEX_HALF ? glm::unpackHalf4x16(bits) : glm::unpackUnorm4x16(bits);
+		return { normalized * decode_.scale + decode_.bias, glm::unpackUnorm4x8(instance.color) };
+	}
+
+private:
+	// Clamps to [0, 1], NaN to 0.
+	static float Saturate(const float value)
+	{
+		return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+	}
+
+	// Rounds to the nearest half float, ties to even (F. Giesen's float_to_half_fast3_rtne). Matches the F16C
+	// conversion for every input, which glm::packHalf() doesn't, and is several times faster.
+	static uint16_t ToHalf(const float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		const auto sign = bits & 0x80000000u;
+		bits ^= sign;
+
+		uint32_t half;
+		if (bits >= 0x47800000u)
+		{
+			// Out of range: infinity, or a quiet NaN.
+			half = bits > 0x7f800000u ? 0x7e00u : 0x7c00u;
+		}
+		else if (bits < 0x38800000u)
+		{
+			// Subnormal or zero. Adding 0.5 lets the FPU do the rounding, leaving the half bits at the bottom.
+			float shifted;
+			std::memcpy(&shifted, &bits, sizeof(shifted));
+			shifted += 0.5f;
+			std::memcpy(&half, &shifted, sizeof(half));
+			half -= 0x3f000000u;
+		}
+		else
+		{
+			// Rebias the exponent and round the mantissa to 10 bits.
+			const auto mantissaOdd = (bits >> 13) & 1u;
+			bits += 0xc8000fffu + mantissaOdd;
+			half = bits >> 13;
+		}
+		return static_cast<uint16_t>(half | (sign >> 16));
+	}
+
+	// Degenerate axes (eg. every particle at the same height) encode as 0.
+	static glm::vec4 InverseScale(const glm::vec4& scale)
+	{
+		return glm::vec4(
+			scale.x > 0.0f ? 1.0f / scale.x : 0.0f,
+			scale.y > 0.0f ? 1.0f / scale.y : 0.0f,
+			scale.z > 0.0f ? 1.0f / scale.z : 0.0f,
+			scale.w > 0.0f ? 1.0f / scale.w : 0.0f);
+	}
+
+	ParticleVertexFormat format_;
+	ParticleInstanceDecode decode_;
+	glm::vec4 inverseScale_;
+};
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ParticleKernels.h"
+
+// Streams of ParticleRandom the effects draw from, so each spawned quantity is independent of the others.
+enum ParticleRandomStream : uint32_t
+{
+	SPAWN_DECAY_STREAM,
+	SPAWN_VELOCITY_STREAM,
+	// Spawn table of the GPU backend.
+	GPU_SPAWN_DECAY_STREAM,
+	GPU_SPAWN_VELOCITY_STREAM,
+	// Spawn positions of ParticleBehavior emitters.
+	SPAWN_POSITION_STREAM,
+	// rand() calls of ParticleScript spawn programs, one stream each from here on.
+	SPAWN_SCRIPT_STREAM
+};
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+// There is no generator state: every draw is a pure function of the effect seed and a counter made of a stream ID, the
+// frame and the particle index. Particles may therefore be spawned in any order, on any thread, and still get the same
+// values from run to run; and batches of counters map onto SIMD lanes, so the batch APIs below fill whole
+// structure-of-arrays streams at a time. Different quantities drawn for the same particle (eg. decay and velocity) use
+// different streams.
+class ParticleRandom
+{
+public:
+	using Block = std::array<uint32_t, 4>;
+
+	// Counters generated per internal batch. The batch APIs may be given any count.
+	static constexpr size_t BATCH_SIZE = 256;
+
+	explicit ParticleRandom(const uint64_t seed = 0)
+		: key_{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32) }
+	{
+	}
+
+	// Four independent uniformly distributed words for one counter.
+	Block Generate(const uint32_t stream, const uint32_t frame, const uint32_t index) const
+	{
+		return Philox({ index, frame, stream, 0 }, key_);
+	}
+
+	float Uniform(const uint32_t stream, const uint32_t frame, const uint32_t index, const float min = 0.0f,
+	              const float max = 1.0f) const
+	{
+		return min + (max - min) * ToUnitFloat(Generate(stream, frame, index)[0]);
+	}
+
+	glm::vec3 UnitSphere(const uint32_t stream, const uint32_t frame, const uint32_t index) const
+	{
+		const auto words = Generate(stream, frame, index);
+		glm::vec3 result;
+		ToUnitSphere(words[0], words[1], result.x, result.y, result.z);
+		return result;
+	}
+
+	glm::vec3 UnitBall(const uint32_t stream, const uint32_t frame, const uint32_t index) const
+	{
+		const auto words = Generate(stream, frame, index);
+		glm::vec3 result;
+		ToUnitSphere(words[0], words[1], result.x, result.y, result.z);
+		return result * CubeRoot(ToOpenUnitFloat(words[2]));
+	}
+
+	// Batch APIs. Element i of the outputs is drawn for particle indices[i] (or firstIndex + i for the Range variants),
+	// and matches what the single-particle functions above return for it.
+
+	// Uniform in [min, max).
+	void FillUniform(const uint32_t stream, const uint32_t frame, const uint32_t* indices, const size_t count,
+	                 float* out, const float min = 0.0f, const float max = 1.0f) const
+	{
+		ForEachBatch(stream, frame, indices, 0, count, [out, min, max](const Words& words, const size_t offset, const size_t n)
+		{
+			MapUniform(words, n, out + offset, min, max);
+		});
+	}
+
+	void FillUniformRange(const uint32_t stream, const uint32_t frame, const uint32_t firstIndex, const size_t count,
+	                      float* out, const float min = 0.0f, const float max = 1.0f) const
+	{
+		ForEachBatch(stream, frame, nullptr, firstIndex, count, [out, min, max](const Words& words, const size_t offset, const size_t n)
+		{
+			MapUniform(words, n, out + offset, min, max);
+		});
+	}
+
+	// Uniform on the surface of the unit sphere.
+	void FillUnitSphere(const uint32_t stream, const uint32_t frame, const uint32_t* indices, const size_t count,
+	                    float* x, float* y, float* z) const
+	{
+		ForEachBatch(stream, frame, indices, 0, count, [x, y, z](const Words& words, const size_t offset, const size_t n)
+		{
+			MapUnitSphere(words, n, x + offset, y + offset, z + offset);
+		});
+	}
+
+	void FillUnitSphereRange(const uint32_t stream, const uint32_t frame, const uint32_t firstIndex, const size_t count,
+	                         float* x, float* y, float* z) const
+	{
+		ForEachBatch(stream, frame, nullptr, firstIndex, count, [x, y, z](const Words& words, const size_t offset, const size_t n)
+		{
+			MapUnitSphere(words, n, x + offset, y + offset, z + offset);
+		});
+	}
+
+	// Uniform in the volume of the unit ball.
+	void FillUnitBall(const uint32_t stream, const uint32_t frame, const uint32_t* indices, const size_t count,
+	                  float* x, float* y, float* z) const
+	{
+		ForEachBatch(stream, frame, indices, 0, count, [x, y, z](const Words& words, const size_t offset, const size_t n)
+		{
+			MapUnitBall(words, n, x + offset, y + offset, z + offset);
+		});
+	}
+
+	void FillUnitBallRange(const uint32_t stream, const uint32_t frame, const uint32_t firstIndex, const size_t count,
+	                       float* x, float* y, float* z) const
+	{
+		ForEachBatch(stream, frame, nullptr, firstIndex, count, [x, y, z](const Words& words, const size_t offset, const size_t n)
+		{
+			MapUnitBall(words, n, x + offset, y + offset, z + offset);
+		});
+	}
+
+	// Reference implementation of one Philox4x32-10 block.
+	static Block Philox(Block counter, std::array<uint32_t, 2> key)
+	{
+		for (auto round = 0; round < NUM_ROUNDS; ++round)
+		{
+			const auto product0 = static_cast<uint64_t>(MULTIPLIER_0) * counter[0];
+			const auto product1 = static_cast<uint64_t>(MULTIPLIER_1) * counter[2];
+			counter = {
+				static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+				static_cast<uint32_t>(product1),
+				static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+				static_cast<uint32_t>(product0)
+			};
+			key[0] += WEYL_0;
+			key[1] += WEYL_1;
+		}
+		return counter;
+	}
+
+	// [0, 1) with 24 bits of precision.
+	static float ToUnitFloat(const uint32_t word)
+	{
+		return static_cast<float>(word >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// (0, 1]
+	static float ToOpenUnitFloat(const uint32_t word)
+	{
+		return static_cast<float>((word >> 8) + 1) * (1.0f / 16777216.0f);
+	}
+
+private:
+	static constexpr int NUM_ROUNDS = 10;
+	static constexpr uint32_t MULTIPLIER_0 = 0xD2511F53u;
+	static constexpr uint32_t MULTIPLIER_1 = 0xCD9E8D57u;
+	static constexpr uint32_t WEYL_0 = 0x9E3779B9u;
+	static constexpr uint32_t WEYL_1 = 0xBB67AE85u;
+
+	// Output words of a batch, one structure-of-arrays stream per Philox output word.
+	using Words = std::array<std::array<uint32_t, BATCH_SIZE>, 4>;
+
+	// Philox over the counters { index[i], frame, stream, 0 } of one batch. count is a multiple of 8.
+	using GenerateFunc = void (*)(const uint32_t* index, size_t count, uint32_t frame, uint32_t stream,
+	                              const std::array<uint32_t, 2>& key, Words& words);
+
+	template<class Map>
+	void ForEachBatch(const uint32_t stream, const uint32_t frame, const uint32_t* indices, const uint32_t firstIndex,
+	                  const size_t count, const Map& map) const
+	{
+		static const auto generate = SelectGenerate(ParticleKernels::Detect());
+
+		alignas(32) std::array<uint32_t, BATCH_SIZE> batchIndices;
+		Words words;
+
+		for (size_t offset = 0; offset < count; offset += BATCH_SIZE)
+		{
+			const auto n = count - offset < BATCH_SIZE ? count - offset : BATCH_SIZE;
+			for (size_t i = 0; i < n; ++i)
+			{
+				batchIndices[i] = indices ? indices[offset + i] : static_cast<uint32_t>(firstIndex + offset + i);
+			}
+			// The kernels run whole lanes; the extra counters are generated and ignored.
+			const auto paddedCount = (n + 7) & ~size_t(7);
+			std::fill(batchIndices.begin() + n, batchIndices.begin() + paddedCount, 0u);
+
+			generate(batchIndices.data(), paddedCount, frame, stream, key_, words);
+			map(words, offset, n);
+		}
+	}
+
+	static void MapUniform(const Words& words, const size_t count, float* out, const float min, const float max)
+	{
+		const auto scale = max - min;
+		for (size_t i = 0; i < count; ++i)
+		{
+			out[i] = min + scale * ToUnitFloat(words[0][i]);
+		}
+	}
+
+	static void MapUnitSphere(const Words& words, const size_t count, float* x, float* y, float* z)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			ToUnitSphere(words[0][i], words[1][i], x[i], y[i], z[i]);
+		}
+	}
+
+	static void MapUnitBall(const Words& words, const size_t count, float* x, float* y, float* z)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto radius = CubeRoot(ToOpenUnitFloat(words[2][i]));
+			ToUnitSphere(words[0][i], words[1][i], x[i], y[i], z[i]);
+			x[i] *= radius;
+			y[i] *= radius;
+			z[i] *= radius;
+		}
+	}
+
+	// Archimedes: z uniform in [-1, 1) and a uniform angle around it give a uniform point on the sphere.
+	static void ToUnitSphere(const uint32_t zWord, const uint32_t angleWord, float& x, float& y, float& z)
+	{
+		z = 1.0f - 2.0f * ToUnitFloat(zWord);
+		const auto radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		float sine, cosine;
+		SinCosTurns(ToUnitFloat(angleWord), sine, cosine);
+		x = radius * cosine;
+		y = radius * sine;
+	}
+
+	// sin and cos of 2 pi turns, for turns in [0, 1). Branch-free polynomials (error < 1e-6), unlike std::sin and
+	// std::cos, so the mapping loops vectorize.
+	static void SinCosTurns(const float turns, float& sine, float& cosine)
+	{
+		const auto quadrants = turns * 4.0f;
+		const auto quadrant = static_cast<int>(quadrants);
+		const auto a = (quadrants - static_cast<float>(quadrant)) * 1.57079632679f;
+		const auto a2 = a * a;
+		const auto s = a * (1.0f + a2 * (-1.0f / 6.0f + a2 * (1.0f / 120.0f + a2 * (-1.0f / 5040.0f +
+			a2 * (1.0f / 362880.0f + a2 * (-1.0f / 39916800.0f))))));
+		const auto c = 1.0f + a2 * (-0.5f + a2 * (1.0f / 24.0f + a2 * (-1.0f / 720.0f + a2 * (1.0f / 40320.0f +
+			a2 * (-1.0f / 3628800.0f + a2 * (1.0f / 479001600.0f))))));
+
+		// Rotate (c, s) into the quadrant.
+		const auto swap = (quadrant & 1) != 0;
+		const auto negateCosine = quadrant == 1 || quadrant == 2;
+		const auto negateSine = quadrant >= 2;
+		const auto baseSine = swap ? c : s;
+		const auto baseCosine = swap ? s : c;
+		sine = negateSine ? -baseSine : baseSine;
+		cosine = negateCosine ? -baseCosine : baseCosine;
+	}
+
+	// Cube root of x in (0, 1]: an exponent-dividing bit trick, refined with Newton iterations.
+	static float CubeRoot(const float x)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		bits = bits / 3 + 0x2A5137A0u;
+		float y;
+		std::memcpy(&y, &bits, sizeof(y));
+		for (auto iteration = 0; iteration < 3; ++iteration)
+		{
+			y -= (y * y * y - x) / (3.0f * y * y);
+		}
+		return y;
+	}
+
+	static void GenerateScalar(const uint32_t* index, const size_t count, const uint32_t frame, const uint32_t stream,
+	                           const std::array<uint32_t, 2>& key, Words& words)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto block = Philox({ index[i], frame, stream, 0 }, key);
+			words[0][i] = block[0];
+			words[1][i] = block[1];
+			words[2][i] = block[2];
+			words[3][i] = block[3];
+		}
+	}
+
+#if PARTICLE_KERNELS_X86
+	// 32x32 -> 64 bit products of every lane: _mm_mul_epu32 only multiplies the even lanes, so the odd ones are shifted
+	// down for a second multiply and the halves are interleaved back.
+	static void MulHiLo(const __m128i a, const __m128i multiplier, __m128i& hi, __m128i& lo)
+	{
+		const auto lowMask = _mm_set1_epi64x(0xFFFFFFFFll);
+		const auto even = _mm_mul_epu32(a, multiplier);
+		const auto odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), multiplier);
+		lo = _mm_or_si128(_mm_and_si128(even, lowMask), _mm_slli_epi64(odd, 32));
+		hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(lowMask, odd));
+	}
+
+	static void GenerateSSE2(const uint32_t* index, const size_t count, const uint32_t frame, const uint32_t stream,
+	                         const std::array<uint32_t, 2>& key, Words& words)
+	{
+		const auto multiplier0 = _mm_set1_epi32(static_cast<int>(MULTIPLIER_0));
+		const auto multiplier1 = _mm_set1_epi32(static_cast<int>(MULTIPLIER_1));
+
+		for (size_t i = 0; i < count; i += 4)
+		{
+			auto c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(index + i));
+			auto c1 = _mm_set1_epi32(static_cast<int>(frame));
+			auto c2 = _mm_set1_epi32(static_cast<int>(stream));
+			auto c3 = _mm_setzero_si128();
+			auto k0 = key[0];
+			auto k1 = key[1];
+
+			for (auto round = 0; round < NUM_ROUNDS; ++round)
+			{
+				__m128i hi0, lo0, hi1, lo1;
+				MulHiLo(c0, multiplier0, hi0, lo0);
+				MulHiLo(c2, multiplier1, hi1, lo1);
+				c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32(static_cast<int>(k0)));
+				c1 = lo1;
+				c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32(static_cast<int>(k1)));
+				c3 = lo0;
+				k0 += WEYL_0;
+				k1 += WEYL_1;
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(words[0].data() + i), c0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(words[1].data() + i), c1);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(words[2].data() + i), c2);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(words[3].data() + i), c3);
+		}
+	}
+
+	PARTICLE_TARGET_AVX2
+	static void GenerateAVX2(const uint32_t* index, const size_t count, const uint32_t frame, const uint32_t stream,
+	                         const std::array<uint32_t, 2>& key, Words& words)
+	{
+		const auto multiplier0 = _mm256_set1_epi32(static_cast<int>(MULTIPLIER_0));
+		const auto multiplier1 = _mm256_set1_epi32(static_cast<int>(MULTIPLIER_1));
+
+		for (size_t i = 0; i < count; i += 8)
+		{
+			auto c0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i));
+			auto c1 = _mm256_set1_epi32(static_cast<int>(frame));
+			auto c2 = _mm256_set1_epi32(static_cast<int>(stream));
+			auto c3 = _mm256_setzero_si256();
+			auto k0 = key[0];
+			auto k1 = key[1];
+
+			for (auto round = 0; round < NUM_ROUNDS; ++round)
+			{
+				const auto even0 = _mm256_mul_epu32(c0, multiplier0);
+				const auto odd0 = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), multiplier0);
+				const auto even1 = _mm256_mul_epu32(c2, multiplier1);
+				const auto odd1 = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), multiplier1);
+				const auto hi0 = _mm256_blend_epi32(_mm256_srli_epi64(even0, 32), odd0, 0xAA);
+				const auto lo0 = _mm256_blend_epi32(even0, _mm256_slli_epi64(odd0, 32), 0xAA);
+				const auto hi1 = _mm256_blend_epi32(_mm256_srli_epi64(even1, 32), odd1, 0xAA);
+				const auto lo1 = _mm256_blend_epi32(even1, _mm256_slli_epi64(odd1, 32), 0xAA);
+
+				c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(static_cast<int>(k0)));
+				c1 = lo1;
+				c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(static_cast<int>(k1)));
+				c3 = lo0;
+				k0 += WEYL_0;
+				k1 += WEYL_1;
+			}
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(words[0].data() + i), c0);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(words[1].data() + i), c1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(words[2].data() + i), c2);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(words[3].data() + i), c3);
+		}
+	}
+#endif
+
+	static GenerateFunc SelectGenerate(const ParticleKernels::InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+#if PARTICLE_KERNELS_X86
+		case ParticleKernels::AVX2:
+			return GenerateAVX2;
+		case ParticleKernels::SSE2:
+			return GenerateSSE2;
+#endif
+		default:
+			return GenerateScalar;
+		}
+	}
+
+	std::array<uint32_t, 2> key_;
+};
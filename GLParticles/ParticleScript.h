@@ -0,0 +1,821 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ParticleBehavior.h"
+#include "ParticleKernels.h"
+#include "ParticlePool.h"
+#include "ParticleRandom.h"
+
+// Per-particle program of an effect file (see ParticleEffectFile), compiled from text into a compact register
+// bytecode. The interpreter runs each instruction over a whole block of BLOCK_SIZE particles, four lanes at a time, so
+// decoding it costs the same as a couple of SIMD operations.
+//
+// A program is a list of assignments, one per line, eg.
+//     drag = 0.5 * stepScale
+//     vx = vx - vx * drag
+// of numbers, names, + - * / and parentheses, and the functions min(a, b), max(a, b), clamp(x, lo, hi), mix(a, b, t),
+// abs(x), sqrt(x), floor(x), sin(x), cos(x), and in spawn programs rand() (uniform in [0, 1), drawn afresh by every
+// call in the program). Names are the particle's attributes (px, py, pz, vx, vy, vz, life, decay, size), dt and
+// stepScale in update programs, and locals, which the first assignment to a new name declares. Everything that only
+// depends on numbers is folded when compiling.
+class ParticleScript
+{
+public:
+	// A multiple of ParticlePool::LANE_PADDING, so update blocks never run past the padding.
+	static constexpr size_t BLOCK_SIZE = ParticlePool::LANE_PADDING;
+	static constexpr size_t NUM_REGISTERS = 256;
+
+	enum Stage
+	{
+		// Runs on freshly spawned particles. Writes px, py, pz, vx, vy, vz, decay and size.
+		SPAWN,
+		// Runs every step, before the particles move. Writes vx, vy, vz and size.
+		UPDATE
+	};
+
+	// Registers with a fixed meaning. Constants are allocated down from the last register, locals and temporaries up
+	// from NUM_FIXED_REGISTERS.
+	enum Register : uint8_t
+	{
+		POSITION_X,
+		POSITION_Y,
+		POSITION_Z,
+		VELOCITY_X,
+		VELOCITY_Y,
+		VELOCITY_Z,
+		LIFE,
+		DECAY,
+		SIZE,
+		NUM_ATTRIBUTES,
+		DELTA_TIME = NUM_ATTRIBUTES,
+		STEP_SCALE,
+		NUM_FIXED_REGISTERS
+	};
+
+	enum OpCode : uint8_t
+	{
+		MOVE,
+		ADD,
+		SUBTRACT,
+		MULTIPLY,
+		DIVIDE,
+		MINIMUM,
+		MAXIMUM,
+		ABSOLUTE,
+		SQUARE_ROOT,
+		FLOOR,
+		SINE,
+		COSINE,
+		// a is the call site, which picks the random stream.
+		RANDOM
+	};
+
+	// target = a op b
+	struct Instruction
+	{
+		OpCode op;
+		uint8_t target;
+		uint8_t a;
+		uint8_t b;
+	};
+
+	// One register: a value for each particle of a block.
+	struct alignas(16) Lanes
+	{
+		std::array<float, BLOCK_SIZE> values;
+	};
+
+	using Registers = std::array<Lanes, NUM_REGISTERS>;
+
+	ParticleScript() = default;
+
+	// Compiles source for stage. On failure, returns false and leaves script alone, with what went wrong and on which
+	// line (counted from firstLine) in error.
+	static bool Compile(const std::string& source, const Stage stage, ParticleScript& script, std::string& error,
+	                    const int firstLine = 1)
+	{
+		ParticleScript compiled;
+		Compiler compiler(stage, compiled);
+		std::istringstream lines(source);
+		std::string line;
+		for (auto lineNumber = firstLine; std::getline(lines, line); ++lineNumber)
+		{
+			if (!compiler.CompileLine(line))
+			{
+				error = "line " + std::to_string(lineNumber) + ": " + compiler.Error();
+				return false;
+			}
+		}
+
+		script = std::move(compiled);
+		return true;
+	}
+
+	bool IsEmpty() const
+	{
+		return code_.empty();
+	}
+
+	const std::vector<Instruction>& Code() const
+	{
+		return code_;
+	}
+
+	// Attributes the program reads and writes, as masks of 1 << Register.
+	uint32_t Reads() const
+	{
+		return reads_;
+	}
+
+	uint32_t Writes() const
+	{
+		return writes_;
+	}
+
+	// Fills the constant registers. Call once before running blocks through registers.
+	void InitializeRegisters(Registers& registers) const
+	{
+		for (size_t i = 0; i < constants_.size(); ++i)
+		{
+			registers[NUM_REGISTERS - 1 - i].values.fill(constants_[i]);
+		}
+	}
+
+	// Runs the program over one block of registers. rand() draws for particles indices[0, count) and frame.
+	void Execute(Registers& registers, const ParticleRandom& random, const uint32_t frame, const uint32_t* indices,
+	             const size_t count) const
+	{
+#if PARTICLE_KERNELS_X86
+		static const auto hasSSE2 = ParticleKernels::Detect() != ParticleKernels::SCALAR;
+		if (hasSSE2)
+		{
+			Run<ParticleFloat4>(registers, random, frame, indices, count);
+			return;
+		}
+#endif
+		Run<ParticleFloat1>(registers, random, frame, indices, count);
+	}
+
+private:
+	// One value of an expression being compiled: a number known when compiling, or a register.
+	struct Value
+	{
+		bool isConstant;
+		float constant;
+		uint8_t reg;
+	};
+
+	class Compiler
+	{
+	public:
+		Compiler(const Stage stage, ParticleScript& script)
+			: stage_(stage),
+			  script_(script),
+			  nextRegister_(NUM_FIXED_REGISTERS)
+		{
+		}
+
+		bool CompileLine(const std::string& line)
+		{
+			text_ = line.substr(0, line.find('#'));
+			position_ = 0;
+			if (!Peek())
+			{
+				return true;
+			}
+
+			std::string name;
+			if (!Identifier(name) || !Expect('='))
+			{
+				return Fail("expected an assignment");
+			}
+
+			const auto attribute = Attribute(name);
+			if (attribute < NUM_ATTRIBUTES && !IsWritable(attribute))
+			{
+				return Fail(name + " is read-only here");
+			}
+			if (attribute >= NUM_ATTRIBUTES && (name == "dt" || name == "stepScale" || IsFunction(name)))
+			{
+				return Fail(name + " can't be assigned");
+			}
+
+			const auto firstTemporary = nextRegister_;
+			Value value;
+			if (!Expression(value))
+			{
+				return false;
+			}
+			if (Peek())
+			{
+				return Fail(std::string("unexpected '") + Peek() + "'");
+			}
+
+			if (attribute < NUM_ATTRIBUTES)
+			{
+				if (!Store(value, attribute, firstTemporary))
+				{
+					return false;
+				}
+				script_.writes_ |= 1u << attribute;
+			}
+			else if (value.isConstant)
+			{
+				// Constant locals are only ever folded.
+				locals_[name] = value;
+			}
+			else
+			{
+				auto local = locals_.find(name);
+				if (local == locals_.end() || local->second.isConstant)
+				{
+					// The statement's temporaries are dead once the value is stored, so a new local takes the first one
+					// and keeps it.
+					const auto reg = static_cast<uint8_t>(firstTemporary);
+					local = locals_.insert_or_assign(name, Value{ false, 0.0f, reg }).first;
+					if (!Store(value, local->second.reg, firstTemporary))
+					{
+						return false;
+					}
+					nextRegister_ = firstTemporary + 1;
+					return true;
+				}
+				if (!Store(value, local->second.reg, firstTemporary))
+				{
+					return false;
+				}
+			}
+
+			nextRegister_ = firstTemporary;
+			return true;
+		}
+
+		const std::string& Error() const
+		{
+			return error_;
+		}
+
+	private:
+		// expression := term (('+' | '-') term)*
+		bool Expression(Value& value)
+		{
+			if (!Term(value))
+			{
+				return false;
+			}
+			while (Peek() == '+' || Peek() == '-')
+			{
+				const auto op = text_[position_++] == '+' ? ADD : SUBTRACT;
+				Value right;
+				if (!Term(right) || !Emit(op, value, right, value))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// term := unary (('*' | '/') unary)*
+		bool Term(Value& value)
+		{
+			if (!Unary(value))
+			{
+				return false;
+			}
+			while (Peek() == '*' || Peek() == '/')
+			{
+				const auto op = text_[position_++] == '*' ? MULTIPLY : DIVIDE;
+				Value right;
+				if (!Unary(right) || !Emit(op, value, right, value))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// unary := '-' unary | primary
+		bool Unary(Value& value)
+		{
+			if (Peek() != '-')
+			{
+				return Primary(value);
+			}
+
+			++position_;
+			Value operand;
+			// Multiplying by -1 flips the sign of zeros too, like negation.
+			return Unary(operand) && Emit(MULTIPLY, operand, Constant(-1.0f), value);
+		}
+
+		// primary := number | name | function '(' arguments ')' | '(' expression ')'
+		bool Primary(Value& value)
+		{
+			const auto c = Peek();
+			if (c == '(')
+			{
+				++position_;
+				return Expression(value) && Expect(')');
+			}
+			if (std::isdigit(static_cast<unsigned char>(c)) || c == '.')
+			{
+				const auto* const start = text_.c_str() + position_;
+				char* end = nullptr;
+				const auto number = std::strtof(start, &end);
+				if (end == start)
+				{
+					return Fail("invalid number");
+				}
+				position_ += end - start;
+				value = Constant(number);
+				return true;
+			}
+
+			std::string name;
+			if (!Identifier(name))
+			{
+				return Fail(c ? std::string("unexpected '") + c + "'" : "expected a value");
+			}
+			if (IsFunction(name))
+			{
+				return Call(name, value);
+			}
+
+			const auto attribute = Attribute(name);
+			if (attribute < NUM_ATTRIBUTES)
+			{
+				script_.reads_ |= 1u << attribute;
+				value = { false, 0.0f, attribute };
+				return true;
+			}
+			if (stage_ == UPDATE && (name == "dt" || name == "stepScale"))
+			{
+				value = { false, 0.0f, static_cast<uint8_t>(name == "dt" ? DELTA_TIME : STEP_SCALE) };
+				return true;
+			}
+
+			const auto local = locals_.find(name);
+			if (local == locals_.end())
+			{
+				return Fail("unknown name " + name);
+			}
+			value = local->second;
+			return true;
+		}
+
+		bool Call(const std::string& name, Value& value)
+		{
+			std::vector<Value> arguments;
+			if (!Expect('('))
+			{
+				return false;
+			}
+			while (Peek() != ')')
+			{
+				if (!arguments.empty() && !Expect(','))
+				{
+					return false;
+				}
+				Value argument;
+				if (!Expression(argument))
+				{
+					return false;
+				}
+				arguments.push_back(argument);
+			}
+			++position_;
+
+			const auto arity = name == "rand" ? 0u : name == "clamp" || name == "mix" ? 3u
+				: name == "min" || name == "max" ? 2u : 1u;
+			if (arguments.size() != arity)
+			{
+				return Fail(name + " takes " + std::to_string(arity) + " arguments");
+			}
+
+			if (name == "rand")
+			{
+				if (stage_ != SPAWN)
+				{
+					return Fail("rand() is only available when spawning");
+				}
+				if (!Allocate(value))
+				{
+					return false;
+				}
+				script_.code_.push_back({ RANDOM, value.reg, numRandomCalls_++, 0 });
+				return true;
+			}
+			if (name == "min" || name == "max")
+			{
+				return Emit(name == "min" ? MINIMUM : MAXIMUM, arguments[0], arguments[1], value);
+			}
+			if (name == "clamp")
+			{
+				return Emit(MAXIMUM, arguments[0], arguments[1], value) && Emit(MINIMUM, value, arguments[2], value);
+			}
+			if (name == "mix")
+			{
+				// a + (b - a) * t
+				Value difference;
+				return Emit(SUBTRACT, arguments[1], arguments[0], difference) &&
+				       Emit(MULTIPLY, difference, arguments[2], difference) &&
+				       Emit(ADD, arguments[0], difference, value);
+			}
+
+			const auto op = name == "abs" ? ABSOLUTE : name == "sqrt" ? SQUARE_ROOT : name == "floor" ? FLOOR
+				: name == "sin" ? SINE : COSINE;
+			return Emit(op, arguments[0], arguments[0], value);
+		}
+
+		// Folds result = a op b when both are constant, and emits it into a new temporary otherwise.
+		bool Emit(const OpCode op, const Value& a, const Value& b, Value& result)
+		{
+			if (a.isConstant && b.isConstant)
+			{
+				result = Constant(Fold(op, a.constant, b.constant));
+				return true;
+			}
+
+			Value left = a;
+			Value right = b;
+			Value target;
+			if (!Materialize(left) || !Materialize(right) || !Allocate(target))
+			{
+				return false;
+			}
+			script_.code_.push_back({ op, target.reg, left.reg, right.reg });
+			result = target;
+			return true;
+		}
+
+		// Writes value into target: by retargeting the instruction that just computed it into a temporary, or with a
+		// move. Returns false if a constant value finds no register.
+		bool Store(Value value, const uint8_t target, const uint8_t firstTemporary)
+		{
+			auto& code = script_.code_;
+			const auto isTemporary = value.reg >= firstTemporary &&
+			                         value.reg < NUM_REGISTERS - script_.constants_.size();
+			if (!value.isConstant && isTemporary && !code.empty() && code.back().target == value.reg)
+			{
+				code.back().target = target;
+				return true;
+			}
+			if (!Materialize(value))
+			{
+				return false;
+			}
+			code.push_back({ MOVE, target, value.reg, value.reg });
+			return true;
+		}
+
+		// Gives a constant a register, shared with equal constants.
+		bool Materialize(Value& value)
+		{
+			if (!value.isConstant)
+			{
+				return true;
+			}
+
+			auto& constants = script_.constants_;
+			size_t index = 0;
+			while (index < constants.size() && std::memcmp(&constants[index], &value.constant, sizeof(float)) != 0)
+			{
+				++index;
+			}
+			if (index == constants.size())
+			{
+				if (NUM_REGISTERS - constants.size() <= nextRegister_)
+				{
+					return Fail("program is too long");
+				}
+				constants.push_back(value.constant);
+			}
+			value = { false, 0.0f, static_cast<uint8_t>(NUM_REGISTERS - 1 - index) };
+			return true;
+		}
+
+		bool Allocate(Value& value)
+		{
+			if (nextRegister_ >= NUM_REGISTERS - script_.constants_.size())
+			{
+				return Fail("program is too long");
+			}
+			value = { false, 0.0f, static_cast<uint8_t>(nextRegister_++) };
+			return true;
+		}
+
+		static Value Constant(const float constant)
+		{
+			return { true, constant, 0 };
+		}
+
+		static float Fold(const OpCode op, const float a, const float b)
+		{
+			switch (op)
+			{
+			case ADD:
+				return a + b;
+			case SUBTRACT:
+				return a - b;
+			case MULTIPLY:
+				return a * b;
+			case DIVIDE:
+				return a / b;
+			case MINIMUM:
+				return a < b ? a : b;
+			case MAXIMUM:
+				return a > b ? a : b;
+			case ABSOLUTE:
+				return std::abs(a);
+			case SQUARE_ROOT:
+				return std::sqrt(a);
+			case FLOOR:
+				return std::floor(a);
+			case SINE:
+				return std::sin(a);
+			case COSINE:
+				return std::cos(a);
+			default:
+				return a;
+			}
+		}
+
+		static bool IsFunction(const std::string& name)
+		{
+			return name == "min" || name == "max" || name == "clamp" || name == "mix" || name == "abs" ||
+			       name == "sqrt" || name == "floor" || name == "sin" || name == "cos" || name == "rand";
+		}
+
+		// Register of the attribute called name, NUM_ATTRIBUTES if there is none.
+		static uint8_t Attribute(const std::string& name)
+		{
+			static const char* const names[NUM_ATTRIBUTES] = {
+				"px", "py", "pz", "vx", "vy", "vz", "life", "decay", "size"
+			};
+			for (uint8_t attribute = 0; attribute < NUM_ATTRIBUTES; ++attribute)
+			{
+				if (name == names[attribute])
+				{
+					return attribute;
+				}
+			}
+			return NUM_ATTRIBUTES;
+		}
+
+		bool IsWritable(const uint8_t attribute) const
+		{
+			if (stage_ == UPDATE)
+			{
+				return (attribute >= VELOCITY_X && attribute <= VELOCITY_Z) || attribute == SIZE;
+			}
+			return attribute != LIFE;
+		}
+
+		// Next character that isn't a space, 0 at the end of the line.
+		char Peek()
+		{
+			while (position_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[position_])))
+			{
+				++position_;
+			}
+			return position_ < text_.size() ? text_[position_] : 0;
+		}
+
+		bool Identifier(std::string& name)
+		{
+			const auto c = Peek();
+			if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_')
+			{
+				return false;
+			}
+			const auto start = position_;
+			while (position_ < text_.size() &&
+			       (std::isalnum(static_cast<unsigned char>(text_[position_])) || text_[position_] == '_'))
+			{
+				++position_;
+			}
+			name = text_.substr(start, position_ - start);
+			return true;
+		}
+
+		bool Expect(const char c)
+		{
+			if (Peek() != c)
+			{
+				return Fail(std::string("expected '") + c + "'");
+			}
+			++position_;
+			return true;
+		}
+
+		bool Fail(const std::string& error)
+		{
+			if (error_.empty())
+			{
+				error_ = error;
+			}
+			return false;
+		}
+
+		Stage stage_;
+		ParticleScript& script_;
+		std::map<std::string, Value> locals_;
+		size_t nextRegister_;
+		uint8_t numRandomCalls_ = 0;
+		std::string text_;
+		size_t position_ = 0;
+		std::string error_;
+	};
+
+	template<class Float>
+	void Run(Registers& registers, const ParticleRandom& random, const uint32_t frame, const uint32_t* indices,
+	         const size_t count) const
+	{
+		for (const auto& instruction : code_)
+		{
+			auto& target = registers[instruction.target].values;
+			const auto& a = registers[instruction.a].values;
+			const auto& b = registers[instruction.b].values;
+			switch (instruction.op)
+			{
+			case MOVE:
+				target = a;
+				break;
+			case ADD:
+				Binary<Float>(target, a, b, [](const Float x, const Float y) { return x + y; });
+				break;
+			case SUBTRACT:
+				Binary<Float>(target, a, b, [](const Float x, const Float y) { return x - y; });
+				break;
+			case MULTIPLY:
+				Binary<Float>(target, a, b, [](const Float x, const Float y) { return x * y; });
+				break;
+			case DIVIDE:
+				Binary<Float>(target, a, b, [](const Float x, const Float y) { return x / y; });
+				break;
+			case MINIMUM:
+				Binary<Float>(target, a, b, [](const Float x, const Float y) { return Min(x, y); });
+				break;
+			case MAXIMUM:
+				Binary<Float>(target, a, b, [](const Float x, const Float y) { return Max(x, y); });
+				break;
+			case ABSOLUTE:
+				Map(target, a, [](const float x) { return std::abs(x); });
+				break;
+			case SQUARE_ROOT:
+				Map(target, a, [](const float x) { return std::sqrt(x); });
+				break;
+			case FLOOR:
+				Map(target, a, [](const float x) { return std::floor(x); });
+				break;
+			case SINE:
+				Map(target, a, [](const float x) { return std::sin(x); });
+				break;
+			case COSINE:
+				Map(target, a, [](const float x) { return std::cos(x); });
+				break;
+			case RANDOM:
+				random.FillUniform(SPAWN_SCRIPT_STREAM + instruction.a, frame, indices, count, target.data());
+				std::fill(target.begin() + count, target.end(), 0.0f);
+				break;
+			}
+		}
+	}
+
+	template<class Float, class Op>
+	static void Binary(std::array<float, BLOCK_SIZE>& target, const std::array<float, BLOCK_SIZE>& a,
+	                   const std::array<float, BLOCK_SIZE>& b, const Op& op)
+	{
+		for (size_t i = 0; i < BLOCK_SIZE; i += Float::LANES)
+		{
+			op(Float::Load(&a[i]), Float::Load(&b[i])).Store(&target[i]);
+		}
+	}
+
+	template<class Op>
+	static void Map(std::array<float, BLOCK_SIZE>& target, const std::array<float, BLOCK_SIZE>& a, const Op& op)
+	{
+		for (size_t i = 0; i < BLOCK_SIZE; ++i)
+		{
+			target[i] = op(a[i]);
+		}
+	}
+
+	std::vector<Instruction> code_;
+	// Register NUM_REGISTERS - 1 - i holds constants_[i].
+	std::vector<float> constants_;
+	uint32_t reads_ = 0;
+	uint32_t writes_ = 0;
+};
+
+// ParticleBehavior of an effect file: the settings' spawn distributions followed by the spawn program, and the update
+// program followed by the usual integration (see ParticleKernels::Integrate()). The update program sees each particle
+// before the step, and what it writes to the velocity moves the particle, like the force fields.
+struct ParticleScriptModules
+{
+	ParticleModules<ParticlePointEmitter, ParticleBallVelocity, ParticleUniformDecay> defaults;
+	ParticleScript spawn;
+	ParticleScript update;
+
+	void Spawn(const ParticleRandom& random, const uint32_t frame, const uint32_t* indices, const size_t count,
+	           const glm::vec3& origin, const ParticlePool& pool) const
+	{
+		defaults.Spawn(random, frame, indices, count, origin, pool);
+		if (spawn.IsEmpty())
+		{
+			return;
+		}
+
+		ParticleScript::Registers registers;
+		spawn.InitializeRegisters(registers);
+		for (size_t block = 0; block < count; block += ParticleScript::BLOCK_SIZE)
+		{
+			const auto blockCount = std::min(ParticleScript::BLOCK_SIZE, count - block);
+			const auto* const blockIndices = indices + block;
+			ForEachAttribute(spawn.Reads(), [&](const uint8_t attribute, float* stream)
+			{
+				auto& lanes = registers[attribute].values;
+				lanes.fill(0.0f);
+				for (size_t i = 0; i < blockCount; ++i)
+				{
+					lanes[i] = stream[blockIndices[i]];
+				}
+			}, pool);
+			spawn.Execute(registers, random, frame, blockIndices, blockCount);
+			ForEachAttribute(spawn.Writes(), [&](const uint8_t attribute, float* stream)
+			{
+				for (size_t i = 0; i < blockCount; ++i)
+				{
+					stream[blockIndices[i]] = registers[attribute].values[i];
+				}
+			}, pool);
+		}
+
+		// Spawned particles start where they are.
+		for (size_t i = 0; i < count; ++i)
+		{
+			pool.PreviousX()[indices[i]] = pool.PositionX()[indices[i]];
+			pool.PreviousY()[indices[i]] = pool.PositionY()[indices[i]];
+			pool.PreviousZ()[indices[i]] = pool.PositionZ()[indices[i]];
+		}
+	}
+
+	// Same contract as ParticleKernels::Integrate().
+	void Update(const ParticlePool& pool, const size_t begin, const size_t end, const ParticleIntegration& step) const
+	{
+		if (!update.IsEmpty())
+		{
+			const ParticleRandom random;
+			ParticleScript::Registers registers;
+			update.InitializeRegisters(registers);
+			registers[ParticleScript::DELTA_TIME].values.fill(step.deltaTime);
+			registers[ParticleScript::STEP_SCALE].values.fill(step.stepScale);
+
+			for (auto block = begin; block < end; block += ParticleScript::BLOCK_SIZE)
+			{
+				ForEachAttribute(update.Reads(), [&](const uint8_t attribute, float* stream)
+				{
+					std::copy(stream + block, stream + block + ParticleScript::BLOCK_SIZE,
+					          registers[attribute].values.begin());
+				}, pool);
+				update.Execute(registers, random, 0, nullptr, 0);
+				ForEachAttribute(update.Writes(), [&](const uint8_t attribute, float* stream)
+				{
+					std::copy(registers[attribute].values.begin(), registers[attribute].values.end(), stream + block);
+				}, pool);
+			}
+		}
+
+		ParticleKernels::Integrate(pool, begin, end, step);
+	}
+
+private:
+	template<class Func>
+	static void ForEachAttribute(uint32_t mask, const Func& func, const ParticlePool& pool)
+	{
+		float* const streams[ParticleScript::NUM_ATTRIBUTES] = {
+			pool.PositionX(), pool.PositionY(), pool.PositionZ(), pool.VelocityX(), pool.VelocityY(), pool.VelocityZ(),
+			pool.Life(), pool.Decay(), pool.Size()
+		};
+		for (uint8_t attribute = 0; mask; ++attribute, mask >>= 1)
+		{
+			if (mask & 1)
+			{
+				func(attribute, streams[attribute]);
+			}
+		}
+	}
+};
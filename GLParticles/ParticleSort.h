@@ -0,0 +1,379 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "ParticlePool.h"
+#include "WorkerPool.h"
+
+struct ParticleSortSettings
+{
+	enum Mode
+	{
+		// Radix sort from scratch every frame.
+		FULL,
+		// Keep last frame's order and repair it with a bounded insertion sort, falling back to a full sort when the
+		// order is too far off.
+		INCREMENTAL
+	};
+
+	Mode mode = FULL;
+	// Largest number of element shifts an incremental repair may do, as a fraction of the particle count, before it
+	// gives up and falls back to a full sort.
+	float maxDisorder = 0.5f;
+	// While the view doesn't change, sort only every amortizeFrames frames and reuse the previous order in between.
+	// 1 sorts every frame.
+	int amortizeFrames = 1;
+};
+
+// Cumulative counters, for tuning ParticleSortSettings.
+struct ParticleSortStats
+{
+	uint64_t fullSorts = 0;
+	uint64_t incrementalSorts = 0;
+	uint64_t fallbacks = 0;
+	uint64_t skippedFrames = 0;
+	// Element shifts done by incremental repairs, including the ones that fell back.
+	uint64_t repairShifts = 0;
+};
+
+// Back-to-front depth ordering of a ParticlePool.
+// The view-space depth of every particle is extracted once into a 32-bit key, then the (key, index) pairs go through
+// an LSD radix sort: four linear 8-bit passes instead of O(n log n) comparisons. Passes are split into blocks that
+// are histogrammed and scattered in parallel when a WorkerPool is given.
+// Since the order changes little between frames, the sorter can instead repair the previous frame's order (see
+// ParticleSortSettings::INCREMENTAL).
+class ParticleDepthSorter
+{
+public:
+	static constexpr size_t RADIX_BITS = 8;
+	static constexpr size_t NUM_BUCKETS = 1 << RADIX_BITS;
+	static constexpr size_t NUM_PASSES = 32 / RADIX_BITS;
+
+	// Particles per block in a parallel sort pass.
+	static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+	// Sorts the first pool.Count() particles farthest-first as seen through view. The result is read from Order().
+	void Sort(const ParticlePool& pool, const glm::mat4& view, WorkerPool* workers = nullptr)
+	{
+		const auto count = pool.Count();
+		const auto hasOrder = isOrderValid_ && indices_.size() == count;
+		// Particles spawning and dying change the count, but the order of the ones that stay is still worth repairing.
+		const auto canRepair = isOrderValid_;
+
+		if (hasOrder && view == lastView_ && ++framesSinceSort_ < settings_.amortizeFrames)
+		{
+			++stats_.skippedFrames;
+			return;
+		}
+		framesSinceSort_ = 0;
+		lastView_ = view;
+		isOrderValid_ = true;
+
+		if (settings_.mode == ParticleSortSettings::INCREMENTAL && canRepair)
+		{
+			const auto orderedCount = hasOrder ? count : ResizeOrder(count);
+
+			ForEachBlock(workers, count, [this, &pool, &view](const size_t, const size_t begin, const size_t end)
+			{
+				ComputeKeys(pool, view, begin, end, true);
+			});
+
+			if (RepairOrder(count, orderedCount))
+			{
+				++stats_.incrementalSorts;
+				return;
+			}
+			++stats_.fallbacks;
+		}
+
+		Resize(count);
+		ForEachBlock(workers, count, [this, &pool, &view](const size_t, const size_t begin, const size_t end)
+		{
+			ComputeKeys(pool, view, begin, end, false);
+		});
+		RadixSort(count, workers);
+		++stats_.fullSorts;
+	}
+
+	// Forgets the previous order, eg. after particles were moved around in the pool. The next Sort() is a full sort.
+	void Invalidate()
+	{
+		isOrderValid_ = false;
+	}
+
+	// Allocates for sorting up to count particles up front, so sorts that size never allocate.
+	void Reserve(const size_t count)
+	{
+		keys_.reserve(count);
+		scratchKeys_.reserve(count);
+		indices_.reserve(count);
+		scratchIndices_.reserve(count);
+		histograms_.reserve((count + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	}
+
+	const ParticleSortSettings& Settings() const
+	{
+		return settings_;
+	}
+
+	void SetSettings(const ParticleSortSettings& settings)
+	{
+		settings_ = settings;
+	}
+
+	const ParticleSortStats& Stats() const
+	{
+		return stats_;
+	}
+
+	void ResetStats()
+	{
+		stats_ = {};
+	}
+
+	// Particle indices, farthest from the camera first.
+	const std::vector<uint32_t>& Order() const
+	{
+		return indices_;
+	}
+
+	// Maps a float to a uint32_t whose unsigned order matches the float order (negative values included).
+	static uint32_t FloatToSortableKey(const float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		const uint32_t mask = (bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u;
+		return bits ^ mask;
+	}
+
+private:
+	using Histogram = std::array<uint32_t, NUM_BUCKETS>;
+
+	void Resize(const size_t count)
+	{
+		keys_.resize(count);
+		scratchKeys_.resize(count);
+		indices_.resize(count);
+		scratchIndices_.resize(count);
+		histograms_.resize((count + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	}
+
+	// Fits the previous order to count particles: the indices past the new count are dropped, keeping the order of the
+	// rest, and the indices of particles that weren't sorted yet are appended for RepairOrder() to merge in. Returns
+	// how many of the indices come from the previous order.
+	size_t ResizeOrder(const size_t count)
+	{
+		const auto previousCount = indices_.size();
+		size_t kept = 0;
+		for (size_t i = 0; i < previousCount; ++i)
+		{
+			if (indices_[i] < count)
+			{
+				indices_[kept++] = indices_[i];
+			}
+		}
+
+		Resize(count);
+		for (auto index = previousCount; index < count; ++index)
+		{
+			indices_[kept++] = static_cast<uint32_t>(index);
+		}
+		return previousCount < count ? previousCount : count;
+	}
+
+	// Computes the keys of [begin, end). With reuseOrder the keys follow the current order, otherwise the order is
+	// reset to the pool order.
+	void ComputeKeys(const ParticlePool& pool, const glm::mat4& view, const size_t begin, const size_t end,
+	                 const bool reuseOrder)
+	{
+		// The camera looks down -Z in view space, so ascending view-space z is back-to-front.
+		const auto zx = view[0][2];
+		const auto zy = view[1][2];
+		const auto zz = view[2][2];
+		const auto zw = view[3][2];
+
+		const auto* const px = pool.PositionX();
+		const auto* const py = pool.PositionY();
+		const auto* const pz = pool.PositionZ();
+
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto p = reuseOrder ? indices_[i] : static_cast<uint32_t>(i);
+			keys_[i] = FloatToSortableKey(zx * px[p] + zy * py[p] + zz * pz[p] + zw);
+			indices_[i] = p;
+		}
+	}
+
+	// Insertion sort of the (key, index) pairs, which is linear for an almost sorted order. The first orderedCount pairs
+	// (last frame's order) and the rest (particles new to the order) are sorted separately, then merged, so new
+	// particles cost a pass over the order rather than shifting it once each. Returns false, leaving the order
+	// partially repaired, once more than maxDisorder * count shifts were needed.
+	bool RepairOrder(const size_t count, const size_t orderedCount)
+	{
+		const auto maxShifts = static_cast<uint64_t>(settings_.maxDisorder * static_cast<float>(count));
+		uint64_t shifts = 0;
+
+		for (const auto& run : { std::make_pair(size_t(0), orderedCount), std::make_pair(orderedCount, count) })
+		{
+			for (auto i = run.first + 1; i < run.second; ++i)
+			{
+				const auto key = keys_[i];
+				if (keys_[i - 1] <= key)
+				{
+					continue;
+				}
+
+				const auto index = indices_[i];
+				auto j = i;
+				for (; j > run.first && keys_[j - 1] > key; --j)
+				{
+					keys_[j] = keys_[j - 1];
+					indices_[j] = indices_[j - 1];
+				}
+				keys_[j] = key;
+				indices_[j] = index;
+
+				shifts += i - j;
+				if (shifts > maxShifts)
+				{
+					stats_.repairShifts += shifts;
+					return false;
+				}
+			}
+		}
+		stats_.repairShifts += shifts;
+
+		if (orderedCount < count)
+		{
+			MergeOrder(count, orderedCount);
+		}
+		return true;
+	}
+
+	// Merges the sorted runs [0, middle) and [middle, count) of the (key, index) pairs, through the scratch arrays.
+	// Stable, so equal keys keep last frame's order first.
+	void MergeOrder(const size_t count, const size_t middle)
+	{
+		size_t left = 0;
+		size_t right = middle;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto takeLeft = right == count || (left < middle && keys_[left] <= keys_[right]);
+			const auto source = takeLeft ? left++ : right++;
+			scratchKeys_[i] = keys_[source];
+			scratchIndices_[i] = indices_[source];
+		}
+		keys_.swap(scratchKeys_);
+		indices_.swap(scratchIndices_);
+	}
+
+	void RadixSort(const size_t count, WorkerPool* workers)
+	{
+		for (size_t pass = 0; pass < NUM_PASSES; ++pass)
+		{
+			const auto shift = static_cast<uint32_t>(pass * RADIX_BITS);
+
+			ForEachBlock(workers, count, [this, shift](const size_t block, const size_t begin, const size_t end)
+			{
+				auto& histogram = histograms_[block];
+				histogram.fill(0);
+				for (auto i = begin; i < end; ++i)
+				{
+					++histogram[(keys_[i] >> shift) & (NUM_BUCKETS - 1)];
+				}
+			});
+
+			// Every key shares this digit, so the pass would be an identity permutation.
+			if (IsSingleBucket(count))
+			{
+				continue;
+			}
+
+			// Turn the per-block counts into per-block scatter offsets: bucket-major, then block order, which keeps
+			// the sort stable.
+			uint32_t offset = 0;
+			for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+			{
+				for (auto& histogram : histograms_)
+				{
+					const auto bucketCount = histogram[bucket];
+					histogram[bucket] = offset;
+					offset += bucketCount;
+				}
+			}
+
+			ForEachBlock(workers, count, [this, shift](const size_t block, const size_t begin, const size_t end)
+			{
+				auto& offsets = histograms_[block];
+				for (auto i = begin; i < end; ++i)
+				{
+					const auto destination = offsets[(keys_[i] >> shift) & (NUM_BUCKETS - 1)]++;
+					scratchKeys_[destination] = keys_[i];
+					scratchIndices_[destination] = indices_[i];
+				}
+			});
+
+			keys_.swap(scratchKeys_);
+			indices_.swap(scratchIndices_);
+		}
+	}
+
+	bool IsSingleBucket(const size_t count) const
+	{
+		for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+		{
+			size_t bucketCount = 0;
+			for (const auto& histogram : histograms_)
+			{
+				bucketCount += histogram[bucket];
+			}
+			if (bucketCount != 0)
+			{
+				return bucketCount == count;
+			}
+		}
+		return true;
+	}
+
+	template<class Func>
+	static void ForEachBlock(WorkerPool* workers, const size_t count, const Func& func)
+	{
+		const auto numBlocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const auto runBlocks = [count, &func](const size_t firstBlock, const size_t lastBlock)
+		{
+			for (auto block = firstBlock; block < lastBlock; ++block)
+			{
+				const auto begin = block * BLOCK_SIZE;
+				const auto end = begin + BLOCK_SIZE < count ? begin + BLOCK_SIZE : count;
+				func(block, begin, end);
+			}
+		};
+
+		if (workers)
+		{
+			workers->ParallelFor(numBlocks, 1, runBlocks);
+		}
+		else
+		{
+			runBlocks(0, numBlocks);
+		}
+	}
+
+	std::vector<uint32_t> keys_;
+	std::vector<uint32_t> scratchKeys_;
+	std::vector<uint32_t> indices_;
+	std::vector<uint32_t> scratchIndices_;
+	std::vector<Histogram> histograms_;
+
+	ParticleSortSettings settings_;
+	ParticleSortStats stats_;
+	glm::mat4 lastView_ = glm::mat4(0.0f);
+	int framesSinceSort_ = 0;
+	bool isOrderValid_ = false;
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "ParticlePool.h"
+#include "WorkerPool.h"
+
+// Uniform grid over a ParticlePool for neighbor queries, rebuilt from scratch whenever the particles moved.
+// Space is cut into cubic cells of CellSize(), and cells are hashed into a power-of-two table, so the grid is unbounded
+// and its memory follows the particle count rather than the extent of the effect. The build is a counting sort on the
+// hashed cell: particles are histogrammed per block, the counts turn into scatter offsets (cell-major, then block order,
+// which keeps it stable), and each block scatters its particles, so every step runs in parallel when a WorkerPool is
+// given. Positions are copied into cell order along with the indices, so a query walks contiguous memory.
+// Distinct cells may share a bucket of the table. Radius queries visit each bucket once; ForEachCell() hands out whole
+// buckets.
+// The indices refer to the pool as it was at Build(): any change to the pool (eg. the next simulation step, which
+// removes dead particles) invalidates them.
+class ParticleSpatialGrid
+{
+public:
+	// Blocks of a parallel build. Few and large: each block owns a histogram of the whole table.
+	static constexpr size_t MIN_BLOCK_SIZE = 64 * 1024;
+	// Table buckets per particle, rounded up to a power of two, within [MIN_TABLE_SIZE, MAX_TABLE_SIZE].
+	static constexpr size_t MIN_TABLE_SIZE = 1024;
+	static constexpr size_t MAX_TABLE_SIZE = 1 << 22;
+	// Largest query range, in cells, whose visited buckets are tracked (a radius of up to 1.5 cells).
+	static constexpr int MAX_QUERY_CELLS = 64;
+
+	// Sorts the first pool.Count() particles into cells of cellSize.
+	void Build(const ParticlePool& pool, const float cellSize, WorkerPool* workers = nullptr)
+	{
+		Build(pool.PositionX(), pool.PositionY(), pool.PositionZ(), pool.Count(), cellSize, workers);
+	}
+
+	// Same, from any structure-of-arrays positions.
+	void Build(const float* px, const float* py, const float* pz, const size_t count, const float cellSize,
+	           WorkerPool* workers = nullptr)
+	{
+		cellSize_ = cellSize;
+		inverseCellSize_ = 1.0f / cellSize;
+		Resize(count, workers);
+
+		// Hash every particle and count it in its block's histogram.
+		ForEachBlock(workers, [this, px, py, pz](const size_t block, const size_t begin, const size_t end)
+		{
+			auto* const histogram = counts_.data() + block * tableSize_;
+			std::fill_n(histogram, tableSize_, 0u);
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto bucket = Bucket(CellOf(px[i]), CellOf(py[i]), CellOf(pz[i]));
+				buckets_[i] = bucket;
+				++histogram[bucket];
+			}
+		});
+
+		ComputeOffsets(workers);
+
+		ForEachBlock(workers, [this, px, py, pz](const size_t block, const size_t begin, const size_t end)
+		{
+			auto* const offsets = counts_.data() + block * tableSize_;
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto destination = offsets[buckets_[i]]++;
+				indices_[destination] = static_cast<uint32_t>(i);
+				sortedX_[destination] = px[i];
+				sortedY_[destination] = py[i];
+				sortedZ_[destination] = pz[i];
+			}
+		});
+	}
+
+	// Allocates for builds over up to count particles with workers up front, so builds that size never allocate.
+	void Reserve(const size_t count, WorkerPool* workers = nullptr)
+	{
+		const auto tableSize = TableSize(count);
+		buckets_.reserve(count);
+		indices_.reserve(count);
+		sortedX_.reserve(count);
+		sortedY_.reserve(count);
+		sortedZ_.reserve(count);
+		counts_.reserve(NumBlocks(count, workers) * tableSize);
+		cellStart_.reserve(tableSize + 1);
+		rangeTotals_.reserve((tableSize + MIN_TABLE_SIZE - 1) / MIN_TABLE_SIZE);
+	}
+
+	// Calls func(index, distanceSquared) for every particle within radius of center, in no particular order.
+	template<class Func>
+	void ForEachInRadius(const glm::vec3& center, const float radius, const Func& func) const
+	{
+		if (indices_.empty())
+		{
+			return;
+		}
+
+		const auto radiusSquared = radius * radius;
+		const auto minCell = glm::ivec3(CellOf(center.x - radius), CellOf(center.y - radius), CellOf(center.z - radius));
+		const auto maxCell = glm::ivec3(CellOf(center.x + radius), CellOf(center.y + radius), CellOf(center.z + radius));
+		const auto cells = maxCell - minCell + 1;
+
+		// A particle within radius always lies in a cell of the range, so a bucket shared by several cells in range only
+		// needs to be visited once, whichever cell it came from. Past MAX_QUERY_CELLS, tracking visited buckets costs
+		// more than checking the cell of every candidate instead.
+		const auto trackBuckets = cells.x * cells.y * cells.z <= MAX_QUERY_CELLS;
+		std::array<uint32_t, MAX_QUERY_CELLS> visited;
+		size_t numVisited = 0;
+
+		for (auto z = minCell.z; z <= maxCell.z; ++z)
+		{
+			for (auto y = minCell.y; y <= maxCell.y; ++y)
+			{
+				for (auto x = minCell.x; x <= maxCell.x; ++x)
+				{
+					const auto bucket = Bucket(x, y, z);
+					if (trackBuckets)
+					{
+						const auto visitedEnd = visited.begin() + numVisited;
+						if (std::find(visited.begin(), visitedEnd, bucket) != visitedEnd)
+						{
+							continue;
+						}
+						visited[numVisited++] = bucket;
+					}
+
+					for (auto i = cellStart_[bucket]; i < cellStart_[bucket + 1]; ++i)
+					{
+						const auto dx = sortedX_[i] - center.x;
+						const auto dy = sortedY_[i] - center.y;
+						const auto dz = sortedZ_[i] - center.z;
+						const auto distanceSquared = dx * dx + dy * dy + dz * dz;
+						if (distanceSquared <= radiusSquared && (trackBuckets || IsInCell(i, x, y, z)))
+						{
+							func(indices_[i], distanceSquared);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Number of particles within radius of center.
+	size_t CountInRadius(const glm::vec3& center, const float radius) const
+	{
+		size_t count = 0;
+		ForEachInRadius(center, radius, [&count](uint32_t, float) { ++count; });
+		return count;
+	}
+
+	// Calls func(first, count) for every non-empty bucket, with the particle indices it holds at [first, first + count)
+	// and their positions at the same offsets of SortedX/Y/Z(). If workers is given, buckets are handed out in parallel.
+	template<class Func>
+	void ForEachCell(const Func& func, WorkerPool* workers = nullptr) const
+	{
+		const auto runBuckets = [this, &func](const size_t firstBucket, const size_t lastBucket)
+		{
+			for (auto bucket = firstBucket; bucket < lastBucket; ++bucket)
+			{
+				const auto first = cellStart_[bucket];
+				const auto count = cellStart_[bucket + 1] - first;
+				if (count > 0)
+				{
+					func(first, count);
+				}
+			}
+		};
+
+		if (workers)
+		{
+			workers->ParallelFor(tableSize_, MIN_TABLE_SIZE, runBuckets);
+		}
+		else
+		{
+			runBuckets(0, tableSize_);
+		}
+	}
+
+	float CellSize() const
+	{
+		return cellSize_;
+	}
+
+	size_t Count() const
+	{
+		return indices_.size();
+	}
+
+	size_t TableSize() const
+	{
+		return tableSize_;
+	}
+
+	// Particle indices in cell order.
+	const std::vector<uint32_t>& Indices() const
+	{
+		return indices_;
+	}
+
+	// Particle positions in cell order.
+	const float* SortedX() const
+	{
+		return sortedX_.data();
+	}
+
+	const float* SortedY() const
+	{
+		return sortedY_.data();
+	}
+
+	const float* SortedZ() const
+	{
+		return sortedZ_.data();
+	}
+
+	// Offset of the first particle of bucket in cell order. The bucket holds the particles up to BucketStart(bucket + 1),
+	// so bucket may go up to TableSize().
+	uint32_t BucketStart(const uint32_t bucket) const
+	{
+		return cellStart_[bucket];
+	}
+
+	// Integer coordinate of the cell holding coordinate value.
+	int CellOf(const float value) const
+	{
+		return static_cast<int>(std::floor(value * inverseCellSize_));
+	}
+
+	// Whether sorted particle i lies in cell (x, y, z).
+	bool IsInCell(const size_t i, const int x, const int y, const int z) const
+	{
+		return CellOf(sortedX_[i]) == x && CellOf(sortedY_[i]) == y && CellOf(sortedZ_[i]) == z;
+	}
+
+	// Table bucket of cell (x, y, z): the spatial hash of Teschner et al., "Optimized Spatial Hashing for Collision
+	// Detection of Deformable Objects".
+	uint32_t Bucket(const int x, const int y, const int z) const
+	{
+		const auto hash = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^
+		                  static_cast<uint32_t>(z) * 83492791u;
+		return hash & static_cast<uint32_t>(tableSize_ - 1);
+	}
+
+private:
+	static size_t TableSize(const size_t count)
+	{
+		auto tableSize = MIN_TABLE_SIZE;
+		while (tableSize < count && tableSize < MAX_TABLE_SIZE)
+		{
+			tableSize *= 2;
+		}
+		return tableSize;
+	}
+
+	// One block per thread, as long as blocks stay large enough to pay for their histogram.
+	static size_t NumBlocks(const size_t count, WorkerPool* workers)
+	{
+		const auto numThreads = workers ? workers->NumThreads() : 1;
+		return std::max<size_t>(1, std::min(numThreads, count / MIN_BLOCK_SIZE));
+	}
+
+	void Resize(const size_t count, WorkerPool* workers)
+	{
+		tableSize_ = TableSize(count);
+		numBlocks_ = NumBlocks(count, workers);
+		blockSize_ = (count + numBlocks_ - 1) / numBlocks_;
+
+		buckets_.resize(count);
+		indices_.resize(count);
+		sortedX_.resize(count);
+		sortedY_.resize(count);
+		sortedZ_.resize(count);
+		counts_.resize(numBlocks_ * tableSize_);
+		cellStart_.resize(tableSize_ + 1);
+	}
+
+	// Turns the block histograms into scatter offsets and fills cellStart_. The table is split into ranges that are
+	// summed, then offset by an exclusive scan over the range totals.
+	void ComputeOffsets(WorkerPool* workers)
+	{
+		const auto numRanges = (tableSize_ + MIN_TABLE_SIZE - 1) / MIN_TABLE_SIZE;
+		rangeTotals_.resize(numRanges);
+
+		ForEachRange(workers, numRanges, [this](const size_t range, const size_t begin, const size_t end)
+		{
+			uint32_t total = 0;
+			for (auto bucket = begin; bucket < end; ++bucket)
+			{
+				for (size_t block = 0; block < numBlocks_; ++block)
+				{
+					total += counts_[block * tableSize_ + bucket];
+				}
+			}
+			rangeTotals_[range] = total;
+		});
+
+		uint32_t offset = 0;
+		for (auto& total : rangeTotals_)
+		{
+			const auto rangeTotal = total;
+			total = offset;
+			offset += rangeTotal;
+		}
+		cellStart_[tableSize_] = offset;
+
+		ForEachRange(workers, numRanges, [this](const size_t range, const size_t begin, const size_t end)
+		{
+			auto offset = rangeTotals_[range];
+			for (auto bucket = begin; bucket < end; ++bucket)
+			{
+				cellStart_[bucket] = offset;
+				for (size_t block = 0; block < numBlocks_; ++block)
+				{
+					auto& count = counts_[block * tableSize_ + bucket];
+					const auto blockCount = count;
+					count = offset;
+					offset += blockCount;
+				}
+			}
+		});
+	}
+
+	template<class Func>
+	void ForEachBlock(WorkerPool* workers, const Func& func) const
+	{
+		const auto count = buckets_.size();
+		const auto runBlocks = [this, count, &func](const size_t firstBlock, const size_t lastBlock)
+		{
+			for (auto block = firstBlock; block < lastBlock; ++block)
+			{
+				const auto begin = std::min(block * blockSize_, count);
+				const auto end = std::min(begin + blockSize_, count);
+				func(block, begin, end);
+			}
+		};
+
+		if (workers)
+		{
+			workers->ParallelFor(numBlocks_, 1, runBlocks);
+		}
+		else
+		{
+			runBlocks(0, numBlocks_);
+		}
+	}
+
+	// Calls func(range, begin, end) for table ranges of MIN_TABLE_SIZE buckets.
+	template<class Func>
+	void ForEachRange(WorkerPool* workers, const size_t numRanges, const Func& func) const
+	{
+		const auto runRanges = [this, &func](const size_t firstRange, const size_t lastRange)
+		{
+			for (auto range = firstRange; range < lastRange; ++range)
+			{
+				const auto begin = range * MIN_TABLE_SIZE;
+				func(range, begin, std::min(begin + MIN_TABLE_SIZE, tableSize_));
+			}
+		};
+
+		if (workers)
+		{
+			workers->ParallelFor(numRanges, 64, runRanges);
+		}
+		else
+		{
+			runRanges(0, numRanges);
+		}
+	}
+
+	float cellSize_ = 1.0f;
+	float inverseCellSize_ = 1.0f;
+	size_t tableSize_ = 0;
+	size_t numBlocks_ = 0;
+	size_t blockSize_ = 0;
+
+	// Bucket of every particle, in pool order.
+	std::vector<uint32_t> buckets_;
+	std::vector<uint32_t> indices_;
+	std::vector<float> sortedX_;
+	std::vector<float> sortedY_;
+	std::vector<float> sortedZ_;
+	// Per-block histograms, then scatter offsets (block-major).
+	std::vector<uint32_t> counts_;
+	std::vector<uint32_t> rangeTotals_;
+	// First sorted particle of every bucket, with the particle count at the end.
+	std::vector<uint32_t> cellStart_;
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "ParticlePool.h"
+
+struct ParticleTrailSettings
+{
+	// Past positions every particle keeps, drawn as a ribbon behind it. 0 for no trails. CPU backend only.
+	int length = 0;
+	// Simulation steps between two recorded positions. Longer intervals stretch the same samples over more time.
+	int interval = 1;
+	// Width of the ribbon at the particle, as a multiple of its size. It tapers to nothing at the oldest position.
+	float width = 1.0f;
+};
+
+// Vertex of a trail ribbon. particle_trail.vert draws every trail of an effect as one triangle strip.
+struct ParticleTrailVertex
+{
+	glm::vec3 position;
+	// Normalized RGBA8, red in the lowest byte.
+	uint32_t color;
+};
+
+static_assert(sizeof(ParticleTrailVertex) == 16, "ParticleTrailVertex must stay tightly packed");
+
+// Ring buffers of the past positions of every particle of a pool, for drawing trails.
+// The rings live in one pooled allocation, particle by particle, as separate x, y and z rings of Length() floats. A
+// ribbon is built from a handful of contiguous cache lines that way, where rows of samples over the whole pool would
+// gather from a different stream for every point. Every particle records at the same steps, so one head indexes all the
+// rings, and particles only track how many of their samples are valid.
+// Everything is allocated once, at the pool's capacity; nothing is allocated per step or frame. Copies share the same
+// storage.
+class ParticleTrails
+{
+public:
+	ParticleTrails() = default;
+
+	ParticleTrails(const size_t capacity, const ParticleTrailSettings& settings)
+		: settings_(settings),
+		  length_(static_cast<size_t>(std::max(settings.length, 1))),
+		  capacity_(capacity),
+		  head_(0),
+		  steps_(0),
+		  counts_(std::make_shared<std::vector<uint32_t>>(capacity, 0))
+	{
+		const auto bytes = capacity_ * 3 * length_ * sizeof(float);
+		samples_.reset(static_cast<float*>(::operator new[](bytes, std::align_val_t(ParticlePool::STREAM_ALIGNMENT))),
+		               [](float* data) { ::operator delete[](data, std::align_val_t(ParticlePool::STREAM_ALIGNMENT)); });
+		std::fill_n(samples_.get(), capacity_ * 3 * length_, 0.0f);
+	}
+
+	// Samples kept per particle.
+	size_t Length() const
+	{
+		return length_;
+	}
+
+	// Vertices BuildRibbon() writes per particle: two per point (the particle, then its samples), plus the first and
+	// last repeated, so that consecutive ribbons join through degenerate triangles.
+	size_t VerticesPerTrail() const
+	{
+		return 2 * (length_ + 1) + 2;
+	}
+
+	// Counts one simulation step, and returns whether its positions are to be recorded. Call once per step, before the
+	// Record() calls of that step.
+	bool Advance()
+	{
+		if (steps_++ % static_cast<uint32_t>(std::max(settings_.interval, 1)) != 0)
+		{
+			return false;
+		}
+		head_ = (head_ + 1) % length_;
+		return true;
+	}
+
+	// Records where the particles [begin, end) of pool were before the step that just ran, as their newest sample.
+	void Record(const ParticlePool& pool, const size_t begin, const size_t end) const
+	{
+		const auto* const previousX = pool.PreviousX();
+		const auto* const previousY = pool.PreviousY();
+		const auto* const previousZ = pool.PreviousZ();
+		auto* const counts = counts_->data();
+		const auto length = static_cast<uint32_t>(length_);
+		for (auto i = begin; i < end; ++i)
+		{
+			Ring(i, 0)[head_] = previousX[i];
+			Ring(i, 1)[head_] = previousY[i];
+			Ring(i, 2)[head_] = previousZ[i];
+			counts[i] = std::min(counts[i] + 1, length);
+		}
+	}
+
+	// Forgets the samples of the particles [begin, end), eg. once they are spawned.
+	void Reset(const size_t begin, const size_t end) const
+	{
+		std::fill(counts_->begin() + begin, counts_->begin() + end, 0);
+	}
+
+	// Copies the samples of particle src over particle dst, along with ParticlePool::CopyParticle().
+	void CopyParticle(const size_t src, const size_t dst) const
+	{
+		std::copy_n(Ring(src, 0), 3 * length_, Ring(dst, 0));
+		(*counts_)[dst] = (*counts_)[src];
+	}
+
+	// Copies the samples of the first count particles of source, trails of the same settings, moved by offset, along
+	// with ParticleEffect::Restart(). The rest are forgotten.
+	void CopyFrom(const ParticleTrails& source, const size_t count, const glm::vec3& offset)
+	{
+		head_ = source.head_;
+		steps_ = source.steps_;
+		std::copy_n(source.counts_->begin(), count, counts_->begin());
+		std::fill(counts_->begin() + count, counts_->end(), 0);
+		for (size_t p = 0; p < count; ++p)
+		{
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				std::transform(source.Ring(p, axis), source.Ring(p, axis) + length_, Ring(p, axis),
+				               [&](const float sample) { return sample + offset[axis]; });
+			}
+		}
+	}
+
+	// Valid samples of particle p, up to Length().
+	uint32_t Count(const size_t p) const
+	{
+		return (*counts_)[p];
+	}
+
+	// Sample age of particle p, 0 being the newest. age < Count(p).
+	glm::vec3 Sample(const size_t age, const size_t p) const
+	{
+		const auto slot = head_ >= age ? head_ - age : head_ + length_ - age;
+		return glm::vec3(Ring(p, 0)[slot], Ring(p, 1)[slot], Ring(p, 2)[slot]);
+	}
+
+	// Writes the VerticesPerTrail() vertices of the ribbon of particle p, drawn at positionSize (xyz: where the
+	// particle is drawn, w: its size) in color, and facing eye. The ribbon narrows and fades out towards the oldest
+	// sample; the samples a young particle doesn't have yet collapse onto its oldest point, into nothing.
+	void BuildRibbon(const size_t p, const glm::vec4& positionSize, const glm::vec4& color, const glm::vec3& eye,
+	                 ParticleTrailVertex* vertices) const
+	{
+		const auto count = Count(p);
+		const auto head = glm::vec3(positionSize);
+		const auto point = [&](const size_t k)
+		{
+			const auto clamped = std::min<size_t>(k, count);
+			return clamped == 0 ? head : Sample(clamped - 1, p);
+		};
+
+		// Only the alpha changes along the ribbon.
+		const auto rgb = glm::packUnorm4x8(glm::vec4(glm::vec3(color), 0.0f));
+		const auto alpha = glm::clamp(color.a, 0.0f, 1.0f) * 255.0f;
+		const auto halfWidth = 0.5f * settings_.width * positionSize.w;
+		const auto fadeStep = 1.0f / static_cast<float>(length_);
+		auto side = glm::vec3(0.0f);
+		auto previous = head;
+		auto current = head;
+		for (size_t k = 0; k <= length_; ++k)
+		{
+			const auto next = point(k + 1);
+			// Across the ribbon: perpendicular to both its direction and the view.
+			const auto across = glm::cross(previous - next, eye - current);
+			const auto acrossLength2 = glm::dot(across, across);
+			if (acrossLength2 > 1e-20f)
+			{
+				side = across / std::sqrt(acrossLength2);
+			}
+
+			const auto fade = 1.0f - static_cast<float>(k) * fadeStep;
+			const auto packedColor = rgb | static_cast<uint32_t>(alpha * fade + 0.5f) << 24;
+			const auto offset = side * (halfWidth * fade);
+			vertices[1 + 2 * k] = { current + offset, packedColor };
+			vertices[2 + 2 * k] = { current - offset, packedColor };
+
+			previous = current;
+			current = next;
+		}
+		vertices[0] = vertices[1];
+		vertices[2 * length_ + 3] = vertices[2 * length_ + 2];
+	}
+
+	const ParticleTrailSettings& Settings() const
+	{
+		return settings_;
+	}
+
+private:
+	float* Ring(const size_t p, const size_t axis) const
+	{
+		return samples_.get() + (p * 3 + axis) * length_;
+	}
+
+	ParticleTrailSettings settings_;
+	size_t length_ = 1;
+	size_t capacity_ = 0;
+	// Slot of the newest sample in every ring.
+	size_t head_ = 0;
+	uint32_t steps_ = 0;
+	std::shared_ptr<float> samples_;
+	std::shared_ptr<std::vector<uint32_t>> counts_;
+};
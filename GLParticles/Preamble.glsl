@@ -25,4 +25,50 @@
 #define SCENE_DIFFUSE_MAP_TEXTURE_BINDING 0
 #define SCENE_NORMAL_MAP_TEXTURE_BINDING 1
 
+// Particles
+#define PARTICLE_POSITION_SIZE_ATTRIB_LOCATION 0
+#define PARTICLE_COLOR_ATTRIB_LOCATION 1
+
+#define PARTICLE_INSTANCE_BINDING 0
+
+#define PARTICLE_VP_UNIFORM_LOCATION 0
+#define PARTICLE_HAS_TEXTURE_UNIFORM_LOCATION 1
+#define PARTICLE_CAMERA_RIGHT_UNIFORM_LOCATION 2
+#define PARTICLE_CAMERA_UP_UNIFORM_LOCATION 3
+#define PARTICLE_DECODE_SCALE_UNIFORM_LOCATION 4
+#define PARTICLE_DECODE_BIAS_UNIFORM_LOCATION 5
+
+#define PARTICLE_TEXTURE_BINDING 0
+
+// Particle trails, drawn with the particle uniforms and texture
+#define PARTICLE_TRAIL_POSITION_ATTRIB_LOCATION 0
+#define PARTICLE_TRAIL_COLOR_ATTRIB_LOCATION 1
+
+#define PARTICLE_TRAIL_VERTEX_BINDING 0
+
+// Particle simulation (compute)
+#define PARTICLE_SIMULATE_GROUP_SIZE 256
+#define PARTICLE_EMIT_GROUP_SIZE 64
+// Entries of the spawn velocity/decay table. Must be a power of two.
+#define PARTICLE_SPAWN_TABLE_SIZE 4096
+
+#define PARTICLE_SIM_PARTICLES_BUFFER_BINDING 0
+#define PARTICLE_SIM_INSTANCES_BUFFER_BINDING 1
+#define PARTICLE_SIM_DEAD_LIST_BUFFER_BINDING 2
+#define PARTICLE_SIM_SPAWN_TABLE_BUFFER_BINDING 3
+#define PARTICLE_SIM_COUNTERS_BUFFER_BINDING 4
+
+#define PARTICLE_SIM_COUNT_UNIFORM_LOCATION 0
+#define PARTICLE_SIM_FRAME_UNIFORM_LOCATION 1
+#define PARTICLE_SIM_DELTA_TIME_UNIFORM_LOCATION 2
+#define PARTICLE_SIM_STEP_SCALE_UNIFORM_LOCATION 3
+#define PARTICLE_SIM_GRAVITY_STEP_UNIFORM_LOCATION 4
+#define PARTICLE_SIM_EMITTER_POSITION_UNIFORM_LOCATION 5
+#define PARTICLE_SIM_SIZE_UNIFORM_LOCATION 6
+#define PARTICLE_SIM_INITIAL_COLOR_UNIFORM_LOCATION 7
+#define PARTICLE_SIM_END_COLOR_UNIFORM_LOCATION 8
+#define PARTICLE_SIM_COLOR_FALLOFF_UNIFORM_LOCATION 9
+#define PARTICLE_SIM_SPAWN_BUDGET_UNIFORM_LOCATION 10
+#define PARTICLE_SIM_ALPHA_UNIFORM_LOCATION 11
+
 #endif // PREAMBLE_GLSL
\ No newline at end of file
@@ -1,8 +1,16 @@
 #pragma once
 
 #include "opengl.h"
+
+#include <chrono>
+#include <vector>
+
 #include "Scene.h"
+#include "ParticleBudget.h"
+#include "ParticleEffectFiles.h"
 #include "ShaderSet.h"
+#include "SimulationClock.h"
+#include "WorkerPool.h"
 
 class Renderer
 {
@@ -14,6 +22,11 @@ public:
 		shaders_.SetVersion("460");
 		shaders_.SetPreambleFile("preamble.glsl");
 		shaderProgramID_ = shaders_.AddProgramFromExts({ "shader.vert", "shader.frag" });
+		particleProgramID_ = shaders_.AddProgramFromExts({ "particle.vert", "particle.frag" });
+		particleTrailProgramID_ = shaders_.AddProgramFromExts({ "particle_trail.vert", "particle.frag" });
+		particleComputePrograms_.simulate = shaders_.AddProgramFromExts({ "particle_simulate.comp" });
+		particleComputePrograms_.emit = shaders_.AddProgramFromExts({ "particle_emit.comp" });
+		particleComputePrograms_.instances = shaders_.AddProgramFromExts({ "particle_instances.comp" });
 	}
 
 	void RenderFrame()
@@ -43,6 +56,7 @@ public:
 		const glm::mat4 VP = P * V;
 		
 		shaders_.UpdatePrograms();
+		particleEffectFiles_.Update(*scene_);
 		glUseProgram(*shaderProgramID_);
 
 		const auto& instances = scene_->Instances();
@@ -54,12 +68,7 @@ public:
 			const auto transform = scene_->Transform(instance.TransformID);
 
 			// std::cout << "Rendering instance " << instanceId << " of mesh with " << mesh.NumIndices() << " indices." << std::endl;
-			glm::mat4 MW = glm::mat4(1.0f);
-			MW = glm::translate(-transform.RotationOrigin()) * MW;
-			MW = glm::mat4_cast(transform.Rotation()) * MW;
-			MW = glm::translate(transform.RotationOrigin()) * MW;
-			MW = glm::scale(transform.Scale()) * MW;
-			MW = glm::translate(transform.Translation()) * MW;
+			const auto MW = transform.ModelMatrix();
 
 			glm::mat3 N_MW = glm::mat4(1.0f);
 			N_MW = glm::mat3_cast(transform.Rotation()) * N_MW;
@@ -125,7 +134,32 @@ public:
 			
 			glBindVertexArray(0);
 		}
-		
+
+		RenderParticles(static_cast<float>(deltaTime), mainCamera, V, P, VP);
+	}
+
+	// Time the last frame spent waiting for the GPU to release particle streaming buffers.
+	double ParticleFenceWaitMilliseconds() const
+	{
+		return particleFenceWaitMilliseconds_;
+	}
+
+	// Decides how much work each particle effect gets; its Usage() and Decisions() describe the last frame.
+	ParticleBudgetManager& ParticleBudget()
+	{
+		return particleBudget_;
+	}
+
+	// Particle effects loaded from effect files, reloaded as the files change.
+	ParticleEffectFiles& EffectFiles()
+	{
+		return particleEffectFiles_;
+	}
+
+	// Fixed timestep the particle effects are simulated with.
+	SimulationClock& ParticleClock()
+	{
+		return particleClock_;
 	}
 
 	void SetViewport(const int width, const int height)
@@ -135,10 +169,175 @@ public:
 	}
 	
 private:
+	void RenderParticles(const float deltaTime, const Camera& camera, const glm::mat4& V, const glm::mat4& P,
+	                     const glm::mat4& VP)
+	{
+		const auto& particleEffects = scene_->ParticleEffects();
+		if (particleEffects.empty())
+		{
+			return;
+		}
+
+		particleEffectIds_.clear();
+		for (uint32_t effectId : particleEffects)
+		{
+			particleEffectIds_.push_back(effectId);
+		}
+
+		// The effects advance in whole fixed steps and are drawn between their last two, so the motion is smooth and
+		// doesn't depend on the frame rate.
+		const auto steps = particleClock_.Advance(deltaTime);
+		// Particle constants are tuned for millisecond steps.
+		const auto stepMilliseconds = static_cast<float>(particleClock_.StepSeconds() * 1000.0);
+
+		// The budget decides which of those steps each effect runs, drops the ones too small to see for the rest of
+		// the frame, and only simulates the ones outside the view frustum.
+		const auto& decisions = particleBudget_.Plan(particleEffectIds_, [this](const uint32_t effectId) -> ::ParticleEffect&
+		{
+			return scene_->ParticleEffect(effectId);
+		}, camera.Eye(), V, P, viewportHeight_, steps, particleClock_.Alpha());
+
+		visibleParticleEffects_.clear();
+		simulatedParticleEffects_.clear();
+		for (const auto& decision : decisions)
+		{
+			if (decision.visible)
+			{
+				visibleParticleEffects_.push_back(&decision);
+			}
+			if (decision.visible || decision.steps > 0)
+			{
+				simulatedParticleEffects_.push_back(&decision);
+			}
+		}
+		const auto& visible = visibleParticleEffects_;
+		const auto& simulated = simulatedParticleEffects_;
+
+		// Acquiring the streaming buffer segments touches GL, so it happens here on the render thread. GPU effects need
+		// theirs to simulate at all.
+		particleFenceWaitMilliseconds_ = 0.0;
+		for (const auto* decision : simulated)
+		{
+			auto& effect = scene_->ParticleEffect(decision->effectId);
+			if (!decision->visible && !effect.IsGpuSimulated())
+			{
+				continue;
+			}
+			effect.BeginFrame();
+			particleFenceWaitMilliseconds_ += effect.FenceWaitMilliseconds();
+		}
+
+		// Effects update in parallel (and large effects split further inside Simulate()), writing straight into the
+		// mapped segments. ParallelFor() returns once every effect is done, which is the barrier before the draws below.
+		const auto updateStart = std::chrono::steady_clock::now();
+		workers_.ParallelFor(simulated.size(), 1, [&](const size_t begin, const size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto& decision = *simulated[i];
+				auto& effect = scene_->ParticleEffect(decision.effectId);
+				for (auto step = 0; step < decision.steps; ++step)
+				{
+					effect.Simulate(stepMilliseconds * decision.stepMultiple, &workers_);
+				}
+				if (decision.visible)
+				{
+					effect.PrepareDraw(V, decision.alpha, &workers_);
+				}
+			}
+		});
+
+		// Sub-emitters spawn from the events of the frame's steps in one pass, once every effect is done raising them.
+		// Their particles are drawn from the next frame on.
+		for (const auto* decision : simulated)
+		{
+			auto& effect = scene_->ParticleEffect(decision->effectId);
+			const auto* events = effect.Events();
+			if (!events)
+			{
+				continue;
+			}
+			for (const auto& subEmitter : effect.Settings().events.subEmitters)
+			{
+				scene_->ParticleEffect(subEmitter.effectId).SpawnFromEvents(*events, subEmitter, &workers_);
+			}
+			effect.ClearEvents();
+		}
+		particleBudget_.ReportCpuTime(
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - updateStart).count());
+
+		// GPU-simulated effects run their compute passes now that Simulate() queued their steps.
+		for (const auto* decision : simulated)
+		{
+			scene_->ParticleEffect(decision->effectId).Dispatch(particleComputePrograms_);
+		}
+
+		glUseProgram(*particleProgramID_);
+		glUniformMatrix4fv(PARTICLE_VP_UNIFORM_LOCATION, 1, GL_FALSE, glm::value_ptr(VP));
+		// The rows of the view rotation are the camera's world-space axes.
+		glUniform3f(PARTICLE_CAMERA_RIGHT_UNIFORM_LOCATION, V[0][0], V[1][0], V[2][0]);
+		glUniform3f(PARTICLE_CAMERA_UP_UNIFORM_LOCATION, V[0][1], V[1][1], V[2][1]);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		glDepthMask(GL_FALSE);
+
+		for (const auto* decision : visible)
+		{
+			auto& effect = scene_->ParticleEffect(decision->effectId);
+			BindParticleTexture(effect);
+			effect.Draw();
+		}
+
+		// Trails blend additively like the quads, so they don't need sorting against them.
+		glUseProgram(*particleTrailProgramID_);
+		glUniformMatrix4fv(PARTICLE_VP_UNIFORM_LOCATION, 1, GL_FALSE, glm::value_ptr(VP));
+		for (const auto* decision : visible)
+		{
+			auto& effect = scene_->ParticleEffect(decision->effectId);
+			if (effect.HasTrails())
+			{
+				BindParticleTexture(effect);
+				effect.DrawTrails();
+			}
+		}
+
+		glDepthMask(GL_TRUE);
+		glDisable(GL_BLEND);
+	}
+
+	// Binds the texture of effect for the particle program that is bound.
+	void BindParticleTexture(const ::ParticleEffect& effect)
+	{
+		glActiveTexture(GL_TEXTURE0 + PARTICLE_TEXTURE_BINDING);
+		if (effect.Settings().texture == -1)
+		{
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glUniform1i(PARTICLE_HAS_TEXTURE_UNIFORM_LOCATION, 0);
+		}
+		else
+		{
+			scene_->Texture(effect.Settings().texture).Bind();
+			glUniform1i(PARTICLE_HAS_TEXTURE_UNIFORM_LOCATION, 1);
+		}
+	}
+
 	std::shared_ptr<Scene> scene_;
 	bool isFirstFrame_;
 	ShaderSet shaders_;
 	GLuint* shaderProgramID_;
+	GLuint* particleProgramID_;
+	GLuint* particleTrailProgramID_;
+	ParticleComputePrograms particleComputePrograms_;
+	WorkerPool workers_;
+	SimulationClock particleClock_;
+	ParticleBudgetManager particleBudget_;
+	// Per-frame lists of RenderParticles(), kept so their storage is reused from frame to frame.
+	std::vector<uint32_t> particleEffectIds_;
+	std::vector<const ParticleBudgetDecision*> visibleParticleEffects_;
+	std::vector<const ParticleBudgetDecision*> simulatedParticleEffects_;
+	ParticleEffectFiles particleEffectFiles_;
+	double particleFenceWaitMilliseconds_ = 0.0;
 
 	double lastFrameTime_ = 0.0f;
 	double currentFrameTime_ = 0.0f;
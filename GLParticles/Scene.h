@@ -11,6 +11,7 @@
 #include "Transform.h"
 #include "Camera.h"
 #include "Texture.h"
+#include "ParticleEffect.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
@@ -21,7 +22,7 @@
 class Scene
 {
 public:
-	Scene() : textures_(256), materials_(256), meshes_(256), transforms_(256), instances_(256), cameras_(256)
+	Scene() : textures_(256), materials_(256), meshes_(256), transforms_(256), instances_(256), cameras_(256), particleEffects_(256)
 	{
 	}
 	
@@ -85,6 +86,49 @@ public:
 		return cameras_[id];
 	}
 
+	// By reference, unlike the other lists: copying effects allocates.
+	const packed_freelist<::ParticleEffect>& ParticleEffects() const
+	{
+		return particleEffects_;
+	}
+
+	::ParticleEffect& ParticleEffect(const uint32_t id) const
+	{
+		return particleEffects_[id];
+	}
+
+	// Calls func(effectId, particleIndex, distanceSquared) for every particle within radius of center, across the
+	// effects that keep a neighbor grid (see ParticleEffectSettings::neighborCellSize).
+	template<class Func>
+	void ForEachParticleInRadius(const glm::vec3& center, const float radius, const Func& func) const
+	{
+		for (uint32_t effectId : particleEffects_)
+		{
+			particleEffects_[effectId].NeighborGrid().ForEachInRadius(center, radius,
+				[&func, effectId](const uint32_t index, const float distanceSquared)
+				{
+					func(effectId, index, distanceSquared);
+				});
+		}
+	}
+
+	// Collision geometry of every mesh instance in the scene, in world space, for ParticleEffectSettings::collider.
+	// Built from the scene as it is now: instances added or moved later are not part of it.
+	std::shared_ptr<const ParticleCollider> BuildParticleCollider() const
+	{
+		std::vector<glm::vec3> corners;
+		for (uint32_t instanceId : instances_)
+		{
+			const auto& instance = instances_[instanceId];
+			const auto MW = transforms_[instance.TransformID].ModelMatrix();
+			for (const auto& corner : meshes_[instance.MeshID].TriangleCorners())
+			{
+				corners.push_back(glm::vec3(MW * glm::vec4(corner, 1.0f)));
+			}
+		}
+		return std::make_shared<const ParticleCollider>(corners);
+	}
+
 	::Camera& MainCamera() const
 	{
 		return Camera(MainCameraId());
@@ -234,6 +278,8 @@ public:
 
 				}
 				
+				mesh.TriangleCorners().insert(mesh.TriangleCorners().end(), vertices.begin(), vertices.end());
+
 				for (size_t v = 0; v < vertices.size(); ++v) {
 					attributes.insert(attributes.end(), {vertices[v].x, vertices[v].y, vertices[v].z});
 
@@ -340,6 +386,25 @@ public:
 		return cameras_.insert(camera);
 	}
 
+	uint32_t AddParticleEffect(const ParticleEffectSettings& settings)
+	{
+		return particleEffects_.emplace(settings);
+	}
+
+	// Moves effect into the scene, eg. one acquired from a ParticleEffectPool. Allocates nothing.
+	uint32_t AddParticleEffect(::ParticleEffect&& effect)
+	{
+		return particleEffects_.insert(std::move(effect));
+	}
+
+	// Moves the effect out of the scene, eg. to release it back to its ParticleEffectPool. Allocates nothing.
+	::ParticleEffect RemoveParticleEffect(const uint32_t id)
+	{
+		auto effect = std::move(particleEffects_[id]);
+		particleEffects_.erase(id);
+		return effect;
+	}
+
 private:
 	packed_freelist<::Texture> textures_;
 	packed_freelist<::Material> materials_;
@@ -347,6 +412,7 @@ private:
 	packed_freelist<::Transform> transforms_;
 	packed_freelist<Mesh::Instance> instances_;
 	packed_freelist<::Camera> cameras_;
+	packed_freelist<::ParticleEffect> particleEffects_;
 
 	uint32_t mainCameraId_;
 };
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+
+// Fixed timestep accumulator ("Fix Your Timestep", Glenn Fiedler).
+// Real frame time is banked, and the simulation advances in whole steps of StepSeconds(), so its results don't depend
+// on the frame rate and a hitch can't turn into one huge explicit Euler step. What is left over is Alpha(), the fraction
+// of a step that real time is past the last simulated state: rendering blends the last two states by it, which keeps
+// motion smooth even when simulating at a lower rate than rendering.
+class SimulationClock
+{
+public:
+	explicit SimulationClock(const double stepSeconds = 1.0 / 60.0, const int maxSubsteps = 4)
+		: stepSeconds_(stepSeconds),
+		  maxSubsteps_(maxSubsteps),
+		  accumulator_(0.0),
+		  totalSteps_(0),
+		  droppedSeconds_(0.0)
+	{
+	}
+
+	// Banks frameSeconds of real time and returns the number of steps to simulate now. Past maxSubsteps, the rest of
+	// the backlog is dropped: the simulation slows down instead of spiralling into ever longer frames.
+	int Advance(const double frameSeconds)
+	{
+		accumulator_ += std::max(frameSeconds, 0.0);
+
+		auto steps = static_cast<int>(accumulator_ / stepSeconds_);
+		if (steps > maxSubsteps_)
+		{
+			const auto dropped = (steps - maxSubsteps_) * stepSeconds_;
+			droppedSeconds_ += dropped;
+			accumulator_ -= dropped;
+			steps = maxSubsteps_;
+		}
+
+		accumulator_ -= steps * stepSeconds_;
+		totalSteps_ += steps;
+		return steps;
+	}
+
+	// Blend factor between the previous and the current simulated state, in [0, 1).
+	float Alpha() const
+	{
+		return static_cast<float>(accumulator_ / stepSeconds_);
+	}
+
+	double StepSeconds() const
+	{
+		return stepSeconds_;
+	}
+
+	void SetStepSeconds(const double stepSeconds)
+	{
+		stepSeconds_ = stepSeconds;
+		accumulator_ = std::min(accumulator_, stepSeconds_);
+	}
+
+	int MaxSubsteps() const
+	{
+		return maxSubsteps_;
+	}
+
+	void SetMaxSubsteps(const int maxSubsteps)
+	{
+		maxSubsteps_ = maxSubsteps;
+	}
+
+	unsigned long long TotalSteps() const
+	{
+		return totalSteps_;
+	}
+
+	// Real time thrown away by the maxSubsteps cap.
+	double DroppedSeconds() const
+	{
+		return droppedSeconds_;
+	}
+
+private:
+	double stepSeconds_;
+	int maxSubsteps_;
+	double accumulator_;
+	unsigned long long totalSteps_;
+	double droppedSeconds_;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "opengl.h"
+
+#include <array>
+#include <chrono>
+#include <memory>
+
+// Persistently mapped ring of buffer segments for data that is rewritten every frame.
+// The storage is allocated once with glBufferStorage and stays mapped (persistent + coherent), so the CPU writes
+// straight into GPU-visible memory without glBufferData reallocations. Each frame writes one segment, and a fence
+// placed after the draws that read it keeps the CPU from overwriting it before the GPU is done.
+// Mapped for reading instead, the same ring carries results back from the GPU: a segment the GPU copied into is read
+// once it comes around again, NUM_SEGMENTS - 1 frames later, when its fence has long passed.
+// Copies share the same GL buffer (like the handles held by Mesh).
+class StreamingBuffer
+{
+public:
+	static constexpr int NUM_SEGMENTS = 3;
+
+	StreamingBuffer()
+		: state_(std::make_shared<State>())
+	{
+	}
+
+	// (Re)allocates the ring so every segment holds at least segmentSize bytes. Waits for the GPU to release the
+	// old storage first, so call it rarely (eg. when a particle effect's capacity grows).
+	// access is GL_MAP_WRITE_BIT to stream data to the GPU, or GL_MAP_READ_BIT to read results back.
+	void Reserve(const GLsizeiptr segmentSize, const GLbitfield access = GL_MAP_WRITE_BIT)
+	{
+		auto& state = *state_;
+		if (state.buffer && segmentSize <= state.segmentSize)
+		{
+			return;
+		}
+
+		state.Release();
+
+		state.segmentSize = Align(segmentSize);
+		const auto totalSize = state.segmentSize * NUM_SEGMENTS;
+		const GLbitfield flags = access | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glGenBuffers(1, &state.buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, state.buffer);
+		glBufferStorage(GL_ARRAY_BUFFER, totalSize, nullptr, flags);
+		state.mapped = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, totalSize, flags));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		state.segment = NUM_SEGMENTS - 1;
+	}
+
+	// Moves on to the next segment, waiting for the GPU to finish reading it if needed, and returns its mapped memory.
+	void* BeginSegment()
+	{
+		auto& state = *state_;
+		state.segment = (state.segment + 1) % NUM_SEGMENTS;
+		state.lastWaitMilliseconds = state.WaitForFence(state.segment);
+		return state.mapped + SegmentOffset();
+	}
+
+	// Fences the current segment. Call after the draws that read from it (or the copies that write to it) were issued.
+	void EndSegment()
+	{
+		auto& state = *state_;
+		state.fences[state.segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	GLuint Buffer() const
+	{
+		return state_->buffer;
+	}
+
+	GLsizeiptr SegmentSize() const
+	{
+		return state_->segmentSize;
+	}
+
+	// Offset of the current segment from the start of Buffer().
+	GLintptr SegmentOffset() const
+	{
+		return state_->segment * state_->segmentSize;
+	}
+
+	int SegmentIndex() const
+	{
+		return state_->segment;
+	}
+
+	// Time the last BeginSegment() spent waiting on the GPU. Consistently non-zero means the GPU is the bottleneck.
+	double LastWaitMilliseconds() const
+	{
+		return state_->lastWaitMilliseconds;
+	}
+
+private:
+	struct State
+	{
+		~State()
+		{
+			Release();
+		}
+
+		double WaitForFence(const int segmentIndex)
+		{
+			auto& fence = fences[segmentIndex];
+			if (!fence)
+			{
+				return 0.0;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			GLbitfield flags = 0;
+			for (;;)
+			{
+				const auto result = glClientWaitSync(fence, flags, 1000000);
+				if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+				{
+					break;
+				}
+				// Make sure the fence actually gets submitted, or the wait could never finish.
+				flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			}
+			glDeleteSync(fence);
+			fence = nullptr;
+
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		void Release()
+		{
+			if (!buffer)
+			{
+				return;
+			}
+
+			for (auto segmentIndex = 0; segmentIndex < NUM_SEGMENTS; ++segmentIndex)
+			{
+				WaitForFence(segmentIndex);
+			}
+
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glDeleteBuffers(1, &buffer);
+
+			buffer = 0;
+			mapped = nullptr;
+			segmentSize = 0;
+		}
+
+		GLuint buffer = 0;
+		char* mapped = nullptr;
+		GLsizeiptr segmentSize = 0;
+		int segment = 0;
+		std::array<GLsync, NUM_SEGMENTS> fences = {};
+		double lastWaitMilliseconds = 0.0;
+	};
+
+	// Segments start on a 256 byte boundary, which satisfies every vertex and uniform/storage buffer offset alignment.
+	static GLsizeiptr Align(const GLsizeiptr size)
+	{
+		return (size + 255) / 256 * 256;
+	}
+
+	std::shared_ptr<State> state_;
+};
@@ -57,6 +57,18 @@ public:
 		translation_ = translation;
 	}
 
+	// Object to world: rotation about the rotation origin, then scale, then translation.
+	glm::mat4 ModelMatrix() const
+	{
+		glm::mat4 MW = glm::mat4(1.0f);
+		MW = glm::translate(-rotationOrigin_) * MW;
+		MW = glm::mat4_cast(rotation_) * MW;
+		MW = glm::translate(rotationOrigin_) * MW;
+		MW = glm::scale(scale_) * MW;
+		MW = glm::translate(translation_) * MW;
+		return MW;
+	}
+
 private:
 	glm::vec3 scale_;
 	glm::vec3 rotationOrigin_;
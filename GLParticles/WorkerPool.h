@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running chunked parallel-for jobs.
+// The calling thread always works on its own job too, and ParallelFor() only returns once every chunk has run, so it
+// doubles as the barrier between update stages. Jobs may be nested (eg. a per-effect job splitting a large effect
+// into chunks): a thread waiting on a job keeps executing queued chunks instead of blocking.
+class WorkerPool
+{
+public:
+	// numWorkers excludes the calling thread. 0 runs everything inline.
+	explicit WorkerPool(const size_t numWorkers = DefaultNumWorkers())
+		: stopping_(false)
+	{
+		threads_.reserve(numWorkers);
+		for (size_t i = 0; i < numWorkers; ++i)
+		{
+			threads_.emplace_back([this]() { WorkerLoop(); });
+		}
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_all();
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Number of threads that run jobs, including the caller.
+	size_t NumThreads() const
+	{
+		return threads_.size() + 1;
+	}
+
+	// Calls func(begin, end) over [0, count) in chunks of grainSize, spread over all threads.
+	void ParallelFor(const size_t count, const size_t grainSize, const std::function<void(size_t, size_t)>& func)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+
+		const auto grain = grainSize > 0 ? grainSize : 1;
+		if (threads_.empty() || count <= grain)
+		{
+			func(0, count);
+			return;
+		}
+
+		auto job = std::make_shared<Job>(func, count, grain);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push_back(job);
+		}
+		wake_.notify_all();
+
+		while (RunChunk(*job))
+		{
+		}
+
+		while (job->doneChunks.load(std::memory_order_acquire) != job->numChunks)
+		{
+			if (!RunQueuedChunk())
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	static size_t DefaultNumWorkers()
+	{
+		const auto hardwareThreads = std::thread::hardware_concurrency();
+		return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+private:
+	struct Job
+	{
+		Job(const std::function<void(size_t, size_t)>& func, const size_t count, const size_t grain)
+			: func(func),
+			  count(count),
+			  grain(grain),
+			  numChunks((count + grain - 1) / grain),
+			  nextChunk(0),
+			  doneChunks(0)
+		{
+		}
+
+		std::function<void(size_t, size_t)> func;
+		size_t count;
+		size_t grain;
+		size_t numChunks;
+		std::atomic<size_t> nextChunk;
+		std::atomic<size_t> doneChunks;
+	};
+
+	// Claims and runs one chunk of job. Returns false once every chunk has been claimed.
+	static bool RunChunk(Job& job)
+	{
+		const auto chunk = job.nextChunk.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= job.numChunks)
+		{
+			return false;
+		}
+
+		const auto begin = chunk * job.grain;
+		const auto end = begin + job.grain < job.count ? begin + job.grain : job.count;
+		job.func(begin, end);
+		job.doneChunks.fetch_add(1, std::memory_order_release);
+		return true;
+	}
+
+	// Runs one chunk of the oldest job that still has unclaimed chunks. Returns false if there is none.
+	bool RunQueuedChunk()
+	{
+		std::shared_ptr<Job> job;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job = FrontJob();
+		}
+		return job && RunChunk(*job);
+	}
+
+	// Drops fully claimed jobs from the front of the queue. Must be called with mutex_ held.
+	std::shared_ptr<Job> FrontJob()
+	{
+		while (!jobs_.empty() && jobs_.front()->nextChunk.load(std::memory_order_relaxed) >= jobs_.front()->numChunks)
+		{
+			jobs_.pop_front();
+		}
+		return jobs_.empty() ? nullptr : jobs_.front();
+	}
+
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [this, &job]()
+				{
+					job = FrontJob();
+					return stopping_ || job;
+				});
+
+				if (stopping_)
+				{
+					return;
+				}
+			}
+
+			while (RunChunk(*job))
+			{
+			}
+		}
+	}
+
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<std::shared_ptr<Job>> jobs_;
+	bool stopping_;
+};
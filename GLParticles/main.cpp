@@ -12,6 +12,7 @@
 #include <array>
 #include "Scene.h"
 #include "Renderer.h"
+#include "ParticleEffectPool.h"
 
 #pragma comment(lib, "glfw3dll.lib")
 // #pragma comment(lib, "legacy_stdio_definitions")
@@ -112,249 +113,6 @@ std::stringstream readFile(const std::string& filename)
 
 	return buffer;
 }
-
-struct _particle
-{
-	glm::vec3 position;
-	glm::vec3 color;
-	glm::vec3 velocity;
-	float size;
-	float life = 1.0f;
-	float decay;
-	const float DAMPENING = 2000.0f;
-	const glm::vec3 GRAVITY = { 0.0f, -0.8f, 0.0f };
-
-
-	_particle() = default;
-
-	_particle(const glm::vec3& position, const glm::vec3& color, const glm::vec3& velocity, float size, float decay)
-		: position(position),
-		  color(color),
-		  velocity(velocity),
-		  size(size),
-		  decay(decay)
-	{
-	}
-
-
-	_particle(const _particle& other)
-		: position(other.position),
-		  color(other.color),
-		  velocity(other.velocity),
-		  size(other.size),
-		  life(other.life),
-		  DAMPENING(other.DAMPENING)
-	{
-	}
-
-	_particle(_particle&& other) noexcept
-		: position(std::move(other.position)),
-		  color(std::move(other.color)),
-		  velocity(std::move(other.velocity)),
-		  size(other.size),
-		  life(other.life),
-		  DAMPENING(other.DAMPENING)
-	{
-	}
-
-	_particle& operator=(const _particle& other)
-	{
-		if (this == &other)
-			return *this;
-		position = other.position;
-		color = other.color;
-		velocity = other.velocity;
-		size = other.size;
-		life = other.life;
-		return *this;
-	}
-
-	_particle& operator=(_particle&& other) noexcept
-	{
-		if (this == &other)
-			return *this;
-		position = std::move(other.position);
-		color = std::move(other.color);
-		velocity = std::move(other.velocity);
-		size = other.size;
-		life = other.life;
-		return *this;
-	}
-
-	void Update(const float deltaTime)
-	{
-		position += (velocity * deltaTime) / DAMPENING;
-		velocity += (GRAVITY * deltaTime) / DAMPENING;
-		life -= decay * deltaTime;
-		color = glm::vec3(1.0f, glm::mix(0.0f, 1.0f, life * 0.5f), 0.0f);
-		if (life <= 0.0f)
-		{
-			Reset();
-		}
-	}
-
-	void Reset()
-	{
-		position = glm::vec3(0.0f, 0.0f, 0.0f);
-		color = glm::vec3(1.0f, 1.0f, 0.0f);
-		// velocity = glm::vec3(float((rand() % 60) - 32.0f), float((rand() % 60) - 30.0f), float((rand() % 60) - 30.0f));
-		// velocity = glm::vec3(0.0f);
-		// velocity = glm::vec3(float((rand() % 50) - 26.0f) * 10.0f, float((rand() % 50) - 25.0f) * 10.0f, float((rand() % 50) - 25.0f) * 10.0f);
-		velocity = glm::ballRand(5.0f);
-		// velocity = glm::normalize(glm::vec3(((rand() % 20) - 10) / 50.0f, 1.0f, ((rand() % 20) - 10) / 50.0f));
-		life = 1.0f;
-		decay = (float(rand() % 100) / 1000.0f + 0.003f) * 0.5f;
-		size = 0.02f;
-	}
-	
-	std::array<glm::vec4, 6> GetColor() const
-	{
-		return {
-			glm::vec4(color, life),
-			glm::vec4(color, life),
-			glm::vec4(color, life),
-			glm::vec4(color, life),
-			glm::vec4(color, life),
-			glm::vec4(color, life)
-		};
-	}
-
-	std::array<glm::vec3, 6> GetVertices()
-	{
-		auto halfSize = size / 2.0f;
-		auto x0 = glm::vec3{ position.x - halfSize, position.y - halfSize, position.z };
-		auto x1 = glm::vec3{ position.x + halfSize, position.y - halfSize, position.z };
-		auto x2 = glm::vec3{ position.x + halfSize, position.y + halfSize, position.z };
-		auto x3 = glm::vec3{ position.x - halfSize, position.y + halfSize, position.z };
-		
-		return {
-			x0, x1, x3,
-			x1, x2, x3
-		};
-	}
-
-	std::array<glm::vec2, 6> GetTexCoords()
-	{
-		return {
-			glm::vec2{0.0f, 0.0f},
-			glm::vec2{1.0f, 0.0f},
-			glm::vec2{0.0f, 1.0f},
-			glm::vec2{1.0f, 0.0f},
-			glm::vec2{1.0f, 1.0f},
-			glm::vec2{0.0f, 1.0f}
-		};
-	}
-};
-
-struct _particleEffect
-{
-	glm::vec3 position;
-	glm::vec3 initialColor;
-	glm::vec3 endColor;
-	float colorFalloff;
-	float particleSize;
-	int numParticles;
-	float (*decayFunc)();
-	glm::vec3(*velocityFunc)();
-
-	std::vector<_particle> particles;
-	std::array<GLuint, 3> buffers;
-
-	_particleEffect(const glm::vec3& position, const glm::vec3& initialColor, const glm::vec3& endColor,
-		float colorFalloff, float particleSize, int numParticles, float(* decayFunc)(), glm::vec3(* velocityFunc)())
-		: position(position),
-		  initialColor(initialColor),
-		  endColor(endColor),
-		  colorFalloff(colorFalloff),
-		  particleSize(particleSize),
-		  numParticles(numParticles),
-		  decayFunc(decayFunc),
-		  velocityFunc(velocityFunc)
-	{
-		particles.reserve(numParticles);
-		glGenBuffers(3, &buffers[0]);
-	}
-
-	void Update(float deltaTime)
-	{
-		std::sort(particles.begin(), particles.end(), [](_particle a, _particle b)
-			{
-				return a.GetVertices()[0].z < b.GetVertices()[0].z;
-			});
-		std::vector<glm::vec3> vertices;
-		vertices.reserve(6 * numParticles);
-		std::vector<glm::vec4> colors;
-		colors.reserve(6 * numParticles);
-		std::vector<glm::vec2> texCoords;
-		texCoords.reserve(6 * numParticles);
-		for (auto& particle : particles)
-		{
-			particle.Update(deltaTime);
-			auto vert = particle.GetVertices();
-			auto col = particle.GetColor();
-			auto coords = particle.GetTexCoords();
-			vertices.insert(vertices.end(), vert.begin(), vert.end());
-			colors.insert(colors.end(), col.begin(), col.end());
-			texCoords.insert(texCoords.end(), coords.begin(), coords.end());
-		}
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), &vertices[0], GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, cbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(colors[0]) * colors.size(), &colors[0], GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, tbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(texCoords[0]) * texCoords.size(), &texCoords[0], GL_DYNAMIC_DRAW);
-	}
-};
-
-const int numParticles = 100;
-std::array<_particle, numParticles> particles;
-
-void resetParticles()
-{
-	srand(time(NULL));
-	for (auto& particle : particles)
-	{
-		particle.Reset();
-	}
-}
-
-void updateParticles(const float deltaTime, const GLuint vbo, const GLuint cbo, const GLuint tbo)
-{
-	std::sort(particles.begin(), particles.end(), [](_particle a, _particle b)
-	{
-			return a.GetVertices()[0].z < b.GetVertices()[0].z;
-	});
-	std::vector<glm::vec3> vertices;
-	vertices.reserve(6 * numParticles);
-	std::vector<glm::vec4> colors;
-	colors.reserve(6 * numParticles);
-	std::vector<glm::vec2> texCoords;
-	texCoords.reserve(6 * numParticles);
-	for (auto& particle : particles)
-	{
-		particle.Update(deltaTime);
-		auto vert = particle.GetVertices();
-		auto col = particle.GetColor();
-		auto coords = particle.GetTexCoords();
-
-		// std::cout << "vert: [" << vert[0].x << "," << vert[0].y << "," << vert[0].z << ";" << vert[1].x << "," << vert[1].y << "," << vert[1].z << ";" << vert[2].x << "," << vert[2].y << "," << vert[2].z << ";"
-			// << vert[3].x << "," << vert[3].y << "," << vert[3].z << ";" << vert[4].x << "," << vert[4].y << "," << vert[4].z << ";" << vert[5].x << "," << vert[5].y << "," << vert[5].z << "]" << std::endl;
-		// std::cout << "col: [" << col[0].x << "," << col[0].y << "," << col[0].z << ";" << col[1].x << "," << col[1].y << "," << col[1].z << ";" << col[2].x << "," << col[2].y << "," << col[2].z << ";"
-			// << col[3].x << "," << col[3].y << "," << col[3].z << ";" << col[4].x << "," << col[4].y << "," << col[4].z << ";" << col[5].x << "," << col[5].y << "," << col[5].z << "]" << std::endl;
-		// std::cout << "tex: [" << coords[0].x << "," << coords[0].y << "," << ";" << coords[1].x << "," << coords[1].y << "," << ";" << coords[2].x << "," << coords[2].y << "," << ";"
-			// << coords[3].x << "," << coords[3].y << "," << ";" << coords[4].x << "," << coords[4].y << "," << ";" << coords[5].x << "," << coords[5].y << "," << "]" << std::endl;
-		
-		vertices.insert(vertices.end(), vert.begin(), vert.end());
-		colors.insert(colors.end(), col.begin(), col.end());
-		texCoords.insert(texCoords.end(), coords.begin(), coords.end());
-	}                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                        
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), &vertices[0], GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, cbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(colors[0]) * colors.size(), &colors[0], GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, tbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(texCoords[0]) * texCoords.size(), &texCoords[0], GL_DYNAMIC_DRAW);
-}
 */
 
 void GLAPIENTRY
@@ -428,6 +186,30 @@ int main(int argc, char** argv)
 	});
 	scene->SetMainCameraId(mainCamera);
 
+	// The rest of the sparks is defined in Sparks.effect, and reloaded as it is edited.
+	ParticleEffectSettings sparks;
+	sparks.texture = scene->AddTexture(Texture("Particle.jpg"));
+	sparks.collider = scene->BuildParticleCollider();
+	const auto sparksEffect = renderer->EffectFiles().Add(*scene, "Sparks.effect", sparks);
+
+	// Impacts on the cube, started from a pool so that firing one allocates nothing, and recycled once they fade.
+	ParticleEffectSettings impact;
+	impact.texture = sparks.texture;
+	impact.collider = sparks.collider;
+	impact.numParticles = 200;
+	impact.initialBurst = 200;
+	impact.decayRange = { 0.002f, 0.004f };
+	impact.speed = 3.0f;
+	impact.initialColor = glm::vec3(1.0f, 0.8f, 0.4f);
+	impact.endColor = glm::vec3(0.4f, 0.1f, 0.0f);
+	ParticleEffectPool effectPool;
+	const auto impactType = effectPool.AddType(impact, 8, true);
+	std::vector<uint32_t> impactEffects;
+	impactEffects.reserve(effectPool.NumInstances(impactType));
+	ParticleEffect acquired;
+	const ParticleRandom impactRandom(2);
+	uint32_t numImpacts = 0;
+
 	resize(window, initialWidth, initialHeight);
 
 	auto materialAmbient = glm::vec3(1.0f);
@@ -448,6 +230,57 @@ int main(int argc, char** argv)
 		ImGui::ColorPicker3("Ambient", glm::value_ptr(materialAmbient), ImGuiColorEditFlags_Float);
 		ImGui::ColorPicker3("Diffuse", glm::value_ptr(materialDiffuse), ImGuiColorEditFlags_Float);
 		ImGui::ColorPicker3("Specular", glm::value_ptr(materialSpecular), ImGuiColorEditFlags_Float);
+		const auto& sortStats = scene->ParticleEffect(sparksEffect).SortStats();
+		ImGui::Text("Particle sorts: %llu full, %llu incremental, %llu fallbacks, %llu skipped",
+		            static_cast<unsigned long long>(sortStats.fullSorts),
+		            static_cast<unsigned long long>(sortStats.incrementalSorts),
+		            static_cast<unsigned long long>(sortStats.fallbacks),
+		            static_cast<unsigned long long>(sortStats.skippedFrames));
+		const auto& simulationStats = scene->ParticleEffect(sparksEffect).SimulationStats();
+		ImGui::Text("Particles: %zu alive, %llu spawned, %llu killed, %llu collisions", simulationStats.aliveCount,
+		            static_cast<unsigned long long>(simulationStats.spawned),
+		            static_cast<unsigned long long>(simulationStats.killed),
+		            static_cast<unsigned long long>(simulationStats.collisions));
+		ImGui::Text("Particle upload: %zu bytes per particle", scene->ParticleEffect(sparksEffect).InstanceSize());
+		ImGui::Text("Particle fence wait: %.3f ms", renderer->ParticleFenceWaitMilliseconds());
+		const auto& particleClock = renderer->ParticleClock();
+		ImGui::Text("Particle steps: %llu (%.0f Hz), dropped %.2f s", particleClock.TotalSteps(),
+		            1.0 / particleClock.StepSeconds(), particleClock.DroppedSeconds());
+		const auto& budget = renderer->ParticleBudget().Usage();
+		ImGui::Text("Particle budget: %zu / %zu alive, %.2f / %.2f ms, emission x%.2f", budget.aliveParticles,
+		            budget.maxParticles, budget.cpuMilliseconds, budget.cpuBudgetMilliseconds, budget.cpuEmissionScale);
+		ImGui::Text("Effects: %zu updated, %zu skipped, %zu visible, %zu culled (%zu offscreen)", budget.updated,
+		            budget.skipped, budget.visible, budget.culled, budget.offscreen);
+		if (ImGui::Button("Impact"))
+		{
+			const auto position = glm::vec3(impactRandom.Uniform(0, numImpacts, 0, -0.5f, 0.5f), 1.0f,
+			                                impactRandom.Uniform(1, numImpacts, 0, -0.5f, 0.5f));
+			++numImpacts;
+			if (effectPool.Acquire(impactType, position, acquired))
+			{
+				impactEffects.push_back(scene->AddParticleEffect(std::move(acquired)));
+			}
+		}
+		ImGui::SameLine();
+		ImGui::Text("%zu / %zu impacts in use", impactEffects.size(), effectPool.NumInstances(impactType));
+		for (auto it = impactEffects.begin(); it != impactEffects.end();)
+		{
+			if (scene->ParticleEffect(*it).IsFinished())
+			{
+				effectPool.Release(impactType, scene->RemoveParticleEffect(*it));
+				it = impactEffects.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		for (const auto& decision : renderer->ParticleBudget().Decisions())
+		{
+			ImGui::Text("  #%u: distance %.1f, %.0f px, every %d, limit %zu, emission x%.2f", decision.effectId,
+			            decision.distance, decision.projectedPixels, decision.updateInterval, decision.particleLimit,
+			            decision.emissionScale);
+		}
 		ImGui::End();
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -0,0 +1,25 @@
+in vec4 fColor;
+in vec2 fTexCoord;
+
+layout(location = PARTICLE_HAS_TEXTURE_UNIFORM_LOCATION)
+uniform int HasTexture;
+
+layout(binding = PARTICLE_TEXTURE_BINDING)
+uniform sampler2D ParticleTexture;
+
+out vec4 FragColor;
+
+void main()
+{
+    vec4 textureColor;
+    if (HasTexture != 0)
+    {
+        textureColor = texture(ParticleTexture, fTexCoord);
+    }
+    else
+    {
+        textureColor = vec4(1.0);
+    }
+
+    FragColor = fColor * textureColor;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+layout(location = PARTICLE_POSITION_SIZE_ATTRIB_LOCATION)
+in vec4 PositionSize;
+
+layout(location = PARTICLE_COLOR_ATTRIB_LOCATION)
+in vec4 Color;
+
+layout(location = PARTICLE_VP_UNIFORM_LOCATION)
+uniform mat4 VP;
+
+layout(location = PARTICLE_CAMERA_RIGHT_UNIFORM_LOCATION)
+uniform vec3 CameraRight;
+
+layout(location = PARTICLE_CAMERA_UP_UNIFORM_LOCATION)
+uniform vec3 CameraUp;
+
+// Turns compact instances back into world space (see ParticleQuantizer). Identity for full float ones.
+layout(location = PARTICLE_DECODE_SCALE_UNIFORM_LOCATION)
+uniform vec4 DecodeScale;
+
+layout(location = PARTICLE_DECODE_BIAS_UNIFORM_LOCATION)
+uniform vec4 DecodeBias;
+
+out vec4 fColor;
+out vec2 fTexCoord;
+
+void main()
+{
+    // One instance per particle, drawn as a 4 vertex triangle strip: (0,0) (1,0) (0,1) (1,1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec4 positionSize = PositionSize * DecodeScale + DecodeBias;
+    vec2 offset = (corner - 0.5f) * positionSize.w;
+    vec3 worldPosition = positionSize.xyz + CameraRight * offset.x + CameraUp * offset.y;
+
+    gl_Position = VP * vec4(worldPosition, 1.0f);
+    fColor = Color;
+    fTexCoord = corner;
+}
\ No newline at end of file
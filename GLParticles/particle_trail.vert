@@ -0,0 +1,20 @@
+layout(location = PARTICLE_TRAIL_POSITION_ATTRIB_LOCATION)
+in vec3 Position;
+
+layout(location = PARTICLE_TRAIL_COLOR_ATTRIB_LOCATION)
+in vec4 Color;
+
+layout(location = PARTICLE_VP_UNIFORM_LOCATION)
+uniform mat4 VP;
+
+out vec4 fColor;
+out vec2 fTexCoord;
+
+void main()
+{
+    // Ribbons come as pairs of vertices, one on each edge, already facing the camera. Across the ribbon, the texture
+    // is sampled down its middle, so the edges fade out the same way the particle quads do.
+    gl_Position = VP * vec4(Position, 1.0f);
+    fColor = Color;
+    fTexCoord = vec2(0.5f, float(gl_VertexID & 1));
+}
\ No newline at end of file